@@ -0,0 +1,87 @@
+#include "bench/bench.hpp"
+
+#include <iostream>
+
+#include <benchmark/benchmark.h>
+#include <boost/algorithm/string.hpp>
+
+namespace fs = boost::filesystem;
+namespace ba = boost::algorithm;
+
+namespace henhouse::bench
+{
+    namespace
+    {
+        //tmpfs and disk
+        const std::string DEFAULT_DIRS = "/dev/shm,/var/tmp";
+        const std::string DIRS_FLAG = "--bench_dirs=";
+    }
+
+    scratch_dir::scratch_dir(const bench_dir& d)
+    {
+        _path = d.path / fs::unique_path("henhouse_bench_%%%%-%%%%-%%%%");
+        fs::create_directories(_path);
+    }
+
+    scratch_dir::~scratch_dir()
+    {
+        boost::system::error_code ec;
+        fs::remove_all(_path, ec);
+    }
+
+    bench_dirs parse_dirs(const std::string& dirs)
+    {
+        std::vector<std::string> paths;
+        ba::split(paths, dirs, ba::is_any_of(","));
+
+        bench_dirs r;
+        for(const auto& p : paths)
+        {
+            if(p.empty()) continue;
+            if(!fs::is_directory(p))
+            {
+                std::cerr << "skipping missing bench dir " << p << std::endl;
+                continue;
+            }
+
+            r.push_back(bench_dir{p, p});
+        }
+        return r;
+    }
+}
+
+/**
+ * Accepts --bench_dirs=a,b,c on top of the google benchmark flags.
+ * Defaults to a tmpfs and a disk directory.
+ */
+int main(int argc, char** argv)
+{
+    namespace hb = henhouse::bench;
+
+    auto dirs = hb::DEFAULT_DIRS;
+
+    std::vector<char*> args;
+    for(int i = 0; i < argc; i++)
+    {
+        const std::string a = argv[i];
+        if(ba::starts_with(a, hb::DIRS_FLAG)) dirs = a.substr(hb::DIRS_FLAG.size());
+        else args.push_back(argv[i]);
+    }
+
+    int bench_argc = args.size();
+    benchmark::Initialize(&bench_argc, args.data());
+    if(benchmark::ReportUnrecognizedArguments(bench_argc, args.data())) return 1;
+
+    const auto bench_dirs = hb::parse_dirs(dirs);
+    if(bench_dirs.empty())
+    {
+        std::cerr << "no bench dirs to run in" << std::endl;
+        return 1;
+    }
+
+    hb::register_timeline_benchmarks(bench_dirs);
+    hb::register_db_benchmarks(bench_dirs);
+
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef HENHOUSE_BENCH_H
+#define HENHOUSE_BENCH_H
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace henhouse::bench
+{
+    /**
+     * A directory benchmarks create their files in. Each benchmark
+     * is registered once per directory so tmpfs and disk can be compared.
+     */
+    struct bench_dir
+    {
+        std::string name;
+        boost::filesystem::path path;
+    };
+
+    using bench_dirs = std::vector<bench_dir>;
+
+    /**
+     * Creates a fresh empty directory under the bench dir which is
+     * removed when the scratch_dir is destroyed.
+     */
+    class scratch_dir
+    {
+        public:
+            scratch_dir(const bench_dir& d);
+            ~scratch_dir();
+
+            const boost::filesystem::path& path() const { return _path;}
+
+        private:
+            boost::filesystem::path _path;
+    };
+
+    void register_timeline_benchmarks(const bench_dirs& dirs);
+    void register_db_benchmarks(const bench_dirs& dirs);
+}
+#endif
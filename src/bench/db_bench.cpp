@@ -0,0 +1,85 @@
+#include "bench/bench.hpp"
+#include "db/db.hpp"
+
+#include <benchmark/benchmark.h>
+
+namespace hdb = henhouse::db;
+
+namespace henhouse::bench
+{
+    namespace
+    {
+        const hdb::time_type RESOLUTION = 60;
+        const hdb::time_type START = 1500000000;
+        const std::size_t CACHE_SIZE = 40;
+        const std::size_t KEYS = 2 * CACHE_SIZE;
+
+        std::vector<std::string> make_keys(std::size_t n)
+        {
+            std::vector<std::string> keys;
+            for(std::size_t i = 0; i < n; i++)
+                keys.push_back("henhouse_bench_key_" + std::to_string(i));
+            return keys;
+        }
+
+        //same key every time, so the timeline is always cached
+        void get_tl_hit(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            hdb::timeline_db db{s.path().string(), CACHE_SIZE, RESOLUTION};
+            db.put("key", START, 1);
+
+            for(auto _ : state)
+                benchmark::DoNotOptimize(db.get("key", START));
+
+            state.SetItemsProcessed(state.iterations());
+        }
+
+        //cycles through twice as many existing keys as the cache holds 
+        //so every get opens and maps the timeline files and evicts another.
+        void get_tl_miss(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            hdb::timeline_db db{s.path().string(), CACHE_SIZE, RESOLUTION};
+
+            const auto keys = make_keys(KEYS);
+            for(const auto& k : keys) db.put(k, START, 1);
+
+            std::size_t i = 0;
+            for(auto _ : state)
+                benchmark::DoNotOptimize(db.get(keys[i++ % keys.size()], START));
+
+            state.SetItemsProcessed(state.iterations());
+        }
+
+        //every get is a key never seen before, which creates its directories and files
+        void get_tl_create(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            hdb::timeline_db db{s.path().string(), CACHE_SIZE, RESOLUTION};
+
+            std::size_t i = 0;
+            for(auto _ : state)
+            {
+                const auto key = "henhouse_bench_new_" + std::to_string(i++);
+                benchmark::DoNotOptimize(db.get(key, START));
+            }
+
+            state.SetItemsProcessed(state.iterations());
+        }
+    }
+
+    void register_db_benchmarks(const bench_dirs& dirs)
+    {
+        for(const auto& d : dirs)
+        {
+            const auto name = [&](const std::string& b) { return b + "@" + d.name;};
+
+            benchmark::RegisterBenchmark(name("timeline_db_get_tl_hit").c_str(), get_tl_hit, d);
+            benchmark::RegisterBenchmark(name("timeline_db_get_tl_miss").c_str(), get_tl_miss, d);
+            //bounded so the run does not create millions of directories
+            benchmark::RegisterBenchmark(name("timeline_db_get_tl_create").c_str(), get_tl_create, d)
+                ->Iterations(10000);
+        }
+    }
+}
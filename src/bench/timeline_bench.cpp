@@ -0,0 +1,230 @@
+#include "bench/bench.hpp"
+#include "db/timeline.hpp"
+
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+namespace hdb = henhouse::db;
+
+namespace henhouse::bench
+{
+    namespace
+    {
+        const hdb::time_type RESOLUTION = 60;
+        const hdb::time_type START = 1500000000;
+        const std::size_t QUERIES = 4096;
+        const std::size_t GAP_EVERY = 16;
+
+        hdb::timeline new_timeline(const scratch_dir& s)
+        {
+            return hdb::from_directory((s.path() / "key").string(), RESOLUTION);
+        }
+
+        //fills n buckets, skipping a bucket every GAP_EVERY buckets
+        //so the index has n / GAP_EVERY entries. Returns time after the last bucket.
+        hdb::time_type fill(hdb::timeline& tl, std::size_t n, std::size_t gap_every = GAP_EVERY)
+        {
+            auto t = START;
+            for(std::size_t i = 0; i < n; i++)
+            {
+                tl.put(t, i % 100);
+                t += i % gap_every == 0 ? 2 * RESOLUTION : RESOLUTION;
+            }
+            return t;
+        }
+
+        std::vector<hdb::time_type> random_times(hdb::time_type from, hdb::time_type to)
+        {
+            std::mt19937_64 g{42};
+            std::uniform_int_distribution<hdb::time_type> d{from, to};
+
+            std::vector<hdb::time_type> r(QUERIES);
+            for(auto& t : r) t = d(g);
+            return r;
+        }
+
+        void put_same_bucket(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            auto tl = new_timeline(s);
+            const auto t = fill(tl, 1);
+
+            for(auto _ : state)
+                benchmark::DoNotOptimize(tl.put(t, 1));
+
+            state.SetItemsProcessed(state.iterations());
+        }
+
+        void put_in_order(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            auto tl = new_timeline(s);
+            auto t = START;
+
+            for(auto _ : state)
+            {
+                benchmark::DoNotOptimize(tl.put(t, 1));
+                t += RESOLUTION;
+            }
+
+            state.SetItemsProcessed(state.iterations());
+        }
+
+        //the same as put_in_order on a timeline of 32 bit buckets
+        void put_in_order_compact(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            auto tl = hdb::open_timeline((s.path() / "key").string(), RESOLUTION, {}, hdb::item_width::compact);
+            auto t = START;
+
+            for(auto _ : state)
+            {
+                benchmark::DoNotOptimize(tl.put(t, 1));
+                t += RESOLUTION;
+            }
+
+            state.SetItemsProcessed(state.iterations());
+        }
+
+        //puts range(0) buckets behind the last bucket, which propagates
+        //the integrals up to the last bucket.
+        void put_late(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            auto tl = new_timeline(s);
+            const auto end = fill(tl, 2 * hdb::ADD_BUCKET_BACK_LIMIT, 2 * hdb::ADD_BUCKET_BACK_LIMIT);
+            const auto t = end - (state.range(0) + 1) * RESOLUTION;
+
+            for(auto _ : state)
+                benchmark::DoNotOptimize(tl.put(t, 1));
+
+            state.SetItemsProcessed(state.iterations());
+        }
+
+        //every put skips range(0) buckets which adds an index entry
+        void put_gap(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            auto tl = new_timeline(s);
+            auto t = START;
+            const auto step = (state.range(0) + 1) * RESOLUTION;
+
+            for(auto _ : state)
+            {
+                benchmark::DoNotOptimize(tl.put(t, 1));
+                t += step;
+            }
+
+            state.SetItemsProcessed(state.iterations());
+        }
+
+        void get(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            auto tl = new_timeline(s);
+            const auto end = fill(tl, state.range(0));
+            const auto times = random_times(START, end);
+
+            std::size_t i = 0;
+            for(auto _ : state)
+                benchmark::DoNotOptimize(tl.get(times[i++ % times.size()], 0));
+
+            state.SetItemsProcessed(state.iterations());
+        }
+
+        void diff(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            auto tl = new_timeline(s);
+            const auto end = fill(tl, state.range(0));
+            const auto times = random_times(START, end);
+
+            std::size_t i = 0;
+            for(auto _ : state)
+            {
+                const auto a = times[i++ % times.size()];
+                const auto b = times[i++ % times.size()];
+                benchmark::DoNotOptimize(tl.diff(a, b, 0));
+            }
+
+            state.SetItemsProcessed(state.iterations());
+        }
+
+        void summary(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            auto tl = new_timeline(s);
+            fill(tl, state.range(0));
+
+            for(auto _ : state)
+                benchmark::DoNotOptimize(tl.summary());
+
+            state.SetItemsProcessed(state.iterations());
+        }
+
+        //every bucket gets its own index entry so the index has range(0) entries
+        void find_range(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            auto tl = new_timeline(s);
+            const auto end = fill(tl, state.range(0), 1);
+            const auto times = random_times(START, end);
+
+            std::size_t i = 0;
+            for(auto _ : state)
+                benchmark::DoNotOptimize(tl.index.find_range(times[i++ % times.size()], 0));
+
+            state.counters["index_size"] = tl.index.size();
+            state.SetItemsProcessed(state.iterations());
+        }
+
+        //pushes range(0) items into a new file, including every resize
+        void push_back(benchmark::State& state, const bench_dir& d)
+        {
+            scratch_dir s{d};
+            const auto n = state.range(0);
+
+            std::size_t run = 0;
+            for(auto _ : state)
+            {
+                hdb::data_type data{s.path() / std::to_string(run++), hdb::DATA_SIZE};
+                for(std::int64_t i = 0; i < n; i++)
+                    data.push_back(hdb::data_item{i, i, i});
+
+                benchmark::DoNotOptimize(data.size());
+            }
+
+            state.SetItemsProcessed(state.iterations() * n);
+        }
+    }
+
+    void register_timeline_benchmarks(const bench_dirs& dirs)
+    {
+        for(const auto& d : dirs)
+        {
+            const auto name = [&](const std::string& b) { return b + "@" + d.name;};
+
+            benchmark::RegisterBenchmark(name("timeline_put_same_bucket").c_str(), put_same_bucket, d);
+            benchmark::RegisterBenchmark(name("timeline_put_in_order").c_str(), put_in_order, d);
+            benchmark::RegisterBenchmark(name("timeline_put_in_order_compact").c_str(), put_in_order_compact, d);
+            benchmark::RegisterBenchmark(name("timeline_put_late").c_str(), put_late, d)
+                ->Arg(1)->Arg(10)->Arg(hdb::ADD_BUCKET_BACK_LIMIT - 2);
+            benchmark::RegisterBenchmark(name("timeline_put_gap").c_str(), put_gap, d)
+                ->Arg(1)->Arg(100);
+
+            benchmark::RegisterBenchmark(name("timeline_get").c_str(), get, d)
+                ->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+            benchmark::RegisterBenchmark(name("timeline_diff").c_str(), diff, d)
+                ->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+            benchmark::RegisterBenchmark(name("timeline_summary").c_str(), summary, d)
+                ->Arg(1 << 10);
+
+            benchmark::RegisterBenchmark(name("index_find_range").c_str(), find_range, d)
+                ->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+
+            benchmark::RegisterBenchmark(name("mapped_vector_push_back").c_str(), push_back, d)
+                ->RangeMultiplier(32)->Range(1 << 10, 1 << 20)->Unit(benchmark::kMicrosecond);
+        }
+    }
+}
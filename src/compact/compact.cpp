@@ -0,0 +1,211 @@
+#include "db/build.hpp"
+#include "db/db.hpp"
+#include "db/schema.hpp"
+#include "util/dbc.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+namespace hdb = henhouse::db;
+
+namespace
+{
+    struct config
+    {
+        hdb::data_roots roots;
+        hdb::time_type resolution;
+        hdb::gap_policy gaps;
+        hdb::storage_schemas schemas;
+        std::time_t now;
+        std::size_t threads;
+        bool dry_run;
+    };
+
+    struct found_timeline
+    {
+        fs::path dir;
+        std::string key;
+    };
+
+    struct counters
+    {
+        std::atomic<std::uint64_t> timelines{0};
+        std::atomic<std::uint64_t> compacted{0};
+        std::atomic<std::uint64_t> index_before{0};
+        std::atomic<std::uint64_t> index_after{0};
+        std::atomic<std::uint64_t> filled{0};
+        std::atomic<std::uint64_t> dropped{0};
+        std::atomic<std::uint64_t> failed{0};
+    };
+
+    bool hidden(const fs::path& p)
+    {
+        const auto name = p.filename().string();
+        return !name.empty() && name[0] == '.';
+    }
+
+    std::vector<found_timeline> find_timelines(const config& c)
+    {
+        std::vector<found_timeline> found;
+        for(const auto& root : c.roots)
+        {
+            if(!fs::exists(root)) continue;
+
+            for(fs::recursive_directory_iterator it{root}, end; it != end; it++)
+            {
+                if(!fs::is_directory(it->status())) continue;
+                if(hidden(it->path()))
+                {
+                    it.no_push();
+                    continue;
+                }
+
+                const auto& dir = it->path();
+                if(fs::exists(dir / hdb::INDEX_FILE) && 
+                        (fs::exists(dir / hdb::DATA_FILE) || fs::exists(dir / hdb::DATA32_FILE) || 
+                         fs::exists(dir / hdb::GAUGE_FILE)))
+                    found.push_back(found_timeline{dir, hdb::dir_key(root, dir)});
+            }
+        }
+        return found;
+    }
+
+    //buckets before this are past the retention of the key's schema
+    hdb::time_type keep_from(const config& c, const std::string& key)
+    {
+        hdb::storage_schema none;
+        return hdb::retention_start(c.schemas.find(key, none), static_cast<hdb::time_type>(c.now));
+    }
+
+    void compact(const config& c, const found_timeline& t, counters& stats)
+    try
+    {
+        stats.timelines++;
+
+        const auto r = hdb::compact_timeline(t.dir.string(), c.resolution, c.gaps, c.dry_run, keep_from(c, t.key));
+        stats.index_before += r.index_before;
+        stats.index_after += r.index_after;
+        if(r.index_after == r.index_before && r.dropped == 0) return;
+
+        stats.compacted++;
+        stats.filled += r.filled;
+        stats.dropped += r.dropped;
+        if(c.dry_run) 
+            std::cout << t.dir.string() << ": " << r.index_before << " -> " << r.index_after 
+                << ", " << r.dropped << " buckets dropped" << std::endl;
+    }
+    catch(std::exception& e)
+    {
+        stats.failed++;
+        std::cerr << "unable to compact " << t.dir.string() << ": " << e.what() << std::endl;
+    }
+
+    void compact_all(const config& c, const std::vector<found_timeline>& found, counters& stats)
+    {
+        std::atomic<std::size_t> next{0};
+        std::vector<std::thread> threads;
+        for(std::size_t t = 0; t < c.threads; t++)
+            threads.emplace_back([&]
+            {
+                for(auto i = next++; i < found.size(); i = next++)
+                    compact(c, found[i], stats);
+            });
+
+        for(auto& t : threads) t.join();
+    }
+}
+
+po::options_description create_descriptions()
+{
+    po::options_description d{"Options"};
+    const auto workers = std::thread::hardware_concurrency();
+
+    d.add_options()
+        ("help,h", "prints help")
+        ("data,d", po::value<std::string>()->default_value("/tmp"), 
+         "Data directory, or the same comma separated list of them henhouse uses")
+        ("resolution", po::value<hdb::time_type>()->default_value(60),
+         "Resolution in seconds of new timelines, only used for timelines missing theirs")
+        ("gap_fill", po::value<std::size_t>()->default_value(15), 
+         "Gaps of up to this many buckets are filled, the same as henhouse's option")
+        ("gap_max_fill", po::value<std::size_t>()->default_value(1440), 
+         "Longest gap filled in a large timeline, the same as henhouse's option")
+        ("schemas", po::value<std::string>()->default_value(""), 
+         "Storage schemas file, the same as henhouse's option. Buckets older than the "
+         "retention of a key's schema are dropped.")
+        ("threads", po::value<std::size_t>()->default_value(workers), "Threads compacting timelines")
+        ("dry_run", "Print the timelines that would be compacted without rewriting them");
+
+    return d;
+}
+
+int main(int argc, char** argv)
+try
+{
+    auto description = create_descriptions();
+
+    po::variables_map opt;
+    po::store(po::parse_command_line(argc, argv, description), opt);
+    po::notify(opt);
+
+    if(opt.count("help"))
+    {
+        std::cout << "usage: henhouse_compact [options]" << std::endl;
+        std::cout << description << std::endl;
+        return 0;
+    }
+
+    hdb::storage_schema defaults;
+    defaults.resolution = opt["resolution"].as<hdb::time_type>();
+
+    config c
+    {
+        hdb::parse_data_roots(opt["data"].as<std::string>()),
+        opt["resolution"].as<hdb::time_type>(),
+        hdb::gap_policy{opt["gap_fill"].as<std::size_t>(), opt["gap_max_fill"].as<std::size_t>()},
+        hdb::load_schemas(opt["schemas"].as<std::string>(), defaults),
+        std::time(nullptr),
+        std::max<std::size_t>(1, opt["threads"].as<std::size_t>()),
+        opt.count("dry_run") > 0
+    };
+
+    if(c.resolution == 0) throw std::runtime_error{"resolution must be greater than 0"};
+
+    hdb::data_roots existing;
+    std::copy_if(c.roots.begin(), c.roots.end(), std::back_inserter(existing), 
+            [](const auto& r) { return fs::exists(r);});
+    const hdb::data_lock lock{existing};
+
+    counters stats;
+    const auto start = std::chrono::steady_clock::now();
+
+    const auto found = find_timelines(c);
+    compact_all(c, found, stats);
+
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "duration: " << seconds << "s" << std::endl;
+    std::cout << "timelines: " << stats.timelines << std::endl;
+    std::cout << "compacted: " << stats.compacted << std::endl;
+    std::cout << "index items: " << stats.index_before << " -> " << stats.index_after << std::endl;
+    std::cout << "filled buckets: " << stats.filled << std::endl;
+    std::cout << "dropped buckets: " << stats.dropped << std::endl;
+    std::cout << "failed: " << stats.failed << std::endl;
+
+    return stats.failed > 0 ? 1 : 0;
+}
+catch(std::exception& e)
+{
+    std::cerr << "error, exiting: " << e.what() << std::endl;
+    return 1;
+}
@@ -0,0 +1,61 @@
+#include "db/anomaly.hpp"
+
+#include <cmath>
+#include <limits>
+
+namespace henhouse::db
+{
+    namespace
+    {
+        const mean_type UNSCORED = std::numeric_limits<mean_type>::quiet_NaN();
+
+        mean_type z_score(const diff_result& step, const diff_result& window)
+        {
+            if(window.size == 0 || step.size == 0) return UNSCORED;
+
+            //variance from the integrals can round to just below 0 
+            if(!(window.variance > 0)) return UNSCORED;
+
+            return (step.mean - window.mean) / std::sqrt(window.variance);
+        }
+    }
+
+    anomalies query_anomalies(const any_timeline& t, const anomaly_query& q)
+    {
+        REQUIRE_GREATER(q.step, 0);
+        REQUIRE_GREATER(q.window, 0);
+        REQUIRE_GREATER_EQUAL(q.threshold, 0);
+
+        auto a = std::max(q.window, q.a);
+        const auto b = std::max(a, q.b);
+
+        anomalies r;
+        if(q.threshold == 0)
+        {
+            const auto steps = (b - a) / q.step;
+            r.times.reserve(steps);
+            r.means.reserve(steps);
+            r.scores.reserve(steps);
+        }
+
+        offset_type window_offset = 0;
+        offset_type step_offset = 0;
+        for(; a + q.step <= b; a += q.step)
+        {
+            const auto w = t.diff(a - q.window, a, window_offset);
+            window_offset = w.index_offset;
+
+            const auto s = t.diff(a, a + q.step, step_offset);
+            step_offset = s.index_offset;
+
+            const auto z = z_score(s, w);
+            if(q.threshold > 0 && !(std::abs(z) >= q.threshold)) continue;
+
+            r.times.push_back(s.a);
+            r.means.push_back(s.mean);
+            r.scores.push_back(z);
+        }
+
+        return r;
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef HENHOUSE_ANOMALY_H
+#define HENHOUSE_ANOMALY_H
+
+#include "db/timeline.hpp"
+
+#include <vector>
+
+namespace henhouse::db
+{
+    /**
+     * Scores every step seconds from a to b against the window seconds
+     * before it. Only steps scoring at least threshold, either way, are 
+     * kept. A threshold of 0 keeps every step.
+     */
+    struct anomaly_query
+    {
+        time_type a;
+        time_type b;
+        time_type step;
+        time_type window;
+        mean_type threshold = 0;
+    };
+
+    /**
+     * The steps of an anomaly query. The step at times[i] has mean
+     * means[i] per bucket and z-score scores[i]. Steps whose window has 
+     * no variance to score against have a NaN score.
+     */
+    struct anomalies
+    {
+        std::vector<time_type> times;
+        std::vector<mean_type> means;
+        std::vector<mean_type> scores;
+    };
+
+    /**
+     * Z-score of each step's mean per bucket against the mean and 
+     * standard deviation per bucket of its trailing window. Both come 
+     * from the stored integrals, so each step costs two diffs no matter
+     * how wide the window is, and both searches start where the last 
+     * step's ended.
+     */
+    anomalies query_anomalies(const any_timeline& t, const anomaly_query& q);
+}
+#endif
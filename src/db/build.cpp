@@ -0,0 +1,321 @@
+#include "db/build.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace henhouse::db
+{
+    namespace
+    {
+        bool has_timeline(const fs::path& path)
+        {
+            return fs::exists(path / INDEX_FILE) && 
+                (fs::exists(path / DATA_FILE) || fs::exists(path / DATA32_FILE) || fs::exists(path / GAUGE_FILE));
+        }
+
+        bool fits_compact(const buckets& bs)
+        {
+            data_item prev{0, 0, 0};
+            for(const auto& b : bs)
+            {
+                const data_item cur{b.value, prev.integral + b.value, prev.second_integral + b.value * b.value};
+                for(const auto v : {cur.value, cur.integral, cur.second_integral})
+                    if(v < std::numeric_limits<std::int32_t>::min() || v > std::numeric_limits<std::int32_t>::max()) 
+                        return false;
+                prev = cur;
+            }
+            return true;
+        }
+
+        template <class item>
+        void write_items(const fs::path& path, const time_type resolution, const buckets& bs, index_type& index)
+        {
+            using field = decltype(item::value);
+            basic_data_type<item> data{path, sizeof(data_metadata) + bs.size() * sizeof(item)};
+
+            data_item prev{0, 0, 0};
+            for(std::size_t i = 0; i < bs.size(); i++)
+            {
+                const auto& b = bs[i];
+                REQUIRE(i == 0 || b.time > bs[i-1].time);
+                REQUIRE(i == 0 || (b.time - bs[i-1].time) % resolution == 0);
+
+                if(i == 0 || b.time != bs[i-1].time + resolution) 
+                    index.push_back(index_item{b.time, data.size()});
+
+                data_item current{b.value, prev.integral + b.value, prev.second_integral + b.value * b.value};
+                data.push_back(item{
+                        static_cast<field>(current.value), 
+                        static_cast<field>(current.integral), 
+                        static_cast<field>(current.second_integral)});
+                prev = current;
+            }
+
+            ENSURE_EQUAL(data.size(), bs.size());
+        }
+
+        //merges two bucket lists sorted by time, adding buckets at the same time
+        buckets merge_buckets(const buckets& a, const buckets& b)
+        {
+            buckets r;
+            r.reserve(a.size() + b.size());
+
+            auto ai = a.begin();
+            auto bi = b.begin();
+            while(ai != a.end() || bi != b.end())
+            {
+                if(bi == b.end() || (ai != a.end() && ai->time < bi->time)) r.push_back(*ai++);
+                else if(ai == a.end() || bi->time < ai->time) r.push_back(*bi++);
+                else
+                {
+                    r.push_back(bucket{ai->time, ai->value + bi->value});
+                    ai++;
+                    bi++;
+                }
+            }
+
+            return r;
+        }
+
+        //aligns points sorted by time to the grid at anchor, summing points in the same bucket
+        buckets align_points(const data_points& points, const time_type anchor, const time_type res, merge_result& r)
+        {
+            buckets added;
+            added.reserve(points.size());
+            for(std::size_t i = 0; i < points.size(); i++)
+            {
+                const auto& p = points[i];
+                REQUIRE(i == 0 || p.time >= points[i-1].time);
+
+                time_type t = 0;
+                if(p.time >= anchor) t = anchor + ((p.time - anchor) / res) * res;
+                else
+                {
+                    const auto back = (anchor - p.time + res - 1) / res * res;
+                    if(back > anchor)
+                    {
+                        r.rejected++;
+                        continue;
+                    }
+                    t = anchor - back;
+                }
+
+                if(!added.empty() && added.back().time == t) added.back().value += p.count;
+                else added.push_back(bucket{t, p.count});
+                r.merged++;
+            }
+
+            return added;
+        }
+
+        /**
+         * The new values of the stored buckets the added ones land on. 
+         * Empty if any lands in a gap or outside the timeline, since 
+         * those change the layout and need a rewrite.
+         */
+        bucket_patches stored_patches(const any_timeline& t, const buckets& added)
+        {
+            bucket_patches r;
+            const auto& index = t.index();
+            if(index.empty() || added.empty()) return r;
+
+            const auto res = index.meta().resolution;
+            const auto size = t.data_size();
+
+            offset_type index_offset = 0;
+            for(const auto& b : added)
+            {
+                const auto* range = index.find_range(b.time, index_offset);
+                if(range == nullptr || (b.time - range->time) % res != 0) return {};
+
+                const auto next = range + 1;
+                const auto end = next != index.cend() ? std::min<offset_type>(next->pos, size) : size;
+                const auto pos = range->pos + (b.time - range->time) / res;
+                if(pos >= end) return {};
+
+                index_offset = range - index.cbegin();
+                r.push_back(bucket_patch{pos, t.get(b.time, index_offset).value.value + b.value});
+            }
+
+            return r;
+        }
+    }
+
+    buckets read_buckets(const any_timeline& t)
+    {
+        buckets r;
+        const auto& index = t.index();
+        if(index.empty()) return r;
+
+        const auto resolution = index.meta().resolution;
+        REQUIRE_GREATER(resolution, 0);
+
+        const auto values = t.values();
+        r.reserve(values.size());
+        for(auto range = index.cbegin(); range != index.cend(); range++)
+        {
+            const auto next = range + 1;
+            const auto end = next != index.cend() ? 
+                std::min<offset_type>(next->pos, values.size()) : values.size();
+
+            for(auto pos = range->pos; pos < end; pos++)
+                r.push_back(bucket{range->time + (pos - range->pos) * resolution, values[pos]});
+        }
+
+        return r;
+    }
+
+    void write_timeline(const std::string& path, const time_type resolution, const buckets& bs, const item_width width)
+    {
+        REQUIRE(!path.empty());
+        REQUIRE_GREATER(resolution, 0);
+
+        const fs::path root = path;
+        fs::create_directories(root);
+
+        const auto stored = width == item_width::compact && fits_compact(bs) ? 
+            item_width::compact : item_width::wide;
+
+        const auto index_path = root / (std::string{INDEX_FILE} + NEW_SUFFIX);
+        const auto data_path = root / (std::string{data_file_name(stored)} + NEW_SUFFIX);
+        fs::remove(index_path);
+        fs::remove(data_path);
+
+        {
+            index_type index{index_path, resolution};
+            if(stored == item_width::compact) write_items<data_item32>(data_path, resolution, bs, index);
+            else write_items<data_item>(data_path, resolution, bs, index);
+        }
+
+        commit_rewrite(root, stored);
+    }
+
+    merge_result merge_points(const std::string& path, const time_type resolution, const data_points& points)
+    {
+        REQUIRE(!path.empty());
+        REQUIRE_GREATER(resolution, 0);
+
+        merge_result r;
+        if(points.empty()) return r;
+
+        if(!has_timeline(path))
+        {
+            const auto added = align_points(points, points.front().time, resolution, r);
+            write_timeline(path, resolution, added);
+            r.buckets = added.size();
+            return r;
+        }
+
+        buckets added;
+        bucket_patches patches;
+        time_type res = 0;
+        item_width width = item_width::wide;
+        {
+            const auto t = open_timeline(path, resolution);
+            if(t.is_gauge())
+            {
+                r.gauge = points.size();
+                return r;
+            }
+
+            res = t.index().meta().resolution;
+            width = t.width();
+            const auto anchor = t.index().empty() ? points.front().time : t.index().front().time;
+            CHECK_GREATER(res, 0);
+
+            added = align_points(points, anchor, res, r);
+            patches = stored_patches(t, added);
+            r.buckets = t.data_size();
+        }
+
+        //points landing on stored buckets only change those and the integrals after them
+        if(!patches.empty() && patch_timeline(path, patches)) return r;
+
+        const auto existing = read_buckets(open_timeline(path, resolution));
+        const auto all = merge_buckets(existing, added);
+        write_timeline(path, res, all, width);
+
+        r.buckets = all.size();
+        return r;
+    }
+
+    buckets fill_gaps(const buckets& bs, const time_type resolution, const gap_policy& gaps)
+    {
+        REQUIRE_GREATER(resolution, 0);
+
+        buckets r;
+        r.reserve(bs.size());
+
+        for(const auto& b : bs)
+        {
+            if(!r.empty())
+            {
+                const auto last = r.back().time;
+                REQUIRE_GREATER(b.time, last);
+
+                const offset_type gap = (b.time - last) / resolution - 1;
+                if(gap > 0 && gaps.fills(gap, r.size()))
+                    for(offset_type i = 1; i <= gap; i++) r.push_back(bucket{last + i * resolution, 0});
+            }
+            r.push_back(b);
+        }
+
+        return r;
+    }
+
+    compact_result compact_timeline(
+            const std::string& path, 
+            const time_type resolution, 
+            const gap_policy& gaps, 
+            bool dry_run,
+            const time_type keep_from)
+    {
+        REQUIRE(!path.empty());
+        REQUIRE_GREATER(resolution, 0);
+
+        compact_result r;
+        if(!has_timeline(path)) return r;
+
+        buckets existing;
+        auto res = resolution;
+        auto width = item_width::wide;
+        {
+            const auto t = open_timeline(path, resolution);
+            res = t.index().meta().resolution;
+            r.index_before = t.index().size();
+            r.index_after = r.index_before;
+            if(t.is_gauge()) return r;
+
+            width = t.width();
+            existing = read_buckets(t);
+        }
+
+        CHECK_GREATER(res, 0);
+
+        const auto kept = std::find_if(existing.begin(), existing.end(), 
+                [keep_from](const auto& b) { return b.time >= keep_from;});
+        r.dropped = kept - existing.begin();
+        existing.erase(existing.begin(), kept);
+
+        const auto filled = fill_gaps(existing, res, gaps);
+
+        r.index_after = 0;
+        for(std::size_t i = 0; i < filled.size(); i++)
+            if(i == 0 || filled[i].time != filled[i-1].time + res) r.index_after++;
+
+        if(r.index_after >= r.index_before && r.dropped == 0) 
+        {
+            r.index_after = r.index_before;
+            return r;
+        }
+
+        r.filled = filled.size() - existing.size();
+        if(!dry_run) write_timeline(path, res, filled, width);
+
+        return r;
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef HENHOUSE_BUILD_H
+#define HENHOUSE_BUILD_H
+
+#include "db/timeline.hpp"
+
+#include <vector>
+
+namespace henhouse::db
+{
+    struct data_point
+    {
+        time_type time;
+        count_type count;
+    };
+
+    using data_points = std::vector<data_point>;
+
+    struct bucket
+    {
+        time_type time;
+        count_type value;
+    };
+
+    using buckets = std::vector<bucket>;
+
+    struct merge_result
+    {
+        std::size_t merged = 0;     //points added to the timeline
+        std::size_t rejected = 0;   //points before the start of time on the timeline's grid
+        std::size_t gauge = 0;      //points refused because the timeline is a gauge
+        std::size_t buckets = 0;    //buckets in the rewritten timeline
+    };
+
+    struct compact_result
+    {
+        std::size_t index_before = 0;   //index items before compacting
+        std::size_t index_after = 0;    //index items after, the same when nothing changed
+        std::size_t filled = 0;         //empty buckets written into gaps
+        std::size_t dropped = 0;        //buckets older than the retention dropped
+    };
+
+    /**
+     * Reads every stored bucket of a timeline in time order. 
+     */
+    buckets read_buckets(const any_timeline& t);
+
+    /**
+     * Writes a timeline from scratch into path from buckets sorted by time
+     * that lie on a grid of the resolution. Contiguous buckets share an
+     * index entry and gaps start a new one, the same layout put produces.
+     * Integrals are computed in one pass. New files are written next to the 
+     * old ones and replaced by commit_rewrite, so a crash leaves either the
+     * old timeline or the new one. A compact timeline is written wide if 
+     * its integrals don't fit.
+     *
+     * Not safe while anything else has the timeline open.
+     */
+    void write_timeline(
+            const std::string& path, 
+            const time_type resolution, 
+            const buckets& bs, 
+            const item_width width = item_width::wide);
+
+    /**
+     * Adds points sorted by time to the timeline stored in path, creating
+     * it if needed. Unlike put, points may be arbitrarily far in the past.
+     * Points are aligned to the existing timeline's grid, or the first 
+     * point's time for a new timeline. When every point lands on a stored
+     * bucket the buckets are patched in place with patch_timeline, which
+     * recomputes the integrals from the earliest changed bucket on. Points
+     * in gaps or outside the timeline rewrite it with write_timeline at 
+     * its width. Points to a gauge timeline are all refused and counted
+     * as gauge, they were staged as counts.
+     *
+     * Not safe while anything else has the timeline open.
+     */
+    merge_result merge_points(const std::string& path, const time_type resolution, const data_points& points);
+
+    /**
+     * Fills the gaps between buckets sorted by time with empty buckets
+     * where the gap policy would have filled them on put.
+     */
+    buckets fill_gaps(const buckets& bs, const time_type resolution, const gap_policy& gaps);
+
+    /**
+     * Rewrites the timeline stored in path with its gaps filled under the
+     * gap policy and its buckets before keep_from dropped, when that removes
+     * index items or buckets. A dry run only counts them. Gauge timelines 
+     * are left as they are.
+     *
+     * Not safe while anything else has the timeline open.
+     */
+    compact_result compact_timeline(
+            const std::string& path, 
+            const time_type resolution, 
+            const gap_policy& gaps, 
+            bool dry_run,
+            const time_type keep_from = 0);
+}
+#endif
@@ -0,0 +1,105 @@
+#include "db/coalesce.hpp"
+
+namespace henhouse::db
+{
+    namespace
+    {
+        std::size_t round_up_pow2(std::size_t n)
+        {
+            std::size_t p = 1;
+            while(p < n) p <<= 1;
+            return p;
+        }
+    }
+
+    coalesce_table::coalesce_table(std::size_t slots) : 
+        _slots(slots > 0 ? round_up_pow2(slots) : 0) {}
+
+    pending_put* coalesce_table::find(std::size_t hash)
+    {
+        const auto& t = *this;
+        return const_cast<pending_put*>(t.find(hash));
+    }
+
+    const pending_put* coalesce_table::find(std::size_t hash) const
+    {
+        if(_size == 0) return nullptr;
+
+        const auto mask = _slots.size() - 1;
+        for(auto i = slot(hash);; i = (i + 1) & mask)
+        {
+            const auto& p = _slots[i];
+            if(!p.used) return nullptr;
+            if(p.hash == hash) return &p;
+        }
+    }
+
+    pending_put* coalesce_table::insert(std::size_t hash, const std::string& key, time_type from, time_type to)
+    {
+        REQUIRE(enabled());
+        REQUIRE(find(hash) == nullptr);
+        REQUIRE_LESS(from, to);
+
+        //keep probes short, a key that misses out is written directly
+        if((_size + 1) * 4 > _slots.size() * 3) return nullptr;
+
+        const auto mask = _slots.size() - 1;
+        auto i = slot(hash);
+        while(_slots[i].used) i = (i + 1) & mask;
+
+        auto& p = _slots[i];
+        p.hash = hash;
+        p.key = key;
+        p.from = from;
+        p.to = to;
+        p.count = 0;
+        p.used = true;
+        _size++;
+
+        return &p;
+    }
+
+    void coalesce_table::erase(pending_put* p)
+    {
+        REQUIRE(p);
+        REQUIRE(p->used);
+        REQUIRE_GREATER(_size, 0);
+
+        const auto mask = _slots.size() - 1;
+        auto hole = static_cast<std::size_t>(p - _slots.data());
+        CHECK_LESS(hole, _slots.size());
+
+        //shift back every following entry that would no longer be found
+        for(auto i = (hole + 1) & mask; _slots[i].used; i = (i + 1) & mask)
+        {
+            const auto home = slot(_slots[i].hash);
+            const auto dist_hole = (hole - home) & mask;
+            const auto dist_i = (i - home) & mask;
+            if(dist_hole > dist_i) continue;
+
+            std::swap(_slots[hole], _slots[i]);
+            hole = i;
+        }
+
+        _slots[hole].used = false;
+        _slots[hole].key.clear();
+        _size--;
+    }
+
+    pending_puts coalesce_table::take()
+    {
+        pending_puts r;
+        r.reserve(_size);
+
+        for(auto& p : _slots)
+        {
+            if(!p.used) continue;
+            r.push_back(std::move(p));
+            p.used = false;
+            p.key.clear();
+        }
+
+        _size = 0;
+        return r;
+    }
+}
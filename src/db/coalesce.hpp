@@ -0,0 +1,64 @@
+#ifndef HENHOUSE_COALESCE_H
+#define HENHOUSE_COALESCE_H
+
+#include "db/timeline.hpp"
+
+#include <string>
+#include <vector>
+
+namespace henhouse::db
+{
+    /**
+     * Counts added to the last bucket of a timeline that have not been 
+     * written to it yet. Covers times [from, to).
+     */
+    struct pending_put
+    {
+        std::size_t hash = 0;
+        std::string key;
+        time_type from = 0;
+        time_type to = 0;
+        count_type count = 0;
+        bool used = false;
+    };
+
+    using pending_puts = std::vector<pending_put>;
+
+    /**
+     * Small open addressing table of pending puts by key hash, at most one
+     * per key. Uses linear probing and backward shift deletion so lookups
+     * never scan tombstones. A table of 0 slots is disabled.
+     * Note this interface is NOT thread safe.
+     */
+    class coalesce_table
+    {
+        public:
+            coalesce_table(std::size_t slots = 0);
+
+            bool enabled() const { return !_slots.empty();}
+            bool empty() const { return _size == 0;}
+            std::size_t size() const { return _size;}
+
+            pending_put* find(std::size_t hash);
+            const pending_put* find(std::size_t hash) const;
+
+            /**
+             * Adds an empty pending put for the key's bucket [from, to). 
+             * Returns nullptr when the table is too full.
+             */
+            pending_put* insert(std::size_t hash, const std::string& key, time_type from, time_type to);
+
+            void erase(pending_put* p);
+
+            //removes and returns every pending put
+            pending_puts take();
+
+        private:
+            std::size_t slot(std::size_t hash) const { return hash & (_slots.size() - 1);}
+
+        private:
+            pending_puts _slots;
+            std::size_t _size = 0;
+    };
+}
+#endif
@@ -1,10 +1,18 @@
 #include "db/db.hpp"
 
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <functional>
+#include <iostream>
 #include <boost/filesystem.hpp>
 
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
 #include <boost/regex.hpp>
+#include <boost/algorithm/string.hpp>
 
 namespace fs = boost::filesystem;
 
@@ -15,28 +23,88 @@ namespace henhouse::db
         const int MAX_DIR_LENGTH = 8;
         const int MAX_DIR_SPLIT_LENGTH = MAX_DIR_LENGTH * 4;
         const offset_type NO_OFFSET = 0;
+    }
 
-        fs::path get_key_dir(const fs::path& root, const stde::string_view& key)
+    fs::path key_dir(const fs::path& root, const stde::string_view& key)
+    {
+        REQUIRE(!key.empty());
+        fs::path p = root;
+
+        for(std::size_t i = 0; i < key.size() && i < MAX_DIR_SPLIT_LENGTH; i += MAX_DIR_LENGTH)
         {
-            REQUIRE(!key.empty());
-            fs::path p = root;
+            const auto d = key.substr(i, MAX_DIR_LENGTH);
+            p.append(d.begin(), d.end());
+        }
 
-            for(std::size_t i = 0; i < key.size() && i < MAX_DIR_SPLIT_LENGTH; i += MAX_DIR_LENGTH)
-            {
-                const auto d = key.substr(i, MAX_DIR_LENGTH);
-                p.append(d.begin(), d.end());
-            }
+        if(key.size() > MAX_DIR_SPLIT_LENGTH)
+        {
+            const auto d = key.substr(MAX_DIR_SPLIT_LENGTH, key.size() - MAX_DIR_SPLIT_LENGTH);
+            p.append(d.begin(), d.end());
+        }
 
-            if(key.size() > MAX_DIR_SPLIT_LENGTH)
+        return p;
+    }
+
+    std::size_t root_num(const stde::string_view& key, const std::size_t roots)
+    {
+        REQUIRE_GREATER(roots, 0);
+        return std::hash<stde::string_view>{}(key) % roots;
+    }
+
+    fs::path key_dir(const data_roots& roots, const stde::string_view& key)
+    {
+        return key_dir(roots[root_num(key, roots.size())], key);
+    }
+
+    std::string dir_key(const fs::path& root, const fs::path& dir)
+    {
+        std::string key;
+        for(const auto& d : fs::relative(dir, root)) key += d.string();
+        return key;
+    }
+
+    data_roots parse_data_roots(const std::string& roots)
+    {
+        std::vector<std::string> parts;
+        boost::split(parts, roots, boost::is_any_of(","));
+
+        data_roots r;
+        for(const auto& p : parts) 
+            if(!p.empty()) r.emplace_back(p);
+
+        if(r.empty()) throw std::runtime_error{"no data directories in '" + roots + "'"};
+        return r;
+    }
+
+    data_lock::data_lock(const data_roots& roots)
+    {
+        try
+        {
+            for(const auto& root : roots)
             {
-                const auto d = key.substr(MAX_DIR_SPLIT_LENGTH, key.size() - MAX_DIR_SPLIT_LENGTH);
-                p.append(d.begin(), d.end());
-            }
+                const auto path = (root / LOCK_FILE).string();
+                const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+                if(fd < 0) throw std::runtime_error{"unable to open " + path + ": " + std::strerror(errno)};
+                _fds.push_back(fd);
 
-            return p;
+                if(::flock(fd, LOCK_EX | LOCK_NB) == 0) continue;
+                if(errno == EWOULDBLOCK) 
+                    throw std::runtime_error{"data directory " + root.string() + " is in use by another process"};
+                throw std::runtime_error{"unable to lock " + path + ": " + std::strerror(errno)};
+            }
+        }
+        catch(...)
+        {
+            for(const auto fd : _fds) ::close(fd);
+            throw;
         }
     }
 
+    data_lock::~data_lock()
+    {
+        for(const auto fd : _fds) ::close(fd);
+    }
+
     void sanatize_key(std::string& res, const stde::string_view& key)
     {
         res.assign(key.data(), key.size());
@@ -49,75 +117,301 @@ namespace henhouse::db
                 }, '_');
     }
 
+    timeline_db::~timeline_db()
+    try
+    {
+        flush_coalesced();
+    }
+    catch(std::exception& e)
+    {
+        std::cerr << "Error writing coalesced puts: " << e.what() << std::endl;
+    }
+
     summary_result timeline_db::summary(const stde::string_view& key) const
     {
+        flush_coalesced(key);
         const auto& tl = get_tl(key);
         return tl.summary();
     }
 
     get_result timeline_db::get(const stde::string_view& key, time_type t) const 
     {
+        flush_coalesced(key);
         const auto& tl = get_tl(key);
         return tl.get(t, NO_OFFSET);
     }
 
-    bool timeline_db::put(const stde::string_view& key, time_type t, count_type count)
+    bool timeline_db::put(const stde::string_view& key, time_type t, const put_value& v)
     {
+        if(!_pending.enabled())
+        {
+            auto& tl = get_tl(key);
+            choose_kind(key, tl, v);
+            return tl.put(t, v);
+        }
+
+        const auto h = std::hash<stde::string_view>{}(key);
+        auto p = _pending.find(h);
+        if(p)
+        {
+            if(t >= p->from && t < p->to)
+            {
+                //pending puts are only kept for counters
+                if(v.fractional) return false;
+                p->count += v.count;
+                _coalesced.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+
+            //points before the bucket go straight to their own bucket,
+            //the bucket is only closed by one past it.
+            if(t >= p->to) 
+            {
+                flush(*p);
+                _pending.erase(p);
+            }
+        }
+
         auto& tl = get_tl(key);
-        return tl.put(t, count);
+        choose_kind(key, tl, v);
+        if(!tl.put(t, v)) return false;
+        if(tl.is_gauge()) return true;
+
+        //the first put of a bucket writes through and opens it for coalescing 
+        const auto b = tl.last_bucket();
+        if(!_pending.find(h) && t >= b.from && t < b.to) 
+            _pending.insert(h, std::string{key.data(), key.size()}, b.from, b.to);
+
+        return true;
+    }
+
+    void timeline_db::choose_kind(const stde::string_view& key, any_timeline& tl, const put_value& v) const
+    {
+        if(tl.is_gauge() || !tl.index().empty()) return;
+
+        if(!_gauge_keys.empty() && boost::regex_search(key.begin(), key.end(), _gauge_keys)) 
+            tl.make_gauge();
+    }
+
+    void timeline_db::flush_coalesced()
+    {
+        for(const auto& p : _pending.take()) flush(p);
+    }
+
+    void timeline_db::flush_coalesced(const stde::string_view& key) const
+    {
+        if(_pending.empty()) return;
+
+        const auto h = std::hash<stde::string_view>{}(key);
+        auto p = _pending.find(h);
+        if(!p) return;
+
+        const auto pending = std::move(*p);
+        _pending.erase(p);
+        flush(pending);
+    }
+
+    void timeline_db::flush(const pending_put& p) const
+    {
+        if(p.count == 0) return;
+
+        //the bucket is still the last one since every put to the key
+        //goes through the table first
+        auto& tl = const_cast<timeline_db*>(this)->get_tl(p.key);
+        const bool put = tl.put(p.from, p.count);
+        CHECK(put);
     }
 
     diff_result timeline_db::diff(const stde::string_view& key, time_type a, time_type b, const offset_type index_offset) const
     {
+        flush_coalesced(key);
         const auto& tl = get_tl(key);
         return tl.diff(a, b, index_offset);
     }
 
+    raw_result timeline_db::raw(const stde::string_view& key, time_type a, time_type b) const
+    {
+        flush_coalesced(key);
+        const auto& tl = get_tl(key);
+        const auto dir = key_dir(_roots, key);
+        return raw_result
+        {
+            tl.raw(a, b), 
+            (dir / INDEX_FILE).string(), 
+            tl.data_file().string(),
+            tl.width()
+        };
+    }
+
+    series timeline_db::values(const stde::string_view& key, const series_query& q) const
+    {
+        flush_coalesced(key);
+        const auto& tl = get_tl(key);
+        return query_series(tl, q);
+    }
+
+    anomalies timeline_db::anomaly(const stde::string_view& key, const anomaly_query& q) const
+    {
+        flush_coalesced(key);
+        const auto& tl = get_tl(key);
+        return query_anomalies(tl, q);
+    }
+
+    void timeline_db::sync(const stde::string_view& key)
+    {
+        REQUIRE_FALSE(key.empty());
+        flush_coalesced(key);
+
+        const auto h = std::hash<stde::string_view>{}(key);
+        const auto t = _tls.findWithoutPromotion(h);
+        if(t != std::end(_tls)) 
+        {
+            t->second.sync();
+            return;
+        }
+
+        sync_timeline_files(key_dir(_roots, key));
+    }
+
+    merge_result timeline_db::merge(const stde::string_view& key, const data_points& points)
+    {
+        REQUIRE_FALSE(key.empty());
+        flush_coalesced(key);
+
+        const auto h = std::hash<stde::string_view>{}(key);
+        _tls.erase(h);
+        _keys.erase(h);
+
+        return merge_points(key_dir(_roots, key).string(), schema(key).resolution, points);
+    }
+
+    compact_result timeline_db::apply_retention(const stde::string_view& key, time_type now)
+    {
+        REQUIRE_FALSE(key.empty());
+
+        const auto& s = schema(key);
+        const auto keep_from = retention_start(s, now);
+        const auto path = key_dir(_roots, key);
+        if(keep_from == 0 || !has_timeline_files(path)) return compact_result{};
+
+        flush_coalesced(key);
+        {
+            const auto t = open_timeline(path.string(), s.resolution);
+            if(t.index().empty() || t.index().front().time >= keep_from) return compact_result{};
+        }
+
+        const auto h = std::hash<stde::string_view>{}(key);
+        _tls.erase(h);
+        _keys.erase(h);
+
+        return compact_timeline(path.string(), s.resolution, _gaps, false, keep_from);
+    }
+
+    void timeline_db::warm(const stde::string_view& key)
+    {
+        const auto& tl = get_tl(key);
+        tl.prefetch(WARM_BUCKETS);
+    }
+
+    std::vector<std::string> timeline_db::hot_keys() const
+    {
+        std::vector<std::string> keys;
+        keys.reserve(_tls.size());
+
+        for(const auto& t : _tls)
+        {
+            const auto k = _keys.find(t.first);
+            if(k != std::end(_keys)) keys.emplace_back(k->second);
+        }
+
+        return keys;
+    }
+
     std::size_t timeline_db::key_index_size(const stde::string_view& key) const
     {
         const auto& tl = get_tl(key);
-        return tl.index.size();
+        return tl.index().size();
     }
 
     std::size_t timeline_db::key_data_size(const stde::string_view& key) const
     {
         const auto& tl = get_tl(key);
-        return tl.data.size();
+        return tl.data_size();
+    }
+
+    const any_timeline* timeline_db::find(const stde::string_view& key) const
+    {
+        REQUIRE_FALSE(key.empty());
+
+        const auto h = std::hash<stde::string_view>{}(key);
+        if(_pending.find(h)) return nullptr;
+
+        const auto& tls = _tls;
+
+        const auto t = tls.findWithoutPromotion(h);
+        return t != std::end(tls) ? &t->second : nullptr;
     }
 
-    timeline& timeline_db::get_tl(const stde::string_view& key)
+    cache_stats timeline_db::stats() const
+    {
+        return cache_stats 
+        {
+            _hits.load(std::memory_order_relaxed),
+            _misses.load(std::memory_order_relaxed),
+            _evictions.load(std::memory_order_relaxed),
+            _coalesced.load(std::memory_order_relaxed)
+        };
+    }
+
+    any_timeline& timeline_db::get_tl(const stde::string_view& key)
     {
         REQUIRE_FALSE(key.empty());
 
         const auto h = std::hash<stde::string_view>{}(key);
 
         const auto t = _tls.find(h);
-        if(t != std::end(_tls)) return t->second;
+        if(t != std::end(_tls)) 
+        {
+            _hits.fetch_add(1, std::memory_order_relaxed);
+            return t->second;
+        }
 
-        const auto key_dir = get_key_dir(_root, key);
+        _misses.fetch_add(1, std::memory_order_relaxed);
 
-        if(!fs::exists(key_dir)) fs::create_directories(key_dir);
+        const auto dir = key_dir(_roots, key);
 
-        _tls.set(h, from_directory(key_dir.string(), _new_tl_resolution));
+        if(!fs::exists(dir)) fs::create_directories(dir);
+
+        const auto& s = schema(key);
+        _tls.set(h, open_timeline(dir.string(), s.resolution, _gaps, _new_tl_width, s.files));
+        _keys[h].assign(key.data(), key.size());
         auto p = _tls.find(h);
 
         return p->second;
     }
 
-    const timeline& timeline_db::get_tl(const stde::string_view& key) const
+    const any_timeline& timeline_db::get_tl(const stde::string_view& key) const
     {
         REQUIRE_FALSE(key.empty());
 
         const auto h = std::hash<stde::string_view>{}(key);
 
         const auto t = _tls.find(h);
-        if(t != std::end(_tls)) return t->second;
+        if(t != std::end(_tls)) 
+        {
+            _hits.fetch_add(1, std::memory_order_relaxed);
+            return t->second;
+        }
+
+        _misses.fetch_add(1, std::memory_order_relaxed);
 
-        const auto key_dir = get_key_dir(_root, key);
+        const auto dir = key_dir(_roots, key);
 
-        if(!fs::exists(key_dir)) fs::create_directories(key_dir);
+        if(!fs::exists(dir)) fs::create_directories(dir);
 
-        _tls.set(h, from_directory(key_dir.string(), _new_tl_resolution));
+        const auto& s = schema(key);
+        _tls.set(h, open_timeline(dir.string(), s.resolution, _gaps, _new_tl_width, s.files));
+        _keys[h].assign(key.data(), key.size());
         auto p = _tls.find(h);
         return p->second;
     }
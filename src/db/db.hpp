@@ -2,15 +2,46 @@
 #define HENHOUSE_DB_H
 
 #include "db/timeline.hpp"
+#include "db/build.hpp"
+#include "db/coalesce.hpp"
+#include "db/schema.hpp"
+#include "db/transform.hpp"
+#include "db/anomaly.hpp"
 
+#include <atomic>
+#include <unordered_map>
+#include <vector>
 #include <experimental/string_view>
 #include <folly/container/EvictingCacheMap.h>
+#include <boost/regex.hpp>
 
 namespace stde = std::experimental;
 
 namespace henhouse::db
 {
-    using timeline_cache = folly::EvictingCacheMap<std::size_t, timeline>;
+    using timeline_cache = folly::EvictingCacheMap<std::size_t, any_timeline>;
+
+    //directories timelines are spread across, usually one per disk
+    using data_roots = std::vector<boost::filesystem::path>;
+
+    struct cache_stats
+    {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        std::uint64_t coalesced = 0;
+    };
+
+    /**
+     * Item ranges covering a time range and the files they are stored in.
+     */
+    struct raw_result
+    {
+        raw_range range;
+        std::string index_file;
+        std::string data_file;
+        item_width width;
+    };
 
     /**
      * Manages a cache of timelines based on key.
@@ -18,41 +49,205 @@ namespace henhouse::db
      *
      * The key passed into the members should be sanatized first using the satantize
      * function.
+     *
+     * With coalescing on, puts to a timeline's last bucket add up in memory 
+     * and are written as one put when a point lands past that bucket, when 
+     * the key is read, synced or merged, or on flush_coalesced.
+     *
+     * A new timeline becomes a gauge when its key matches the gauge keys 
+     * pattern, never because of how its first value is written. Counters
+     * refuse fractional puts. Puts to gauges are never coalesced since 
+     * they replace values instead of adding up.
+     *
+     * New timelines take their resolution and file sizes from the first
+     * storage schema matching their key, or the db's own without one.
      */
     class timeline_db 
     {
         public:
             timeline_db(const std::string& root, const std::size_t cache_size, const time_type new_timeline_resolution) : 
-                _root{root}, _new_tl_resolution{new_timeline_resolution}, _tls{cache_size}
+                timeline_db{data_roots{root}, cache_size, new_timeline_resolution} {}
+
+            timeline_db(
+                    const data_roots& roots, 
+                    const std::size_t cache_size, 
+                    const time_type new_timeline_resolution,
+                    const std::size_t coalesce_slots = 0,
+                    const gap_policy& gaps = {},
+                    const item_width new_timeline_width = item_width::wide,
+                    const std::string& gauge_keys = "",
+                    const storage_schemas& schemas = {}) : 
+                _roots{roots}, _gaps{gaps}, _new_tl_width{new_timeline_width}, _schemas{schemas},
+                _tls{cache_size}, _pending{coalesce_slots}
             {
-                REQUIRE(!root.empty());
+                REQUIRE_FALSE(roots.empty());
                 REQUIRE_GREATER(cache_size, 0);
                 REQUIRE_GREATER(new_timeline_resolution, 0);
+
+                if(!gauge_keys.empty()) _gauge_keys = boost::regex{gauge_keys};
+                _default_schema.resolution = new_timeline_resolution;
+
+                _tls.setPruneHook([this](std::size_t h, any_timeline&&) 
+                        { 
+                            _keys.erase(h);
+                            _evictions.fetch_add(1, std::memory_order_relaxed);
+                        });
             }
 
+            ~timeline_db();
+
         public:
 
             summary_result summary(const stde::string_view& key) const;
             get_result get(const stde::string_view& key, time_type t) const;
-            bool put(const stde::string_view& key, time_type t, count_type c);
+            bool put(const stde::string_view& key, time_type t, count_type c) { return put(key, t, count_value(c));}
+            bool put(const stde::string_view& key, time_type t, const put_value& v);
             diff_result diff(const stde::string_view& key, time_type a, time_type b, const offset_type index_offset) const;
+            raw_result raw(const stde::string_view& key, time_type a, time_type b) const;
+            series values(const stde::string_view& key, const series_query& q) const;
+            anomalies anomaly(const stde::string_view& key, const anomaly_query& q) const;
+
+            /**
+             * Writes the key's timeline to disk. An open timeline writes
+             * what changed since its last sync, a closed one has its files 
+             * synced whole without opening it.
+             */
+            void sync(const stde::string_view& key);
+
+            /**
+             * Adds points sorted by time to the key's timeline no matter how
+             * far in the past they are by rewriting it with merge_points. 
+             * The timeline is closed first and reopened when next used.
+             */
+            merge_result merge(const stde::string_view& key, const data_points& points);
+
+            /**
+             * Drops the key's buckets past its schema's retention at now by
+             * rewriting its timeline with compact_timeline, only when its 
+             * first bucket is that old. The timeline is closed first and 
+             * reopened when next used. Gauges are kept whole.
+             */
+            compact_result apply_retention(const stde::string_view& key, time_type now);
+
+            /**
+             * Writes every coalesced put to its timeline.
+             */
+            void flush_coalesced();
+            bool has_coalesced() const { return !_pending.empty();}
+
+            /**
+             * Opens the key's timeline and reads its recent buckets into memory 
+             * in the background.
+             */
+            void warm(const stde::string_view& key);
+
+            /**
+             * Keys of the open timelines, most recently used first.
+             */
+            std::vector<std::string> hot_keys() const;
+
             std::size_t key_index_size(const stde::string_view& key) const;
             std::size_t key_data_size(const stde::string_view& key) const;
 
+            /**
+             * Returns the timeline if it is already open and has no coalesced 
+             * puts, without opening it or changing its place in the cache. 
+             * Returns nullptr otherwise.
+             * Multiple threads may call find concurrently as long as nothing
+             * else uses the db at the same time.
+             */
+            const any_timeline* find(const stde::string_view& key) const;
+
+            /**
+             * Cache counters. Unlike the rest of the interface this is safe 
+             * to call from any thread.
+             */
+            cache_stats stats() const;
+
         private:
 
-            timeline& get_tl(const stde::string_view& key);
-            const timeline& get_tl(const stde::string_view& key) const;
+            any_timeline& get_tl(const stde::string_view& key);
+            const any_timeline& get_tl(const stde::string_view& key) const;
+
+            //writes the key's coalesced put, if any, so reads see it
+            void flush_coalesced(const stde::string_view& key) const;
+            void flush(const pending_put& p) const;
+
+            const storage_schema& schema(const stde::string_view& key) const { return _schemas.find(key, _default_schema);}
+
+            //makes an empty timeline a gauge if the put calls for it
+            void choose_kind(const stde::string_view& key, any_timeline& tl, const put_value& v) const;
 
         private:
-            boost::filesystem::path _root;
-            time_type _new_tl_resolution;
+            data_roots _roots;
+            gap_policy _gaps;
+            item_width _new_tl_width;
+            storage_schemas _schemas;
+            storage_schema _default_schema;
+            boost::regex _gauge_keys;
             mutable timeline_cache _tls;
+            mutable std::unordered_map<std::size_t, std::string> _keys;
+            mutable std::atomic<std::uint64_t> _hits{0};
+            mutable std::atomic<std::uint64_t> _misses{0};
+            std::atomic<std::uint64_t> _evictions{0};
+            mutable coalesce_table _pending;
+            std::atomic<std::uint64_t> _coalesced{0};
     };
 
     /**
      * Sanitizes the key to valid characters used in the db.
      */
     void sanatize_key(std::string& res, const stde::string_view& key);
+
+    /**
+     * Directory a sanitized key's timeline is stored in under root.
+     * The key is split into 8 character directories so no single
+     * directory gets too many entries.
+     */
+    boost::filesystem::path key_dir(const boost::filesystem::path& root, const stde::string_view& key);
+
+    /**
+     * Root a sanitized key's timeline is stored under. Only depends on the
+     * key and the number of roots, so keys stay put when the number of 
+     * workers changes. Uses the same hash as worker placement.
+     */
+    std::size_t root_num(const stde::string_view& key, std::size_t roots);
+
+    /**
+     * Directory a sanitized key's timeline is stored in under its root.
+     */
+    boost::filesystem::path key_dir(const data_roots& roots, const stde::string_view& key);
+
+    /**
+     * The sanitized key stored in dir under root, the inverse of key_dir.
+     */
+    std::string dir_key(const boost::filesystem::path& root, const boost::filesystem::path& dir);
+
+    /**
+     * Parses a comma separated list of data roots.
+     */
+    data_roots parse_data_roots(const std::string& roots);
+
+    //file in every data root locked by the process writing its timelines
+    const char* const LOCK_FILE = ".lock";
+
+    /**
+     * Locks LOCK_FILE in every data root until destroyed, so henhouse and
+     * the tools that write timelines offline never share a data directory.
+     * The lock is advisory and released by the kernel if the process dies.
+     * Throws if another process holds any of them.
+     */
+    class data_lock
+    {
+        public:
+            data_lock(const data_roots& roots);
+            ~data_lock();
+
+            data_lock(const data_lock&) = delete;
+            data_lock& operator=(const data_lock&) = delete;
+
+        private:
+            std::vector<int> _fds;
+    };
 }
 #endif
@@ -0,0 +1,129 @@
+#include "db/late.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+namespace fs = boost::filesystem;
+
+namespace henhouse::db
+{
+    namespace
+    {
+        //spill records are a u16 key size, the key, time and count in native byte order
+        const std::size_t MAX_SPILL_KEY = std::numeric_limits<std::uint16_t>::max();
+
+        void sort_points(data_points& points)
+        {
+            std::stable_sort(points.begin(), points.end(), 
+                    [](const auto& a, const auto& b) { return a.time < b.time;});
+        }
+
+        void read_spill(const fs::path& path, key_points& keys)
+        {
+            std::ifstream in{path.string(), std::ios::binary};
+            if(!in) return;
+
+            std::string key;
+            std::uint16_t size = 0;
+            data_point p;
+            while(in.read(reinterpret_cast<char*>(&size), sizeof(size)))
+            {
+                key.resize(size);
+                in.read(&key[0], size);
+                in.read(reinterpret_cast<char*>(&p.time), sizeof(p.time));
+                in.read(reinterpret_cast<char*>(&p.count), sizeof(p.count));
+
+                //a record cut short by a crash was never acknowledged as staged
+                if(!in) break;
+
+                keys[key].push_back(p);
+            }
+        }
+    }
+
+    late_points::late_points(const fs::path& spill) : _path{spill}
+    {
+        fs::create_directories(_path.parent_path());
+        _spill.open(_path.string(), std::ios::binary | std::ios::trunc);
+        if(!_spill) throw std::runtime_error{"unable to create late spill file " + _path.string()};
+    }
+
+    void late_points::add(const std::string& key, time_type t, count_type c)
+    {
+        REQUIRE_FALSE(key.empty());
+        REQUIRE_LESS_EQUAL(key.size(), MAX_SPILL_KEY);
+
+        const std::uint16_t size = key.size();
+        _spill.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        _spill.write(key.data(), key.size());
+        _spill.write(reinterpret_cast<const char*>(&t), sizeof(t));
+        _spill.write(reinterpret_cast<const char*>(&c), sizeof(c));
+
+        _points[key].push_back(data_point{t, c});
+        _size++;
+    }
+
+    key_points late_points::take()
+    {
+        key_points taken;
+        std::swap(taken, _points);
+        _size = 0;
+
+        for(auto& k : taken) sort_points(k.second);
+        return taken;
+    }
+
+    void late_points::flush()
+    {
+        _spill.flush();
+        if(!_spill) throw std::runtime_error{"unable to write late spill file " + _path.string()};
+    }
+
+    void late_points::clear_spill()
+    {
+        _spill.close();
+        _spill.open(_path.string(), std::ios::binary | std::ios::trunc);
+        if(!_spill) throw std::runtime_error{"unable to truncate late spill file " + _path.string()};
+    }
+
+    merge_result merge_spill_files(
+            const fs::path& dir, 
+            const data_roots& roots, 
+            const storage_schemas& schemas, 
+            const storage_schema& defaults)
+    {
+        REQUIRE_FALSE(roots.empty());
+        REQUIRE_GREATER(defaults.resolution, 0);
+
+        merge_result total;
+        if(!fs::exists(dir)) return total;
+
+        key_points keys;
+        std::vector<fs::path> files;
+        for(fs::directory_iterator it{dir}, end; it != end; it++)
+        {
+            if(!fs::is_regular_file(it->status())) continue;
+            read_spill(it->path(), keys);
+            files.push_back(it->path());
+        }
+
+        for(auto& k : keys)
+        {
+            sort_points(k.second);
+
+            const auto resolution = schemas.find(k.first, defaults).resolution;
+            const auto r = merge_points(key_dir(roots, k.first).string(), resolution, k.second);
+            total.merged += r.merged;
+            total.rejected += r.rejected + r.gauge;
+        }
+
+        for(const auto& k : keys)
+        {
+            sync_timeline_files(key_dir(roots, k.first));
+        }
+
+        for(const auto& f : files) fs::remove(f);
+        return total;
+    }
+}
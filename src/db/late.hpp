@@ -0,0 +1,65 @@
+#ifndef HENHOUSE_LATE_H
+#define HENHOUSE_LATE_H
+
+#include "db/db.hpp"
+#include "db/build.hpp"
+
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+namespace henhouse::db
+{
+    using key_points = std::unordered_map<std::string, data_points>;
+
+    /**
+     * Points too far behind their timeline's last bucket for put, staged
+     * until they are merged in batches. Points are kept in memory and 
+     * appended to a spill file, so flushed points survive a process crash.
+     * The spill file is not synced, a machine crash can lose them.
+     * Note this interface is NOT thread safe.
+     */
+    class late_points
+    {
+        public:
+            late_points(const boost::filesystem::path& spill);
+
+            void add(const std::string& key, time_type t, count_type c);
+
+            //points staged
+            std::size_t size() const { return _size;}
+
+            /**
+             * Hands over the staged points by key, each key's points sorted
+             * by time. The spill file keeps them until clear_spill.
+             */
+            key_points take();
+
+            //writes buffered spill records to the file
+            void flush();
+
+            //empties the spill file once the taken points are durable
+            void clear_spill();
+
+        private:
+            boost::filesystem::path _path;
+            std::ofstream _spill;
+            key_points _points;
+            std::size_t _size = 0;
+    };
+
+    /**
+     * Merges the points of every spill file in dir into their timelines
+     * and removes the files. Timelines that don't exist yet take their 
+     * resolution from the key's schema. Used at start to recover points 
+     * staged before a crash, before anything opens the timelines.
+     */
+    merge_result merge_spill_files(
+            const boost::filesystem::path& dir, 
+            const data_roots& roots, 
+            const storage_schemas& schemas, 
+            const storage_schema& defaults);
+}
+#endif
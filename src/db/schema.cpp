@@ -0,0 +1,105 @@
+#include "db/schema.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace henhouse::db
+{
+    const storage_schema& storage_schemas::find(const stde::string_view& key, const storage_schema& fallback) const
+    {
+        for(const auto& s : _schemas)
+            if(boost::regex_search(key.begin(), key.end(), s.regex)) return s;
+
+        return fallback;
+    }
+
+    time_type retention_start(const storage_schema& s, time_type now)
+    {
+        return s.retention > 0 && s.retention < now ? now - s.retention : 0;
+    }
+
+    storage_schemas parse_schemas(std::istream& in, const storage_schema& defaults)
+    {
+        std::vector<storage_schema> schemas;
+
+        std::string line;
+        std::size_t line_num = 0;
+        while(std::getline(in, line))
+        {
+            line_num++;
+
+            std::istringstream fields{line};
+            storage_schema s = defaults;
+            if(!(fields >> s.pattern) || s.pattern[0] == '#') continue;
+
+            const auto error = [&](const std::string& what)
+            {
+                return std::runtime_error{"schema line " + std::to_string(line_num) + ": " + what};
+            };
+
+            //reads the next field if there is one. istream would wrap a 
+            //negative number into an unsigned field, so signs are refused.
+            std::string field;
+            const auto number = [&](const std::string& name, std::uint64_t& v)
+            {
+                if(!(fields >> field)) return false;
+                if(field.find_first_not_of("0123456789") != std::string::npos) 
+                    throw error("bad " + name + " " + field);
+
+                errno = 0;
+                v = std::strtoull(field.c_str(), nullptr, 10);
+                if(errno == ERANGE) throw error(name + " " + field + " is too large");
+                return true;
+            };
+
+            if(!number("resolution", s.resolution)) throw error("expected a resolution after " + s.pattern);
+            if(s.resolution == 0) throw error("resolution must be greater than 0");
+
+            std::uint64_t size = 0;
+            if(number("size", size))
+            {
+                if(size == 0) throw error("size must be greater than 0");
+                s.files.size = size;
+
+                if(fields >> field)
+                {
+                    char* end = nullptr;
+                    s.files.growth = std::strtof(field.c_str(), &end);
+                    if(end != field.c_str() + field.size() || !std::isfinite(s.files.growth)) 
+                        throw error("bad growth " + field);
+                    if(s.files.growth <= 1) throw error("growth must be greater than 1");
+
+                    number("retention", s.retention);
+                }
+            }
+
+            if(fields >> field) throw error("unexpected " + field);
+
+            try
+            {
+                s.regex = boost::regex{s.pattern};
+            }
+            catch(std::exception& e)
+            {
+                throw error("bad pattern " + s.pattern + ": " + e.what());
+            }
+
+            schemas.emplace_back(std::move(s));
+        }
+
+        return storage_schemas{std::move(schemas)};
+    }
+
+    storage_schemas load_schemas(const std::string& path, const storage_schema& defaults)
+    {
+        if(path.empty()) return {};
+
+        std::ifstream in{path};
+        if(!in) throw std::runtime_error{"unable to open schemas " + path};
+
+        return parse_schemas(in, defaults);
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef HENHOUSE_SCHEMA_H
+#define HENHOUSE_SCHEMA_H
+
+#include "db/timeline.hpp"
+
+#include <istream>
+#include <string>
+#include <vector>
+#include <experimental/string_view>
+
+#include <boost/regex.hpp>
+
+namespace stde = std::experimental;
+
+namespace henhouse::db
+{
+    /**
+     * How the timelines of keys matching a pattern are stored. Resolution 
+     * and the initial file size only apply when a timeline is created, 
+     * growth whenever its files are full. Retention is how many seconds of
+     * buckets are kept, 0 keeps everything. Older buckets are dropped by
+     * henhouse's retention passes and by henhouse_compact.
+     */
+    struct storage_schema
+    {
+        std::string pattern;
+        boost::regex regex;
+        time_type resolution = 0;
+        file_growth files;
+        time_type retention = 0;
+    };
+
+    /**
+     * Time before which buckets are past the schema's retention at now,
+     * or 0 when it keeps everything.
+     */
+    time_type retention_start(const storage_schema& s, time_type now);
+
+    /**
+     * Ordered storage schemas, the first whose pattern is found in a 
+     * sanitized key wins. Keys no schema matches use the fallback, which
+     * has no pattern.
+     */
+    class storage_schemas
+    {
+        public:
+            storage_schemas() = default;
+            storage_schemas(std::vector<storage_schema> schemas) : _schemas{std::move(schemas)} {}
+
+            const storage_schema& find(const stde::string_view& key, const storage_schema& fallback) const;
+
+            bool empty() const { return _schemas.empty();}
+            std::size_t size() const { return _schemas.size();}
+
+        private:
+            std::vector<storage_schema> _schemas;
+    };
+
+    /**
+     * Reads one schema per line of the form 
+     * "<regex> <resolution> [size [growth [retention]]]" with sizes in 
+     * bytes and times in seconds. Missing fields are taken from defaults.
+     * Blank lines and lines starting with # are skipped.
+     */
+    storage_schemas parse_schemas(std::istream& in, const storage_schema& defaults);
+
+    /**
+     * Reads the schemas in path, or returns none if path is empty.
+     */
+    storage_schemas load_schemas(const std::string& path, const storage_schema& defaults);
+}
+#endif
@@ -0,0 +1,184 @@
+#include "db/snapshot.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+namespace henhouse::db
+{
+    namespace
+    {
+        const std::size_t COPY_BUFFER_SIZE = 1 << 20;
+
+        class file
+        {
+            public:
+                file(const fs::path& p, int flags) : _path{p.string()}
+                {
+                    _fd = ::open(_path.c_str(), flags, 0644);
+                    if(_fd < 0) throw std::runtime_error{"unable to open " + _path + ": " + std::strerror(errno)};
+                }
+
+                ~file() { ::close(_fd);}
+
+                int fd() const { return _fd;}
+                const std::string& path() const { return _path;}
+
+                std::uint64_t size() const
+                {
+                    struct stat s;
+                    if(::fstat(_fd, &s) != 0) throw std::runtime_error{"unable to stat " + _path};
+                    return s.st_size;
+                }
+
+            private:
+                std::string _path;
+                int _fd;
+        };
+
+        bool reflink(const file& from, const file& to)
+        {
+#ifdef FICLONE
+            return ::ioctl(to.fd(), FICLONE, from.fd()) == 0;
+#else
+            return false;
+#endif
+        }
+
+        void copy_range(const file& from, const file& to, std::uint64_t offset, std::uint64_t length)
+        {
+            std::vector<char> buffer(std::min<std::uint64_t>(COPY_BUFFER_SIZE, length));
+            while(length > 0)
+            {
+                const auto n = ::pread(from.fd(), buffer.data(), std::min<std::uint64_t>(buffer.size(), length), offset);
+                if(n < 0 && errno == EINTR) continue;
+                if(n <= 0) throw std::runtime_error{"unable to read " + from.path()};
+
+                for(ssize_t w = 0; w < n;)
+                {
+                    const auto r = ::pwrite(to.fd(), buffer.data() + w, n - w, offset + w);
+                    if(r < 0 && errno == EINTR) continue;
+                    if(r <= 0) throw std::runtime_error{"unable to write " + to.path()};
+                    w += r;
+                }
+
+                offset += n;
+                length -= n;
+            }
+        }
+
+        void sync(const file& f)
+        {
+            if(::fsync(f.fd()) != 0) throw std::runtime_error{"unable to sync " + f.path()};
+        }
+
+        copy_stats clone_file(const fs::path& from, const fs::path& to)
+        {
+            file src{from, O_RDONLY};
+            file dst{to, O_WRONLY | O_CREAT | O_TRUNC};
+
+            copy_stats s;
+            s.files = 1;
+
+            if(reflink(src, dst)) s.reflinked = 1;
+            else
+            {
+                const auto size = src.size();
+                copy_range(src, dst, 0, size);
+                s.bytes = size;
+            }
+
+            sync(dst);
+            return s;
+        }
+
+        bool is_timeline_file(const fs::path& p)
+        {
+            const auto name = p.filename().string();
+            return name == INDEX_FILE || name == DATA_FILE || name == DATA32_FILE || name == GAUGE_FILE;
+        }
+    }
+
+    copy_stats fuzzy_copy(const fs::path& root, const fs::path& dest)
+    {
+        copy_stats s;
+        fs::create_directories(dest);
+
+        for(fs::recursive_directory_iterator it{root}, end; it != end; it++)
+        {
+            //hidden directories hold scratch data like import spill files
+            const auto name = it->path().filename().string();
+            if(fs::is_directory(it->status()) && !name.empty() && name[0] == '.')
+            {
+                it.no_push();
+                continue;
+            }
+
+            if(!fs::is_regular_file(it->status()) || !is_timeline_file(it->path())) continue;
+
+            const auto relative = fs::relative(it->path(), root);
+            const auto to = dest / relative;
+            fs::create_directories(to.parent_path());
+            s.add(clone_file(it->path(), to));
+        }
+
+        return s;
+    }
+
+    copy_stats copy_timeline_tail(const fs::path& from, const fs::path& to)
+    {
+        copy_stats s;
+
+        //a timeline widened during the snapshot has changed data files
+        const auto width = stored_width(from);
+        const char* data_name = data_file_name(width);
+        const auto item_size = data_item_size(width);
+
+        const auto from_index = from / INDEX_FILE;
+        const auto from_data = from / data_name;
+        if(!fs::exists(from_index) || !fs::exists(from_data)) return s;
+
+        fs::create_directories(to);
+        s.add(clone_file(from_index, to / INDEX_FILE));
+
+        const auto to_data = to / data_name;
+        if(width == item_width::wide) fs::remove(to / DATA32_FILE);
+        if(!fs::exists(to_data))
+        {
+            s.add(clone_file(from_data, to_data));
+            return s;
+        }
+
+        file src{from_data, O_RDONLY};
+        file dst{to_data, O_RDWR};
+
+        //items before the copied size minus the back limit can't have changed
+        data_metadata copied;
+        if(::pread(dst.fd(), &copied, sizeof(copied), 0) != sizeof(copied)) copied.size = 0;
+
+        const auto first = copied.size > ADD_BUCKET_BACK_LIMIT ? copied.size - ADD_BUCKET_BACK_LIMIT : 0;
+        const std::uint64_t offset = sizeof(data_metadata) + first * item_size;
+
+        const auto size = src.size();
+        if(::ftruncate(dst.fd(), size) != 0) throw std::runtime_error{"unable to resize " + dst.path()};
+
+        copy_range(src, dst, 0, std::min<std::uint64_t>(sizeof(data_metadata), size));
+        if(offset < size) copy_range(src, dst, offset, size - offset);
+        sync(dst);
+
+        s.files++;
+        s.bytes += sizeof(data_metadata) + (offset < size ? size - offset : 0);
+        return s;
+    }
+}
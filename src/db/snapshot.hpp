@@ -0,0 +1,41 @@
+#ifndef HENHOUSE_SNAPSHOT_H
+#define HENHOUSE_SNAPSHOT_H
+
+#include "db/timeline.hpp"
+
+#include <boost/filesystem.hpp>
+
+namespace henhouse::db
+{
+    struct copy_stats
+    {
+        std::size_t files = 0;
+        std::size_t reflinked = 0;
+        std::uint64_t bytes = 0;
+
+        void add(const copy_stats& o)
+        {
+            files += o.files;
+            reflinked += o.reflinked;
+            bytes += o.bytes;
+        }
+    };
+
+    /**
+     * Copies every timeline file under root into the same place under dest
+     * while the timelines may be written to. Files are reflinked when the 
+     * file system supports it and copied otherwise. The copies may be torn
+     * and must be fixed with copy_timeline_tail for every timeline written
+     * to since the copy started.
+     */
+    copy_stats fuzzy_copy(const boost::filesystem::path& root, const boost::filesystem::path& dest);
+
+    /**
+     * Recopies the parts of a timeline that may have changed since it was 
+     * copied by fuzzy_copy: the whole index, the data metadata and the data
+     * items from ADD_BUCKET_BACK_LIMIT before the copied size to the end.
+     * Nothing may write to the timeline while this runs.
+     */
+    copy_stats copy_timeline_tail(const boost::filesystem::path& from, const boost::filesystem::path& to);
+}
+#endif
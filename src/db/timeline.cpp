@@ -4,13 +4,152 @@
 #include <exception>
 #include <fstream>
 #include <functional>
+#include <limits>
+#include <type_traits>
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
 
 namespace henhouse::db
 {
-    const offset_type ADD_BUCKET_BACK_LIMIT = 60;
+    namespace
+    {
+        template <class item>
+        item make_item(count_type value, count_type integral, count_type second_integral)
+        {
+            using field = decltype(item::value);
+            return item
+            {
+                static_cast<field>(value), 
+                static_cast<field>(integral), 
+                static_cast<field>(second_integral)
+            };
+        }
+
+        template <class item>
+        data_item widen(const item& i)
+        {
+            return data_item{i.value, i.integral, i.second_integral};
+        }
+
+        //gauge buckets are returned in the gauge fields
+        data_item widen(const gauge_item&)
+        {
+            return data_item{0, 0, 0};
+        }
+
+        bool fits32(count_type v)
+        {
+            return v >= std::numeric_limits<std::int32_t>::min() && v <= std::numeric_limits<std::int32_t>::max();
+        }
+
+        fs::path new_path(const fs::path& dir, const char* name)
+        {
+            return (dir / name).string() + NEW_SUFFIX;
+        }
+
+        //journals are written whole to a new file and renamed in place, so they exist whole or not at all
+        void write_journal(const fs::path& dir, const char* name, const char* bytes, std::size_t size)
+        {
+            const auto tmp = new_path(dir, name);
+            {
+                std::ofstream out{tmp.string(), std::ios::binary | std::ios::trunc};
+                out.write(bytes, size);
+                out.flush();
+                if(!out) throw std::runtime_error{"unable to write " + tmp.string()};
+            }
+
+            util::sync(tmp);
+            fs::rename(tmp, dir / name);
+            util::sync(dir);
+        }
+
+        std::string read_journal(const fs::path& path)
+        {
+            std::ifstream in{path.string(), std::ios::binary};
+            if(!in) throw std::runtime_error{"unable to read " + path.string()};
+            return std::string{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+        }
+
+        const item_width WIDTHS[] = {item_width::wide, item_width::compact, item_width::gauge};
+
+        //moves the new files in place, data first, and drops data files of other widths
+        void finish_rewrite(const fs::path& dir, const std::string& data_name)
+        {
+            const auto data = new_path(dir, data_name.c_str());
+            if(fs::exists(data)) fs::rename(data, dir / data_name);
+
+            const auto index = new_path(dir, INDEX_FILE);
+            if(fs::exists(index)) fs::rename(index, dir / INDEX_FILE);
+
+            for(const auto w : WIDTHS)
+                if(data_name != data_file_name(w)) fs::remove(dir / data_file_name(w));
+
+            util::sync(dir);
+            fs::remove(dir / REWRITE_FILE);
+        }
+
+        /**
+         * Sets the patched values and recomputes the integrals from the 
+         * first patched bucket to the end. Only checks whether the 
+         * integrals fit the item when dry, without writing anything.
+         * Applying the same patches twice gives the same buckets.
+         */
+        template <class item>
+        bool patch_items(basic_data_type<item>& data, const bucket_patches& patches, bool dry)
+        {
+            REQUIRE_FALSE(patches.empty());
+
+            const auto first = patches.front().pos;
+            REQUIRE_LESS(patches.back().pos, data.size());
+
+            auto prev = first > 0 ? widen(data[first - 1]) : data_item{0, 0, 0};
+            auto p = patches.begin();
+            for(auto i = first; i < data.size(); i++)
+            {
+                count_type v = data[i].value;
+                if(p != patches.end() && p->pos == i) 
+                {
+                    v = p->value;
+                    p++;
+                }
+
+                const data_item current{v, prev.integral + v, prev.second_integral + v * v};
+                if(dry) 
+                {
+                    if(std::is_same<item, data_item32>::value && 
+                            (!fits32(current.value) || !fits32(current.integral) || !fits32(current.second_integral))) 
+                        return false;
+                }
+                else data[i] = make_item<item>(current.value, current.integral, current.second_integral);
+
+                prev = current;
+            }
+
+            if(!dry) data.sync(first);
+            return true;
+        }
+
+        template <class item>
+        bool patch_data(const fs::path& path, const bucket_patches& patches, bool dry)
+        {
+            basic_data_type<item> data{path};
+            return patch_items(data, patches, dry);
+        }
+
+        bool patch_data(const fs::path& dir, const bucket_patches& patches, bool dry)
+        {
+            const auto width = stored_width(dir);
+            const auto path = dir / data_file_name(width);
+            switch(width)
+            {
+                case item_width::wide: return patch_data<data_item>(path, patches, dry);
+                case item_width::compact: return patch_data<data_item32>(path, patches, dry);
+                case item_width::gauge: break;
+            }
+            throw std::runtime_error{"gauge timeline " + dir.string() + " can't be patched"};
+        }
+    }
 
     /**
      * This is the main function to compute the partial sums given previous bucket.
@@ -20,21 +159,49 @@ namespace henhouse::db
      *
      * It computes partial sum(X) and partial sum(X^2) up the current bucket.
      */
-    void propogate(data_item prev, data_item& current)
+    template <class item>
+    void propogate(item prev, item& current)
     {
-        const auto v = current.value;
+        const count_type v = current.value;
         current.integral = prev.integral + v;
         current.second_integral = prev.second_integral + (v  * v);
     }
 
+    void propogate(gauge_item prev, gauge_item& current)
+    {
+        current = next_gauge(prev, current.value);
+    }
+
     //Adds a count c to the current bucket and updates the partial sum
     //values of the current bucket. 
-    void update_current(data_item prev, data_item& current, count_type c)
+    template <class item>
+    void update_current(item prev, item& current, count_type c)
     {
         current.value += c;
         propogate(prev, current);
     }
 
+    //a gauge bucket keeps the last value put in it
+    void update_current(gauge_item prev, gauge_item& current, double v)
+    {
+        current.value = v;
+        propogate(prev, current);
+    }
+
+    //the bucket after prev holding c
+    template <class item>
+    item bucket_after(item prev, count_type c)
+    {
+        auto current = make_item<item>(c, 0, 0);
+        propogate(prev, current);
+        return current;
+    }
+
+    gauge_item bucket_after(gauge_item prev, double v)
+    {
+        return next_gauge(prev, v);
+    }
+
     /**
      *
      * Mean is computing as the (running sum of x) / N.
@@ -83,7 +250,72 @@ namespace henhouse::db
         };
     }
 
-    bool timeline::put(time_type t, count_type c)
+    /**
+     * Same as above for gauge buckets. The sums and their errors are
+     * subtracted separately so the error terms aren't rounded away.
+     */
+    diff_result diff_buckets(
+            const time_type ta,
+            const time_type tb,
+            const time_type resolution,
+            const offset_type index_offset,
+            const gauge_item a,
+            const gauge_item b,
+            const count_type n)
+    {
+        REQUIRE_GREATER(resolution, 0);
+        REQUIRE_GREATER(n, 0);
+
+        const auto sum = (b.integral - a.integral) + (b.integral_error - a.integral_error);
+        const auto second_sum = (b.second_integral - a.second_integral) + (b.second_error - a.second_error);
+        const auto mean = sum / n;
+        const auto second_mean = second_sum / n;
+        const auto variance = second_mean - mean * mean;
+
+        return diff_result 
+        {
+            ta,
+            tb,
+            resolution,
+            index_offset,
+            0,
+            mean,
+            variance,
+            n,
+            {0, 0, 0},
+            {0, 0, 0},
+            true,
+            sum,
+            a,
+            b
+        };
+    }
+
+    //diff of two buckets got from the same timeline
+    diff_result diff_buckets(
+            const time_type ta,
+            const time_type tb,
+            const time_type resolution,
+            const offset_type index_offset,
+            const get_result& a,
+            const get_result& b,
+            const count_type n)
+    {
+        if(a.is_gauge) return diff_buckets(ta, tb, resolution, index_offset, a.gauge, b.gauge, n);
+        return diff_buckets(ta, tb, resolution, index_offset, a.value, b.value, n);
+    }
+
+    void set_bucket(get_result& r, const gauge_item& i)
+    {
+        r.is_gauge = true;
+        r.gauge = i;
+    }
+
+    template <class item>
+    void set_bucket(get_result&, const item&) {}
+
+    template <class item>
+    bool basic_timeline<item>::put(time_type t, value_type c)
     {
         //We already have data, let's add and index new point.
         if(index.size() > 0)
@@ -108,7 +340,7 @@ namespace henhouse::db
                     //to catch up.
                     if(data.size() - pos < ADD_BUCKET_BACK_LIMIT)
                     {
-                        const auto prev = pos > 0 ? data[pos - 1] : data_item{0, 0, 0};
+                        const auto prev = pos > 0 ? data[pos - 1] : item{};
                         update_current(prev, data[pos], c);
                         for(auto p = pos + 1; p < data.size(); p++)
                             propogate(data[p-1], data[p]);
@@ -121,14 +353,19 @@ namespace henhouse::db
                     const auto last_pos = data.size() - 1;
                     const auto prev = data[last_pos];
 
-                    //don't compute integral and second_integral
-                    //because propogate will overwrite
-                    data_item current{c, 0, 0};
-                    propogate(prev, current);
-                    data.push_back(current);
+                    //short gaps are filled with empty buckets instead of indexed,
+                    //they carry the previous integrals forward.
+                    const auto gap = pos - last_pos - 1;
+                    if(gap > 0 && gaps.fills(gap, data.size()))
+                    {
+                        const auto empty = bucket_after(prev, 0);
+                        for(offset_type i = 0; i < gap; i++) data.push_back(empty);
+                    }
+
+                    data.push_back(bucket_after(prev, c));
 
                     //skip if we have no gaps, otherwise index.
-                    auto new_pos = last_pos + 1;
+                    auto new_pos = data.size() - 1;
                     if(pos == new_pos) return true;
 
                     //index position
@@ -149,8 +386,7 @@ namespace henhouse::db
         {
             CHECK_EQUAL(data.size(), 0);
 
-            data_item v{c, c, c * c};
-            data.push_back(v);
+            data.push_back(bucket_after(item{}, c));
 
             index_item i = {t, 0};
             index.push_back(i);
@@ -159,12 +395,87 @@ namespace henhouse::db
         return true;
     }
 
-    summary_result timeline::summary() const  
+    template <class item>
+    bool basic_timeline<item>::fits(time_type t, value_type c) const
     {
+        if constexpr(std::is_same<item, data_item32>::value)
+        {
+            if(index.empty()) return fits32(c) && fits32(c * c);
+
+            //mirrors put, points put rejects always fit
+            const auto last_range = index.cend() - 1;
+            if(t < last_range->time) return true;
+
+            const auto p = index.find_pos_from_range(t, last_range, index.cend());
+            const auto pos = p.pos + p.offset;
+
+            if(pos >= data.size())
+            {
+                const auto prev = data.back();
+                return fits32(c) && fits32(prev.integral + c) && fits32(prev.second_integral + c * c);
+            }
+
+            if(data.size() - pos >= ADD_BUCKET_BACK_LIMIT) return true;
+
+            //both checked before squaring so the square change can't overflow 64 bits
+            const count_type old = data[pos].value;
+            if(!fits32(c) || !fits32(old + c)) return false;
+
+            const auto v = old + c;
+            const auto square_change = v * v - old * old;
+
+            for(auto i = pos; i < data.size(); i++)
+                if(!fits32(data[i].integral + c) || !fits32(data[i].second_integral + square_change)) return false;
+        }
+
+        return true;
+    }
+
+    template <class item>
+    bucket_range basic_timeline<item>::last_bucket() const
+    {
+        REQUIRE_FALSE(index.empty());
+        REQUIRE_FALSE(data.empty());
+
         const auto resolution = index.meta().resolution;
         CHECK_GREATER(resolution, 0);
 
-        if(index.empty()) return summary_result{0,0,resolution, 0,0,0,0};
+        const auto back = index.back();
+        CHECK_GREATER(data.size(), back.pos);
+
+        const auto from = back.time + (data.size() - 1 - back.pos) * resolution;
+        return bucket_range{from, from + resolution};
+    }
+
+    template <class item>
+    void basic_timeline<item>::sync()
+    {
+        //puts since the last sync may have changed buckets up to
+        //ADD_BUCKET_BACK_LIMIT behind the end
+        const auto data_from = synced_data > ADD_BUCKET_BACK_LIMIT ? 
+            synced_data - ADD_BUCKET_BACK_LIMIT : 0;
+
+        data.sync(data_from);
+        index.sync(synced_index);
+
+        synced_data = data.size();
+        synced_index = index.size();
+    }
+
+    template <class item>
+    void basic_timeline<item>::prefetch(offset_type buckets) const
+    {
+        index.prefetch_tail(index.size());
+        data.prefetch_tail(buckets);
+    }
+
+    template <class item>
+    summary_result basic_timeline<item>::summary() const  
+    {
+        const auto resolution = index.meta().resolution;
+        CHECK_GREATER(resolution, 0);
+
+        if(index.empty()) return summary_result{0,0,resolution, 0,0,0,0, std::is_same<item, gauge_item>::value};
         REQUIRE(!data.empty());
 
         const auto front = index.front();
@@ -183,8 +494,11 @@ namespace henhouse::db
         count_type n = (to - from) /  resolution;
 
         //if we have one bucket then first is empty data item
-        auto first_bucket = data_item{0,0,0};
-        auto last_bucket = data.back();
+        get_result first_bucket{};
+        get_result last_bucket{};
+        last_bucket.value = widen(data.back());
+        set_bucket(last_bucket, data.back());
+        first_bucket.is_gauge = last_bucket.is_gauge;
 
         //diff the two buckets
         auto diff = diff_buckets(from, to, resolution, 0, first_bucket, last_bucket, n);
@@ -196,7 +510,9 @@ namespace henhouse::db
             diff.sum,
             diff.mean,
             diff.variance,
-            n
+            n,
+            diff.is_gauge,
+            diff.gauge_sum
         };
     }
 
@@ -211,7 +527,8 @@ namespace henhouse::db
         ENSURE_RANGE(r.pos + r.offset, 0, size);
     }
 
-    get_result timeline::get(time_type t, const offset_type index_offset) const
+    template <class item>
+    get_result basic_timeline<item>::get(time_type t, const offset_type index_offset) const
     {
         auto p = index.find_pos(t, index_offset);
 
@@ -219,26 +536,30 @@ namespace henhouse::db
 
         // zero out data before beginning of collection
         const bool before_beginning =  t < p.time;
-        const auto dat = before_beginning ? data_item{0,0,0} : data[p.pos + p.offset];
+        const auto dat = before_beginning ? item{} : data[p.pos + p.offset];
 
-        return get_result 
+        get_result r
         { 
             p.index_offset,
                 t,
                 p.time, 
                 p.pos,
                 p.offset,
-                dat
+                widen(dat)
         };
+        set_bucket(r, dat);
+        return r;
     }
 
-    diff_result timeline::diff(time_type a, time_type b, const offset_type index_offset) const
+    template <class item>
+    diff_result basic_timeline<item>::diff(time_type a, time_type b, const offset_type index_offset) const
     {
         const auto resolution = index.meta().resolution;
         CHECK_GREATER(resolution, 0);
 
         if(a > b) std::swap(a,b);
-        if(data.size() == 0) return diff_result{ a, b, resolution, 0, 0, 0, 0, 0, {0}, {0}};
+        if(data.size() == 0) 
+            return diff_result{ a, b, resolution, 0, 0, 0, 0, 0, {}, {}, std::is_same<item, gauge_item>::value, 0, {}, {}};
 
         auto ar = get(a, index_offset);
         auto br = get(b, index_offset);
@@ -249,14 +570,178 @@ namespace henhouse::db
         const auto time_diff = b - a;
         auto n = time_diff / resolution;
 
-        if(n == 0) return diff_result{ a, b, resolution, 0, 0, 0, 0, 0, ar.value, br.value};
+        if(n == 0) return diff_result{ a, b, resolution, 0, 0, 0, 0, 0, ar.value, br.value, ar.is_gauge, 0, ar.gauge, br.gauge};
 
         CHECK_GREATER(n , 0);
         CHECK_LESS_EQUAL(ar.index_offset, br.index_offset);
-        return diff_buckets(a, b, resolution, ar.index_offset, ar.value, br.value, n);
+        return diff_buckets(a, b, resolution, ar.index_offset, ar, br, n);
     }
 
-    timeline from_directory(const std::string& path, const time_type resolution) 
+    template <class item>
+    raw_range basic_timeline<item>::raw(time_type a, time_type b) const
+    {
+        const auto resolution = index.meta().resolution;
+        CHECK_GREATER(resolution, 0);
+
+        if(a > b) std::swap(a,b);
+        if(data.empty() || index.empty() || b < index.front().time) 
+            return raw_range{resolution, 0, 0, 0, 0};
+
+        auto pa = index.find_pos(a, 0);
+        auto pb = index.find_pos(b, pa.index_offset);
+        clamp(pa, data.size());
+        clamp(pb, data.size());
+
+        return raw_range
+        {
+            resolution,
+            pa.index_offset,
+            pb.index_offset + 1,
+            pa.pos + pa.offset,
+            pb.pos + pb.offset + 1
+        };
+    }
+
+    template struct basic_timeline<data_item>;
+    template struct basic_timeline<data_item32>;
+    template struct basic_timeline<gauge_item>;
+
+    bool any_timeline::put(time_type t, const put_value& v)
+    {
+        if(auto* g = boost::get<gauge_timeline>(&_tl)) return g->put(t, v.gauge);
+        if(v.fractional) return false;
+
+        if(auto* n = boost::get<timeline32>(&_tl))
+        {
+            if(n->fits(t, v.count)) return n->put(t, v.count);
+            widen();
+        }
+
+        return boost::get<timeline>(_tl).put(t, v.count);
+    }
+
+    void any_timeline::make_gauge()
+    {
+        REQUIRE(index().empty());
+        if(is_gauge()) return;
+
+        //counter files go first, a crash in between leaves an empty 
+        //timeline that decides its kind again on the next put
+        gauge_timeline g;
+        boost::apply_visitor([&g](auto& t) 
+                {
+                    g.index = std::move(t.index);
+                    g.gaps = t.gaps;
+                }, _tl);
+
+        _tl = timeline{};
+        fs::remove(_dir / DATA_FILE);
+        fs::remove(_dir / DATA32_FILE);
+
+        g.data = gauge_data_type{_dir / GAUGE_FILE, _files.size, _files.growth};
+        _tl = std::move(g);
+    }
+
+    item_width any_timeline::width() const
+    {
+        switch(_tl.which())
+        {
+            case 0: return item_width::wide;
+            case 1: return item_width::compact;
+            default: return item_width::gauge;
+        }
+    }
+
+    bucket_range any_timeline::last_bucket() const
+    {
+        return boost::apply_visitor([](const auto& t) { return t.last_bucket();}, _tl);
+    }
+
+    void any_timeline::sync()
+    {
+        boost::apply_visitor([](auto& t) { t.sync();}, _tl);
+    }
+
+    void any_timeline::prefetch(offset_type buckets) const
+    {
+        boost::apply_visitor([buckets](const auto& t) { t.prefetch(buckets);}, _tl);
+    }
+
+    summary_result any_timeline::summary() const
+    {
+        return boost::apply_visitor([](const auto& t) { return t.summary();}, _tl);
+    }
+
+    get_result any_timeline::get(time_type t, const offset_type index_offset) const
+    {
+        return boost::apply_visitor([&](const auto& tl) { return tl.get(t, index_offset);}, _tl);
+    }
+
+    diff_result any_timeline::diff(time_type a, time_type b, const offset_type index_offset) const
+    {
+        return boost::apply_visitor([&](const auto& t) { return t.diff(a, b, index_offset);}, _tl);
+    }
+
+    raw_range any_timeline::raw(time_type a, time_type b) const
+    {
+        return boost::apply_visitor([&](const auto& t) { return t.raw(a, b);}, _tl);
+    }
+
+    fs::path any_timeline::data_file() const
+    {
+        return _dir / data_file_name(width());
+    }
+
+    const index_type& any_timeline::index() const
+    {
+        return boost::apply_visitor([](const auto& t) -> const index_type& { return t.index;}, _tl);
+    }
+
+    offset_type any_timeline::data_size() const
+    {
+        return boost::apply_visitor([](const auto& t) -> offset_type { return t.data.size();}, _tl);
+    }
+
+    std::vector<count_type> any_timeline::values() const
+    {
+        REQUIRE_FALSE(is_gauge());
+        return boost::apply_visitor([](const auto& t) 
+                {
+                    std::vector<count_type> r;
+                    r.reserve(t.data.size());
+                    for(std::size_t i = 0; i < t.data.size(); i++) r.push_back(static_cast<count_type>(t.data[i].value));
+                    return r;
+                }, _tl);
+    }
+
+    void any_timeline::widen()
+    {
+        auto& n = boost::get<timeline32>(_tl);
+
+        //the wide file is complete on disk before it replaces the compact one,
+        //a crash before the compact one is removed leaves both and the wide wins.
+        const auto wide_path = _dir / DATA_FILE;
+        const auto wide_new_path = new_path(_dir, DATA_FILE);
+        fs::remove(wide_new_path);
+        {
+            data_type wide{wide_new_path, sizeof(data_metadata) + n.data.size() * sizeof(data_item)};
+            for(std::size_t i = 0; i < n.data.size(); i++) wide.push_back(henhouse::db::widen(n.data[i]));
+            wide.sync(0);
+        }
+        fs::rename(wide_new_path, wide_path);
+
+        timeline w;
+        w.index = std::move(n.index);
+        w.data = data_type{wide_path, _files.size, _files.growth};
+        w.synced_index = n.synced_index;
+        w.synced_data = w.data.size();
+        w.gaps = n.gaps;
+
+        _tl = std::move(w);
+        fs::remove(_dir / DATA32_FILE);
+    }
+
+    timeline from_directory(const std::string& path, const time_type resolution, const gap_policy& gaps, const file_growth& files) 
     {
         REQUIRE(!path.empty());
         REQUIRE_GREATER(resolution, 0);
@@ -269,12 +754,178 @@ namespace henhouse::db
 
         timeline t;
 
-        fs::path idx_data = root / "_.i";
+        fs::path idx_data = root / INDEX_FILE;
         t.index = std::move(index_type{idx_data, resolution});
 
-        fs::path cdata = root / "_.d";
-        t.data = std::move(data_type{cdata, DATA_SIZE});
+        fs::path cdata = root / DATA_FILE;
+        t.data = std::move(data_type{cdata, files.size, files.growth});
+        t.gaps = gaps;
 
         return t;
     }
+
+    any_timeline open_timeline(
+            const std::string& path, 
+            const time_type resolution, 
+            const gap_policy& gaps,
+            const item_width width,
+            const file_growth& files)
+    {
+        REQUIRE(!path.empty());
+        REQUIRE_GREATER(resolution, 0);
+
+        fs::create_directory(path);
+        if(!fs::is_directory(path))
+            throw std::runtime_error{"path " + path + " is not a directory"}; 
+
+        const fs::path root = path;
+        if(has_unfinished_change(root)) recover_timeline(root);
+
+        const auto wide = root / DATA_FILE;
+        const auto compact = root / DATA32_FILE;
+
+        //both exist when widening was interrupted after the wide file was in place
+        if(fs::exists(wide) && fs::exists(compact)) fs::remove(compact);
+
+        const bool stored = fs::exists(wide) || fs::exists(compact) || fs::exists(root / GAUGE_FILE);
+        const auto w = stored ? stored_width(root) : width;
+
+        if(w == item_width::wide) return any_timeline{root, from_directory(path, resolution, gaps, files), files};
+
+        if(w == item_width::gauge)
+        {
+            gauge_timeline t;
+            t.index = index_type{root / INDEX_FILE, resolution};
+            t.data = gauge_data_type{root / GAUGE_FILE, files.size, files.growth};
+            t.gaps = gaps;
+            return any_timeline{root, std::move(t), files};
+        }
+
+        timeline32 t;
+        t.index = index_type{root / INDEX_FILE, resolution};
+        t.data = data32_type{compact, files.size, files.growth};
+        t.gaps = gaps;
+        return any_timeline{root, std::move(t), files};
+    }
+
+    const char* data_file_name(item_width width)
+    {
+        switch(width)
+        {
+            case item_width::wide: return DATA_FILE;
+            case item_width::compact: return DATA32_FILE;
+            case item_width::gauge: return GAUGE_FILE;
+        }
+        return DATA_FILE;
+    }
+
+    std::size_t data_item_size(item_width width)
+    {
+        switch(width)
+        {
+            case item_width::wide: return sizeof(data_item);
+            case item_width::compact: return sizeof(data_item32);
+            case item_width::gauge: return sizeof(gauge_item);
+        }
+        return sizeof(data_item);
+    }
+
+    item_width stored_width(const fs::path& dir)
+    {
+        if(fs::exists(dir / DATA_FILE)) return item_width::wide;
+        if(fs::exists(dir / GAUGE_FILE)) return item_width::gauge;
+        if(fs::exists(dir / DATA32_FILE)) return item_width::compact;
+        return item_width::wide;
+    }
+
+    bool has_timeline_files(const fs::path& dir)
+    {
+        return fs::exists(dir / INDEX_FILE) || fs::exists(dir / DATA_FILE) || 
+            fs::exists(dir / DATA32_FILE) || fs::exists(dir / GAUGE_FILE);
+    }
+
+    void sync_timeline_files(const fs::path& dir)
+    {
+        util::sync(dir / DATA_FILE);
+        util::sync(dir / DATA32_FILE);
+        util::sync(dir / GAUGE_FILE);
+        util::sync(dir / INDEX_FILE);
+    }
+
+    void commit_rewrite(const fs::path& dir, item_width width)
+    {
+        const std::string data_name = data_file_name(width);
+        const auto data = new_path(dir, data_file_name(width));
+        const auto index = new_path(dir, INDEX_FILE);
+        REQUIRE(fs::exists(data));
+        REQUIRE(fs::exists(index));
+
+        util::sync(data);
+        util::sync(index);
+        write_journal(dir, REWRITE_FILE, data_name.data(), data_name.size());
+
+        finish_rewrite(dir, data_name);
+    }
+
+    bool patch_timeline(const fs::path& dir, const bucket_patches& patches)
+    {
+        if(patches.empty()) return true;
+        REQUIRE(std::is_sorted(patches.begin(), patches.end(), 
+                    [](const auto& a, const auto& b) { return a.pos < b.pos;}));
+
+        if(!patch_data(dir, patches, true)) return false;
+
+        write_journal(dir, PATCH_FILE, 
+                reinterpret_cast<const char*>(patches.data()), patches.size() * sizeof(bucket_patch));
+
+        patch_data(dir, patches, false);
+        fs::remove(dir / PATCH_FILE);
+        return true;
+    }
+
+    bool has_unfinished_change(const fs::path& dir)
+    {
+        return fs::exists(dir / REWRITE_FILE) || fs::exists(dir / PATCH_FILE);
+    }
+
+    bool recover_timeline(const fs::path& dir)
+    {
+        bool recovered = false;
+
+        if(fs::exists(dir / REWRITE_FILE))
+        {
+            const auto data_name = read_journal(dir / REWRITE_FILE);
+            const auto known = std::any_of(std::begin(WIDTHS), std::end(WIDTHS), 
+                    [&](const auto w) { return data_name == data_file_name(w);});
+            if(!known) throw std::runtime_error{"bad rewrite journal in " + dir.string()};
+
+            finish_rewrite(dir, data_name);
+            recovered = true;
+        }
+        else
+        {
+            //a rewrite that never got journaled left the old files as they were
+            for(const auto* name : {INDEX_FILE, DATA_FILE, DATA32_FILE, GAUGE_FILE})
+                recovered |= fs::remove(new_path(dir, name));
+        }
+
+        for(const auto* name : {REWRITE_FILE, PATCH_FILE})
+            recovered |= fs::remove(new_path(dir, name));
+
+        if(fs::exists(dir / PATCH_FILE))
+        {
+            const auto bytes = read_journal(dir / PATCH_FILE);
+            if(bytes.size() % sizeof(bucket_patch) != 0) 
+                throw std::runtime_error{"bad patch journal in " + dir.string()};
+
+            bucket_patches patches(bytes.size() / sizeof(bucket_patch));
+            std::copy(bytes.begin(), bytes.end(), reinterpret_cast<char*>(patches.data()));
+
+            if(!patches.empty()) patch_data(dir, patches, false);
+            fs::remove(dir / PATCH_FILE);
+            recovered = true;
+        }
+
+        return recovered;
+    }
 }
@@ -7,6 +7,9 @@
 #include <string>
 #include <algorithm>
 #include <cmath>
+#include <vector>
+
+#include <boost/variant.hpp>
 
 namespace henhouse::db
 {
@@ -42,9 +45,126 @@ namespace henhouse::db
         count_type second_integral;
     };
 
+    /**
+     * Half the size of a data_item, for timelines whose values and
+     * integrals fit in 32 bits.
+     */
+    struct data_item32
+    {
+        std::int32_t value;
+        std::int32_t integral;
+        std::int32_t second_integral;
+    };
+
+    /**
+     * A bucket of a gauge timeline. Values are doubles and the integrals
+     * are Neumaier compensated sums, the running sum plus the rounding
+     * error it lost, so long prefix sums stay accurate and diffs of them
+     * don't cancel away the small values.
+     */
+    struct gauge_item
+    {
+        double value;
+        double integral;
+        double integral_error;
+        double second_integral;
+        double second_error;
+    };
+
+    /**
+     * Adds v to a compensated sum.
+     */
+    inline void add_compensated(double& sum, double& error, double v)
+    {
+        const auto t = sum + v;
+        if(std::abs(sum) >= std::abs(v)) error += (sum - t) + v;
+        else error += (v - t) + sum;
+        sum = t;
+    }
+
+    /**
+     * The bucket after prev holding value, with its integrals computed.
+     */
+    inline gauge_item next_gauge(const gauge_item& prev, double value)
+    {
+        gauge_item r = prev;
+        r.value = value;
+        add_compensated(r.integral, r.integral_error, value);
+        add_compensated(r.second_integral, r.second_error, value * value);
+        return r;
+    }
+
+    //how the buckets of a timeline are stored, 64 or 32 bit counts or gauge values
+    enum class item_width { wide, compact, gauge };
+
     const std::size_t DATA_SIZE = util::PAGE_SIZE;
     const std::size_t INDEX_SIZE = util::PAGE_SIZE;
 
+    //bytes a new data file starts at and the factor full files grow by
+    struct file_growth
+    {
+        std::size_t size = DATA_SIZE;
+        float growth = util::GROW_FACTOR;
+    };
+
+    //files of a timeline within its directory
+    const char* const INDEX_FILE = "_.i";
+    const char* const DATA_FILE = "_.d";
+    const char* const DATA32_FILE = "_.d32";
+    const char* const GAUGE_FILE = "_.dg";
+
+    //journals of unfinished changes to a timeline's files, see recover_timeline
+    const char* const REWRITE_FILE = "_.rw";
+    const char* const PATCH_FILE = "_.pt";
+    const char* const NEW_SUFFIX = ".new";
+
+    //buckets at the end of a timeline read ahead when it is warmed,
+    //a week at the default resolution.
+    const offset_type WARM_BUCKETS = 10080;
+
+    //how many buckets behind the last one a put may still land in.
+    const offset_type ADD_BUCKET_BACK_LIMIT = 60;
+
+    //a gap may be filled with zero buckets up to this fraction of the
+    //timeline's buckets, bounded by gap_policy::max_fill.
+    const offset_type GAP_FILL_RATIO = 64;
+
+    /**
+     * Decides whether buckets skipped by a put are written as zero buckets
+     * or start a new index item. A zero bucket costs 24 bytes of data, 12
+     * in a compact timeline, an index item 16 bytes plus a deeper binary 
+     * search on every query, so
+     * gaps up to fill buckets are always filled and longer ones as long as 
+     * they stay small next to the timeline. The default never fills.
+     */
+    struct gap_policy
+    {
+        offset_type fill = 0;
+        offset_type max_fill = 0;
+
+        bool fills(offset_type gap, offset_type size) const
+        {
+            return gap <= std::min(max_fill, std::max(fill, size / GAP_FILL_RATIO));
+        }
+    };
+
+    /**
+     * A value put to a timeline. Counter timelines add count, gauge
+     * timelines take gauge, the value as it was sent. Counters refuse 
+     * fractional values rather than truncate them.
+     */
+    struct put_value
+    {
+        count_type count = 0;
+        double gauge = 0;
+        bool fractional = false;
+    };
+
+    inline put_value count_value(count_type c)
+    {
+        return put_value{c, static_cast<double>(c), false};
+    }
+
     struct pos_result
     {
         offset_type index_offset;
@@ -113,7 +233,12 @@ namespace henhouse::db
             }
     };
 
-    using data_type = util::mapped_vector<data_metadata, data_item>;
+    template <class item>
+        using basic_data_type = util::mapped_vector<data_metadata, item>;
+
+    using data_type = basic_data_type<data_item>;
+    using data32_type = basic_data_type<data_item32>;
+    using gauge_data_type = basic_data_type<gauge_item>;
 
     struct summary_result
     {
@@ -124,6 +249,8 @@ namespace henhouse::db
         mean_type mean;
         variance_type variance;
         count_type size;
+        bool is_gauge = false;
+        mean_type gauge_sum = 0;    //sum of a gauge timeline, sum is 0
     };
 
     struct get_result
@@ -134,6 +261,8 @@ namespace henhouse::db
         offset_type pos;
         offset_type offset;
         data_item value;
+        bool is_gauge = false;
+        gauge_item gauge{};         //bucket of a gauge timeline, value is 0
     };
 
     struct diff_result
@@ -148,27 +277,234 @@ namespace henhouse::db
         count_type size;
         data_item left;             //left bucket
         data_item right;            //right bucket. 
+        bool is_gauge = false;      //sum and buckets are in the gauge fields
+        mean_type gauge_sum = 0;
+        gauge_item gauge_left{};
+        gauge_item gauge_right{};
     };
 
+    //values added within the time range of either kind of timeline
+    inline mean_type sum_of(const diff_result& r) { return r.is_gauge ? r.gauge_sum : r.sum;}
+    inline mean_type sum_of(const summary_result& r) { return r.is_gauge ? r.gauge_sum : r.sum;}
+
+    /**
+     * Half open time range of one bucket.
+     */
+    struct bucket_range
+    {
+        time_type from;
+        time_type to;
+    };
+
+    /**
+     * Half open ranges of index and data items covering a time range.
+     */
+    struct raw_range
+    {
+        time_type resolution;
+        offset_type index_begin;
+        offset_type index_end;
+        offset_type data_begin;
+        offset_type data_end;
+    };
+
+    //what a put to a timeline of the item adds
+    template <class item> struct put_type { using type = count_type;};
+    template <> struct put_type<gauge_item> { using type = double;};
+
     /**
      * Manages getting and putting timeline data into and indexed structure 
      * stored on disk. Uses memory mapped index and data mapped_arrays.
+     * Buckets are stored as item, either data_item or data_item32, and
+     * always returned as data_item. Gauge timelines store gauge_item and
+     * return it in the gauge fields of results. A put to a gauge bucket
+     * replaces its value instead of adding to it.
      *
      * This interface is NOT thread safe.
      */
-    struct timeline
+    template <class item>
+    struct basic_timeline
     {
+        using value_type = typename put_type<item>::type;
+
         index_type index;
-        data_type data;
+        basic_data_type<item> data;
+
+        //sizes when the timeline was last synced
+        offset_type synced_index = 0;
+        offset_type synced_data = 0;
+
+        gap_policy gaps;
+
+        bool put(time_type t, value_type c);
+
+        /**
+         * True if put can store c at t without overflowing an item. 
+         * Always true for data_item and gauge_item.
+         */
+        bool fits(time_type t, value_type c) const;
 
-        bool put(time_type t, count_type c);
+        /**
+         * Times covered by the last bucket. Puts there touch only that bucket.
+         * The timeline must not be empty.
+         */
+        bucket_range last_bucket() const;
+
+        /**
+         * Writes what changed since the last sync to disk. Data is written 
+         * before the index because index items point into the data.
+         */
+        void sync();
+
+        /**
+         * Reads the whole index and the last buckets into memory in the 
+         * background so the first queries don't fault them in.
+         */
+        void prefetch(offset_type buckets) const;
 
         summary_result summary() const;  
 
         get_result get(time_type t, const offset_type index_offset) const;
         diff_result diff(time_type a, time_type b, const offset_type index_offset) const;
+        raw_range raw(time_type a, time_type b) const;
+    };
+
+    using timeline = basic_timeline<data_item>;
+    using timeline32 = basic_timeline<data_item32>;
+    using gauge_timeline = basic_timeline<gauge_item>;
+
+    extern template struct basic_timeline<data_item>;
+    extern template struct basic_timeline<data_item32>;
+    extern template struct basic_timeline<gauge_item>;
+
+    /**
+     * A timeline of any width. Compact timelines are widened in place
+     * the first time a put would overflow them, by writing their buckets
+     * to a wide data file and removing the compact one.
+     *
+     * This interface is NOT thread safe.
+     */
+    class any_timeline
+    {
+        public:
+            any_timeline() = default;
+            any_timeline(const boost::filesystem::path& dir, timeline t, const file_growth& files = {}) : 
+                _dir{dir}, _files{files}, _tl{std::move(t)} {}
+            any_timeline(const boost::filesystem::path& dir, timeline32 t, const file_growth& files = {}) : 
+                _dir{dir}, _files{files}, _tl{std::move(t)} {}
+            any_timeline(const boost::filesystem::path& dir, gauge_timeline t, const file_growth& files = {}) : 
+                _dir{dir}, _files{files}, _tl{std::move(t)} {}
+
+            bool put(time_type t, count_type c) { return put(t, count_value(c));}
+            bool put(time_type t, const put_value& v);
+
+            /**
+             * Turns an empty counter timeline into a gauge one, replacing
+             * its data file.
+             */
+            void make_gauge();
+            bucket_range last_bucket() const;
+            void sync();
+            void prefetch(offset_type buckets) const;
+
+            summary_result summary() const;
+            get_result get(time_type t, const offset_type index_offset) const;
+            diff_result diff(time_type a, time_type b, const offset_type index_offset) const;
+            raw_range raw(time_type a, time_type b) const;
+
+            item_width width() const;
+            bool is_gauge() const { return width() == item_width::gauge;}
+            boost::filesystem::path data_file() const;
+
+            const index_type& index() const;
+            offset_type data_size() const;
+
+            //every bucket's value, widened. Not for gauge timelines.
+            std::vector<count_type> values() const;
+
+        private:
+            void widen();
+
+        private:
+            boost::filesystem::path _dir;
+            file_growth _files;
+            boost::variant<timeline, timeline32, gauge_timeline> _tl;
     };
 
-    timeline from_directory(const std::string& path, const time_type resolution);
+    //name of the data file of timelines stored at the width
+    const char* data_file_name(item_width width);
+    std::size_t data_item_size(item_width width);
+
+    /**
+     * Width of the timeline stored in dir, from the data file it has.
+     * A wide file wins over the others, it is only left next to a compact
+     * one by an interrupted widen. Without any data file it is wide.
+     */
+    item_width stored_width(const boost::filesystem::path& dir);
+
+    //true if dir has an index or any data file
+    bool has_timeline_files(const boost::filesystem::path& dir);
+
+    timeline from_directory(
+            const std::string& path, 
+            const time_type resolution, 
+            const gap_policy& gaps = {}, 
+            const file_growth& files = {});
+
+    /**
+     * Opens the timeline in path at whatever width it was written with. 
+     * New timelines are created with the given width, which may be gauge,
+     * and resolution. Data files are created and grown as files says.
+     */
+    any_timeline open_timeline(
+            const std::string& path, 
+            const time_type resolution, 
+            const gap_policy& gaps = {},
+            const item_width width = item_width::wide,
+            const file_growth& files = {});
+
+    /**
+     * Syncs the files of a timeline that isn't open, data before index.
+     */
+    void sync_timeline_files(const boost::filesystem::path& dir);
+
+    /**
+     * Replaces the files of the timeline in dir with the index and data
+     * file of the width written next to them with NEW_SUFFIX. Once both
+     * are durable REWRITE_FILE is written, naming the data file, and from
+     * then on the rewrite is finished even after a crash. The timeline 
+     * must not be open.
+     */
+    void commit_rewrite(const boost::filesystem::path& dir, item_width width);
+
+    //new value of a stored bucket, by position in the data file
+    struct bucket_patch
+    {
+        offset_type pos;
+        count_type value;
+    };
+
+    using bucket_patches = std::vector<bucket_patch>;
+
+    /**
+     * Sets the values of stored buckets of the counter timeline in dir
+     * and recomputes the integrals from the first of them on, leaving the
+     * index and the buckets before alone. The patches are journaled in 
+     * PATCH_FILE first, so a crash part way is finished by recovery. 
+     * Returns false without changing anything when the integrals would 
+     * no longer fit a compact timeline. The timeline must not be open.
+     */
+    bool patch_timeline(const boost::filesystem::path& dir, const bucket_patches& patches);
+
+    //true if a rewrite or patch of the timeline in dir was interrupted
+    bool has_unfinished_change(const boost::filesystem::path& dir);
+
+    /**
+     * Finishes a rewrite or patch of the timeline in dir interrupted 
+     * after it was journaled, or removes the new files of one interrupted
+     * before, which leaves the old files as they were. Returns true if 
+     * there was anything to do. open_timeline calls it first.
+     */
+    bool recover_timeline(const boost::filesystem::path& dir);
 }
 #endif
@@ -0,0 +1,307 @@
+#include "db/transform.hpp"
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace henhouse::db
+{
+    namespace
+    {
+        const mean_type MISSING = std::numeric_limits<mean_type>::quiet_NaN();
+
+        //windows not covered at all have no rate
+        void rate(std::vector<mean_type>& v, const std::vector<time_type>& covered)
+        {
+            REQUIRE_EQUAL(v.size(), covered.size());
+
+            const auto n = v.size();
+            const auto* c = covered.data();
+            auto* d = v.data();
+            for(std::size_t i = 0; i < n; i++) d[i] = c[i] > 0 ? d[i] / c[i] : MISSING;
+        }
+
+        //seconds of the window from a to b before now
+        time_type covered_by(time_type a, time_type b, time_type now)
+        {
+            b = std::min(b, now);
+            return b > a ? b - a : 0;
+        }
+
+        void derivative(std::vector<mean_type>& v, bool nonnegative)
+        {
+            if(v.empty()) return;
+
+            std::vector<mean_type> r(v.size());
+            const auto n = v.size();
+            const auto* d = v.data();
+            auto* o = r.data();
+
+            o[0] = MISSING;
+            for(std::size_t i = 1; i < n; i++) o[i] = d[i] - d[i-1];
+
+            if(nonnegative)
+                for(std::size_t i = 1; i < n; i++) o[i] = o[i] < 0 ? MISSING : o[i];
+
+            v.swap(r);
+        }
+
+        void ewma(std::vector<mean_type>& v, double alpha)
+        {
+            bool started = false;
+            mean_type e = 0;
+            for(auto& x : v)
+            {
+                if(std::isnan(x)) continue;
+
+                e = started ? alpha * x + (1 - alpha) * e : x;
+                started = true;
+                x = e;
+            }
+        }
+
+        //partial windows at the start average the values there are
+        void moving_average(std::vector<mean_type>& v, std::size_t n)
+        {
+            REQUIRE_GREATER(n, 0);
+
+            const auto in = v;
+            mean_type sum = 0;
+            std::size_t count = 0;
+            for(std::size_t i = 0; i < in.size(); i++)
+            {
+                if(!std::isnan(in[i])) { sum += in[i]; count++;}
+                if(i >= n && !std::isnan(in[i - n])) { sum -= in[i - n]; count--;}
+
+                v[i] = count > 0 ? sum / count : MISSING;
+            }
+        }
+
+        void cumsum(std::vector<mean_type>& v)
+        {
+            mean_type sum = 0;
+            for(auto& x : v)
+            {
+                if(std::isnan(x)) continue;
+                sum += x;
+                x = sum;
+            }
+        }
+
+        //ratios against nothing are missing rather than infinite
+        void ratio(const std::vector<mean_type>& values, std::vector<mean_type>& shifted)
+        {
+            CHECK_EQUAL(values.size(), shifted.size());
+
+            const auto n = values.size();
+            const auto* v = values.data();
+            auto* d = shifted.data();
+            for(std::size_t i = 0; i < n; i++) d[i] = d[i] != 0 ? v[i] / d[i] : MISSING;
+        }
+
+        void apply(const transform& f, std::vector<mean_type>& v, const std::vector<time_type>& covered)
+        {
+            switch(f.kind)
+            {
+                case transform_kind::rate: rate(v, covered); break;
+                case transform_kind::derivative: derivative(v, false); break;
+                case transform_kind::nonnegative_derivative: derivative(v, true); break;
+                case transform_kind::ewma: ewma(v, f.param); break;
+                case transform_kind::moving_average: moving_average(v, static_cast<std::size_t>(f.param)); break;
+                case transform_kind::cumsum: cumsum(v); break;
+            }
+        }
+
+        template <class number>
+            number parse_param(const std::string& name, const std::string& p)
+            try
+            {
+                return boost::lexical_cast<number>(p);
+            }
+            catch(boost::bad_lexical_cast&)
+            {
+                throw std::runtime_error{"bad parameter for " + name + ": " + p};
+            }
+    }
+
+    mean_type extract(const diff_result& r, value_field f)
+    {
+        switch(f)
+        {
+            case value_field::sum: return sum_of(r);
+            case value_field::mean: return r.mean;
+            case value_field::variance: return r.variance;
+            case value_field::agg: 
+                return r.is_gauge ? r.gauge_right.integral + r.gauge_right.integral_error : r.right.integral;
+        }
+        return sum_of(r);
+    }
+
+    count_type extract_count(const diff_result& r, value_field f)
+    {
+        REQUIRE(is_count(r, f));
+        return f == value_field::sum ? r.sum : r.right.integral;
+    }
+
+    transforms parse_transforms(const std::string& chain)
+    {
+        std::vector<std::string> names;
+        boost::split(names, chain, boost::is_any_of(","));
+
+        transforms r;
+        for(const auto& n : names)
+        {
+            if(n.empty()) continue;
+
+            const auto colon = n.find(':');
+            const auto name = n.substr(0, colon);
+            const auto param = colon == std::string::npos ? std::string{} : n.substr(colon + 1);
+
+            if(name == "rate") r.push_back(transform{transform_kind::rate});
+            else if(name == "derivative") r.push_back(transform{transform_kind::derivative});
+            else if(name == "nonnegative_derivative") r.push_back(transform{transform_kind::nonnegative_derivative});
+            else if(name == "cumsum") r.push_back(transform{transform_kind::cumsum});
+            else if(name == "ewma")
+            {
+                const auto alpha = parse_param<double>(name, param);
+                if(!(alpha > 0 && alpha <= 1)) throw std::runtime_error{"ewma alpha must be in (0, 1]"};
+                r.push_back(transform{transform_kind::ewma, alpha});
+            }
+            else if(name == "ma")
+            {
+                //lexical_cast wraps negative numbers into unsigned ones
+                const auto size = parse_param<std::int64_t>(name, param);
+                if(size <= 0) throw std::runtime_error{"ma needs at least 1 value"};
+                r.push_back(transform{transform_kind::moving_average, static_cast<double>(size)});
+            }
+            else throw std::runtime_error{"unknown transform " + name};
+        }
+
+        return r;
+    }
+
+    period_offsets parse_offsets(const std::string& list)
+    {
+        std::vector<std::string> names;
+        boost::split(names, list, boost::is_any_of(","));
+
+        period_offsets r;
+        for(const auto& n : names)
+        {
+            if(n.empty()) continue;
+
+            time_type unit = 1;
+            auto number = n;
+            switch(n.back())
+            {
+                case 's': unit = 1; break;
+                case 'm': unit = 60; break;
+                case 'h': unit = 60 * 60; break;
+                case 'd': unit = 24 * 60 * 60; break;
+                case 'w': unit = 7 * 24 * 60 * 60; break;
+                default: unit = 0; break;
+            }
+            if(unit != 0) number.pop_back();
+            else unit = 1;
+
+            //lexical_cast wraps negative numbers around instead of failing
+            if(number.empty() || !std::isdigit(static_cast<unsigned char>(number.front()))) 
+                throw std::runtime_error{"bad offset: " + n};
+
+            const auto seconds = parse_param<time_type>("offset", number) * unit;
+            if(seconds == 0) throw std::runtime_error{"offset must be above 0: " + n};
+
+            r.push_back(period_offset{n, seconds});
+        }
+
+        return r;
+    }
+
+    series query_series(const any_timeline& t, const series_query& q)
+    {
+        REQUIRE_GREATER(q.step, 0);
+        REQUIRE_GREATER(q.size, 0);
+
+        auto a = std::max(q.size, q.a);
+        const auto b = std::max(q.step, q.b);
+
+        series s;
+        s.width = q.size;
+        s.times.reserve(b >= a ? (b - a) / q.step + 1 : 1);
+        s.values.reserve(s.times.capacity());
+        s.covered.reserve(s.times.capacity());
+        s.shifted.resize(q.offsets.size());
+        s.shifted_covered.resize(q.offsets.size());
+        for(auto& v : s.shifted) v.reserve(s.times.capacity());
+        for(auto& v : s.shifted_covered) v.reserve(s.times.capacity());
+
+        //exact integers are kept for counters as long as nothing transforms them
+        const bool counts = q.fns.empty() && t.width() != item_width::gauge && 
+            (q.field == value_field::sum || q.field == value_field::agg);
+        if(counts) s.shifted_counts.resize(q.offsets.size());
+
+        //windows only move forward, so each search starts at the last one's index item
+        offset_type index_offset = 0;
+        std::vector<offset_type> shifted_offsets(q.offsets.size(), 0);
+        const auto add = [&](time_type from, time_type to)
+        {
+            const auto r = t.diff(from, to, index_offset);
+            index_offset = r.index_offset;
+            s.times.push_back(r.a);
+            s.values.push_back(extract(r, q.field));
+            s.covered.push_back(covered_by(from, to, q.now));
+            if(counts) s.counts.push_back(extract_count(r, q.field));
+
+            for(std::size_t i = 0; i < q.offsets.size(); i++)
+            {
+                const auto o = q.offsets[i];
+                if(from < o) 
+                {
+                    s.shifted[i].push_back(MISSING);
+                    s.shifted_covered[i].push_back(0);
+                    if(counts) s.shifted_counts[i].push_back(0);
+                    continue;
+                }
+
+                const auto sr = t.diff(from - o, to - o, shifted_offsets[i]);
+                shifted_offsets[i] = sr.index_offset;
+                s.shifted[i].push_back(extract(sr, q.field));
+                s.shifted_covered[i].push_back(covered_by(from - o, to - o, q.now));
+                if(counts) s.shifted_counts[i].push_back(extract_count(sr, q.field));
+            }
+        };
+
+        auto from = a - q.size;
+        for(; a + q.step <= b; from += q.step, a += q.step) add(from, a);
+        add(from, b);
+
+        apply(q.fns, s);
+        if(q.ratio) 
+        {
+            for(auto& v : s.shifted) ratio(s.values, v);
+            s.shifted_counts.clear();
+        }
+
+        return s;
+    }
+
+    void apply(const transform& f, series& s)
+    {
+        REQUIRE_EQUAL(s.shifted.size(), s.shifted_covered.size());
+
+        apply(f, s.values, s.covered);
+        for(std::size_t i = 0; i < s.shifted.size(); i++) apply(f, s.shifted[i], s.shifted_covered[i]);
+
+        s.counts.clear();
+        s.shifted_counts.clear();
+    }
+
+    void apply(const transforms& fns, series& s)
+    {
+        for(const auto& f : fns) apply(f, s);
+    }
+}
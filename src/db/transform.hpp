@@ -0,0 +1,133 @@
+#ifndef HENHOUSE_TRANSFORM_H
+#define HENHOUSE_TRANSFORM_H
+
+#include "db/timeline.hpp"
+
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace henhouse::db
+{
+    //which value of a diff a series holds
+    enum class value_field { sum, mean, variance, agg };
+
+    mean_type extract(const diff_result& r, value_field f);
+
+    //sums and aggregates of counter timelines are exact integers
+    inline bool is_count(const diff_result& r, value_field f) 
+    { 
+        return !r.is_gauge && (f == value_field::sum || f == value_field::agg);
+    }
+
+    //the exact value of a field is_count is true for
+    count_type extract_count(const diff_result& r, value_field f);
+
+    enum class transform_kind 
+    { 
+        rate,                   //per second over the part of its window up to now
+        derivative,             //change from the previous value
+        nonnegative_derivative, //derivative with drops, like counter resets, missing
+        ewma,                   //exponentially weighted moving average, param is alpha
+        moving_average,         //mean of the last param values
+        cumsum                  //running sum
+    };
+
+    struct transform
+    {
+        transform_kind kind;
+        double param = 0;
+    };
+
+    using transforms = std::vector<transform>;
+
+    /**
+     * Parses a comma separated chain of rate, derivative, 
+     * nonnegative_derivative, ewma:<alpha>, ma:<n> and cumsum, applied
+     * left to right. Throws on an unknown name or bad parameter.
+     */
+    transforms parse_transforms(const std::string& chain);
+
+    //how far back a period over period comparison looks, named as requested
+    struct period_offset
+    {
+        std::string name;
+        time_type seconds;
+    };
+
+    using period_offsets = std::vector<period_offset>;
+
+    /**
+     * Parses a comma separated list of offsets, each a number of seconds
+     * or of minutes, hours, days or weeks suffixed m, h, d or w, like 1d,7d.
+     * Throws on a bad or zero offset.
+     */
+    period_offsets parse_offsets(const std::string& list);
+
+    /**
+     * Evenly stepped values of a timeline. The value at times[i] covers
+     * the window of width seconds ending at the next step. Values that
+     * don't exist, like the first derivative, are NaN.
+     *
+     * covered[i] is how many seconds of that window had passed when the
+     * query ran, which is less than width for windows reaching past now
+     * and more for the last window, which ends at the query's end.
+     *
+     * shifted holds one series per compared offset, aligned with times,
+     * of the same windows that many seconds earlier. As ratios they are 
+     * values[i] divided by the shifted value.
+     *
+     * counts and shifted_counts hold the exact integers of untransformed
+     * counter sums and aggregates, which doubles round above 2^53. They 
+     * are empty when the values aren't counts.
+     */
+    struct series
+    {
+        time_type width = 0;
+        std::vector<time_type> times;
+        std::vector<mean_type> values;
+        std::vector<time_type> covered;
+        std::vector<std::vector<mean_type>> shifted;
+        std::vector<std::vector<time_type>> shifted_covered;
+        std::vector<count_type> counts;
+        std::vector<std::vector<count_type>> shifted_counts;
+    };
+
+    /**
+     * The windows of a /values query, size seconds wide, every step 
+     * seconds from a to b, the last one ending at b. Nothing past now
+     * is covered yet.
+     */
+    struct series_query
+    {
+        time_type a;
+        time_type b;
+        time_type step;
+        time_type size;
+        value_field field;
+        transforms fns;
+        std::vector<time_type> offsets;
+        bool ratio = false;
+        time_type now = std::numeric_limits<time_type>::max();
+    };
+
+    /**
+     * Diffs every window of the query in one pass over the timeline,
+     * each search starting where the last one ended, then applies the
+     * transforms to the whole series. Shifted windows are diffed in the
+     * same pass, each offset keeping its own place in the index, and 
+     * transformed the same way.
+     */
+    series query_series(const any_timeline& t, const series_query& q);
+
+    /**
+     * Applies a transform in place. Rate and derivatives are branch free 
+     * loops over the contiguous values the compiler vectorizes, the 
+     * averages and cumsum are scans. NaN values are skipped by the scans.
+     * Shifted series are transformed along with the values. Transformed
+     * values are no longer counts.
+     */
+    void apply(const transform& f, series& s);
+    void apply(const transforms& fns, series& s);
+}
+#endif
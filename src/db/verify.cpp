@@ -0,0 +1,394 @@
+#include "db/verify.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace fs = boost::filesystem;
+
+namespace henhouse::db
+{
+    namespace
+    {
+        //items checked together before looking for the first bad one
+        const std::size_t CHECK_BLOCK = 4096;
+
+        /**
+         * A timeline file mapped writable only when repairing.
+         */
+        template <class meta_t, class item_t>
+            class mapped_items
+            {
+                public:
+                    mapped_items(const fs::path& p, verify_mode mode) : _path{p.string()}
+                    {
+                        bio::mapped_file_params params;
+                        params.path = _path;
+                        params.flags = mode == verify_mode::repair ? 
+                            bio::mapped_file::readwrite : 
+                            bio::mapped_file::readonly;
+
+                        _file.open(params);
+                        if(!_file.is_open()) throw std::runtime_error{"unable to mmap " + _path};
+                        if(_file.size() < sizeof(meta_t)) throw std::runtime_error{_path + " is smaller than its metadata"};
+
+                        _writable = mode == verify_mode::repair;
+                        _base = const_cast<char*>(_file.const_data());
+                        ::madvise(_base, _file.size(), MADV_SEQUENTIAL);
+
+                        _capacity = (_file.size() - sizeof(meta_t)) / sizeof(item_t);
+                    }
+
+                    const meta_t& meta() const { return *reinterpret_cast<const meta_t*>(_base);}
+                    const item_t* items() const { return reinterpret_cast<const item_t*>(_base + sizeof(meta_t));}
+                    std::size_t capacity() const { return _capacity;}
+                    std::size_t bytes() const { return _file.size();}
+                    const std::string& path() const { return _path;}
+
+                    meta_t& writable_meta() 
+                    { 
+                        REQUIRE(_writable);
+                        _changed = true;
+                        return *reinterpret_cast<meta_t*>(_base);
+                    }
+
+                    item_t* writable_items() 
+                    { 
+                        REQUIRE(_writable);
+                        _changed = true;
+                        return reinterpret_cast<item_t*>(_base + sizeof(meta_t));
+                    }
+
+                    void sync()
+                    {
+                        if(!_changed) return;
+                        if(::msync(_base, _file.size(), MS_SYNC) != 0) 
+                            throw std::runtime_error{"unable to msync " + _path};
+                    }
+
+                private:
+                    bio::mapped_file _file;
+                    std::string _path;
+                    char* _base = nullptr;
+                    std::size_t _capacity = 0;
+                    bool _writable = false;
+                    bool _changed = false;
+            };
+
+        using index_file = mapped_items<index_metadata, index_item>;
+
+        template <class item>
+            using data_file = mapped_items<data_metadata, item>;
+
+        template <class item>
+            item following(const item& prev, const item& cur)
+            {
+                const count_type v = cur.value;
+                auto r = cur;
+                r.integral = prev.integral + v;
+                r.second_integral = prev.second_integral + v * v;
+                return r;
+            }
+
+        //gauge sums are recomputed the way put computed them, so they match exactly
+        gauge_item following(const gauge_item& prev, const gauge_item& cur)
+        {
+            return next_gauge(prev, cur.value);
+        }
+
+        template <class item>
+            bool integral_follows(const item& prev, const item& cur)
+            {
+                const count_type v = cur.value;
+                return cur.integral - prev.integral == v && 
+                    cur.second_integral - prev.second_integral == v * v;
+            }
+
+        bool integral_follows(const gauge_item& prev, const gauge_item& cur)
+        {
+            const auto e = following(prev, cur);
+            return e.integral == cur.integral && e.integral_error == cur.integral_error &&
+                e.second_integral == cur.second_integral && e.second_error == cur.second_error;
+        }
+
+        /**
+         * Position of the first bucket whose integrals don't follow from
+         * the previous one, or size if all do. Blocks are checked without 
+         * branching so the compiler can vectorize the common, clean case.
+         */
+        template <class item>
+            std::size_t first_bad_integral(const item* d, const std::size_t size)
+            {
+                if(size == 0) return 0;
+                if(!integral_follows(item{}, d[0])) return 0;
+
+                for(std::size_t b = 1; b < size; b += CHECK_BLOCK)
+                {
+                    const auto end = std::min(size, b + CHECK_BLOCK);
+
+                    std::size_t bad = 0;
+                    for(auto i = b; i < end; i++)
+                        bad += !integral_follows(d[i-1], d[i]);
+
+                    if(bad == 0) continue;
+
+                    for(auto i = b; i < end; i++)
+                        if(!integral_follows(d[i-1], d[i])) return i;
+                }
+
+                return size;
+            }
+
+        template <class item>
+            bool unwritten(const item& d)
+            {
+                return d.value == 0 && d.integral == 0 && d.second_integral == 0;
+            }
+
+        /**
+         * Size without trailing buckets that were never written. A size 
+         * made durable before its items leaves zeroed buckets at the end.
+         * Zeroed buckets are only valid while every bucket before them is 
+         * zero too, since any other bucket has non zero integrals.
+         */
+        template <class item>
+            std::size_t written_size(const item* d, const std::size_t size)
+            {
+                auto last = size;
+                while(last > 0 && unwritten(d[last - 1])) last--;
+
+                return last == 0 ? size : last;
+            }
+
+        /**
+         * Number of leading index items that are valid for data of the given size.
+         */
+        std::size_t valid_index_items(const index_file& index, const std::size_t size, const std::size_t data_size)
+        {
+            const auto resolution = index.meta().resolution;
+            const auto* items = index.items();
+
+            if(size == 0 || data_size == 0 || items[0].pos != 0) return 0;
+
+            for(std::size_t i = 1; i < size; i++)
+            {
+                const auto& prev = items[i-1];
+                const auto& cur = items[i];
+
+                if(cur.pos <= prev.pos || cur.pos >= data_size || cur.time <= prev.time) return i;
+
+                //a range can't end after the next one starts
+                if(cur.time - prev.time < (cur.pos - prev.pos) * resolution) return i;
+            }
+
+            return size;
+        }
+
+        void report(const fs::path& dir, const std::string& problem, verify_mode mode)
+        {
+            std::cerr << dir.string() << ": " << problem 
+                << (mode == verify_mode::repair ? ", repaired" : "") << std::endl;
+        }
+
+        /**
+         * Checks and repairs the data of a timeline against its index.
+         */
+        template <class item>
+            void verify_items(
+                    const fs::path& dir, 
+                    index_file& index, 
+                    const fs::path& data_path, 
+                    const verify_mode mode, 
+                    verify_stats& s)
+            {
+                data_file<item> data{data_path, mode};
+                s.bytes = index.bytes() + data.bytes();
+
+                auto index_size = std::min(index.meta().size, index.capacity());
+                auto data_size = written_size(data.items(), std::min(data.meta().size, data.capacity()));
+
+                if(index_size > 0 && index.meta().resolution == 0)
+                    throw std::runtime_error{"index has no resolution"};
+
+                //drop index items past the first invalid one and the data they cover
+                const auto valid = valid_index_items(index, index_size, data_size);
+                if(valid < index_size) data_size = valid == 0 ? 0 : std::min(data_size, index.items()[valid].pos);
+                index_size = valid;
+                if(index_size == 0) data_size = 0;
+
+                if(index_size != index.meta().size || data_size != data.meta().size)
+                {
+                    s.torn = 1;
+                    report(dir, "torn tail, index " + std::to_string(index.meta().size) + " to " + std::to_string(index_size) + 
+                            " items, data " + std::to_string(data.meta().size) + " to " + std::to_string(data_size) + " items", mode);
+
+                    if(mode == verify_mode::repair)
+                    {
+                        //shrink data first so the index never points past it
+                        data.writable_meta().size = data_size;
+                        data.sync();
+                        index.writable_meta().size = index_size;
+                        index.sync();
+                    }
+                }
+
+                const auto bad = first_bad_integral(data.items(), data_size);
+                if(bad < data_size)
+                {
+                    s.integrals = 1;
+                    report(dir, "integrals wrong from bucket " + std::to_string(bad), mode);
+
+                    if(mode == verify_mode::repair)
+                    {
+                        auto* items = data.writable_items();
+                        auto prev = bad > 0 ? items[bad - 1] : item{};
+                        for(auto i = bad; i < data_size; i++)
+                        {
+                            items[i] = following(prev, items[i]);
+                            prev = items[i];
+                        }
+                        data.sync();
+                    }
+                }
+            }
+
+        /**
+         * Shared stack of directories left to walk. Walking ends when the 
+         * stack is empty and no thread is walking a directory that could
+         * add more.
+         */
+        class dir_queue
+        {
+            public:
+                void push(fs::path p)
+                {
+                    {
+                        std::lock_guard<std::mutex> l{_lock};
+                        _dirs.emplace_back(std::move(p));
+                    }
+                    _wake.notify_one();
+                }
+
+                bool pop(fs::path& p)
+                {
+                    std::unique_lock<std::mutex> l{_lock};
+                    _wake.wait(l, [this] { return !_dirs.empty() || _busy == 0;});
+                    if(_dirs.empty()) return false;
+
+                    p = std::move(_dirs.back());
+                    _dirs.pop_back();
+                    _busy++;
+                    return true;
+                }
+
+                void done()
+                {
+                    std::lock_guard<std::mutex> l{_lock};
+                    CHECK_GREATER(_busy, 0);
+                    _busy--;
+                    if(_busy == 0 && _dirs.empty()) _wake.notify_all();
+                }
+
+            private:
+                std::mutex _lock;
+                std::condition_variable _wake;
+                std::vector<fs::path> _dirs;
+                std::size_t _busy = 0;
+        };
+
+        void walk(dir_queue& dirs, const verify_mode mode, verify_stats& s)
+        {
+            fs::path dir;
+            while(dirs.pop(dir))
+            {
+                try
+                {
+                    if(has_timeline_files(dir))
+                        s.add(verify_timeline(dir, mode));
+
+                    for(fs::directory_iterator it{dir}, end; it != end; it++)
+                    {
+                        //hidden directories hold scratch data like import spill files
+                        const auto name = it->path().filename().string();
+                        if(fs::is_directory(it->status()) && !name.empty() && name[0] != '.') 
+                            dirs.push(it->path());
+                    }
+                }
+                catch(std::exception& e)
+                {
+                    std::cerr << "unable to walk " << dir.string() << ": " << e.what() << std::endl;
+                }
+                dirs.done();
+            }
+        }
+    }
+
+    verify_stats verify_timeline(const fs::path& dir, const verify_mode mode)
+    {
+        verify_stats s;
+        s.timelines = 1;
+
+        try
+        {
+            if(has_unfinished_change(dir))
+            {
+                s.unfinished = 1;
+                report(dir, "rewrite or patch interrupted", mode);
+                if(mode == verify_mode::repair) recover_timeline(dir);
+            }
+
+            const auto index_path = dir / INDEX_FILE;
+            const auto width = stored_width(dir);
+            const auto data_path = dir / data_file_name(width);
+            if(!fs::exists(index_path) || !fs::exists(data_path))
+                throw std::runtime_error{"missing index or data file"};
+
+            index_file index{index_path, mode};
+            switch(width)
+            {
+                case item_width::wide: verify_items<data_item>(dir, index, data_path, mode, s); break;
+                case item_width::compact: verify_items<data_item32>(dir, index, data_path, mode, s); break;
+                case item_width::gauge: verify_items<gauge_item>(dir, index, data_path, mode, s); break;
+            }
+        }
+        catch(std::exception& e)
+        {
+            s.failed = 1;
+            std::cerr << dir.string() << ": " << e.what() << std::endl;
+        }
+
+        return s;
+    }
+
+    verify_stats verify_tree(const fs::path& root, const verify_mode mode, const std::size_t threads)
+    {
+        return verify_tree(std::vector<fs::path>{root}, mode, threads);
+    }
+
+    verify_stats verify_tree(const std::vector<fs::path>& roots, const verify_mode mode, const std::size_t threads)
+    {
+        REQUIRE_GREATER(threads, 0);
+
+        verify_stats total;
+
+        dir_queue dirs;
+        for(const auto& root : roots)
+            if(fs::exists(root)) dirs.push(root);
+
+        std::vector<verify_stats> stats(threads);
+        std::vector<std::thread> walkers;
+        walkers.reserve(threads);
+        for(std::size_t t = 0; t < threads; t++)
+            walkers.emplace_back([&dirs, &stats, mode, t] { walk(dirs, mode, stats[t]);});
+
+        for(auto& w : walkers) w.join();
+        for(const auto& s : stats) total.add(s);
+
+        return total;
+    }
+}
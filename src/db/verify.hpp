@@ -0,0 +1,63 @@
+#ifndef HENHOUSE_VERIFY_H
+#define HENHOUSE_VERIFY_H
+
+#include "db/timeline.hpp"
+
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace henhouse::db
+{
+    enum class verify_mode { check, repair };
+
+    /**
+     * Problems found by verification. In check mode they are only 
+     * counted, in repair mode they are also fixed except for failed ones.
+     */
+    struct verify_stats
+    {
+        std::size_t timelines = 0;
+        std::uint64_t bytes = 0;
+        std::size_t torn = 0;       //timelines whose sizes or index ran past valid items
+        std::size_t integrals = 0;  //timelines whose integrals did not match their values
+        std::size_t unfinished = 0; //timelines with a journaled rewrite or patch a crash interrupted
+        std::size_t failed = 0;     //timelines that could not be read or fixed
+
+        void add(const verify_stats& o)
+        {
+            timelines += o.timelines;
+            bytes += o.bytes;
+            torn += o.torn;
+            integrals += o.integrals;
+            unfinished += o.unfinished;
+            failed += o.failed;
+        }
+
+        bool clean() const { return torn == 0 && integrals == 0 && unfinished == 0 && failed == 0;}
+    };
+
+    /**
+     * Verifies the timeline in dir. Sizes must fit their files, index items
+     * must start at the first bucket and strictly increase in time and 
+     * position without overlapping, and every bucket's integrals must equal
+     * the previous bucket's plus its value. Repair first finishes rewrites
+     * and patches a crash interrupted, then cuts torn tails off at the 
+     * first invalid item and recomputes integrals from the values.
+     * Nothing may use the timeline while this runs.
+     */
+    verify_stats verify_timeline(const boost::filesystem::path& dir, verify_mode mode);
+
+    /**
+     * Verifies every timeline under root using threads that share one
+     * queue of directories to walk. Hidden directories are skipped.
+     */
+    verify_stats verify_tree(const boost::filesystem::path& root, verify_mode mode, std::size_t threads);
+
+    /**
+     * Verifies every timeline under all the roots together, so roots on
+     * different disks are read in parallel.
+     */
+    verify_stats verify_tree(const std::vector<boost::filesystem::path>& roots, verify_mode mode, std::size_t threads);
+}
+#endif
@@ -1,5 +1,9 @@
 #include "service/put.hpp"
+#include "service/bulk.hpp"
 #include "service/query.hpp"
+#include "service/placement.hpp"
+#include "service/udp.hpp"
+#include "db/verify.hpp"
 
 #include <iostream>
 #include <chrono>
@@ -29,21 +33,96 @@ po::options_description create_descriptions()
         ("http_port", po::value<std::uint16_t>()->default_value(9090), "Http port")
         ("http2_port", po::value<std::uint16_t>()->default_value(9091), "Http 2.0 port")
         ("put_port", po::value<std::uint16_t>()->default_value(2003), "Data input port")
-        ("data,d", po::value<std::string>()->default_value("/tmp"), "Data directory")
+        ("udp_port", po::value<std::uint16_t>()->default_value(0), "UDP data input port. 0 disables UDP input.")
+        ("bulk_port", po::value<std::uint16_t>()->default_value(0), "Binary bulk data input port. 0 disables bulk input.")
+        ("bulk_max_keys", po::value<std::uint32_t>()->default_value(henhouse::net::MAX_BULK_KEYS), 
+         "Key ids one bulk input connection may use. Connections registering a larger id are closed.")
+        ("udp_workers", po::value<std::size_t>()->default_value(workers), "UDP data input threads")
+        ("data,d", po::value<std::string>()->default_value("/tmp"), 
+         "Data directory, or a comma separated list of them, one per disk, to spread timelines across. "
+         "Changing the list needs henhouse_rebalance.")
+        ("snapshot_dir", po::value<std::string>()->default_value(""), 
+         "Directory POST /snapshot writes snapshots to, outside the data directory. Empty disables snapshots.")
         ("query_workers", po::value<std::size_t>()->default_value(workers), "Query threads")
+        ("put_workers", po::value<std::size_t>()->default_value(workers), "Data input threads")
         ("db_workers", po::value<std::size_t>()->default_value(workers), "DB workers")
+        ("query_cpus", po::value<std::string>()->default_value(""), 
+         "CPU list to pin query threads to, for example 0-3,8. Empty means no pinning.")
+        ("put_cpus", po::value<std::string>()->default_value(""), 
+         "CPU list to pin data input threads to. Empty means no pinning.")
+        ("db_cpus", po::value<std::string>()->default_value(""), 
+         "CPU list to pin DB workers to, one worker per cpu round robin. Empty means no pinning.")
         ("queue_size", po::value<std::size_t>()->default_value(10000), "Input queue size")
+        ("steal_threshold", po::value<std::size_t>()->default_value(henhouse::threaded::STEAL_THRESHOLD), 
+         "Requests waiting on a DB worker before its reads are offered to idle workers. "
+         "0 never offers them.")
+        ("ingest_policy", po::value<std::string>()->default_value("block"), 
+         "What inputs do when a DB worker queue is full. "
+         "block waits, shed drops points, pause stops reading from the connection.")
+        ("durability", po::value<std::string>()->default_value("none"), 
+         "When written data is synced to disk. none leaves it to the kernel, "
+         "periodic syncs every sync_interval, on_batch also syncs after every batch of points.")
+        ("sync_interval", po::value<std::size_t>()->default_value(1000), 
+         "Milliseconds between syncs, bounding how much data a crash can lose.")
+        ("warm_interval", po::value<std::size_t>()->default_value(0), 
+         "Seconds between saves of the keys hot in the caches, which are opened and read ahead "
+         "on the next start. 0 disables warm starts.")
+        ("late_merge_interval", po::value<std::size_t>()->default_value(0), 
+         "Seconds between merges of points too old to put into their timelines. "
+         "0 rejects them instead.")
+        ("late_max_points", po::value<std::size_t>()->default_value(1000000), 
+         "Late points a DB worker stages before merging them early.")
+        ("retention_interval", po::value<std::size_t>()->default_value(0), 
+         "Seconds between passes dropping buckets older than the retention of their key's "
+         "storage schema. 0 leaves that to henhouse_compact.")
+        ("coalesce_interval", po::value<std::size_t>()->default_value(0), 
+         "Milliseconds puts to the current bucket of a timeline may add up in memory "
+         "before they are written. 0 writes every put through.")
+        ("gap_fill", po::value<std::size_t>()->default_value(0), 
+         "Gaps of up to this many buckets are filled with empty buckets instead of indexed.")
+        ("gap_max_fill", po::value<std::size_t>()->default_value(0), 
+         "Longest gap filled in a large timeline, which fills gaps up to 1/64th of its size. "
+         "0 never fills gaps.")
+        ("bucket_width", po::value<std::string>()->default_value("64"), 
+         "Bits per value and integral of new timelines, 64 or 32. 32 bit timelines "
+         "are widened to 64 bits the first time a value or integral overflows. "
+         "Older versions can't read 32 bit timelines.")
+        ("gauge_keys", po::value<std::string>()->default_value(""), 
+         "Regex of sanitized keys whose new timelines are gauges, storing double values. "
+         "Other timelines are counters and reject fractional values.")
+        ("verify", po::value<std::string>()->default_value("off"), 
+         "Verify every timeline before starting. off skips it, check reports problems, "
+         "repair also truncates torn tails and recomputes bad integrals.")
+        ("verify_only", "Exit after verifying, with a non zero status if problems remain.")
         ("cache_size", po::value<std::size_t>()->default_value(40), 
           "Size of timeline db reference cache per worker. "
           "make this too big an you can run out of file descriptors.")
         ("resolution", po::value<henhouse::db::time_type>()->default_value(60), 
          "Minimum resolution in seconds of a timeline.")
+        ("schemas", po::value<std::string>()->default_value(""), 
+         "File of storage schemas, one '<regex> <resolution> [size [growth [retention]]]' per line. "
+         "New timelines take their resolution and file sizes from the first whose regex "
+         "is found in their sanitized key, or --resolution without one.")
         ("max_response_values", po::value<std::size_t>()->default_value(10000), 
          "Maximum points returned in a values response.");
 
     return d;
 }
 
+henhouse::db::item_width parse_bucket_width(const std::string& w)
+{
+    if(w == "32") return henhouse::db::item_width::compact;
+    if(w == "64") return henhouse::db::item_width::wide;
+    throw std::runtime_error{"unknown bucket width " + w + ", expected 32 or 64"};
+}
+
+henhouse::db::verify_mode parse_verify_mode(const std::string& m)
+{
+    if(m == "check") return henhouse::db::verify_mode::check;
+    if(m == "repair") return henhouse::db::verify_mode::repair;
+    throw std::runtime_error{"unknown verify mode " + m + ", expected off, check or repair"};
+}
+
 po::variables_map parse_options(int argc, char* argv[], po::options_description& desc)
 {
     po::variables_map v;
@@ -69,30 +148,163 @@ try
     const auto http_port = opt["http_port"].as<std::uint16_t>();
     const auto http2_port = opt["http2_port"].as<std::uint16_t>();
     const auto put_port = opt["put_port"].as<std::uint16_t>();
+    const auto udp_port = opt["udp_port"].as<std::uint16_t>();
+    const auto udp_workers = opt["udp_workers"].as<std::size_t>();
+    const auto bulk_port = opt["bulk_port"].as<std::uint16_t>();
+    const auto bulk_max_keys = opt["bulk_max_keys"].as<std::uint32_t>();
+    if(bulk_max_keys == 0) throw std::runtime_error{"bulk_max_keys must be greater than 0"};
+    const auto ingest_policy = henhouse::net::parse_ingest_policy(opt["ingest_policy"].as<std::string>());
     const auto query_workers = opt["query_workers"].as<std::size_t>();
+    const auto put_workers = opt["put_workers"].as<std::size_t>();
     const auto db_workers = opt["db_workers"].as<std::size_t>();
-    const auto data_dir = opt["data"].as<std::string>();
+    const auto query_cpus = henhouse::util::parse_cpu_list(opt["query_cpus"].as<std::string>());
+    const auto put_cpus = henhouse::util::parse_cpu_list(opt["put_cpus"].as<std::string>());
+    const auto db_cpus = henhouse::util::parse_cpu_list(opt["db_cpus"].as<std::string>());
+    const auto data_dirs = henhouse::db::parse_data_roots(opt["data"].as<std::string>());
+    const auto snapshot_dir = opt["snapshot_dir"].as<std::string>();
     const auto queue_size = opt["queue_size"].as<std::size_t>();
+    const auto steal_threshold = opt["steal_threshold"].as<std::size_t>();
     const auto cache_size = opt["cache_size"].as<std::size_t>();
     const auto new_timeline_resolution = opt["resolution"].as<henhouse::db::time_type>();
     const auto max_values = opt["max_response_values"].as<std::size_t>();
+    const henhouse::threaded::sync_options sync
+    {
+        henhouse::threaded::parse_durability(opt["durability"].as<std::string>()),
+        std::chrono::milliseconds{opt["sync_interval"].as<std::size_t>()}
+    };
+
+    const henhouse::threaded::warm_options warm{std::chrono::seconds{opt["warm_interval"].as<std::size_t>()}};
+    const henhouse::threaded::late_options late
+    {
+        std::chrono::seconds{opt["late_merge_interval"].as<std::size_t>()},
+        opt["late_max_points"].as<std::size_t>()
+    };
+
+    if(sync.mode != henhouse::threaded::durability::none && sync.interval.count() == 0)
+        throw std::runtime_error{"sync_interval must be greater than 0"};
+    const henhouse::threaded::retention_options retention{std::chrono::seconds{opt["retention_interval"].as<std::size_t>()}};
+    const henhouse::threaded::coalesce_options coalesce
+    {
+        std::chrono::milliseconds{opt["coalesce_interval"].as<std::size_t>()}
+    };
+
+    const henhouse::db::gap_policy gaps
+    {
+        opt["gap_fill"].as<std::size_t>(),
+        opt["gap_max_fill"].as<std::size_t>()
+    };
+
+    const auto bucket_width = parse_bucket_width(opt["bucket_width"].as<std::string>());
+
+    henhouse::db::storage_schema default_schema;
+    default_schema.resolution = new_timeline_resolution;
+    const auto schemas = henhouse::db::load_schemas(opt["schemas"].as<std::string>(), default_schema);
+
+    if(late.max_points == 0) throw std::runtime_error{"late_max_points must be greater than 0"};
 
-    bf::create_directories(data_dir);
-    henhouse::threaded::server db{db_workers, data_dir, queue_size, cache_size, new_timeline_resolution};
+    for(const auto& d : data_dirs) bf::create_directories(d);
+
+    //henhouse_import refuses data directories held here
+    const henhouse::db::data_lock lock{data_dirs};
+
+    const auto verify = opt["verify"].as<std::string>();
+    if(verify != "off" || opt.count("verify_only"))
+    {
+        const auto mode = parse_verify_mode(verify == "off" ? "check" : verify);
+        const auto start = std::chrono::steady_clock::now();
+        const auto s = henhouse::db::verify_tree(data_dirs, mode, 
+                std::max(1u, std::thread::hardware_concurrency()));
+        const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cerr << "Verified DB" << std::endl;
+        std::cerr << "\tmode: " << (mode == henhouse::db::verify_mode::repair ? "repair" : "check") << std::endl;
+        std::cerr << "\ttimelines: " << s.timelines << std::endl;
+        std::cerr << "\tbytes: " << s.bytes << std::endl;
+        std::cerr << "\ttorn: " << s.torn << std::endl;
+        std::cerr << "\tbad integrals: " << s.integrals << std::endl;
+        std::cerr << "\tunfinished: " << s.unfinished << std::endl;
+        std::cerr << "\tfailed: " << s.failed << std::endl;
+        std::cerr << "\tseconds: " << seconds << std::endl;
+
+        if(opt.count("verify_only"))
+        {
+            const bool clean = mode == henhouse::db::verify_mode::repair ? s.failed == 0 : s.clean();
+            return clean ? 0 : 1;
+        }
+    }
+
+    if(!snapshot_dir.empty())
+    {
+        bf::create_directories(snapshot_dir);
+
+        //a snapshot inside the data directory would be copied into the next one
+        const auto snapshots = bf::canonical(snapshot_dir).string() + "/";
+        for(const auto& d : data_dirs)
+        {
+            const auto data = bf::canonical(d).string() + "/";
+            if(snapshots.compare(0, data.size(), data) == 0)
+                throw std::runtime_error{"snapshot_dir must be outside the data directories"};
+        }
+    }
+
+    henhouse::threaded::server db{db_workers, data_dirs, queue_size, cache_size, new_timeline_resolution, db_cpus, sync, warm, late, coalesce, gaps, bucket_width, opt["gauge_keys"].as<std::string>(), schemas, steal_threshold, retention};
 
     std::cerr << "Started DB" << std::endl;
     std::cerr << "\tworkers: " << db_workers << std::endl;
+    std::cerr << "\tdata: " << opt["data"].as<std::string>() << std::endl;
+    std::cerr << "\tcpus: " << opt["db_cpus"].as<std::string>() << std::endl;
     std::cerr << "\tqueue size: " << queue_size << std::endl;
+    std::cerr << "\tsteal threshold: " << steal_threshold << std::endl;
     std::cerr << "\tcache size: " << cache_size << std::endl;
     std::cerr << "\ttimeline resolution: " << new_timeline_resolution << std::endl;
+    std::cerr << "\tdurability: " << opt["durability"].as<std::string>() << std::endl;
+    std::cerr << "\tsync interval: " << sync.interval.count() << "ms" << std::endl;
+    std::cerr << "\twarm interval: " << warm.interval.count() << "s" << std::endl;
+    std::cerr << "\tlate merge interval: " << late.interval.count() << "s" << std::endl;
+    std::cerr << "\tretention interval: " << retention.interval.count() << "s" << std::endl;
+    std::cerr << "\tcoalesce interval: " << coalesce.interval.count() << "ms" << std::endl;
+    std::cerr << "\tgap fill: " << gaps.fill << " to " << gaps.max_fill << " buckets" << std::endl;
+    std::cerr << "\tbucket width: " << opt["bucket_width"].as<std::string>() << std::endl;
+    std::cerr << "\tgauge keys: " << opt["gauge_keys"].as<std::string>() << std::endl;
+    std::cerr << "\tstorage schemas: " << schemas.size() << std::endl;
 
     //setup put endpoing that mimics graphite
     wangle::ServerBootstrap<henhouse::net::put_pipeline> put_server;
-    put_server.childPipeline(std::make_shared<henhouse::net::put_pipeline_factory>(db));
+    put_server.childPipeline(std::make_shared<henhouse::net::put_pipeline_factory>(db, ingest_policy));
+    put_server.group(
+            std::make_shared<folly::IOThreadPoolExecutor>(1),
+            henhouse::net::make_io_pool(put_workers, "put", put_cpus));
     put_server.bind(put_port); //graphite receive port
 
     std::cerr << "Started Input Server" << std::endl;
     std::cerr << "\tport: " << put_port << std::endl;
+    std::cerr << "\tingest policy: " << opt["ingest_policy"].as<std::string>() << std::endl;
+    std::cerr << "\tworkers: " << put_workers << std::endl;
+    std::cerr << "\tcpus: " << opt["put_cpus"].as<std::string>() << std::endl;
+
+    //setup binary bulk input sharing the input threads
+    wangle::ServerBootstrap<henhouse::net::bulk_pipeline> bulk_server;
+    if(bulk_port != 0)
+    {
+        bulk_server.childPipeline(std::make_shared<henhouse::net::bulk_pipeline_factory>(db, ingest_policy, bulk_max_keys));
+        bulk_server.group(put_server.getIOGroup());
+        bulk_server.bind(bulk_port);
+
+        std::cerr << "Started Bulk Input Server" << std::endl;
+        std::cerr << "\tport: " << bulk_port << std::endl;
+        std::cerr << "\tmax keys: " << bulk_max_keys << std::endl;
+    }
+
+    //setup udp input sharing the input cpus
+    std::unique_ptr<henhouse::net::udp_server> udp_server;
+    if(udp_port != 0)
+    {
+        udp_server = std::make_unique<henhouse::net::udp_server>(db, ip, udp_port, udp_workers, ingest_policy, put_cpus);
+
+        std::cerr << "Started UDP Input Server" << std::endl;
+        std::cerr << "\tport: " << udp_port << std::endl;
+        std::cerr << "\tworkers: " << udp_workers << std::endl;
+    }
 
     //setup http query interface
     std::vector<proxygen::HTTPServer::IPConfig> IPs = {
@@ -106,7 +318,7 @@ try
     options.shutdownOn = {SIGINT, SIGTERM};
     options.enableContentCompression = true;
     options.handlerFactories = proxygen::RequestHandlerChain()
-        .addThen<henhouse::net::query_handler_factory>(db, max_values)
+        .addThen<henhouse::net::query_handler_factory>(db, max_values, ingest_policy, snapshot_dir, query_cpus)
         .build();
 
     proxygen::HTTPServer query_server{std::move(options)};
@@ -116,8 +328,10 @@ try
     std::cerr << "\thttp port: " << http_port << std::endl;
     std::cerr << "\thttp2 port: " << http2_port << std::endl;
     std::cerr << "\tworkers: " << query_workers << std::endl;
+    std::cerr << "\tcpus: " << opt["query_cpus"].as<std::string>() << std::endl;
     std::cerr << "\tcompression: " << true << std::endl;
     std::cerr << "\tmax values: " << max_values << std::endl;
+    std::cerr << "\tsnapshot dir: " << snapshot_dir << std::endl;
 
     //start services
     std::thread put_thread
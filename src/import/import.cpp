@@ -0,0 +1,398 @@
+#include "db/build.hpp"
+#include "db/db.hpp"
+#include "db/schema.hpp"
+#include "service/graphite.hpp"
+#include "util/dbc.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+namespace hdb = henhouse::db;
+namespace hn = henhouse::net;
+
+namespace
+{
+    enum class input_format { graphite, csv };
+
+    //keys longer than this are rejected so a spill record length fits in 16 bits
+    const std::size_t MAX_KEY_SIZE = 4096;
+    const std::size_t SPILL_BUFFER_SIZE = 1 << 16;
+
+    struct config
+    {
+        hdb::data_roots roots;
+        fs::path spill;
+        hdb::storage_schema defaults;
+        hdb::storage_schemas schemas;
+        input_format format;
+        std::size_t partitions;
+        std::size_t threads;
+        std::vector<std::string> inputs;
+    };
+
+    struct counters
+    {
+        std::atomic<std::uint64_t> lines{0};
+        std::atomic<std::uint64_t> malformed{0};
+        std::atomic<std::uint64_t> merged{0};
+        std::atomic<std::uint64_t> rejected{0};
+        std::atomic<std::uint64_t> fractional{0};
+        std::atomic<std::uint64_t> gauge{0};
+        std::atomic<std::uint64_t> keys{0};
+    };
+
+    input_format parse_format(const std::string& f)
+    {
+        if(f == "graphite") return input_format::graphite;
+        if(f == "csv") return input_format::csv;
+        throw std::runtime_error{"unknown format " + f + ", expected graphite or csv"};
+    }
+
+    fs::path spill_file(const config& c, std::size_t partition)
+    {
+        return c.spill / ("p" + std::to_string(partition));
+    }
+
+    /**
+     * One spill file per partition shared by every reader. Spill files hold 
+     * records of u16 key size, key, time, count in native byte order and 
+     * only live for one import.
+     */
+    class spill_files
+    {
+        public:
+            spill_files(const config& c) : _files(c.partitions), _locks(c.partitions)
+            {
+                for(std::size_t p = 0; p < c.partitions; p++)
+                {
+                    const auto path = spill_file(c, p).string();
+                    _files[p].open(path, std::ios::binary | std::ios::trunc);
+                    if(!_files[p]) throw std::runtime_error{"unable to create spill file " + path};
+                }
+            }
+
+            std::size_t size() const { return _files.size();}
+
+            void write(std::size_t p, const std::string& records)
+            {
+                REQUIRE_RANGE(p, 0, _files.size());
+
+                std::lock_guard<std::mutex> l{_locks[p]};
+                _files[p].write(records.data(), records.size());
+                if(!_files[p]) throw std::runtime_error{"unable to write spill file"};
+            }
+
+            void close()
+            {
+                for(auto& f : _files) f.close();
+            }
+
+        private:
+            std::vector<std::ofstream> _files;
+            std::vector<std::mutex> _locks;
+    };
+
+    /**
+     * Buffers one reader's records per partition so spill files are
+     * written, and locked, in large chunks.
+     */
+    class spill_writer
+    {
+        public:
+            spill_writer(spill_files& files) : _files{files}, _buffers(files.size()) {}
+
+            void add(const std::string& key, hdb::time_type t, hdb::count_type c)
+            {
+                REQUIRE_LESS_EQUAL(key.size(), MAX_KEY_SIZE);
+
+                const auto p = std::hash<std::string>{}(key) % _buffers.size();
+                auto& b = _buffers[p];
+
+                const std::uint16_t size = key.size();
+                append(b, size);
+                b.append(key);
+                append(b, t);
+                append(b, c);
+
+                if(b.size() >= SPILL_BUFFER_SIZE) flush(p);
+            }
+
+            void flush()
+            {
+                for(std::size_t p = 0; p < _buffers.size(); p++) flush(p);
+            }
+
+        private:
+            template <class value>
+                void append(std::string& b, const value& v)
+                {
+                    b.append(reinterpret_cast<const char*>(&v), sizeof(v));
+                }
+
+            void flush(std::size_t p)
+            {
+                auto& b = _buffers[p];
+                if(b.empty()) return;
+
+                _files.write(p, b);
+                b.clear();
+            }
+
+        private:
+            spill_files& _files;
+            std::vector<std::string> _buffers;
+    };
+
+    void read_input(const config& c, const std::string& input, spill_writer& out, counters& stats)
+    {
+        std::ifstream file;
+        if(input != "-")
+        {
+            file.open(input);
+            if(!file) throw std::runtime_error{"unable to open " + input};
+        }
+        std::istream& in = input == "-" ? std::cin : file;
+
+        std::string line;
+        std::string key;
+        while(std::getline(in, line))
+        {
+            stats.lines++;
+            if(!line.empty() && line.back() == '\r') line.pop_back();
+            if(line.empty()) continue;
+
+            //csv is key,count,timestamp which parses the same with commas as spaces
+            if(c.format == input_format::csv) std::replace(line.begin(), line.end(), ',', ' ');
+
+            hn::point p;
+            if(!hn::parse_point(line, p) || p.key.size() > MAX_KEY_SIZE)
+            {
+                stats.malformed++;
+                continue;
+            }
+
+            //timelines are written as counters, which refuse fractions
+            if(p.value.fractional)
+            {
+                stats.fractional++;
+                continue;
+            }
+
+            hdb::sanatize_key(key, p.key);
+            out.add(key, p.time, p.value.count);
+        }
+    }
+
+    /**
+     * Partitions every input by key into spill files. Each reader thread
+     * takes every n-th input.
+     */
+    void partition(const config& c, counters& stats)
+    {
+        const auto readers = std::max<std::size_t>(1, std::min(c.threads, c.inputs.size()));
+        spill_files files{c};
+
+        std::vector<std::thread> threads;
+        for(std::size_t r = 0; r < readers; r++)
+            threads.emplace_back([&c, &stats, &files, r, readers]
+            {
+                try
+                {
+                    spill_writer out{files};
+                    for(std::size_t i = r; i < c.inputs.size(); i += readers)
+                    {
+                        std::cerr << "reading " << c.inputs[i] << std::endl;
+                        read_input(c, c.inputs[i], out, stats);
+                    }
+                    out.flush();
+                }
+                catch(std::exception& e)
+                {
+                    std::cerr << "error reading input: " << e.what() << std::endl;
+                    std::exit(1);
+                }
+            });
+
+        for(auto& t : threads) t.join();
+        files.close();
+    }
+
+    void read_spill(const fs::path& path, std::unordered_map<std::string, hdb::data_points>& keys)
+    {
+        std::ifstream in{path.string(), std::ios::binary};
+        if(!in) return;
+
+        std::string key;
+        std::uint16_t size = 0;
+        hdb::data_point p;
+        while(in.read(reinterpret_cast<char*>(&size), sizeof(size)))
+        {
+            key.resize(size);
+            in.read(&key[0], size);
+            in.read(reinterpret_cast<char*>(&p.time), sizeof(p.time));
+            in.read(reinterpret_cast<char*>(&p.count), sizeof(p.count));
+            if(!in) throw std::runtime_error{"truncated spill file " + path.string()};
+
+            keys[key].push_back(p);
+        }
+    }
+
+    /**
+     * Loads one partition, which holds every point of its keys, sorts each
+     * key's points by time and merges them into the key's timeline.
+     */
+    void build_partition(const config& c, std::size_t partition, counters& stats)
+    {
+        std::unordered_map<std::string, hdb::data_points> keys;
+        read_spill(spill_file(c, partition), keys);
+
+        for(auto& k : keys)
+        {
+            auto& points = k.second;
+            std::stable_sort(points.begin(), points.end(),
+                    [](const auto& a, const auto& b) { return a.time < b.time;});
+
+            const auto resolution = c.schemas.find(k.first, c.defaults).resolution;
+            const auto r = hdb::merge_points(hdb::key_dir(c.roots, k.first).string(), resolution, points);
+            stats.merged += r.merged;
+            stats.rejected += r.rejected;
+            stats.gauge += r.gauge;
+            stats.keys++;
+        }
+
+        fs::remove(spill_file(c, partition));
+    }
+
+    void build(const config& c, counters& stats)
+    {
+        std::atomic<std::size_t> next{0};
+        std::vector<std::thread> threads;
+        for(std::size_t t = 0; t < c.threads; t++)
+            threads.emplace_back([&]
+            {
+                try
+                {
+                    for(auto p = next++; p < c.partitions; p = next++)
+                        build_partition(c, p, stats);
+                }
+                catch(std::exception& e)
+                {
+                    std::cerr << "error building timelines: " << e.what() << std::endl;
+                    std::exit(1);
+                }
+            });
+
+        for(auto& t : threads) t.join();
+    }
+}
+
+po::options_description create_descriptions()
+{
+    po::options_description d{"Options"};
+    const auto workers = std::thread::hardware_concurrency();
+
+    d.add_options()
+        ("help,h", "prints help")
+        ("data,d", po::value<std::string>()->default_value("/tmp"), 
+         "Data directory, or the same comma separated list of them henhouse uses")
+        ("resolution", po::value<hdb::time_type>()->default_value(60),
+         "Resolution in seconds of new timelines. Existing timelines keep theirs.")
+        ("schemas", po::value<std::string>()->default_value(""), 
+         "Storage schemas file, the same as henhouse's option, giving new timelines of matching keys their resolution")
+        ("format", po::value<std::string>()->default_value("graphite"),
+         "Input format, graphite for '<key> <count> <timestamp>' lines or csv for 'key,count,timestamp'")
+        ("partitions", po::value<std::size_t>()->default_value(256),
+         "Key partitions. One partition must fit in memory while it is built.")
+        ("threads", po::value<std::size_t>()->default_value(workers), "Threads reading inputs and building timelines")
+        ("spill", po::value<std::string>()->default_value(""),
+         "Directory for temporary partition files. Defaults to .import in the first data directory.")
+        ("input", po::value<std::vector<std::string>>()->multitoken(), "Input files, - for stdin");
+
+    return d;
+}
+
+int main(int argc, char** argv)
+try
+{
+    auto description = create_descriptions();
+
+    po::positional_options_description positional;
+    positional.add("input", -1);
+
+    po::variables_map opt;
+    po::store(po::command_line_parser(argc, argv).options(description).positional(positional).run(), opt);
+    po::notify(opt);
+
+    if(opt.count("help") || !opt.count("input"))
+    {
+        std::cout << "usage: henhouse_import [options] input..." << std::endl;
+        std::cout << description << std::endl;
+        return opt.count("help") ? 0 : 1;
+    }
+
+    const auto roots = hdb::parse_data_roots(opt["data"].as<std::string>());
+    const auto spill = opt["spill"].as<std::string>();
+
+    hdb::storage_schema defaults;
+    defaults.resolution = opt["resolution"].as<hdb::time_type>();
+
+    config c
+    {
+        roots,
+        spill.empty() ? roots.front() / ".import" : fs::path{spill},
+        defaults,
+        hdb::load_schemas(opt["schemas"].as<std::string>(), defaults),
+        parse_format(opt["format"].as<std::string>()),
+        opt["partitions"].as<std::size_t>(),
+        std::max<std::size_t>(1, opt["threads"].as<std::size_t>()),
+        opt["input"].as<std::vector<std::string>>()
+    };
+
+    if(c.defaults.resolution == 0) throw std::runtime_error{"resolution must be greater than 0"};
+    if(c.partitions == 0) throw std::runtime_error{"partitions must be greater than 0"};
+
+    for(const auto& r : c.roots) fs::create_directories(r);
+    const hdb::data_lock lock{c.roots};
+    fs::create_directories(c.spill);
+
+    counters stats;
+    const auto start = std::chrono::steady_clock::now();
+
+    partition(c, stats);
+    const auto partitioned = std::chrono::steady_clock::now();
+    std::cerr << "partitioned " << stats.lines << " lines in "
+        << std::chrono::duration<double>(partitioned - start).count() << "s" << std::endl;
+
+    build(c, stats);
+    fs::remove(c.spill);
+
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "duration: " << seconds << "s" << std::endl;
+    std::cout << "lines: " << stats.lines << std::endl;
+    std::cout << "malformed: " << stats.malformed << std::endl;
+    std::cout << "keys: " << stats.keys << std::endl;
+    std::cout << "points: " << stats.merged << " (" << stats.merged / seconds << "/s)" << std::endl;
+    std::cout << "rejected: " << stats.rejected << std::endl;
+    std::cout << "fractional: " << stats.fractional << " (refused, timelines are counters)" << std::endl;
+    std::cout << "gauge: " << stats.gauge << " (refused, their timelines are gauges)" << std::endl;
+
+    return 0;
+}
+catch(std::exception& e)
+{
+    std::cerr << "error, exiting: " << e.what() << std::endl;
+    return 1;
+}
@@ -0,0 +1,401 @@
+#include "load/net.hpp"
+#include "util/dbc.hpp"
+#include "util/histogram.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+namespace ba = boost::algorithm;
+namespace hu = henhouse::util;
+namespace hl = henhouse::load;
+
+namespace
+{
+    enum query_type { diff, values, summary, total_query_types };
+    const char* const QUERY_NAMES[] = { "diff", "values", "summary" };
+
+    //most points put per send call
+    const std::size_t MAX_BATCH = 1000;
+    const auto IDLE_SLEEP = std::chrono::milliseconds(1);
+    const auto RECONNECT_SLEEP = std::chrono::seconds(1);
+    const double NANOS_PER_MILLI = 1e6;
+
+    struct config
+    {
+        std::string host;
+        std::uint16_t put_port;
+        std::uint16_t http_port;
+        std::string key_prefix;
+        std::size_t keys;
+        double zipf;
+        double put_rate;
+        std::size_t put_connections;
+        double late_fraction;
+        std::uint64_t late_max;
+        double query_rate;
+        std::size_t query_connections;
+        std::array<double, total_query_types> mix;
+        std::uint64_t span;
+        std::uint64_t step;
+        std::uint64_t duration;
+        std::uint64_t report_interval;
+    };
+
+    struct counters
+    {
+        std::atomic<std::uint64_t> points{0};
+        std::atomic<std::uint64_t> put_errors{0};
+        std::atomic<std::uint64_t> queries{0};
+        std::atomic<std::uint64_t> query_errors{0};
+        std::array<hu::histogram, total_query_types> latency;
+    };
+
+    /**
+     * Picks key ranks with Zipfian popularity where rank k has weight 1/k^s.
+     * s = 0 gives uniform popularity.
+     */
+    class zipf_keys
+    {
+        public:
+            zipf_keys(std::size_t n, double s) : _cdf(n)
+            {
+                REQUIRE_GREATER(n, 0);
+
+                double sum = 0;
+                for(std::size_t k = 0; k < n; k++) 
+                {
+                    sum += 1.0 / std::pow(k + 1, s);
+                    _cdf[k] = sum;
+                }
+                for(auto& c : _cdf) c /= sum;
+            }
+
+            std::size_t operator()(std::mt19937_64& g) const
+            {
+                const auto u = std::uniform_real_distribution<double>{0.0, 1.0}(g);
+                const auto k = std::lower_bound(_cdf.begin(), _cdf.end(), u) - _cdf.begin();
+                return std::min<std::size_t>(k, _cdf.size() - 1);
+            }
+
+        private:
+            std::vector<double> _cdf;
+    };
+
+    std::uint64_t unix_now()
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    std::string key_name(const config& c, std::size_t k)
+    {
+        return c.key_prefix + std::to_string(k);
+    }
+
+    /**
+     * Sends points at a steady rate, in batches when behind schedule.
+     */
+    void put_thread(const config& c, const zipf_keys& keys, counters& stats, 
+            const std::atomic<bool>& done, unsigned seed)
+    {
+        std::mt19937_64 g{seed};
+        std::bernoulli_distribution late{c.late_fraction};
+        std::uniform_int_distribution<std::uint64_t> late_by{1, std::max<std::uint64_t>(1, c.late_max)};
+        std::uniform_int_distribution<int> count{1, 10};
+
+        const double rate = c.put_rate / c.put_connections;
+
+        while(!done)
+        try
+        {
+            hl::connection con{c.host, c.put_port};
+
+            const auto start = hu::now();
+            std::uint64_t sent = 0;
+
+            std::string batch;
+            while(!done)
+            {
+                const auto elapsed = std::chrono::duration<double>(hu::now() - start).count();
+                const auto due = static_cast<std::uint64_t>(elapsed * rate);
+
+                if(due <= sent)
+                {
+                    std::this_thread::sleep_for(IDLE_SLEEP);
+                    continue;
+                }
+
+                const auto n = std::min<std::uint64_t>(due - sent, MAX_BATCH);
+                const auto now = unix_now();
+
+                batch.clear();
+                for(std::uint64_t i = 0; i < n; i++)
+                {
+                    const auto t = late(g) ? now - std::min(now, late_by(g)) : now;
+                    batch += key_name(c, keys(g));
+                    batch += ' ';
+                    batch += std::to_string(count(g));
+                    batch += ' ';
+                    batch += std::to_string(t);
+                    batch += '\n';
+                }
+
+                con.send(batch);
+                sent += n;
+                stats.points.fetch_add(n, std::memory_order_relaxed);
+            }
+        }
+        catch(std::exception& e)
+        {
+            std::cerr << "put error: " << e.what() << std::endl;
+            stats.put_errors++;
+            std::this_thread::sleep_for(RECONNECT_SLEEP);
+        }
+    }
+
+    std::string query_path(const config& c, query_type t, const std::string& key)
+    {
+        const auto b = unix_now();
+        const auto a = b - std::min(b, c.span);
+
+        switch(t)
+        {
+            case diff: 
+                return "/diff?keys=" + key + "&a=" + std::to_string(a) + "&b=" + std::to_string(b);
+            case values: 
+                return "/values?keys=" + key + "&a=" + std::to_string(a) + "&b=" + std::to_string(b) 
+                    + "&step=" + std::to_string(c.step);
+            default: 
+                return "/summary?keys=" + key;
+        }
+    }
+
+    /**
+     * Issues one query at a time. When rate limited, latency is measured from
+     * when the query was scheduled rather than sent so a slow server is 
+     * not hidden by the client waiting on it.
+     */
+    void query_thread(const config& c, const zipf_keys& keys, counters& stats, 
+            const std::atomic<bool>& done, unsigned seed)
+    {
+        std::mt19937_64 g{seed};
+        std::discrete_distribution<int> pick{c.mix.begin(), c.mix.end()};
+
+        const double rate = c.query_rate / c.query_connections;
+        const auto period = rate > 0 ? 
+            std::chrono::duration_cast<hu::clock::duration>(std::chrono::duration<double>(1.0 / rate)) :
+            hu::clock::duration::zero();
+
+        while(!done)
+        try
+        {
+            hl::http_client http{c.host, c.http_port};
+            auto scheduled = hu::now();
+
+            while(!done)
+            {
+                if(rate > 0) 
+                {
+                    std::this_thread::sleep_until(scheduled);
+                    scheduled += period;
+                }
+
+                const auto t = static_cast<query_type>(pick(g));
+                const auto path = query_path(c, t, key_name(c, keys(g)));
+
+                const auto start = rate > 0 ? scheduled - period : hu::now();
+                const auto r = http.get(path);
+                stats.latency[t].record(start, hu::now());
+
+                if(r.status == 200) stats.queries++;
+                else stats.query_errors++;
+            }
+        }
+        catch(std::exception& e)
+        {
+            std::cerr << "query error: " << e.what() << std::endl;
+            stats.query_errors++;
+            std::this_thread::sleep_for(RECONNECT_SLEEP);
+        }
+    }
+
+    std::array<double, total_query_types> parse_mix(const std::string& mix)
+    {
+        std::array<double, total_query_types> r = {0, 0, 0};
+
+        std::vector<std::string> parts;
+        ba::split(parts, mix, ba::is_any_of(","));
+        for(const auto& p : parts)
+        {
+            std::vector<std::string> kv;
+            ba::split(kv, p, ba::is_any_of(":"));
+            if(kv.size() != 2) throw std::runtime_error{"bad query mix entry: " + p};
+
+            const auto n = std::find(std::begin(QUERY_NAMES), std::end(QUERY_NAMES), kv[0]) - std::begin(QUERY_NAMES);
+            if(n >= total_query_types) throw std::runtime_error{"unknown query type: " + kv[0]};
+
+            r[n] = boost::lexical_cast<double>(kv[1]);
+        }
+
+        return r;
+    }
+
+    void report_latency(const counters& stats)
+    {
+        std::cout << std::setw(10) << "query" 
+            << std::setw(12) << "count" 
+            << std::setw(12) << "p50 ms" 
+            << std::setw(12) << "p99 ms" 
+            << std::setw(12) << "p999 ms" 
+            << std::setw(12) << "max ms" << std::endl;
+
+        for(int t = 0; t < total_query_types; t++)
+        {
+            const auto h = stats.latency[t].snapshot();
+            if(h.count == 0) continue;
+
+            std::cout << std::setw(10) << QUERY_NAMES[t] 
+                << std::setw(12) << h.count
+                << std::setw(12) << h.percentile(0.5) / NANOS_PER_MILLI
+                << std::setw(12) << h.percentile(0.99) / NANOS_PER_MILLI
+                << std::setw(12) << h.percentile(0.999) / NANOS_PER_MILLI
+                << std::setw(12) << h.percentile(1.0) / NANOS_PER_MILLI << std::endl;
+        }
+    }
+}
+
+po::options_description create_descriptions()
+{
+    po::options_description d{"Options"};
+
+    d.add_options()
+        ("help,h", "prints help")
+        ("host", po::value<std::string>()->default_value("localhost"), "Henhouse host")
+        ("put_port", po::value<std::uint16_t>()->default_value(2003), "Data input port")
+        ("http_port", po::value<std::uint16_t>()->default_value(9090), "Http port")
+        ("key_prefix", po::value<std::string>()->default_value("load_"), "Prefix of generated keys")
+        ("keys", po::value<std::size_t>()->default_value(10000), "Number of distinct keys")
+        ("zipf", po::value<double>()->default_value(1.0), 
+         "Zipf exponent of key popularity for both puts and queries. 0 is uniform.")
+        ("put_rate", po::value<double>()->default_value(100000), "Points per second across all put connections")
+        ("put_connections", po::value<std::size_t>()->default_value(4), "Put connections")
+        ("late_fraction", po::value<double>()->default_value(0.0), "Fraction of points with an old timestamp")
+        ("late_max", po::value<std::uint64_t>()->default_value(300), 
+         "Late points are up to this many seconds old, uniformly")
+        ("query_rate", po::value<double>()->default_value(0), 
+         "Queries per second across all query connections. 0 means as fast as possible.")
+        ("query_connections", po::value<std::size_t>()->default_value(4), "Query connections")
+        ("query_mix", po::value<std::string>()->default_value("diff:1,values:1,summary:1"), 
+         "Relative weights of query types")
+        ("span", po::value<std::uint64_t>()->default_value(3600), "Seconds back from now queried by diff and values")
+        ("step", po::value<std::uint64_t>()->default_value(60), "Step of values queries in seconds")
+        ("duration", po::value<std::uint64_t>()->default_value(60), "Seconds to run")
+        ("report_interval", po::value<std::uint64_t>()->default_value(5), "Seconds between progress reports");
+
+    return d;
+}
+
+int main(int argc, char** argv)
+try
+{
+    auto description = create_descriptions();
+
+    po::variables_map opt;
+    po::store(po::parse_command_line(argc, argv, description), opt);
+    po::notify(opt);
+
+    if(opt.count("help"))
+    {
+        std::cout << description << std::endl;
+        return 0;
+    }
+
+    config c
+    {
+        opt["host"].as<std::string>(),
+        opt["put_port"].as<std::uint16_t>(),
+        opt["http_port"].as<std::uint16_t>(),
+        opt["key_prefix"].as<std::string>(),
+        opt["keys"].as<std::size_t>(),
+        opt["zipf"].as<double>(),
+        opt["put_rate"].as<double>(),
+        opt["put_connections"].as<std::size_t>(),
+        opt["late_fraction"].as<double>(),
+        opt["late_max"].as<std::uint64_t>(),
+        opt["query_rate"].as<double>(),
+        opt["query_connections"].as<std::size_t>(),
+        parse_mix(opt["query_mix"].as<std::string>()),
+        opt["span"].as<std::uint64_t>(),
+        opt["step"].as<std::uint64_t>(),
+        opt["duration"].as<std::uint64_t>(),
+        opt["report_interval"].as<std::uint64_t>()
+    };
+
+    if(c.keys == 0) throw std::runtime_error{"keys must be greater than 0"};
+    if(c.step == 0) throw std::runtime_error{"step must be greater than 0"};
+    if(c.report_interval == 0) throw std::runtime_error{"report_interval must be greater than 0"};
+    if(c.late_fraction < 0 || c.late_fraction > 1) throw std::runtime_error{"late_fraction must be in [0, 1]"};
+
+    const zipf_keys keys{c.keys, c.zipf};
+    counters stats;
+    std::atomic<bool> done{false};
+
+    std::vector<std::thread> threads;
+    unsigned seed = 0;
+    if(c.put_rate > 0)
+        for(std::size_t i = 0; i < c.put_connections; i++)
+            threads.emplace_back(put_thread, std::cref(c), std::cref(keys), std::ref(stats), std::cref(done), seed++);
+
+    for(std::size_t i = 0; i < c.query_connections; i++)
+        threads.emplace_back(query_thread, std::cref(c), std::cref(keys), std::ref(stats), std::cref(done), seed++);
+
+    const auto start = hu::now();
+    std::uint64_t last_points = 0;
+    std::uint64_t last_queries = 0;
+
+    for(std::uint64_t elapsed = 0; elapsed < c.duration; elapsed += c.report_interval)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(std::min(c.report_interval, c.duration - elapsed)));
+
+        const std::uint64_t points = stats.points;
+        const std::uint64_t queries = stats.queries;
+        std::cout << "points/s: " << (points - last_points) / c.report_interval
+            << " queries/s: " << (queries - last_queries) / c.report_interval
+            << " put errors: " << stats.put_errors
+            << " query errors: " << stats.query_errors << std::endl;
+
+        last_points = points;
+        last_queries = queries;
+    }
+
+    done = true;
+    for(auto& t : threads) t.join();
+
+    const auto seconds = std::chrono::duration<double>(hu::now() - start).count();
+
+    std::cout << std::endl;
+    std::cout << "duration: " << seconds << "s" << std::endl;
+    std::cout << "points: " << stats.points << " (" << stats.points / seconds << "/s)" << std::endl;
+    std::cout << "queries: " << stats.queries << " (" << stats.queries / seconds << "/s)" << std::endl;
+    std::cout << "put errors: " << stats.put_errors << std::endl;
+    std::cout << "query errors: " << stats.query_errors << std::endl;
+    std::cout << std::endl;
+    report_latency(stats);
+
+    return 0;
+}
+catch(std::exception& e) 
+{
+    std::cerr << "error, exiting: " << e.what() << std::endl;
+    return 1;
+}
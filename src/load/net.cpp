@@ -0,0 +1,168 @@
+#include "load/net.hpp"
+#include "util/dbc.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace ba = boost::algorithm;
+
+namespace henhouse::load
+{
+    namespace
+    {
+        const std::size_t READ_SIZE = 64 * 1024;
+
+        std::runtime_error socket_error(const std::string& what)
+        {
+            return std::runtime_error{what + ": " + std::strerror(errno)};
+        }
+    }
+
+    connection::connection(const std::string& host, std::uint16_t port)
+    {
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo* addrs = nullptr;
+        const auto service = std::to_string(port);
+        const auto e = getaddrinfo(host.c_str(), service.c_str(), &hints, &addrs);
+        if(e != 0) throw std::runtime_error{"unable to resolve " + host + ": " + gai_strerror(e)};
+
+        for(auto a = addrs; a != nullptr; a = a->ai_next)
+        {
+            _fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if(_fd < 0) continue;
+            if(connect(_fd, a->ai_addr, a->ai_addrlen) == 0) break;
+
+            close(_fd);
+            _fd = -1;
+        }
+        freeaddrinfo(addrs);
+
+        if(_fd < 0) throw socket_error("unable to connect to " + host + ":" + service);
+
+        int one = 1;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        ENSURE_GREATER_EQUAL(_fd, 0);
+    }
+
+    connection::~connection()
+    {
+        if(_fd >= 0) close(_fd);
+    }
+
+    void connection::send(const std::string& data)
+    {
+        INVARIANT_GREATER_EQUAL(_fd, 0);
+
+        std::size_t sent = 0;
+        while(sent < data.size())
+        {
+            const auto n = ::send(_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) throw socket_error("send failed");
+            sent += n;
+        }
+    }
+
+    void connection::recv(std::string& buf)
+    {
+        INVARIANT_GREATER_EQUAL(_fd, 0);
+
+        char b[READ_SIZE];
+        ssize_t n;
+        do { n = ::recv(_fd, b, sizeof(b), 0);} while(n < 0 && errno == EINTR);
+
+        if(n < 0) throw socket_error("recv failed");
+        if(n == 0) throw std::runtime_error{"connection closed"};
+        buf.append(b, n);
+    }
+
+    http_client::http_client(const std::string& host, std::uint16_t port) : 
+        _host{host}, _c{host, port} {}
+
+    void http_client::fill(std::size_t n)
+    {
+        while(_buf.size() < n) _c.recv(_buf);
+    }
+
+    std::string http_client::read_line()
+    {
+        auto end = _buf.find("\r\n");
+        while(end == std::string::npos)
+        {
+            _c.recv(_buf);
+            end = _buf.find("\r\n");
+        }
+
+        auto line = _buf.substr(0, end);
+        _buf.erase(0, end + 2);
+        return line;
+    }
+
+    http_response http_client::get(const std::string& path)
+    {
+        _c.send("GET " + path + " HTTP/1.1\r\nHost: " + _host + "\r\n\r\n");
+
+        http_response r;
+
+        const auto status = read_line();
+        std::vector<std::string> parts;
+        ba::split(parts, status, ba::is_space(), ba::token_compress_on);
+        if(parts.size() < 2) throw std::runtime_error{"bad status line: " + status};
+        r.status = boost::lexical_cast<int>(parts[1]);
+
+        bool chunked = false;
+        std::size_t length = 0;
+        for(auto h = read_line(); !h.empty(); h = read_line())
+        {
+            const auto colon = h.find(':');
+            if(colon == std::string::npos) continue;
+
+            const auto name = ba::to_lower_copy(ba::trim_copy(h.substr(0, colon)));
+            const auto value = ba::trim_copy(h.substr(colon + 1));
+
+            if(name == "content-length") length = boost::lexical_cast<std::size_t>(value);
+            else if(name == "transfer-encoding" && ba::icontains(value, "chunked")) chunked = true;
+        }
+
+        if(!chunked)
+        {
+            fill(length);
+            r.body = _buf.substr(0, length);
+            _buf.erase(0, length);
+            return r;
+        }
+
+        while(true)
+        {
+            const auto size_line = read_line();
+            const auto size = std::stoul(size_line, nullptr, 16);
+            if(size == 0) 
+            {
+                //skip trailers
+                for(auto t = read_line(); !t.empty(); t = read_line()) {}
+                break;
+            }
+
+            fill(size + 2);
+            r.body.append(_buf, 0, size);
+            _buf.erase(0, size + 2);
+        }
+
+        return r;
+    }
+}
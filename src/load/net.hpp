@@ -0,0 +1,57 @@
+#ifndef HENHOUSE_LOAD_NET_H
+#define HENHOUSE_LOAD_NET_H
+
+#include <cstdint>
+#include <string>
+
+namespace henhouse::load
+{
+    /**
+     * Blocking TCP connection. Throws std::runtime_error on any socket error.
+     */
+    class connection
+    {
+        public:
+            connection(const std::string& host, std::uint16_t port);
+            ~connection();
+
+            connection(const connection&) = delete;
+            connection& operator=(const connection&) = delete;
+
+            void send(const std::string& data);
+
+            //reads at least one byte and appends it to buf
+            void recv(std::string& buf);
+
+        private:
+            int _fd = -1;
+    };
+
+    struct http_response
+    {
+        int status = 0;
+        std::string body;
+    };
+
+    /**
+     * Minimal keep alive HTTP/1.1 client that understands 
+     * content length and chunked responses.
+     */
+    class http_client
+    {
+        public:
+            http_client(const std::string& host, std::uint16_t port);
+
+            http_response get(const std::string& path);
+
+        private:
+            void fill(std::size_t n);
+            std::string read_line();
+
+        private:
+            std::string _host;
+            connection _c;
+            std::string _buf;
+    };
+}
+#endif
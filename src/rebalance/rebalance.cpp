@@ -0,0 +1,262 @@
+#include "db/db.hpp"
+#include "util/dbc.hpp"
+#include "util/mmap.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+namespace hdb = henhouse::db;
+namespace hutil = henhouse::util;
+
+namespace
+{
+    struct config
+    {
+        hdb::data_roots from;
+        hdb::data_roots to;
+        std::size_t threads;
+        bool dry_run;
+    };
+
+    //a timeline found in one of the old roots
+    struct found_timeline
+    {
+        fs::path dir;
+        std::string key;
+    };
+
+    struct counters
+    {
+        std::atomic<std::uint64_t> timelines{0};
+        std::atomic<std::uint64_t> moved{0};
+        std::atomic<std::uint64_t> copied_bytes{0};
+    };
+
+    bool hidden(const fs::path& p)
+    {
+        const auto name = p.filename().string();
+        return !name.empty() && name[0] == '.';
+    }
+
+    /**
+     * Finds every timeline directory under the old roots. A directory with 
+     * only one of its files left is still a timeline, it was interrupted 
+     * part way through a move.
+     */
+    std::vector<found_timeline> find_timelines(const config& c)
+    {
+        std::vector<found_timeline> found;
+        for(const auto& root : c.from)
+        {
+            if(!fs::exists(root)) continue;
+
+            for(fs::recursive_directory_iterator it{root}, end; it != end; it++)
+            {
+                if(!fs::is_directory(it->status())) continue;
+                if(hidden(it->path()))
+                {
+                    it.no_push();
+                    continue;
+                }
+
+                const auto& dir = it->path();
+                if(hdb::has_timeline_files(dir))
+                    found.push_back(found_timeline{dir, hdb::dir_key(root, dir)});
+            }
+        }
+        return found;
+    }
+
+    /**
+     * Moves a file, copying it when the new place is on another disk. A copy 
+     * is synced and renamed into place before the original is removed, so 
+     * an interrupted move leaves the original to move again.
+     */
+    void move_file(const fs::path& from, const fs::path& to, counters& stats)
+    {
+        boost::system::error_code e;
+        fs::rename(from, to, e);
+        if(!e) return;
+
+        if(e != boost::system::errc::cross_device_link) 
+            throw fs::filesystem_error{"unable to move", from, to, e};
+
+        const fs::path tmp = to.string() + ".new";
+        fs::copy_file(from, tmp, fs::copy_option::overwrite_if_exists);
+        hutil::sync(tmp);
+        fs::rename(tmp, to);
+        fs::remove(from);
+
+        stats.copied_bytes += fs::file_size(to);
+    }
+
+    void move_timeline(const config& c, const found_timeline& t, counters& stats)
+    {
+        stats.timelines++;
+
+        const auto to = hdb::key_dir(c.to, t.key);
+        if(fs::exists(to) && fs::equivalent(t.dir, to)) return;
+
+        stats.moved++;
+        if(c.dry_run)
+        {
+            std::cout << t.dir.string() << " -> " << to.string() << std::endl;
+            return;
+        }
+
+        fs::create_directories(to);
+
+        //only the timeline's own files move, so finish whatever a crash left journaled
+        hdb::recover_timeline(t.dir);
+
+        //data first so a moved index never points at missing data
+        for(const auto* name : {hdb::DATA_FILE, hdb::DATA32_FILE, hdb::GAUGE_FILE, hdb::INDEX_FILE})
+            if(fs::exists(t.dir / name)) move_file(t.dir / name, to / name, stats);
+    }
+
+    void move_all(const config& c, const std::vector<found_timeline>& found, counters& stats)
+    {
+        std::atomic<std::size_t> next{0};
+        std::vector<std::thread> threads;
+        for(std::size_t t = 0; t < c.threads; t++)
+            threads.emplace_back([&]
+            {
+                try
+                {
+                    for(auto i = next++; i < found.size(); i = next++)
+                        move_timeline(c, found[i], stats);
+                }
+                catch(std::exception& e)
+                {
+                    std::cerr << "error moving timelines: " << e.what() << std::endl;
+                    std::exit(1);
+                }
+            });
+
+        for(auto& t : threads) t.join();
+    }
+
+    /**
+     * Removes directories left empty under the old roots, deepest first.
+     */
+    void remove_empty_dirs(const config& c)
+    {
+        for(const auto& root : c.from)
+        {
+            if(!fs::exists(root)) continue;
+
+            std::vector<fs::path> dirs;
+            for(fs::recursive_directory_iterator it{root}, end; it != end; it++)
+            {
+                if(!fs::is_directory(it->status())) continue;
+                if(hidden(it->path())) 
+                {
+                    it.no_push();
+                    continue;
+                }
+                dirs.push_back(it->path());
+            }
+
+            std::sort(dirs.begin(), dirs.end(), 
+                    [](const auto& a, const auto& b) { return a.string().size() > b.string().size();});
+
+            for(const auto& d : dirs)
+                if(fs::is_empty(d)) fs::remove(d);
+        }
+    }
+
+    //the hot keys henhouse saves for warm starts live in the first root
+    void move_hot_keys(const config& c, counters& stats)
+    {
+        const auto from = c.from.front() / ".hot";
+        const auto to = c.to.front() / ".hot";
+        if(!fs::exists(from) || (fs::exists(to) && fs::equivalent(from, to))) return;
+
+        move_file(from, to, stats);
+    }
+}
+
+po::options_description create_descriptions()
+{
+    po::options_description d{"Options"};
+    const auto workers = std::thread::hardware_concurrency();
+
+    d.add_options()
+        ("help,h", "prints help")
+        ("from", po::value<std::string>(), "Comma separated data directories henhouse used until now")
+        ("to", po::value<std::string>(), "Comma separated data directories henhouse will use")
+        ("threads", po::value<std::size_t>()->default_value(workers), "Threads moving timelines")
+        ("dry_run", "Print the moves without making them");
+
+    return d;
+}
+
+int main(int argc, char** argv)
+try
+{
+    auto description = create_descriptions();
+
+    po::variables_map opt;
+    po::store(po::parse_command_line(argc, argv, description), opt);
+    po::notify(opt);
+
+    if(opt.count("help") || !opt.count("from") || !opt.count("to"))
+    {
+        std::cout << "usage: henhouse_rebalance --from <dirs> --to <dirs>" << std::endl;
+        std::cout << description << std::endl;
+        return opt.count("help") ? 0 : 1;
+    }
+
+    config c
+    {
+        hdb::parse_data_roots(opt["from"].as<std::string>()),
+        hdb::parse_data_roots(opt["to"].as<std::string>()),
+        std::max<std::size_t>(1, opt["threads"].as<std::size_t>()),
+        opt.count("dry_run") > 0
+    };
+
+    for(const auto& r : c.to) fs::create_directories(r);
+
+    //a root in both lists is locked once, flock conflicts across descriptors
+    hdb::data_roots locked = c.to;
+    for(const auto& r : c.from)
+        if(fs::exists(r) && std::none_of(locked.begin(), locked.end(), 
+                    [&](const auto& l) { return fs::equivalent(l, r);}))
+            locked.push_back(r);
+    const hdb::data_lock lock{locked};
+
+    counters stats;
+    const auto start = std::chrono::steady_clock::now();
+
+    const auto found = find_timelines(c);
+    move_all(c, found, stats);
+
+    if(!c.dry_run)
+    {
+        move_hot_keys(c, stats);
+        remove_empty_dirs(c);
+    }
+
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "duration: " << seconds << "s" << std::endl;
+    std::cout << "timelines: " << stats.timelines << std::endl;
+    std::cout << "moved: " << stats.moved << std::endl;
+    std::cout << "copied bytes: " << stats.copied_bytes << std::endl;
+
+    return 0;
+}
+catch(std::exception& e)
+{
+    std::cerr << "error, exiting: " << e.what() << std::endl;
+    return 1;
+}
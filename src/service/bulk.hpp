@@ -0,0 +1,81 @@
+#ifndef HENHOUSE_BULK_SERV_H
+#define HENHOUSE_BULK_SERV_H
+
+#include "service/bulk_reader.hpp"
+#include "service/pause.hpp"
+
+#include <wangle/bootstrap/ServerBootstrap.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+
+namespace henhouse::net
+{
+    typedef wangle::Pipeline<folly::IOBufQueue&, std::unique_ptr<folly::IOBuf>> bulk_pipeline;
+
+    class bulk_handler : public wangle::HandlerAdapter<std::unique_ptr<folly::IOBuf>> 
+    {
+        public:
+            bulk_handler(threaded::server& db, ingest_policy policy, std::uint32_t max_keys) : 
+                wangle::HandlerAdapter<std::unique_ptr<folly::IOBuf>>{}, 
+                _db{db},
+                _reader{db, policy, max_keys}
+            {}
+
+        public:
+            virtual void read(Context* ctx, std::unique_ptr<folly::IOBuf> frame) override 
+            try
+            {
+                if(_reader.read(*frame)) _pauser.send(ctx, _reader.buffer());
+            }
+            catch(std::exception& e)
+            {
+                _db.ingest().malformed.fetch_add(1, std::memory_order_relaxed);
+                std::cerr << "bulk input error, closing connection: " << e.what() << std::endl;
+                close(ctx);
+            }
+
+            virtual void readException(Context* ctx, folly::exception_wrapper e) override
+            {
+                std::cerr << "bulk read error: " << exceptionStr(e) << std::endl;
+                close(ctx);
+            }
+
+            virtual void readEOF(Context* ctx) override { close(ctx); }
+
+        private:
+            threaded::server& _db;
+            bulk_reader _reader;
+            read_pauser<bulk_pipeline> _pauser;
+    };
+
+    class bulk_pipeline_factory : public wangle::PipelineFactory<bulk_pipeline> 
+    {
+        public:
+            bulk_pipeline_factory(threaded::server& db, ingest_policy policy, std::uint32_t max_keys = MAX_BULK_KEYS) : 
+                wangle::PipelineFactory<bulk_pipeline>{},
+                _db{db}, _policy{policy}, _max_keys{max_keys} {}
+
+        public:
+            bulk_pipeline::Ptr newPipeline(std::shared_ptr<folly::AsyncTransportWrapper> sock) 
+            {
+                auto pipeline = bulk_pipeline::create();
+                pipeline->addBack(wangle::AsyncSocketHandler{sock});
+                pipeline->addBack(wangle::LengthFieldBasedFrameDecoder{
+                        sizeof(std::uint32_t),  //length field size
+                        MAX_BULK_FRAME,
+                        0,                      //length field offset
+                        0,                      //length adjustment
+                        sizeof(std::uint32_t),  //strip the length
+                        false});                //little endian
+                pipeline->addBack(bulk_handler{_db, _policy, _max_keys});
+                pipeline->finalize();
+                return pipeline;
+            }
+
+        private:
+            threaded::server& _db;
+            ingest_policy _policy;
+            std::uint32_t _max_keys;
+    };
+}
+#endif
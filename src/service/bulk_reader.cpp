@@ -0,0 +1,62 @@
+#include "service/bulk_reader.hpp"
+
+#include <ctime>
+
+#include <folly/io/Cursor.h>
+
+namespace henhouse::net
+{
+    bool bulk_reader::read(const folly::IOBuf& frame)
+    {
+        folly::io::Cursor c{&frame};
+        if(c.totalLength() == 0) return false;
+
+        const auto type = c.read<std::uint8_t>();
+        if(type == bulk_key_frame) 
+        {
+            if(c.totalLength() <= sizeof(std::uint32_t)) 
+                throw bulk_protocol_error{"key frame without a key"};
+
+            const auto id = c.readLE<std::uint32_t>();
+            if(id >= _max_keys) 
+                throw bulk_protocol_error{"key id " + std::to_string(id) + " is over the limit of " 
+                    + std::to_string(_max_keys) + " keys"};
+
+            bulk_key k;
+            k.key = c.readFixedString(c.totalLength());
+            k.worker = _db.prepare_key(k.key);
+
+            if(id >= _keys.size()) _keys.resize(id + 1);
+            _keys[id] = std::move(k);
+            return false;
+        }
+
+        if(type != bulk_points_frame) 
+            throw bulk_protocol_error{"unknown frame type " + std::to_string(type)};
+
+        if(c.totalLength() % BULK_RECORD_SIZE != 0)
+            throw bulk_protocol_error{"points frame is not a whole number of records"};
+
+        //a frame is stored whole or not at all, so every id is 
+        //checked before any record is buffered
+        for(auto check = c; check.totalLength() > 0;)
+        {
+            const auto id = check.readLE<std::uint32_t>();
+            if(id >= _keys.size() || _keys[id].key.empty()) 
+                throw bulk_protocol_error{"unregistered key id " + std::to_string(id)};
+            check.skip(BULK_RECORD_SIZE - sizeof(std::uint32_t));
+        }
+
+        const auto now = std::time(nullptr);
+        while(c.totalLength() > 0)
+        {
+            const auto id = c.readLE<std::uint32_t>();
+            const auto t = c.readLE<db::time_type>();
+            const auto count = c.readLE<db::count_type>();
+
+            const auto& k = _keys[id];
+            _buffer.add(k.key, k.worker, t, db::count_value(count), now);
+        }
+        return true;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef HENHOUSE_BULK_READER_H
+#define HENHOUSE_BULK_READER_H
+
+#include "service/threaded.hpp"
+#include "service/ingest.hpp"
+
+#include <folly/io/IOBuf.h>
+
+namespace henhouse::net
+{
+    /**
+     * Binary bulk input. Every frame is a little endian u32 length followed by
+     * that many bytes, the first of which is the frame type.
+     *
+     * key frame:    u32 id, key bytes for the rest of the frame
+     * points frame: packed records of u32 id, u64 timestamp, i64 count
+     *
+     * A key frame registers a key once per connection and assigns it an id 
+     * that points frames refer to. All integers are little endian.
+     */
+    enum bulk_frame_type : std::uint8_t 
+    { 
+        bulk_key_frame = 1, 
+        bulk_points_frame = 2
+    };
+
+    const std::uint32_t MAX_BULK_FRAME = 1 << 20;
+
+    //key ids a connection may use by default. The key table grows to the
+    //largest id, so this bounds what one connection can allocate.
+    const std::uint32_t MAX_BULK_KEYS = 1 << 16;
+    const std::size_t BULK_RECORD_SIZE = 
+        sizeof(std::uint32_t) + sizeof(db::time_type) + sizeof(db::count_type);
+
+    struct bulk_protocol_error : public std::runtime_error 
+    {
+        bulk_protocol_error(const std::string& error) : std::runtime_error{error}{}
+    };
+
+    /**
+     * Decodes the frames of one bulk connection into its ingest buffer.
+     *
+     * This class is not thread safe, each connection owns its own.
+     */
+    class bulk_reader
+    {
+        public:
+            bulk_reader(threaded::server& db, ingest_policy policy, std::uint32_t max_keys) : 
+                _db{db}, _max_keys{max_keys}, _buffer{db, policy} {}
+
+            /**
+             * Reads one frame, without its length. Returns true if it was 
+             * a points frame whose points now wait in the buffer to be sent.
+             * Throws bulk_protocol_error if the frame is malformed.
+             */
+            bool read(const folly::IOBuf& frame);
+
+            ingest_buffer& buffer() { return _buffer;}
+
+        private:
+            struct bulk_key
+            {
+                std::string key;
+                std::size_t worker = 0;
+            };
+
+        private:
+            threaded::server& _db;
+            std::uint32_t _max_keys;
+            std::vector<bulk_key> _keys;
+            ingest_buffer _buffer;
+    };
+}
+#endif
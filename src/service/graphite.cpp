@@ -0,0 +1,111 @@
+#include "service/graphite.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string>
+
+namespace henhouse::net
+{
+    namespace
+    {
+        bool is_space(char c) { return c == ' ' || c == '\t';}
+        bool is_digit(char c) { return c >= '0' && c <= '9';}
+        bool is_number_char(char c) 
+        { 
+            return is_digit(c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+        }
+
+        stde::string_view next_field(stde::string_view& s)
+        {
+            std::size_t b = 0;
+            while(b < s.size() && is_space(s[b])) b++;
+
+            auto e = b;
+            while(e < s.size() && !is_space(s[e])) e++;
+
+            const auto f = s.substr(b, e - b);
+            s.remove_prefix(e);
+            return f;
+        }
+
+        /**
+         * Parses a whole integer field. Fails on anything after the digits 
+         * or if the value is out of range.
+         */
+        bool parse_int(const std::string& s, long long& v)
+        {
+            if(s.empty() || !is_number_char(s.front())) return false;
+
+            char* end = nullptr;
+            errno = 0;
+            v = std::strtoll(s.c_str(), &end, 10);
+            return errno == 0 && end == s.c_str() + s.size();
+        }
+
+        bool parse_time(const std::string& s, db::time_type& v)
+        {
+            if(s.empty() || !is_digit(s.front())) return false;
+
+            char* end = nullptr;
+            errno = 0;
+            const auto r = std::strtoull(s.c_str(), &end, 10);
+            if(errno != 0 || end != s.c_str() + s.size()) return false;
+
+            v = r;
+            return true;
+        }
+
+        /**
+         * Parses a count which is either an integer or a decimal with a 
+         * fraction or exponent like 1.5, 1e3 or 1.5e-05. Decimals with a
+         * fraction are fractional, others like 1.0 or 1e3 are whole counts.
+         * The count is the truncated value either way, which must fit.
+         */
+        bool parse_value(stde::string_view field, db::put_value& v)
+        {
+            //strtod also takes hex, inf and nan which graphite never sends
+            for(auto c : field) if(!is_number_char(c)) return false;
+
+            const std::string s{field.data(), field.size()};
+
+            long long i = 0;
+            if(parse_int(s, i))
+            {
+                v.count = i;
+                v.gauge = static_cast<double>(i);
+                v.fractional = false;
+                return true;
+            }
+            if(s.empty() || errno == ERANGE) return false;
+
+            char* end = nullptr;
+            errno = 0;
+            const auto d = std::strtod(s.c_str(), &end);
+            if(errno != 0 || end != s.c_str() + s.size() || !std::isfinite(d)) return false;
+
+            //min is -2^63 and exact as a double, so -min is just past max
+            const auto min = static_cast<double>(std::numeric_limits<db::count_type>::min());
+            if(d < min || d >= -min) return false;
+
+            v.count = static_cast<db::count_type>(d);
+            v.gauge = d;
+            v.fractional = d != std::trunc(d);
+            return true;
+        }
+    }
+
+    bool parse_point(stde::string_view line, point& p)
+    {
+        p.key = next_field(line);
+        if(p.key.empty()) return false;
+
+        if(!parse_value(next_field(line), p.value)) return false;
+
+        const auto time = next_field(line);
+        if(!parse_time({time.data(), time.size()}, p.time)) return false;
+
+        return next_field(line).empty();
+    }
+}
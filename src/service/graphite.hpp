@@ -0,0 +1,62 @@
+#ifndef HENHOUSE_GRAPHITE_H
+#define HENHOUSE_GRAPHITE_H
+
+#include "db/timeline.hpp"
+
+#include <ctime>
+#include <experimental/string_view>
+
+namespace stde = std::experimental;
+
+namespace henhouse::net
+{
+    const std::uint64_t TOLERANCE=60*10; //10 minute tolerance
+
+    struct point
+    {
+        stde::string_view key;
+        db::put_value value;
+        db::time_type time;
+    };
+
+    /**
+     * Parses one graphite line of the form "<key> <count> <timestamp>".
+     * The count may be a decimal such as 1.5 or 1e-05, which counters 
+     * refuse and gauges keep whole. Returns false if the line is malformed
+     * or the count doesn't fit 64 bits.
+     */
+    bool parse_point(stde::string_view line, point& p);
+
+    /**
+     * Calls f for every point parsed out of newline separated lines 
+     * and returns how many lines were malformed. Empty lines are skipped.
+     */
+    template <class point_func>
+        std::size_t for_each_point(stde::string_view lines, point_func f)
+        {
+            std::size_t malformed = 0;
+            while(!lines.empty())
+            {
+                auto end = lines.find('\n');
+                if(end == stde::string_view::npos) end = lines.size();
+
+                auto line = lines.substr(0, end);
+                lines.remove_prefix(std::min(end + 1, lines.size()));
+
+                if(!line.empty() && line.back() == '\r') line.remove_suffix(1);
+                if(line.empty()) continue;
+
+                point p;
+                if(parse_point(line, p)) f(p);
+                else malformed++;
+            }
+            return malformed;
+        }
+
+    //don't allow puts too far into the future
+    inline bool too_far_in_future(db::time_type t, std::time_t now)
+    {
+        return t > static_cast<db::time_type>(now + TOLERANCE);
+    }
+}
+#endif
@@ -0,0 +1,183 @@
+#ifndef HENHOUSE_HTTP_PUT_SERV_H
+#define HENHOUSE_HTTP_PUT_SERV_H
+
+#include "service/threaded.hpp"
+#include "service/ingest.hpp"
+
+#include <folly/json.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <proxygen/lib/utils/ZlibStreamDecompressor.h>
+
+namespace henhouse::net
+{
+    /**
+     * Handles POST /put. The body is newline separated graphite lines,
+     * optionally gzip or deflate compressed. Lines are parsed as body chunks
+     * arrive and every chunk is sent to the workers as one batch per worker,
+     * so the body is never buffered whole. When the policy is pause and the 
+     * workers are behind, ingress is paused until they catch up.
+     */
+    class put_request_handler : public proxygen::RequestHandler
+    {
+        public:
+            put_request_handler(threaded::server& db, ingest_policy policy) :
+                RequestHandler{}, _buffer{db, policy}, _lines{_buffer} {}
+
+            void onRequest(std::unique_ptr<proxygen::HTTPMessage> req) noexcept override
+            try
+            {
+                if(req->getMethod() != proxygen::HTTPMethod::POST)
+                {
+                    fail(405, "Method Not Allowed");
+                    return;
+                }
+
+                const auto& encoding = req->getHeaders().getSingleOrEmpty(
+                        proxygen::HTTP_HEADER_CONTENT_ENCODING);
+
+                if(encoding == "gzip")
+                    _decompressor = std::make_unique<proxygen::ZlibStreamDecompressor>(
+                            proxygen::ZlibCompressionType::GZIP);
+                else if(encoding == "deflate")
+                    _decompressor = std::make_unique<proxygen::ZlibStreamDecompressor>(
+                            proxygen::ZlibCompressionType::DEFLATE);
+                else if(!encoding.empty() && encoding != "identity")
+                    fail(415, "Unsupported Content-Encoding");
+            }
+            catch(std::exception& e)
+            {
+                fail(500, e.what());
+            }
+
+            void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override
+            try
+            {
+                if(_failed) return;
+
+                if(_decompressor)
+                {
+                    body = _decompressor->decompress(body.get());
+                    if(_decompressor->hasError())
+                    {
+                        fail(400, "Unable to decompress body");
+                        return;
+                    }
+                    if(!body) return;
+                }
+
+                for(const auto& range : *body)
+                    _lines.add({reinterpret_cast<const char*>(range.data()), range.size()});
+
+                send();
+            }
+            catch(std::exception& e)
+            {
+                fail(500, e.what());
+            }
+
+            void onEOM() noexcept override
+            try
+            {
+                if(_failed) return;
+
+                _lines.finish();
+                _eom = true;
+                send();
+            }
+            catch(std::exception& e)
+            {
+                fail(500, e.what());
+            }
+
+            void onUpgrade(proxygen::UpgradeProtocol proto) noexcept override {}
+
+            void requestComplete() noexcept override 
+            { 
+                delete this;
+            }
+
+            void onError(proxygen::ProxygenError err) noexcept override 
+            { 
+                delete this;
+            }
+
+        private:
+
+            /**
+             * Sends buffered points and responds once the body is done.
+             * If the workers are behind, ingress is paused and sending is 
+             * retried until they take everything.
+             */
+            void send()
+            {
+                if(_buffer.paused()) return;
+
+                if(!_buffer.send())
+                {
+                    downstream_->pauseIngress();
+                    _delay = RESUME_DELAY;
+                    _retry = folly::AsyncTimeout::make(
+                            *folly::EventBaseManager::get()->getEventBase(), 
+                            [this]() noexcept { retry(); });
+                    _retry->scheduleTimeout(_delay);
+                    return;
+                }
+
+                if(_eom) respond();
+            }
+
+            void retry()
+            try
+            {
+                if(!_buffer.send())
+                {
+                    _delay = next_resume_delay(_delay);
+                    _retry->scheduleTimeout(_delay);
+                    return;
+                }
+
+                downstream_->resumeIngress();
+                if(_eom) respond();
+            }
+            catch(std::exception& e)
+            {
+                fail(500, e.what());
+            }
+
+            void respond()
+            {
+                folly::dynamic out = folly::dynamic::object
+                    ("accepted", static_cast<std::int64_t>(_buffer.accepted()))
+                    ("rejected", static_cast<std::int64_t>(_lines.rejected() + _buffer.rejected()));
+
+                proxygen::ResponseBuilder{downstream_}
+                    .status(200, "OK")
+                    .header("Content-Type", "application/json")
+                    .body(folly::toJson(out))
+                    .sendWithEOM();
+            }
+
+            void fail(const std::uint16_t code, const std::string& reason)
+            {
+                if(_failed) return;
+                _failed = true;
+
+                proxygen::ResponseBuilder{downstream_}
+                    .status(code, reason)
+                    .sendWithEOM();
+            }
+
+        private:
+            ingest_buffer _buffer;
+            chunked_lines _lines;
+            std::unique_ptr<proxygen::ZlibStreamDecompressor> _decompressor;
+            std::unique_ptr<folly::AsyncTimeout> _retry;
+            std::chrono::milliseconds _delay = RESUME_DELAY;
+            bool _eom = false;
+            bool _failed = false;
+    };
+}
+#endif
@@ -0,0 +1,131 @@
+#include "service/ingest.hpp"
+#include "service/graphite.hpp"
+
+namespace henhouse::net
+{
+    ingest_policy parse_ingest_policy(const std::string& policy)
+    {
+        if(policy == "block") return ingest_policy::block;
+        if(policy == "shed") return ingest_policy::shed;
+        if(policy == "pause") return ingest_policy::pause;
+        throw std::runtime_error{"unknown ingest policy " + policy + ", expected block, shed, or pause"};
+    }
+
+    ingest_buffer::ingest_buffer(threaded::server& db, ingest_policy policy) : 
+        _db{db}, _policy{policy}, _batches(db.total_workers()) {}
+
+    void ingest_buffer::add_lines(stde::string_view lines, std::time_t now)
+    {
+        const auto malformed = for_each_point(lines, [&](const point& p)
+        {
+            std::string key{p.key.data(), p.key.size()};
+            const auto n = _db.prepare_key(key);
+            add(std::move(key), n, p.time, p.value, now);
+        });
+
+        if(malformed == 0) return;
+
+        _rejected += malformed;
+        _db.ingest().malformed.fetch_add(malformed, std::memory_order_relaxed);
+    }
+
+    void ingest_buffer::add(std::string key, std::size_t worker, db::time_type t, const db::put_value& v, std::time_t now)
+    {
+        REQUIRE_RANGE(worker, 0, _batches.size());
+
+        if(too_far_in_future(t, now))
+        {
+            _rejected++;
+            _db.ingest().future.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        _batches[worker].emplace_back(threaded::put_item{std::move(key), t, v});
+        _accepted++;
+    }
+
+    bool ingest_buffer::send()
+    {
+        switch(_policy)
+        {
+            case ingest_policy::block:
+                _db.put(_batches);
+                return true;
+
+            case ingest_policy::shed:
+                if(_db.try_put(_batches)) return true;
+
+                for(auto& b : _batches)
+                {
+                    _db.ingest().dropped.fetch_add(b.size(), std::memory_order_relaxed);
+                    b.clear();
+                }
+                return true;
+
+            case ingest_policy::pause:
+                _paused = !_db.try_put(_batches);
+                return !_paused;
+        }
+
+        return true;
+    }
+
+    void chunked_lines::add(stde::string_view chunk)
+    {
+        //finish the line left over from the previous chunk
+        if(!_partial.empty() || _skip_line)
+        {
+            const auto end = chunk.find('\n');
+            const auto head = chunk.substr(0, end);
+            if(!_skip_line) _partial.append(head.data(), head.size());
+
+            if(end == stde::string_view::npos)
+            {
+                check_partial();
+                return;
+            }
+
+            if(_skip_line) _skip_line = false;
+            else add_lines(_partial);
+
+            _partial.clear();
+            chunk.remove_prefix(end + 1);
+        }
+
+        //parse whole lines and keep the tail for the next chunk
+        const auto last = chunk.rfind('\n');
+        if(last == stde::string_view::npos)
+        {
+            _partial.assign(chunk.data(), chunk.size());
+            check_partial();
+            return;
+        }
+
+        add_lines(chunk.substr(0, last));
+
+        const auto tail = chunk.substr(last + 1);
+        _partial.assign(tail.data(), tail.size());
+        check_partial();
+    }
+
+    void chunked_lines::finish()
+    {
+        if(!_skip_line) add_lines(_partial);
+        _partial.clear();
+        _skip_line = false;
+    }
+
+    void chunked_lines::check_partial()
+    {
+        if(_partial.size() <= MAX_PUT_LINE) return;
+
+        _partial.clear();
+        _skip_line = true;
+        _rejected++;
+    }
+
+    void chunked_lines::add_lines(stde::string_view lines)
+    {
+        _buffer.add_lines(lines, std::time(nullptr));
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef HENHOUSE_INGEST_H
+#define HENHOUSE_INGEST_H
+
+#include "service/threaded.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <experimental/string_view>
+
+namespace stde = std::experimental;
+
+namespace henhouse::net
+{
+    /**
+     * What an input does when a worker queue is full.
+     *
+     * block: wait for room, stalling the input thread.
+     * shed:  drop the points and count them.
+     * pause: stop reading from the connection until the workers catch up.
+     *        Inputs that cannot pause, like UDP, block instead.
+     */
+    enum class ingest_policy { block, shed, pause };
+
+    ingest_policy parse_ingest_policy(const std::string& policy);
+
+    //how soon a paused connection first retries sending its points, 
+    //each failed retry doubles the wait up to MAX_RESUME_DELAY
+    const auto RESUME_DELAY = std::chrono::milliseconds(1);
+    const auto MAX_RESUME_DELAY = std::chrono::milliseconds(64);
+
+    inline std::chrono::milliseconds next_resume_delay(std::chrono::milliseconds delay)
+    {
+        return std::min(delay * 2, MAX_RESUME_DELAY);
+    }
+
+    /**
+     * Points read from one connection waiting to be sent to the DB workers,
+     * batched per worker. Points that are malformed or too far in the future
+     * are counted in the server's ingest counters.
+     *
+     * This class is not thread safe, each connection owns its own.
+     */
+    class ingest_buffer
+    {
+        public:
+            ingest_buffer(threaded::server& db, ingest_policy policy);
+
+            /**
+             * Adds every point in newline separated graphite lines.
+             */
+            void add_lines(stde::string_view lines, std::time_t now);
+
+            /**
+             * Adds a point whose key was prepared by the server. 
+             */
+            void add(std::string key, std::size_t worker, db::time_type t, const db::put_value& v, std::time_t now);
+
+            /**
+             * Sends everything buffered according to the policy. Returns
+             * false if the workers could not take it all and the connection
+             * should stop reading and call send again later.
+             */
+            bool send();
+
+            bool paused() const { return _paused;}
+
+            //points added and points refused since the buffer was made
+            std::size_t accepted() const { return _accepted;}
+            std::size_t rejected() const { return _rejected;}
+
+        private:
+            threaded::server& _db;
+            ingest_policy _policy;
+            std::vector<threaded::put_items> _batches;
+            bool _paused = false;
+            std::size_t _accepted = 0;
+            std::size_t _rejected = 0;
+    };
+
+    //longest line kept while waiting for the rest of it in the next chunk
+    const std::size_t MAX_PUT_LINE = 4096;
+
+    /**
+     * Adds lines arriving in chunks, such as an HTTP body, to an ingest 
+     * buffer. A line cut by the end of a chunk is kept until the rest of it
+     * arrives. Lines longer than MAX_PUT_LINE are dropped and counted.
+     *
+     * This class is not thread safe.
+     */
+    class chunked_lines
+    {
+        public:
+            explicit chunked_lines(ingest_buffer& buffer) : _buffer{buffer} {}
+
+            void add(stde::string_view chunk);
+
+            /**
+             * Adds the last line, which may not end in a newline.
+             */
+            void finish();
+
+            //lines too long to parse
+            std::size_t rejected() const { return _rejected;}
+
+        private:
+            void check_partial();
+            void add_lines(stde::string_view lines);
+
+        private:
+            ingest_buffer& _buffer;
+            std::string _partial;
+            bool _skip_line = false;
+            std::size_t _rejected = 0;
+    };
+}
+#endif
@@ -0,0 +1,236 @@
+#include "service/metrics.hpp"
+#include "util/mmap.hpp"
+
+#include <cmath>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace henhouse::net
+{
+    namespace
+    {
+        //names of the req variant alternatives, in order.
+        const char* const REQ_NAMES[] = 
+        {
+            "put", 
+            "get", 
+            "diff", 
+            "summary", 
+            "put_batch",
+            "raw",
+            "track",
+            "pause",
+            "sync",
+            "warm",
+            "hot",
+            "merge",
+            "values",
+            "anomaly",
+            "retention",
+            "wake",
+            "stop"
+        };
+
+        static_assert(sizeof(REQ_NAMES) / sizeof(REQ_NAMES[0]) == threaded::REQ_TYPES, 
+                "every request type needs a metrics name");
+
+        //histogram buckets reported, in seconds. Each is reported at the 
+        //upper bound of the last internal bucket below it.
+        const std::array<double, 14> BUCKETS = 
+        {
+            1e-6, 5e-6, 
+            1e-5, 5e-5, 
+            1e-4, 5e-4, 
+            1e-3, 5e-3, 
+            1e-2, 5e-2, 
+            1e-1, 5e-1, 
+            1.0, 5.0
+        };
+
+        const std::array<double, 3> QUANTILES = {0.5, 0.99, 0.999};
+
+        const double NANOS = 1e9;
+
+        void header(std::ostream& o, const std::string& name, const std::string& type, const std::string& help)
+        {
+            o << "# HELP " << name << " " << help << "\n";
+            o << "# TYPE " << name << " " << type << "\n";
+        }
+
+        std::string labels(const std::string& l, const std::string& extra)
+        {
+            if(l.empty() && extra.empty()) return "";
+            if(l.empty()) return "{" + extra + "}";
+            if(extra.empty()) return "{" + l + "}";
+            return "{" + l + "," + extra + "}";
+        }
+
+        //exact decimal seconds of a nanosecond count
+        std::string seconds(std::uint64_t nanos)
+        {
+            auto fraction = std::to_string(nanos % 1000000000);
+            fraction.insert(0, 9 - fraction.size(), '0');
+            fraction.erase(fraction.find_last_not_of('0') + 1);
+
+            const auto whole = std::to_string(nanos / 1000000000);
+            return fraction.empty() ? whole : whole + "." + fraction;
+        }
+
+        //the inclusive upper bound of the last internal bucket ending at or before v
+        std::uint64_t bucket_bound(std::uint64_t v)
+        {
+            auto b = util::histogram_bucket(v);
+            if(util::histogram_bucket_max(b) > v && b > 0) b--;
+            return util::histogram_bucket_max(b);
+        }
+
+        /**
+         * The counts of internal buckets can't be split, so each reported
+         * bucket's le is the bound its count is exact for.
+         */
+        void histogram(
+                std::ostream& o, 
+                const std::string& name, 
+                const std::string& l, 
+                const util::histogram_snapshot& h)
+        {
+            bool first = true;
+            std::uint64_t last = 0;
+            for(const auto b : BUCKETS)
+            {
+                const auto le = bucket_bound(std::llround(b * NANOS));
+                if(!first && le == last) continue;
+                first = false;
+                last = le;
+
+                o << name << "_bucket" 
+                    << labels(l, "le=\"" + seconds(le) + "\"") 
+                    << " " << h.count_at_most(le) << "\n";
+            }
+
+            o << name << "_bucket" << labels(l, "le=\"+Inf\"") << " " << h.count << "\n";
+            o << name << "_sum" << labels(l, "") << " " << (h.sum / NANOS) << "\n";
+            o << name << "_count" << labels(l, "") << " " << h.count << "\n";
+        }
+
+        void quantiles(
+                std::ostream& o, 
+                const std::string& name, 
+                const std::string& l, 
+                const util::histogram_snapshot& h)
+        {
+            for(const auto q : QUANTILES)
+                o << name << labels(l, "quantile=\"" + std::to_string(q) + "\"") 
+                    << " " << (h.percentile(q) / NANOS) << "\n";
+        }
+
+        std::size_t open_fds()
+        {
+            boost::system::error_code ec;
+            std::size_t n = 0;
+            for(fs::directory_iterator it{"/proc/self/fd", ec}, end; !ec && it != end; it.increment(ec))
+                n++;
+            return n;
+        }
+    }
+
+    std::string render_metrics(const threaded::server& db)
+    {
+        std::stringstream o;
+
+        const auto& m = db.metrics();
+
+        const auto wait = m.queue_wait.snapshot();
+        header(o, "henhouse_queue_wait_seconds", "histogram", 
+                "Time requests wait in a DB worker queue.");
+        histogram(o, "henhouse_queue_wait_seconds", "", wait);
+
+        header(o, "henhouse_queue_wait_quantile_seconds", "gauge", 
+                "Queue wait time quantiles since start.");
+        quantiles(o, "henhouse_queue_wait_quantile_seconds", "", wait);
+
+        std::array<util::histogram_snapshot, threaded::REQ_TYPES> exec;
+        for(std::size_t t = 0; t < exec.size(); t++) exec[t] = m.exec[t].snapshot();
+
+        header(o, "henhouse_db_exec_seconds", "histogram", 
+                "Time a DB worker spends executing a request by request type.");
+        for(std::size_t t = 0; t < exec.size(); t++)
+            histogram(o, "henhouse_db_exec_seconds", std::string{"type=\""} + REQ_NAMES[t] + "\"", exec[t]);
+
+        header(o, "henhouse_db_exec_quantile_seconds", "gauge", 
+                "DB execution time quantiles since start by request type.");
+        for(std::size_t t = 0; t < exec.size(); t++)
+            quantiles(o, "henhouse_db_exec_quantile_seconds", std::string{"type=\""} + REQ_NAMES[t] + "\"", exec[t]);
+
+        const auto render = m.render.snapshot();
+        header(o, "henhouse_http_render_seconds", "histogram", 
+                "Time spent rendering HTTP responses once results are ready.");
+        histogram(o, "henhouse_http_render_seconds", "", render);
+
+        header(o, "henhouse_http_render_quantile_seconds", "gauge", 
+                "HTTP render time quantiles since start.");
+        quantiles(o, "henhouse_http_render_quantile_seconds", "", render);
+
+        const auto stats = db.stats();
+
+        header(o, "henhouse_worker_queue_depth", "gauge", "Requests waiting in each DB worker queue.");
+        for(std::size_t w = 0; w < stats.size(); w++)
+            o << "henhouse_worker_queue_depth{worker=\"" << w << "\"} " << stats[w].queue_depth << "\n";
+
+        header(o, "henhouse_steal_queue_depth", "gauge", "Reads waiting to be stolen by idle workers.");
+        o << "henhouse_steal_queue_depth " << db.steal_queue_depth() << "\n";
+
+        header(o, "henhouse_timeline_cache_hits_total", "counter", "Timeline cache hits per worker.");
+        for(std::size_t w = 0; w < stats.size(); w++)
+            o << "henhouse_timeline_cache_hits_total{worker=\"" << w << "\"} " << stats[w].cache.hits << "\n";
+
+        header(o, "henhouse_timeline_cache_misses_total", "counter", "Timeline cache misses per worker.");
+        for(std::size_t w = 0; w < stats.size(); w++)
+            o << "henhouse_timeline_cache_misses_total{worker=\"" << w << "\"} " << stats[w].cache.misses << "\n";
+
+        header(o, "henhouse_timeline_cache_evictions_total", "counter", "Timeline cache evictions per worker.");
+        for(std::size_t w = 0; w < stats.size(); w++)
+            o << "henhouse_timeline_cache_evictions_total{worker=\"" << w << "\"} " << stats[w].cache.evictions << "\n";
+
+        header(o, "henhouse_puts_coalesced_total", "counter", "Points added to a pending put of their bucket instead of the timeline per worker.");
+        for(std::size_t w = 0; w < stats.size(); w++)
+            o << "henhouse_puts_coalesced_total{worker=\"" << w << "\"} " << stats[w].cache.coalesced << "\n";
+
+        header(o, "henhouse_points_rejected_total", "counter", "Points refused by their timeline per worker, usually for being too old.");
+        for(std::size_t w = 0; w < stats.size(); w++)
+            o << "henhouse_points_rejected_total{worker=\"" << w << "\"} " << stats[w].rejected << "\n";
+
+        header(o, "henhouse_late_points", "gauge", "Points too old for put staged per worker until they are merged.");
+        for(std::size_t w = 0; w < stats.size(); w++)
+            o << "henhouse_late_points{worker=\"" << w << "\"} " << stats[w].late_pending << "\n";
+
+        header(o, "henhouse_late_points_merged_total", "counter", "Staged late points merged into their timelines per worker.");
+        for(std::size_t w = 0; w < stats.size(); w++)
+            o << "henhouse_late_points_merged_total{worker=\"" << w << "\"} " << stats[w].late_merged << "\n";
+
+        header(o, "henhouse_timelines_synced_total", "counter", "Timelines written to disk by durability syncs per worker.");
+        for(std::size_t w = 0; w < stats.size(); w++)
+            o << "henhouse_timelines_synced_total{worker=\"" << w << "\"} " << stats[w].synced << "\n";
+
+        const auto& ingest = db.ingest();
+        header(o, "henhouse_points_dropped_total", "counter", "Points shed because a worker queue was full.");
+        o << "henhouse_points_dropped_total " << ingest.dropped.load(std::memory_order_relaxed) << "\n";
+
+        header(o, "henhouse_points_future_total", "counter", "Points dropped for being too far in the future.");
+        o << "henhouse_points_future_total " << ingest.future.load(std::memory_order_relaxed) << "\n";
+
+        header(o, "henhouse_points_malformed_total", "counter", "Input lines or frames that did not parse.");
+        o << "henhouse_points_malformed_total " << ingest.malformed.load(std::memory_order_relaxed) << "\n";
+
+        header(o, "henhouse_open_fds", "gauge", "Open file descriptors.");
+        o << "henhouse_open_fds " << open_fds() << "\n";
+
+        header(o, "henhouse_mapped_bytes", "gauge", "Bytes of timeline files currently memory mapped.");
+        o << "henhouse_mapped_bytes " << util::mapped_bytes() << "\n";
+
+        return o.str();
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef HENHOUSE_METRICS_H
+#define HENHOUSE_METRICS_H
+
+#include "service/threaded.hpp"
+
+#include <string>
+
+namespace henhouse::net
+{
+    /**
+     * Renders server metrics in the Prometheus text exposition format.
+     */
+    std::string render_metrics(const threaded::server& db);
+}
+#endif
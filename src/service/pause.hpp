@@ -0,0 +1,68 @@
+#ifndef HENHOUSE_PAUSE_H
+#define HENHOUSE_PAUSE_H
+
+#include "service/ingest.hpp"
+
+#include <folly/io/async/AsyncTimeout.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+
+namespace henhouse::net
+{
+    /**
+     * Stops reading from a wangle connection while its ingest buffer is
+     * paused and retries sending on the connection's event base until the
+     * workers take everything, then resumes reading. Other connections on
+     * the same event base keep being served.
+     *
+     * Reading is stopped and resumed with the pipeline's transportInactive
+     * and transportActive, which detach and attach the read callback owned
+     * by the pipeline's AsyncSocketHandler. Retries back off while the
+     * workers stay behind.
+     *
+     * Owned by the connection's handler so a pending retry dies with it.
+     */
+    template <class pipeline>
+    class read_pauser
+    {
+        public:
+            /**
+             * Sends the buffer, pausing the connection if the workers 
+             * cannot take it all. Does nothing while already paused since
+             * the retry will send whatever was added since.
+             */
+            template <class context>
+                void send(context* ctx, ingest_buffer& buffer)
+                {
+                    if(buffer.paused() || buffer.send()) return;
+
+                    //inactive takes the transport out of the pipeline
+                    auto transport = ctx->getTransport();
+                    if(!transport) return;
+
+                    auto* p = static_cast<pipeline*>(ctx->getPipeline());
+                    p->transportInactive();
+
+                    _delay = RESUME_DELAY;
+                    _retry = folly::AsyncTimeout::make(*transport->getEventBase(), 
+                            [this, transport, p, &buffer]() noexcept
+                            {
+                                if(!transport->good()) return;
+                                if(!buffer.send())
+                                {
+                                    _delay = next_resume_delay(_delay);
+                                    _retry->scheduleTimeout(_delay);
+                                    return;
+                                }
+
+                                p->transportActive();
+                            });
+
+                    _retry->scheduleTimeout(_delay);
+                }
+
+        private:
+            std::unique_ptr<folly::AsyncTimeout> _retry;
+            std::chrono::milliseconds _delay = RESUME_DELAY;
+    };
+}
+#endif
@@ -0,0 +1,49 @@
+#ifndef HENHOUSE_PLACEMENT_H
+#define HENHOUSE_PLACEMENT_H
+
+#include "util/cpu.hpp"
+
+#include <memory>
+
+#include <folly/executors/IOThreadPoolExecutor.h>
+#include <folly/executors/thread_factory/NamedThreadFactory.h>
+
+namespace henhouse::net
+{
+    /**
+     * Thread factory for IO thread pools that places each new thread
+     * on the next cpu in the rotation.
+     */
+    class placed_thread_factory : public folly::NamedThreadFactory
+    {
+        public:
+            placed_thread_factory(const std::string& prefix, const util::cpu_list& cpus) :
+                folly::NamedThreadFactory{prefix}, _cpus{std::make_shared<util::cpu_rotation>(cpus)} {}
+
+        public:
+            std::thread newThread(folly::Func&& func) override
+            {
+                auto cpus = _cpus;
+                return folly::NamedThreadFactory::newThread(
+                        [cpus, func = std::move(func)]() mutable
+                        {
+                            cpus->place_current_thread();
+                            func();
+                        });
+            }
+
+        private:
+            std::shared_ptr<util::cpu_rotation> _cpus;
+    };
+
+    inline std::shared_ptr<folly::IOThreadPoolExecutor> make_io_pool(
+            const std::size_t threads,
+            const std::string& prefix,
+            const util::cpu_list& cpus)
+    {
+        REQUIRE_GREATER(threads, 0);
+        return std::make_shared<folly::IOThreadPoolExecutor>(
+                threads, std::make_shared<placed_thread_factory>(prefix, cpus));
+    }
+}
+#endif
@@ -2,8 +2,9 @@
 #define HENHOUSE_PUT_SERV_H
 
 #include "service/threaded.hpp"
+#include "service/ingest.hpp"
+#include "service/pause.hpp"
 
-#include <sstream>
 #include <ctime>
 
 #include <wangle/bootstrap/ServerBootstrap.h>
@@ -14,33 +15,20 @@
 namespace henhouse::net
 {
     typedef wangle::Pipeline<folly::IOBufQueue&, std::string> put_pipeline;
-    const std::uint64_t TOLERANCE=60*10; //10 minute tolerance
 
     class put_handler : public wangle::HandlerAdapter<std::string> 
     {
         public:
-            put_handler(threaded::server& db) : 
+            put_handler(threaded::server& db, ingest_policy policy) : 
                 wangle::HandlerAdapter<std::string>{}, 
-                _db{db} 
+                _buffer{db, policy} 
             {}
 
         public:
             virtual void read(Context* ctx, std::string msg) override 
             {
-                std::stringstream m{msg};
-
-                std::string key;
-                db::time_type t; 
-                std::int64_t c;
-                m >> key >> c >> t;
-
-                if(key.empty()) return;
-
-                //don't allow puts too far into the future
-                const auto now = std::time(nullptr);
-                if(t > (now + TOLERANCE)) return;
-
-                _db.put(key, t, c);
+                _buffer.add_lines(msg, std::time(nullptr));
+                _pauser.send(ctx, _buffer);
             }
 
             virtual void readException(Context* ctx, folly::exception_wrapper e) override
@@ -51,14 +39,16 @@ namespace henhouse::net
             virtual void readEOF(Context* ctx) override { close(ctx); }
 
         private:
-            threaded::server& _db;
+            ingest_buffer _buffer;
+            read_pauser<put_pipeline> _pauser;
     };
 
     class put_pipeline_factory : public wangle::PipelineFactory<put_pipeline> 
     {
         public:
-            put_pipeline_factory(threaded::server& db) : wangle::PipelineFactory<put_pipeline>{},
-                _db{db} {}
+            put_pipeline_factory(threaded::server& db, ingest_policy policy) : 
+                wangle::PipelineFactory<put_pipeline>{},
+                _db{db}, _policy{policy} {}
 
         public:
             put_pipeline::Ptr newPipeline(std::shared_ptr<folly::AsyncTransportWrapper> sock) 
@@ -67,13 +57,14 @@ namespace henhouse::net
                 pipeline->addBack(wangle::AsyncSocketHandler{sock});
                 pipeline->addBack(wangle::LineBasedFrameDecoder{8192});
                 pipeline->addBack(wangle::StringCodec{});
-                pipeline->addBack(put_handler{_db});
+                pipeline->addBack(put_handler{_db, _policy});
                 pipeline->finalize();
                 return pipeline;
             }
 
         private:
             threaded::server& _db;
+            ingest_policy _policy;
     };
 }
 #endif
@@ -2,6 +2,11 @@
 #define HENHOUSE_QUERY_SERV_H
 
 #include "service/threaded.hpp"
+#include "service/metrics.hpp"
+#include "service/http_put.hpp"
+#include "service/raw.hpp"
+#include "service/snapshot.hpp"
+#include "util/cpu.hpp"
 
 #include <experimental/string_view>
 #include <sstream>
@@ -25,6 +30,7 @@
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/split.hpp>
 
+#include <cmath>
 #include <ctime>
 
 
@@ -74,9 +80,11 @@ namespace henhouse::net
 
     }
 
+    //either a whole series or one diff per window of a payload query
     struct values_result
     {
         stde::string_view key;
+        ht::values_future series;
         std::vector<ht::diff_future> results;
     };
 
@@ -90,11 +98,19 @@ namespace henhouse::net
     {
         stde::string_view key;
         ht::diff_future result;
+        std::vector<ht::diff_future> shifted;  //one per compared offset, invalid if it reaches before 0
+    };
+
+    struct anomaly_result
+    {
+        stde::string_view key;
+        ht::anomaly_future result;
     };
 
     using key_values_result = std::vector<values_result>;
     using summary_results = std::vector<summary_result>;
     using diff_results = std::vector<diff_result>;
+    using anomaly_results = std::vector<anomaly_result>;
 
     class query_request_handler : public proxygen::RequestHandler {
         public:
@@ -123,6 +139,12 @@ namespace henhouse::net
                     on_diff(*_req);
                 else if(_req->getPath() == "/values")
                     on_values(*_req);
+                else if(_req->getPath() == "/anomaly")
+                    on_anomaly(*_req);
+                else if(_req->getPath() == "/raw")
+                    on_raw(*_req);
+                else if(_req->getPath() == "/metrics")
+                    on_metrics();
                 else
                 {
                     proxygen::ResponseBuilder{downstream_}
@@ -176,16 +198,23 @@ namespace henhouse::net
                         results.emplace_back(std::move(r));
                     });
 
-                    for(auto& r: results)
+                    std::vector<db::summary_result> values;
+                    values.reserve(results.size());
+                    for(auto& r: results) values.emplace_back(r.result.get());
+
+                    const auto start = util::now();
+                    for(std::size_t i = 0; i < results.size(); i++)
                     {
                         folly::dynamic s = folly::dynamic::object
-                        ("key", r.key.to_string())
-                        ("stats", summary(r.result.get()));
+                        ("key", results[i].key.to_string())
+                        ("stats", summary(values[i]));
                         out.push_back(std::move(s));
                     }
 
-                    rb.body(folly::toJson(out))
-                        .status(200, "OK")
+                    rb.body(folly::toJson(out));
+                    _db.metrics().render.record(start, util::now());
+
+                    rb.status(200, "OK")
                         .sendWithEOM();
                 }
                 else
@@ -219,25 +248,55 @@ namespace henhouse::net
 
                     if(a > b) std::swap(a, b);
 
+                    const auto offsets = get_offsets(req);
+
+                    //shifted diffs go to the key's worker right behind the base one
                     diff_results results;
                     for_each_key(keys, [&](const stde::string_view & key)
                     {
                         diff_result r{key, _db.diff(key, a, b, NO_OFFSET)};
+                        for(const auto& o : offsets)
+                            r.shifted.emplace_back(a >= o.seconds ? 
+                                    _db.diff(key, a - o.seconds, b - o.seconds, NO_OFFSET) : 
+                                    ht::diff_future{});
                         results.emplace_back(std::move(r));
                     });
 
                     folly::dynamic out = folly::dynamic::array();
 
-                    for(auto& r: results)
+                    std::vector<db::diff_result> values;
+                    values.reserve(results.size());
+                    for(auto& r: results) values.emplace_back(r.result.get());
+
+                    std::vector<std::vector<db::diff_result>> shifted(results.size());
+                    for(std::size_t i = 0; i < results.size(); i++)
+                        for(auto& f : results[i].shifted) 
+                            shifted[i].emplace_back(f.valid() ? f.get() : db::diff_result{});
+
+                    const auto start = util::now();
+                    for(std::size_t i = 0; i < results.size(); i++)
                     {
                         folly::dynamic s = folly::dynamic::object
-                            ("key", r.key.to_string())
-                            ("stats", diff(r.result.get()));
+                            ("key", results[i].key.to_string())
+                            ("stats", diff(values[i]));
+
+                        if(!offsets.empty()) 
+                        {
+                            folly::dynamic c = folly::dynamic::object;
+                            for(std::size_t j = 0; j < offsets.size(); j++)
+                                c[offsets[j].name] = a >= offsets[j].seconds ? 
+                                    compared_diff(values[i], shifted[i][j]) : 
+                                    folly::dynamic(nullptr);
+                            s["stats"]["compare"] = std::move(c);
+                        }
+
                         out.push_back(std::move(s));
                     }
 
-                    rb.body(folly::toJson(out))
-                        .status(200, "OK")
+                    rb.body(folly::toJson(out));
+                    _db.metrics().render.record(start, util::now());
+
+                    rb.status(200, "OK")
                         .sendWithEOM();
                 }
                 else
@@ -246,19 +305,119 @@ namespace henhouse::net
                 }
             }
 
-            using extract_func_t = std::function<std::string(const hdb::diff_result& r)>;
-            extract_func_t get_extract_func(proxygen::HTTPMessage& req)
+            void on_anomaly(proxygen::HTTPMessage& req) 
             {
                 using boost::lexical_cast;
-                extract_func_t f = [](const hdb::diff_result& r) { return lexical_cast<std::string>(r.sum);};
-                if(req.hasQueryParam("mean")) 
-                    f = [](const hdb::diff_result& r) { return lexical_cast<std::string>(r.mean);};
-                else if(req.hasQueryParam("var"))
-                    f = [](const hdb::diff_result& r) { return lexical_cast<std::string>(r.variance);}; 
-                else if(req.hasQueryParam("agg"))
-                    f = [](const hdb::diff_result& r) { return lexical_cast<std::string>(r.right.integral);};
-
-                return f;
+                auto rb = proxygen::ResponseBuilder{downstream_};
+
+                if(!req.hasQueryParam("keys"))
+                {
+                    rb.status(400, "Missing keys parameter").sendWithEOM();
+                    return;
+                }
+
+                auto keys = req.getQueryParam("keys");
+                if(keys.empty()) 
+                {
+                    rb.status(400, "The Keys parameter must be a comma separated list").sendWithEOM();
+                    return;
+                }
+
+                hdb::anomaly_query q;
+                q.a = req.hasQueryParam("a") ? 
+                    lexical_cast<std::uint64_t>(req.getQueryParam("a")) :
+                    0;
+
+                q.b = req.hasQueryParam("b") ? 
+                    lexical_cast<std::uint64_t>(req.getQueryParam("b")) : 
+                    std::time(0);
+
+                if(q.a > q.b) std::swap(q.a, q.b);
+
+                q.step = req.hasQueryParam("step") ?
+                    lexical_cast<std::uint64_t>(req.getQueryParam("step")) :
+                    60;
+
+                q.window = req.hasQueryParam("window") ?
+                    lexical_cast<std::uint64_t>(req.getQueryParam("window")) :
+                    60 * q.step;
+
+                q.threshold = req.hasQueryParam("threshold") ?
+                    lexical_cast<hdb::mean_type>(req.getQueryParam("threshold")) :
+                    0;
+
+                if(q.step < 1) throw bad_request( SMALL_PRECISION_STEP_ERROR );
+                if(q.window < 1) throw bad_request{"cannot go beyond second precision, for window"};
+                if(!(q.threshold >= 0)) throw bad_request{"threshold must be positive"};
+                if((q.b - q.a) / q.step > MAX_QUERY_SIZE) throw bad_request( QUERY_TOO_LARGE );
+
+                anomaly_results results;
+                for_each_key(keys, [&](const stde::string_view & key)
+                {
+                    anomaly_result r{key, _db.anomaly(key, q)};
+                    results.emplace_back(std::move(r));
+                });
+
+                std::vector<db::anomalies> values;
+                values.reserve(results.size());
+                for(auto& r: results) values.emplace_back(r.result.get());
+
+                const auto start = util::now();
+
+                folly::dynamic out = folly::dynamic::object;
+                for(std::size_t i = 0; i < results.size(); i++)
+                {
+                    const auto& v = values[i];
+
+                    folly::dynamic points = folly::dynamic::array();
+                    for(std::size_t p = 0; p < v.times.size(); p++)
+                    {
+                        //unscored steps are null 
+                        const auto z = std::isnan(v.scores[p]) ? folly::dynamic(nullptr) : folly::dynamic(v.scores[p]);
+                        points.push_back(folly::dynamic::object("x", v.times[p])("y", v.means[p])("z", z));
+                    }
+                    out[results[i].key.to_string()] = std::move(points);
+                }
+
+                rb.body(folly::toJson(out));
+                _db.metrics().render.record(start, util::now());
+
+                rb.status(200, "OK")
+                    .sendWithEOM();
+            }
+
+            hdb::value_field get_value_field(proxygen::HTTPMessage& req)
+            {
+                if(req.hasQueryParam("mean")) return hdb::value_field::mean;
+                if(req.hasQueryParam("var")) return hdb::value_field::variance;
+                if(req.hasQueryParam("agg")) return hdb::value_field::agg;
+                return hdb::value_field::sum;
+            }
+
+            hdb::transforms get_transforms(proxygen::HTTPMessage& req)
+            try
+            {
+                return req.hasQueryParam("fn") ? hdb::parse_transforms(req.getQueryParam("fn")) : hdb::transforms{};
+            }
+            catch(std::exception& e)
+            {
+                throw bad_request{e.what()};
+            }
+
+            hdb::period_offsets get_offsets(proxygen::HTTPMessage& req)
+            try
+            {
+                return req.hasQueryParam("compare") ? hdb::parse_offsets(req.getQueryParam("compare")) : hdb::period_offsets{};
+            }
+            catch(std::exception& e)
+            {
+                throw bad_request{e.what()};
+            }
+
+            //missing values, like the first derivative, are null
+            static std::string format_value(hdb::mean_type v)
+            {
+                return std::isnan(v) ? std::string{"null"} : boost::lexical_cast<std::string>(v);
             }
 
             void on_values(proxygen::HTTPMessage& req)
@@ -277,7 +436,10 @@ namespace henhouse::net
                         return;
                     }
 
-                    auto extract_func = get_extract_func(req);
+                    const auto field = get_value_field(req);
+                    const auto fns = get_transforms(req);
+                    const auto offsets = get_offsets(req);
+                    const bool ratio = req.hasQueryParam("ratio");
 
                     bool is_csv = req.hasQueryParam("csv");
 
@@ -311,6 +473,9 @@ namespace henhouse::net
                             return;
                         }
 
+                        if(!fns.empty()) throw bad_request{"transforms need evenly stepped values, not a payload"};
+                        if(!offsets.empty()) throw bad_request{"compare needs evenly stepped values, not a payload"};
+
                         for_each_key(keys, [&](const stde::string_view& key) 
                         {
                             results.emplace_back(query_values(key, payload));
@@ -338,12 +503,12 @@ namespace henhouse::net
 
                         for_each_key(keys, [&](const stde::string_view& key)
                         {
-                            results.emplace_back(query_values(key, a, b, step, segment_size));
+                            results.emplace_back(query_values(key, a, b, step, segment_size, field, fns, offsets, ratio));
                         });
                     }
 
                     //render values as results come in
-                    render_values(results, rb, keys, render_func, extract_func, is_csv);
+                    render_values(results, rb, keys, render_func, field, offsets, is_csv);
                     rb.sendWithEOM();
                 }
                 else
@@ -352,6 +517,41 @@ namespace henhouse::net
                 }
             }
 
+            void on_raw(proxygen::HTTPMessage& req)
+            {
+                using boost::lexical_cast;
+
+                const auto key = req.getQueryParam("key");
+                if(key.empty()) throw bad_request{"Missing key parameter"};
+
+                auto a = req.hasQueryParam("a") ? 
+                    lexical_cast<std::uint64_t>(req.getQueryParam("a")) :
+                    0;
+
+                auto b = req.hasQueryParam("b") ? 
+                    lexical_cast<std::uint64_t>(req.getQueryParam("b")) : 
+                    std::time(0);
+
+                if(a > b) std::swap(a, b);
+
+                auto body = _db.raw(key, a, b).get();
+
+                proxygen::ResponseBuilder{downstream_}
+                    .status(200, "OK")
+                    .header("Content-Type", "application/octet-stream")
+                    .body(std::move(body))
+                    .sendWithEOM();
+            }
+
+            void on_metrics()
+            {
+                proxygen::ResponseBuilder{downstream_}
+                    .status(200, "OK")
+                    .header("Content-Type", "text/plain; version=0.0.4")
+                    .body(render_metrics(_db))
+                    .sendWithEOM();
+            }
+
             void onUpgrade(proxygen::UpgradeProtocol proto) noexcept override {}
 
             void requestComplete() noexcept override 
@@ -366,6 +566,7 @@ namespace henhouse::net
 
             folly::dynamic diff(const db::diff_result& r)
             {
+                if(r.is_gauge) return gauge_diff(r);
 
                 folly::dynamic o = folly::dynamic::object
                     ("sum", r.sum)
@@ -384,57 +585,107 @@ namespace henhouse::net
                 return o;
             }
 
+            //a shifted diff with the base sum's ratio to it, null against nothing
+            folly::dynamic compared_diff(const db::diff_result& base, const db::diff_result& shifted)
+            {
+                const auto shifted_sum = hdb::sum_of(shifted);
+
+                folly::dynamic o = diff(shifted);
+                o["ratio"] = shifted_sum != 0 ? folly::dynamic(hdb::sum_of(base) / shifted_sum) : folly::dynamic(nullptr);
+                return o;
+            }
+
+            //gauges render their sums as doubles, counters keep integers
+            folly::dynamic gauge_diff(const db::diff_result& r)
+            {
+                const auto& left = r.gauge_left;
+                const auto& right = r.gauge_right;
+
+                folly::dynamic o = folly::dynamic::object
+                    ("sum", r.gauge_sum)
+                    ("mean", r.mean)
+                    ("variance", r.variance)
+                    ("points", r.size)
+                    ("resolution", r.resolution)
+                    ("left", 
+                     folly::dynamic::object
+                     ("val", left.value)
+                     ("agg", left.integral + left.integral_error))
+                    ("right", 
+                     folly::dynamic::object
+                     ("val", right.value)
+                     ("agg", right.integral + right.integral_error));
+                return o;
+            }
+
             folly::dynamic summary(const db::summary_result& r)
             {
                 folly::dynamic o = folly::dynamic::object
                     ("from", r.from)
                     ("to", r.to)
                     ("resolution", r.resolution)
-                    ("sum", r.sum)
+                    ("sum", r.is_gauge ? folly::dynamic(r.gauge_sum) : folly::dynamic(r.sum))
                     ("mean", r.mean)
                     ("variance", r.variance)
                     ("points", r.size);
                 return o;
             }
 
-            template<typename render_func, typename extract_func>
+            template<typename render_func>
                 void render_values(
                         key_values_result& results,
                         proxygen::ResponseBuilder& rb,
                         const std::string& keys, 
                         render_func render_value,
-                        extract_func extract_value,
+                        hdb::value_field field,
+                        const hdb::period_offsets& offsets,
                         bool is_csv)
                 {
                     //render the result depending on csv vs json
-                    if(is_csv) 
+                    int c = 0;
+                    const auto render_series = [&](
+                            const std::string& name, 
+                            const hdb::series& s, 
+                            const std::vector<hdb::mean_type>& values,
+                            const std::vector<hdb::count_type>& counts)
                     {
-                        for(auto& r: results)
+                        if(is_csv) 
                         {
-                            rb.body(r.key.to_string());
+                            rb.body(name);
                             rb.body(",");
-                            render_key_values(rb, r, render_value, extract_value);
+                            render_key_values(rb, s.times, values, counts, render_value);
                             rb.body("\n");
-                        };
-                    }
-                    else
-                    {
-                        rb.body("{");
-                        int c = 0;
-                        for(auto& r: results)
+                        }
+                        else
                         {
                             if(c != 0) rb.body(",");
                             c++;
 
                             rb.body("\"");
-                            rb.body(r.key.to_string());
+                            rb.body(name);
                             rb.body("\":[");
-                            render_key_values(rb, r, render_value, extract_value);
+                            render_key_values(rb, s.times, values, counts, render_value);
                             rb.body("]");
-                        };
-                        rb.body("}");
-                    }
+                        }
+                    };
 
+                    if(!is_csv) rb.body("{");
+                    for(auto& r: results)
+                    {
+                        const auto s = wait_series(r, field);
+                        const auto key = r.key.to_string();
+                        render_series(key, s, s.values, s.counts);
+
+                        //shifted series follow the key, named after their offset
+                        const std::vector<hdb::count_type> no_counts;
+                        for(std::size_t i = 0; i < offsets.size() && i < s.shifted.size(); i++)
+                            render_series(
+                                    key + "@" + offsets[i].name, 
+                                    s, 
+                                    s.shifted[i], 
+                                    i < s.shifted_counts.size() ? s.shifted_counts[i] : no_counts);
+                    }
+                    if(!is_csv) rb.body("}");
                 }
 
                 //query even buckets based on step and segment size from a to b
@@ -443,7 +694,11 @@ namespace henhouse::net
                         hdb::time_type a, 
                         hdb::time_type b,
                         hdb::time_type step,
-                        hdb::time_type segment_size)
+                        hdb::time_type segment_size,
+                        hdb::value_field field,
+                        const hdb::transforms& fns,
+                        const hdb::period_offsets& offsets,
+                        bool ratio)
                 {
                     if(step < 1) throw bad_request( SMALL_PRECISION_STEP_ERROR );
                     if(segment_size < 1) throw bad_request( SMALL_PRECISION_SIZE_ERROR );
@@ -451,24 +706,19 @@ namespace henhouse::net
                     a = std::max(segment_size, a);
                     b = std::max(step, b);
 
-                    //output all but last
-                    auto s = a - segment_size;
-                    const auto e = b - step;
-
-                    const auto query_size = (b - a) / step;
+                    //every compared offset is as many values again
+                    const auto query_size = (b - a) / step * (offsets.size() + 1);
                     if(query_size > MAX_QUERY_SIZE) throw bad_request( QUERY_TOO_LARGE );
 
-                    //create place to put future results 
+                    hdb::series_query q{a, b, step, segment_size, field, fns};
+                    for(const auto& o : offsets) q.offsets.push_back(o.seconds);
+                    q.ratio = ratio;
+                    q.now = std::time(0);
+
+                    //the owning worker diffs every window, shifted ones too, in one request
                     values_result r;
                     r.key = key;
-                    r.results.reserve(query_size);
-
-                    //query db async storing the futures
-                    for(; a <= e; s+=step, a+=step)
-                        r.results.emplace_back(_db.diff(key, s, a, PREV_INDEX_OFFSET));
-
-                    //query last
-                    r.results.emplace_back(_db.diff(key, s, b, PREV_INDEX_OFFSET));
+                    r.series = _db.values(key, q);
 
                     return r;
                 }
@@ -504,23 +754,58 @@ namespace henhouse::net
                     throw bad_request("Expected the payload to be an array of integers");
                 }
 
-            template<typename render_func, typename extract_func>
+            //wait for all results of the key so render time
+            //does not include time spent in the DB.
+            hdb::series wait_series(values_result& r, hdb::value_field field)
+            {
+                REQUIRE_FALSE(r.key.empty());
+                REQUIRE(r.series.valid() || !r.results.empty());
+
+                if(r.series.valid()) return r.series.get();
+
+                hdb::series s;
+                s.times.reserve(r.results.size());
+                s.values.reserve(r.results.size());
+                for(auto& f : r.results) 
+                {
+                    const auto v = f.get();
+                    s.times.push_back(v.a);
+                    s.values.push_back(hdb::extract(v, field));
+                    if(hdb::is_count(v, field)) s.counts.push_back(hdb::extract_count(v, field));
+                }
+
+                //a timeline is either kind, but keep counts only if all are
+                if(s.counts.size() != s.values.size()) s.counts.clear();
+                return s;
+            }
+
+            template<typename render_func>
                 void render_key_values(
                         proxygen::ResponseBuilder& rb,
-                        values_result& r,
-                        render_func render_value,
-                        extract_func extract_value)
+                        const std::vector<hdb::time_type>& times,
+                        const std::vector<hdb::mean_type>& values,
+                        const std::vector<hdb::count_type>& counts,
+                        render_func render_value)
                 {
-                    REQUIRE_FALSE(r.key.empty());
-                    REQUIRE_FALSE(r.results.empty());
+                    REQUIRE_EQUAL(times.size(), values.size());
+                    REQUIRE(counts.empty() || counts.size() == values.size());
+                    if(values.empty()) return;
+
+                    const auto start = util::now();
+
+                    //counts are rendered exactly instead of as doubles, missing values stay null
+                    const auto format = [&](std::size_t i)
+                    {
+                        return counts.empty() || std::isnan(values[i]) ? 
+                            format_value(values[i]) : 
+                            std::to_string(counts[i]);
+                    };
 
                     //process results and output to client
                     int c = 0;
-                    for(size_t i = 0; i < r.results.size() - 1; i++, c++) 
+                    for(size_t i = 0; i < values.size() - 1; i++, c++) 
                     {
-                        const auto v = r.results[i].get(); 
-
-                        render_value(rb, v.a, extract_value(v));
+                        render_value(rb, times[i], format(i));
                         rb.body(",");
                         //50 here should roughly be 1k for xy request, though likely larger.
                         //TODO don't use RequestBuilder, do it yourself.
@@ -528,8 +813,9 @@ namespace henhouse::net
                     }
 
                     //output last
-                    const auto lv = r.results[r.results.size() -1].get();
-                    render_value(rb, lv.a, extract_value(lv));
+                    render_value(rb, times.back(), format(values.size() - 1));
+
+                    _db.metrics().render.record(start, util::now());
                 }
 
         private:
@@ -542,8 +828,14 @@ namespace henhouse::net
     class query_handler_factory : public proxygen::RequestHandlerFactory 
     {
         public:
-            query_handler_factory(threaded::server& db, const std::size_t max_values) : 
-                proxygen::RequestHandlerFactory{}, _db{db}, _max_values{max_values} {}
+            query_handler_factory(
+                    threaded::server& db, 
+                    const std::size_t max_values,
+                    const ingest_policy policy,
+                    const std::string& snapshot_dir,
+                    const util::cpu_list& cpus = {}) : 
+                proxygen::RequestHandlerFactory{}, _db{db}, _max_values{max_values}, _policy{policy}, 
+                _snapshot_dir{snapshot_dir}, _cpus{cpus} {}
 
         public:
 
@@ -551,15 +843,30 @@ namespace henhouse::net
                     proxygen::RequestHandler* r, 
                     proxygen::HTTPMessage* m) noexcept override 
             {
+                if(m->getPath() == "/put") return new put_request_handler(_db, _policy);
+                if(m->getPath() == "/snapshot") return new snapshot_request_handler(_db, _snapshot_dir);
                 return new query_request_handler(_db, _max_values);
             }
 
-            void onServerStart(folly::EventBase* evb) noexcept { } 
+            //called on each http IO thread before it handles requests
+            void onServerStart(folly::EventBase* evb) noexcept 
+            try
+            { 
+                _cpus.place_current_thread();
+            } 
+            catch(std::exception& e)
+            {
+                std::cerr << "unable to place query thread: " << e.what() << std::endl;
+            }
+
             void onServerStop() noexcept { }
 
         private:
             threaded::server& _db;
             const std::size_t _max_values;
+            const ingest_policy _policy;
+            const std::string _snapshot_dir;
+            util::cpu_rotation _cpus;
     };
 }
 #endif
@@ -0,0 +1,87 @@
+#include "service/raw.hpp"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace henhouse::net
+{
+    namespace
+    {
+        void unmap(void* p, void* size)
+        {
+            munmap(p, reinterpret_cast<std::size_t>(size));
+        }
+
+        /**
+         * Maps length bytes at offset of the file read only and wraps them 
+         * in an IOBuf that owns the mapping.
+         */
+        std::unique_ptr<folly::IOBuf> map_range(const std::string& file, std::size_t offset, std::size_t length)
+        {
+            REQUIRE_GREATER(length, 0);
+
+            const std::size_t page = sysconf(_SC_PAGESIZE);
+            const auto aligned = offset - (offset % page);
+            const auto skip = offset - aligned;
+            const auto size = skip + length;
+
+            const int fd = open(file.c_str(), O_RDONLY);
+            if(fd < 0) throw std::runtime_error{"unable to open " + file};
+
+            void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, aligned);
+            close(fd);
+            if(p == MAP_FAILED) throw std::runtime_error{"unable to map " + file};
+
+            return folly::IOBuf::takeOwnership(p, size, skip, length, unmap, reinterpret_cast<void*>(size));
+        }
+
+        template <class meta, class item>
+            void append_items(
+                    folly::IOBuf& body, 
+                    const std::string& file, 
+                    db::offset_type begin, 
+                    db::offset_type end)
+            {
+                if(begin >= end) return;
+                body.prependChain(map_range(file, sizeof(meta) + begin * sizeof(item), (end - begin) * sizeof(item)));
+            }
+    }
+
+    std::unique_ptr<folly::IOBuf> raw_body(const db::raw_result& r, db::time_type a, db::time_type b)
+    {
+        const auto& range = r.range;
+        REQUIRE_LESS_EQUAL(range.index_begin, range.index_end);
+        REQUIRE_LESS_EQUAL(range.data_begin, range.data_end);
+
+        raw_header h;
+        std::memcpy(h.magic, RAW_MAGIC, sizeof(h.magic));
+        h.version = RAW_VERSION;
+        h.index_item_size = sizeof(db::index_item);
+        h.data_item_size = db::data_item_size(r.width);
+        h.resolution = range.resolution;
+        h.a = a;
+        h.b = b;
+        h.index_count = range.index_end - range.index_begin;
+        h.data_count = range.data_end - range.data_begin;
+        h.data_pos = range.data_begin;
+
+        auto body = folly::IOBuf::copyBuffer(&h, sizeof(h));
+        append_items<db::index_metadata, db::index_item>(*body, r.index_file, range.index_begin, range.index_end);
+        switch(r.width)
+        {
+            case db::item_width::wide:
+                append_items<db::data_metadata, db::data_item>(*body, r.data_file, range.data_begin, range.data_end);
+                break;
+            case db::item_width::compact:
+                append_items<db::data_metadata, db::data_item32>(*body, r.data_file, range.data_begin, range.data_end);
+                break;
+            case db::item_width::gauge:
+                append_items<db::data_metadata, db::gauge_item>(*body, r.data_file, range.data_begin, range.data_end);
+                break;
+        }
+        return body;
+    }
+}
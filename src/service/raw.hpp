@@ -0,0 +1,47 @@
+#ifndef HENHOUSE_RAW_SERV_H
+#define HENHOUSE_RAW_SERV_H
+
+#include "db/db.hpp"
+
+#include <memory>
+
+#include <folly/io/IOBuf.h>
+
+namespace henhouse::net
+{
+    const std::uint32_t RAW_VERSION = 1;
+    const char RAW_MAGIC[4] = {'H', 'H', 'R', 'W'};
+
+    /**
+     * Leads every /raw response. The header is followed by index_count
+     * index items and then data_count data items, all in the host's byte
+     * order and layout as described by the item sizes. Index item positions
+     * are positions in the whole timeline, data_pos is the position of the
+     * first data item sent.
+     */
+    struct raw_header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t index_item_size;
+        std::uint32_t data_item_size;
+        std::uint64_t resolution;
+        std::uint64_t a;
+        std::uint64_t b;
+        std::uint64_t index_count;
+        std::uint64_t data_count;
+        std::uint64_t data_pos;
+    };
+
+    static_assert(sizeof(raw_header) == 64, "raw header layout is part of the protocol");
+
+    /**
+     * Builds a /raw response body. Items are not copied, the body points
+     * straight at read only mappings of the timeline files which are unmapped
+     * when the body is freed. Must run where the files can't be replaced,
+     * on the worker owning the timeline. Buckets near the end of the 
+     * timeline may still change while the body is being sent.
+     */
+    std::unique_ptr<folly::IOBuf> raw_body(const db::raw_result& r, db::time_type a, db::time_type b);
+}
+#endif
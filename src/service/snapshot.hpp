@@ -0,0 +1,164 @@
+#ifndef HENHOUSE_SNAPSHOT_SERV_H
+#define HENHOUSE_SNAPSHOT_SERV_H
+
+#include "service/threaded.hpp"
+
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+#include <folly/json.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+
+namespace henhouse::net
+{
+    /**
+     * Handles POST /snapshot?name=<name>. Takes a snapshot of the data 
+     * directory into name under the snapshot directory. The snapshot runs
+     * on its own thread so the IO thread keeps serving other requests, and
+     * the response is sent back on the IO thread once it is done.
+     */
+    class snapshot_request_handler : public proxygen::RequestHandler
+    {
+        public:
+            snapshot_request_handler(threaded::server& db, const std::string& dir) :
+                RequestHandler{}, _db{db}, _dir{dir} {}
+
+            void onRequest(std::unique_ptr<proxygen::HTTPMessage> req) noexcept override
+            try
+            {
+                if(_dir.empty())
+                {
+                    respond(404, "Snapshots Disabled");
+                    return;
+                }
+
+                if(req->getMethod() != proxygen::HTTPMethod::POST)
+                {
+                    respond(405, "Method Not Allowed");
+                    return;
+                }
+
+                const auto& name = req->getQueryParam("name");
+                if(name.empty())
+                {
+                    respond(400, "Missing name parameter");
+                    return;
+                }
+
+                std::string safe_name;
+                db::sanatize_key(safe_name, name);
+                _path = (boost::filesystem::path{_dir} / safe_name).string();
+            }
+            catch(std::exception& e)
+            {
+                respond(500, e.what());
+            }
+
+            void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {}
+
+            void onEOM() noexcept override
+            try
+            {
+                if(_responded) return;
+
+                auto* evb = folly::EventBaseManager::get()->getEventBase();
+                _pending = true;
+
+                std::thread{[this, evb]
+                {
+                    threaded::snapshot_result r;
+                    std::uint16_t code = 200;
+                    std::string error;
+                    try
+                    {
+                        r = _db.snapshot(_path);
+                    }
+                    catch(threaded::snapshot_conflict& e)
+                    {
+                        code = 409;
+                        error = e.what();
+                    }
+                    catch(std::exception& e)
+                    {
+                        code = 500;
+                        error = e.what();
+                    }
+
+                    evb->runInEventBaseThread([this, r, code, error]
+                    {
+                        _pending = false;
+                        if(_detached) 
+                        {
+                            delete this;
+                            return;
+                        }
+
+                        if(code == 200) done(r);
+                        else respond(code, error);
+                    });
+                }}.detach();
+            }
+            catch(std::exception& e)
+            {
+                _pending = false;
+                respond(500, e.what());
+            }
+
+            void onUpgrade(proxygen::UpgradeProtocol proto) noexcept override {}
+
+            void requestComplete() noexcept override 
+            { 
+                delete this;
+            }
+
+            //the snapshot thread still refers to the handler, so it deletes it when done
+            void onError(proxygen::ProxygenError err) noexcept override 
+            { 
+                if(_pending) _detached = true;
+                else delete this;
+            }
+
+        private:
+
+            void done(const threaded::snapshot_result& r)
+            {
+                folly::dynamic out = folly::dynamic::object
+                    ("path", r.path)
+                    ("files", static_cast<std::int64_t>(r.copied.files))
+                    ("reflinked", static_cast<std::int64_t>(r.copied.reflinked))
+                    ("bytes", static_cast<std::int64_t>(r.copied.bytes))
+                    ("dirty", static_cast<std::int64_t>(r.dirty))
+                    ("max_pause_ms", r.max_pause / 1000000.0);
+
+                _responded = true;
+                proxygen::ResponseBuilder{downstream_}
+                    .status(200, "OK")
+                    .header("Content-Type", "application/json")
+                    .body(folly::toJson(out))
+                    .sendWithEOM();
+            }
+
+            void respond(const std::uint16_t code, const std::string& reason)
+            {
+                if(_responded) return;
+                _responded = true;
+
+                proxygen::ResponseBuilder{downstream_}
+                    .status(code, reason)
+                    .sendWithEOM();
+            }
+
+        private:
+            threaded::server& _db;
+            const std::string& _dir;
+            std::string _path;
+            bool _pending = false;
+            bool _detached = false;
+            bool _responded = false;
+    };
+}
+#endif
@@ -1,38 +1,199 @@
 #include "service/threaded.hpp"
 
+#include <deque>
+#include <fstream>
+#include <functional>
+
 namespace henhouse::threaded
 {
     const std::size_t QUEUE_SIZE = 1000;
+    const int NO_CPU = -1;
+    const db::offset_type NO_OFFSET = 0;
+
+    //how long a worker holding reads for a full owner queue waits on its own
+    const std::chrono::microseconds HAND_BACK_WAIT{100};
 
     worker::worker(
-            const std::string & root, 
+            const db::data_roots& roots, 
             const std::size_t queue_size, 
             const std::size_t cache_size,
             const db::time_type new_timeline_resolution,
+            const durability mode,
+            const late_options& late,
+            const boost::filesystem::path& late_spill,
+            const coalesce_options& coalesce,
+            const db::gap_policy& gaps,
+            const db::item_width width,
+            const std::string& gauge_keys,
+            const db::storage_schemas& schemas,
             bool* done) : 
-        _db{root, cache_size, new_timeline_resolution}, _queue{queue_size}, _done{done}
+        _queue{queue_size}, _mode{mode}, _late_max{late.max_points}, 
+        _coalesce_interval{coalesce.interval}, _done{done},
+        _db{roots, cache_size, new_timeline_resolution, coalesce.interval.count() > 0 ? coalesce.slots : 0, gaps, width, gauge_keys, schemas}
     {
         REQUIRE(done);
         REQUIRE_GREATER(queue_size, 0);
         REQUIRE_GREATER(cache_size, 0);
         REQUIRE_GREATER(new_timeline_resolution, 0);
+
+        if(late.interval.count() > 0) _late = std::make_unique<db::late_points>(late_spill);
+    }
+
+    dirty_keys worker::take_dirty()
+    {
+        dirty_keys keys{_dirty.begin(), _dirty.end()};
+        _dirty.clear();
+        _tracking = false;
+        return keys;
+    }
+
+    void worker::sync()
+    {
+        if(_late) _late->flush();
+
+        for(auto k = _unsynced.begin(); k != _unsynced.end();)
+        try
+        {
+            _db.sync(*k);
+            _synced.fetch_add(1, std::memory_order_relaxed);
+            k = _unsynced.erase(k);
+        }
+        catch(std::exception& e)
+        {
+            //kept to retry on the next sync
+            std::cerr << "Error syncing: " << *k << ": " << e.what() << std::endl;
+            k++;
+        }
+    }
+
+    bool worker::coalesce_due() const
+    {
+        return _db.has_coalesced() && std::chrono::steady_clock::now() >= _next_coalesce;
+    }
+
+    void worker::flush_coalesced()
+    {
+        _db.flush_coalesced();
+        _next_coalesce = std::chrono::steady_clock::now() + _coalesce_interval;
+    }
+
+    void worker::stage_late(const std::string& key, db::time_type t, db::count_type c)
+    {
+        if(!_late) 
+        {
+            count_rejected();
+            return;
+        }
+
+        _late->add(key, t, c);
+        _late_pending.store(_late->size(), std::memory_order_relaxed);
+
+        if(_late->size() >= _late_max) merge_late();
+    }
+
+    void worker::merge_late()
+    {
+        //a running snapshot only recopies the tails of timelines written 
+        //during it, so rewriting whole timelines waits until it is done
+        if(!_late || _late->size() == 0 || _tracking) return;
+
+        _late->flush();
+        auto staged = _late->take();
+
+        db::key_points failed;
+        for(auto& k : staged)
+        try
+        {
+            const auto r = _db.merge(k.first, k.second);
+            _db.sync(k.first);
+
+            _late_merged.fetch_add(r.merged, std::memory_order_relaxed);
+            _rejected.fetch_add(r.rejected + r.gauge, std::memory_order_relaxed);
+        }
+        catch(std::exception& e)
+        {
+            std::cerr << "Error merging late points: " << k.first << ": " << e.what() << std::endl;
+            failed.emplace(k.first, std::move(k.second));
+        }
+
+        //merged points are on disk, so only the failed ones stay spilled
+        _late->clear_spill();
+        for(const auto& k : failed)
+            for(const auto& p : k.second) _late->add(k.first, p.time, p.count);
+
+        _late_pending.store(_late->size(), std::memory_order_relaxed);
+    }
+
+    std::size_t worker::apply_retention(const std::vector<std::string>& keys, db::time_type now)
+    {
+        //rewrites wait for a running snapshot like merges do
+        if(_tracking) return 0;
+
+        std::size_t dropped = 0;
+        for(const auto& k : keys)
+        try
+        {
+            const auto r = _db.apply_retention(k, now);
+            if(r.dropped == 0) continue;
+
+            _db.sync(k);
+            dropped += r.dropped;
+        }
+        catch(std::exception& e)
+        {
+            std::cerr << "Error applying retention: " << k << ": " << e.what() << std::endl;
+        }
+
+        return dropped;
+    }
+
+    durability parse_durability(const std::string& d)
+    {
+        if(d == "none") return durability::none;
+        if(d == "periodic") return durability::periodic;
+        if(d == "on_batch") return durability::on_batch;
+        throw std::runtime_error{"unknown durability " + d + ", expected none, periodic or on_batch"};
     }
 
     struct req_processeor
     {
         worker* w;
 
-        void operator()(put_req& r)
+        void put(put_req& r)
         try
         {
             INVARIANT(w);
             REQUIRE_GREATER(r.key.size(), 0);
-            w->db().put(r.key.data(), r.time, r.count);
+            //late points are staged as counts, so fractions are never late
+            if(!w->db().put(r.key.data(), r.time, r.value))
+            {
+                if(r.value.fractional) w->count_rejected();
+                else w->stage_late(r.key, r.time, r.value.count);
+            }
+            w->mark_dirty(r.key);
         }
         catch(std::exception& e) 
         {
-            std::cerr << "Error putting data: " << r.key << " " << r.count 
-                << " " << r.count << ": " << e.what() << std::endl;
+            std::cerr << "Error putting data: " << r.key << " " << r.time 
+                << " " << r.value.gauge << ": " << e.what() << std::endl;
+        }
+
+        void operator()(put_req& r)
+        {
+            put(r);
+            w->count_write_applied();
+        }
+
+        void operator()(put_batch_req& r)
+        {
+            for(auto& i : r.items)
+            {
+                put_req p{std::move(i.key), i.time, i.value, r.queued};
+                put(p);
+            }
+            w->count_write_applied();
+
+            if(w->mode() == durability::on_batch) w->sync();
         }
 
         void operator()(get_req& r)
@@ -76,22 +237,321 @@ namespace henhouse::threaded
                 << ": " << e.what() << std::endl;
             r.result.set_value(db::summary_result{});
         }
+
+        void operator()(raw_req& r)
+        try
+        {
+            INVARIANT(w);
+            REQUIRE_GREATER(r.key.size(), 0);
+            r.result.set_value(net::raw_body(w->db().raw(r.key, r.a, r.b), r.a, r.b));
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error finding raw data: " << r.key
+                << " (" << r.a << ", " << r.b << "): " << e.what() << std::endl;
+            r.result.set_value(net::raw_body(db::raw_result{}, r.a, r.b));
+        }
+
+        void operator()(track_req& r)
+        {
+            INVARIANT(w);
+            w->track();
+            r.started.set_value();
+        }
+
+        void operator()(pause_req& r)
+        {
+            INVARIANT(w);
+            w->flush_coalesced();
+            r.paused.set_value(w->take_dirty());
+            r.release.wait();
+        }
+
+        void operator()(sync_req& r)
+        {
+            INVARIANT(w);
+            w->sync();
+            r.synced.set_value();
+        }
+
+        void operator()(warm_req& r)
+        try
+        {
+            INVARIANT(w);
+            REQUIRE_GREATER(r.key.size(), 0);
+            w->db().warm(r.key);
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error warming: " << r.key << ": " << e.what() << std::endl;
+        }
+
+        void operator()(hot_req& r)
+        {
+            INVARIANT(w);
+            r.keys.set_value(w->db().hot_keys());
+        }
+
+        void operator()(merge_req& r)
+        {
+            INVARIANT(w);
+            w->merge_late();
+            r.merged.set_value();
+        }
+
+        void operator()(retention_req& r)
+        {
+            INVARIANT(w);
+            r.dropped.set_value(w->apply_retention(r.keys, r.now));
+        }
+
+        void operator()(values_req& r)
+        try
+        {
+            INVARIANT(w);
+            REQUIRE_GREATER(r.key.size(), 0);
+            r.result.set_value(w->db().values(r.key, r.query));
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error querying values: " << r.key
+                << " (" << r.query.a << ", " << r.query.b << "): " << e.what() << std::endl;
+            r.result.set_value(db::series{});
+        }
+
+        void operator()(anomaly_req& r)
+        try
+        {
+            INVARIANT(w);
+            REQUIRE_GREATER(r.key.size(), 0);
+            r.result.set_value(w->db().anomaly(r.key, r.query));
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error scoring anomalies: " << r.key
+                << " (" << r.query.a << ", " << r.query.b << "): " << e.what() << std::endl;
+            r.result.set_value(db::anomalies{});
+        }
+
+        void operator()(wake_req&) {}
+        void operator()(stop_req&) {}
+    };
+
+    /**
+     * Evaluates reads stolen from another worker. The owner's timeline is
+     * used read only under a shared lock and without promoting it in the
+     * owner's cache. If the owner does not have the timeline open, or has
+     * not yet applied the writes sent to it before the read, the read is 
+     * left in place and marked handed back, for the thief to queue behind
+     * those writes without blocking on the owner's queue.
+     */
+    struct steal_processor
+    {
+        worker* owner;
+        std::uint64_t writes;
+        bool handed_back = false;
+
+        template <class request, class eval_func>
+            void steal(request& r, eval_func eval)
+            {
+                INVARIANT(owner);
+                REQUIRE_GREATER(r.key.size(), 0);
+
+                if(owner->writes_applied() >= writes)
+                {
+                    folly::SharedMutex::ReadHolder l{owner->lock()};
+                    const auto* tl = owner->db().find(r.key);
+                    if(tl) 
+                    {
+                        eval(*tl);
+                        return;
+                    }
+                }
+
+                handed_back = true;
+            }
+
+        void operator()(get_req& r)
+        try
+        {
+            steal(r, [&](const db::any_timeline& tl) { r.result.set_value(tl.get(r.time, NO_OFFSET));});
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error getting stolen data: " << r.key 
+                << " " << r.time << ": " << e.what() << std::endl;
+            r.result.set_value(db::get_result{});
+        }
+
+        void operator()(diff_req& r)
+        try
+        {
+            steal(r, [&](const db::any_timeline& tl) { r.result.set_value(tl.diff(r.a, r.b, r.index_offset));});
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error diffing stolen data: " << r.key
+                << " (" << r.a << ", " << r.b << "): " << e.what() << std::endl;
+            r.result.set_value(db::diff_result{});
+        }
+
+        void operator()(summary_req& r)
+        try
+        {
+            steal(r, [&](const db::any_timeline& tl) { r.result.set_value(tl.summary());});
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error summing stolen data: " << r.key
+                << ": " << e.what() << std::endl;
+            r.result.set_value(db::summary_result{});
+        }
+
+        void operator()(values_req& r)
+        try
+        {
+            steal(r, [&](const db::any_timeline& tl) { r.result.set_value(db::query_series(tl, r.query));});
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error querying stolen values: " << r.key
+                << " (" << r.query.a << ", " << r.query.b << "): " << e.what() << std::endl;
+            r.result.set_value(db::series{});
+        }
+
+        void operator()(anomaly_req& r)
+        try
+        {
+            steal(r, [&](const db::any_timeline& tl) { r.result.set_value(db::query_anomalies(tl, r.query));});
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error scoring stolen anomalies: " << r.key
+                << " (" << r.query.a << ", " << r.query.b << "): " << e.what() << std::endl;
+            r.result.set_value(db::anomalies{});
+        }
+
+        //writes are never stolen, they always stay with the owner.
+        void operator()(put_req&) { handed_back = true; }
+        void operator()(put_batch_req&) { handed_back = true; }
+
+        //raw needs the owner's root, which only the owner's db knows.
+        void operator()(raw_req&) { handed_back = true; }
+
+        //never sent through the steal queue
+        void operator()(track_req&) {}
+        void operator()(pause_req&) {}
+        void operator()(sync_req&) {}
+        void operator()(warm_req&) {}
+        void operator()(hot_req&) {}
+        void operator()(merge_req&) {}
+        void operator()(retention_req&) {}
+        void operator()(wake_req&) {}
+        void operator()(stop_req&) {}
     };
 
-    void req_thread(worker* w) 
+    struct queued_at : public boost::static_visitor<util::timestamp>
+    {
+        template <class request>
+            util::timestamp operator()(const request& r) const { return r.queued;}
+    };
+
+    void record(stage_metrics& m, const req& r, util::timestamp start)
+    {
+        const auto queued = boost::apply_visitor(queued_at{}, r);
+
+        CHECK_RANGE(r.which(), 0, m.exec.size());
+        m.queue_wait.record(queued, start);
+        m.exec[r.which()].record(start, util::now());
+    }
+
+    /**
+     * Queues reads handed back to their owners without blocking. A thief 
+     * blocking on a full owner queue could wait on a worker that is itself
+     * blocked on the thief's queue, so reads that don't fit are kept and 
+     * offered again on the next pass. Returns true if none are left.
+     */
+    bool hand_back(std::deque<stolen_req>& handed_back, const workers& peers)
+    {
+        for(auto it = handed_back.begin(); it != handed_back.end();)
+        {
+            CHECK_RANGE(it->owner, 0, peers.size());
+            if(peers[it->owner]->queue().write(std::move(it->r))) it = handed_back.erase(it);
+            else it++;
+        }
+        return handed_back.empty();
+    }
+
+    void req_thread(worker* w, steal_queue* steal, const workers* peers, stage_metrics* m) 
     {
         REQUIRE(w);
+        REQUIRE(steal);
+        REQUIRE(peers);
+        REQUIRE(m);
 
         req_processeor processeor{w};
+        std::deque<stolen_req> handed_back;
 
         auto& q = w->queue();
 
         while(!w->done())
         try
         {
+            const bool all_handed_back = handed_back.empty() || hand_back(handed_back, *peers);
+
             req r;
-            q.blockingRead(r);
-            boost::apply_visitor(processeor, r);
+            if(!q.read(r))
+            {
+                if(w->coalesce_due())
+                {
+                    folly::SharedMutex::WriteHolder l{w->lock()};
+                    w->flush_coalesced();
+                }
+
+                //out of requests, so everything written so far is one batch
+                if(w->mode() == durability::on_batch && w->has_unsynced())
+                {
+                    folly::SharedMutex::WriteHolder l{w->lock()};
+                    w->sync();
+                }
+
+                //nothing of our own to do, help an overloaded worker.
+                //idle is set before looking so a read offered after the 
+                //look sends a wake up.
+                w->set_idle(true);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                stolen_req s;
+                if(steal->read(s))
+                {
+                    w->set_idle(false);
+                    CHECK_RANGE(s.owner, 0, peers->size());
+                    const auto start = util::now();
+                    steal_processor thief{(*peers)[s.owner].get(), s.writes};
+                    boost::apply_visitor(thief, s.r);
+                    if(thief.handed_back) handed_back.emplace_back(std::move(s));
+                    else record(*m, s.r, start);
+                    continue;
+                }
+
+                //park until a request arrives or coalesced puts are due,
+                //or only briefly while reads wait to be handed back
+                bool got = true;
+                if(!all_handed_back) got = q.tryReadUntil(std::chrono::steady_clock::now() + HAND_BACK_WAIT, r);
+                else if(w->db().has_coalesced()) got = q.tryReadUntil(w->next_coalesce(), r);
+                else q.blockingRead(r);
+
+                w->set_idle(false);
+                if(!got) continue;
+            }
+
+            const auto start = util::now();
+            {
+                folly::SharedMutex::WriteHolder l{w->lock()};
+                boost::apply_visitor(processeor, r);
+                if(w->coalesce_due()) w->flush_coalesced();
+            }
+            record(*m, r, start);
         }
         catch (const std::exception& e)
         {
@@ -99,28 +559,138 @@ namespace henhouse::threaded
         }
     }
 
+    /**
+     * Workers are created on their own thread after the thread is placed
+     * so that the queue and cache are allocated on the worker's NUMA node.
+     */
+    void start_worker(
+            const int cpu,
+            const db::data_roots& roots, 
+            const std::size_t queue_size,
+            const std::size_t cache_size,
+            const db::time_type new_timeline_resolution,
+            const durability mode,
+            const late_options& late,
+            const boost::filesystem::path& late_spill,
+            const coalesce_options& coalesce,
+            const db::gap_policy& gaps,
+            const db::item_width width,
+            const std::string& gauge_keys,
+            const db::storage_schemas& schemas,
+            bool* done,
+            steal_queue* steal,
+            const workers* peers,
+            stage_metrics* m,
+            std::promise<worker_ptr> started)
+    {
+        worker* w = nullptr;
+        try
+        {
+            if(cpu != NO_CPU) util::place_current_thread(cpu);
+
+            auto p = std::make_unique<worker>(
+                    roots, queue_size, cache_size, new_timeline_resolution, mode, late, late_spill, coalesce, gaps, width, gauge_keys, schemas, done);
+            w = p.get();
+            started.set_value(std::move(p));
+        }
+        catch(...)
+        {
+            started.set_exception(std::current_exception());
+            return;
+        }
+
+        req_thread(w, steal, peers, m);
+    }
+
     server::server(
             const std::size_t total_workers, 
-            const std::string& root, 
+            const db::data_roots& roots, 
             const std::size_t queue_size,
             const std::size_t cache_size,
-            const db::time_type new_timeline_resolution) : _root{root}, _done{false} 
+            const db::time_type new_timeline_resolution,
+            const util::cpu_list& cpus,
+            const sync_options& sync,
+            const warm_options& warm,
+            const late_options& late,
+            const coalesce_options& coalesce,
+            const db::gap_policy& gaps,
+            const db::item_width width,
+            const std::string& gauge_keys,
+            const db::storage_schemas& schemas,
+            const std::size_t steal_threshold,
+            const retention_options& retention) : 
+        _roots{roots}, _steal{queue_size}, _sync{sync}, _warm{warm}, _late{late}, _coalesce{coalesce}, 
+        _gaps{gaps}, _width{width}, _gauge_keys{gauge_keys}, _schemas{schemas}, 
+        _steal_threshold{steal_threshold}, _retention{retention}, _done{false} 
     {
         REQUIRE_GREATER(total_workers, 0);
+        REQUIRE_FALSE(roots.empty());
         REQUIRE_GREATER(queue_size, 0);
         REQUIRE_GREATER(cache_size, 0);
         REQUIRE_GREATER(new_timeline_resolution, 0);
 
-        auto workers = total_workers;
+        _workers.reserve(total_workers);
+        _threads.reserve(total_workers);
+
+        //points staged before a crash go into their timelines before 
+        //any worker opens them
+        const auto late_dir = _roots.front() / LATE_DIR;
+        if(_late.interval.count() > 0)
+        {
+            db::storage_schema defaults;
+            defaults.resolution = new_timeline_resolution;
+
+            const auto r = db::merge_spill_files(late_dir, _roots, _schemas, defaults);
+            if(r.merged > 0 || r.rejected > 0)
+                std::cerr << "merged " << r.merged << " late points left from the last run, rejected " 
+                    << r.rejected << std::endl;
+        }
 
-        while(--workers)
+        for(std::size_t n = 0; n < total_workers; n++)
+        try
         {
-            auto w = std::make_unique<worker>(_root, queue_size, cache_size, new_timeline_resolution, &_done);
-            auto t = std::make_unique<std::thread>(req_thread, w.get());
+            const int cpu = cpus.empty() ? NO_CPU : cpus[n % cpus.size()];
+
+            std::promise<worker_ptr> started;
+            auto ready = started.get_future();
+
+            auto t = std::make_unique<std::thread>(
+                    start_worker, 
+                    cpu, 
+                    std::cref(_roots), 
+                    queue_size, 
+                    cache_size, 
+                    new_timeline_resolution, 
+                    _sync.mode,
+                    std::cref(_late),
+                    late_dir / std::to_string(n),
+                    std::cref(_coalesce),
+                    std::cref(_gaps),
+                    _width,
+                    std::cref(_gauge_keys),
+                    std::cref(_schemas),
+                    &_done, 
+                    &_steal,
+                    &_workers,
+                    &_metrics,
+                    std::move(started));
 
-            _workers.emplace_back(std::move(w));
             _threads.emplace_back(std::move(t));
+            _workers.emplace_back(ready.get());
         }
+        catch(...)
+        {
+            stop();
+            throw;
+        }
+
+        if(_warm.interval.count() > 0) warm_start();
+
+        if(_sync.mode != durability::none || _warm.interval.count() > 0 || _late.interval.count() > 0 ||
+                _retention.interval.count() > 0) 
+            _background = std::thread{[this] { background_thread();}};
+
+        ENSURE_EQUAL(_workers.size(), total_workers);
     }
 
     server::~server()
@@ -132,12 +702,51 @@ namespace henhouse::threaded
     {
         if(_done) return;
 
+        if(_background.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> l{_background_lock};
+                _background_done = true;
+            }
+            _background_wake.notify_all();
+            _background.join();
+
+            //workers still run, so late points get merged, whatever they 
+            //wrote last gets synced and their caches hold the hot keys
+            if(_late.interval.count() > 0) 
+            try
+            {
+                merge_late();
+            }
+            catch(std::exception& e)
+            {
+                std::cerr << "error merging late points: " << e.what() << std::endl;
+            }
+
+            if(_sync.mode != durability::none) sync();
+            if(_warm.interval.count() > 0) 
+            try
+            {
+                save_hot_keys();
+            }
+            catch(std::exception& e)
+            {
+                std::cerr << "error saving hot keys: " << e.what() << std::endl;
+            }
+        }
+
         _done = true;
+
+        //workers check done between requests, so a full queue needs no stop 
+        //request and blocking on it could wait on a worker that already exited
+        for(auto& w : _workers)
+            w->queue().write(stop_req{util::now()});
+
         for(auto& t : _threads)
             t->join();
     }
 
-    void server::put(const stde::string_view& key, db::time_type t, db::count_type c)
+    void server::put(const stde::string_view& key, db::time_type t, const db::put_value& v)
     {
         std::string safe_key;
         safe_key.reserve(key.size());
@@ -145,8 +754,74 @@ namespace henhouse::threaded
 
         auto n = worker_num(safe_key);
 
-        put_req r {std::move(safe_key), t, c};
-        _workers[n]->queue().write(std::move(r));
+        put_req r {std::move(safe_key), t, v};
+        r.queued = util::now();
+        _workers[n]->count_write_sent();
+        _workers[n]->queue().blockingWrite(std::move(r));
+    }
+
+    void server::put(put_items items)
+    {
+        std::vector<put_items> batches(_workers.size());
+
+        for(auto& i : items)
+        {
+            const auto n = prepare_key(i.key);
+            batches[n].emplace_back(std::move(i));
+        }
+
+        put(batches);
+    }
+
+    std::size_t server::prepare_key(std::string& key) const
+    {
+        std::string safe_key;
+        db::sanatize_key(safe_key, key);
+        std::swap(safe_key, key);
+        return worker_num(key);
+    }
+
+    void server::put(std::vector<put_items>& batches)
+    {
+        REQUIRE_EQUAL(batches.size(), _workers.size());
+
+        const auto queued = util::now();
+        for(std::size_t n = 0; n < batches.size(); n++)
+        {
+            if(batches[n].empty()) continue;
+
+            put_batch_req r{std::move(batches[n]), queued};
+            _workers[n]->count_write_sent();
+            _workers[n]->queue().blockingWrite(std::move(r));
+            batches[n].clear();
+        }
+    }
+
+    bool server::try_put(std::vector<put_items>& batches)
+    {
+        REQUIRE_EQUAL(batches.size(), _workers.size());
+
+        bool sent = true;
+        const auto queued = util::now();
+        for(std::size_t n = 0; n < batches.size(); n++)
+        {
+            if(batches[n].empty()) continue;
+
+            //write only moves the request in when there is room
+            put_batch_req r{std::move(batches[n]), queued};
+            _workers[n]->count_write_sent();
+            if(_workers[n]->queue().write(std::move(r))) 
+            {
+                batches[n].clear();
+                continue;
+            }
+            _workers[n]->count_write_applied();
+
+            batches[n] = std::move(r.items);
+            sent = false;
+        }
+
+        return sent;
     }
 
     summary_future server::summary(const stde::string_view& key) const 
@@ -157,8 +832,9 @@ namespace henhouse::threaded
 
         auto n = worker_num(safe_key);
         summary_req r{std::move(safe_key)};
+        r.queued = util::now();
         summary_future f = r.result.get_future();
-        _workers[n]->queue().write(std::move(r));
+        send_read(n, std::move(r));
         return f;
     }
 
@@ -171,8 +847,9 @@ namespace henhouse::threaded
         auto n = worker_num(safe_key);
 
         get_req r{std::move(safe_key), t};
+        r.queued = util::now();
         get_future f = r.result.get_future();
-        _workers[n]->queue().write(std::move(r));
+        send_read(n, std::move(r));
         return f;
     }
 
@@ -185,15 +862,381 @@ namespace henhouse::threaded
         auto n = worker_num(safe_key);
 
         diff_req r{std::move(safe_key), a, b, index_offset};
+        r.queued = util::now();
         diff_future f = r.result.get_future();
-        _workers[n]->queue().write(std::move(r));
+        send_read(n, std::move(r));
         return f;
     }
 
+    values_future server::values(const stde::string_view& key, const db::series_query& q) const
+    {
+        std::string safe_key;
+        safe_key.reserve(key.size());
+        db::sanatize_key(safe_key, key);
+
+        auto n = worker_num(safe_key);
+
+        values_req r{std::move(safe_key), q};
+        r.queued = util::now();
+        values_future f = r.result.get_future();
+        send_read(n, std::move(r));
+        return f;
+    }
+
+    anomaly_future server::anomaly(const stde::string_view& key, const db::anomaly_query& q) const
+    {
+        std::string safe_key;
+        safe_key.reserve(key.size());
+        db::sanatize_key(safe_key, key);
+
+        auto n = worker_num(safe_key);
+
+        anomaly_req r{std::move(safe_key), q};
+        r.queued = util::now();
+        anomaly_future f = r.result.get_future();
+        send_read(n, std::move(r));
+        return f;
+    }
+
+    raw_future server::raw(const stde::string_view& key, db::time_type a, db::time_type b) const
+    {
+        std::string safe_key;
+        safe_key.reserve(key.size());
+        db::sanatize_key(safe_key, key);
+
+        auto n = worker_num(safe_key);
+
+        raw_req r{std::move(safe_key), a, b};
+        r.queued = util::now();
+        raw_future f = r.result.get_future();
+        _workers[n]->queue().blockingWrite(std::move(r));
+        return f;
+    }
+
+    snapshot_result server::snapshot(const std::string& dest)
+    {
+        REQUIRE(!dest.empty());
+
+        std::unique_lock<std::mutex> l{_snapshot_lock, std::try_to_lock};
+        if(!l.owns_lock()) throw snapshot_conflict{"a snapshot is already running"};
+
+        const boost::filesystem::path to = dest;
+        if(boost::filesystem::exists(to)) throw snapshot_conflict{"snapshot " + dest + " already exists"};
+
+        //record keys written from here on so their tails can be recopied
+        std::vector<std::future<void>> started;
+        for(auto& w : _workers)
+        {
+            track_req t{{}, util::now()};
+            started.emplace_back(t.started.get_future());
+            w->queue().blockingWrite(std::move(t));
+        }
+        for(auto& s : started) s.get();
+
+        snapshot_result r;
+        r.path = dest;
+
+        db::data_roots copies;
+        for(std::size_t n = 0; n < _roots.size(); n++)
+            copies.emplace_back(_roots.size() == 1 ? to : to / std::to_string(n));
+
+        std::exception_ptr error;
+        try
+        {
+            for(std::size_t n = 0; n < _roots.size(); n++)
+                r.copied.add(db::fuzzy_copy(_roots[n], copies[n]));
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+
+        //pause one worker at a time and recopy what it wrote during the copy.
+        //a failed copy still pauses every worker to end tracking.
+        for(auto& w : _workers)
+        {
+            std::promise<void> release;
+            pause_req p{{}, release.get_future().share(), util::now()};
+            auto paused = p.paused.get_future();
+            w->queue().blockingWrite(std::move(p));
+
+            const auto keys = paused.get();
+            const auto start = util::now();
+            try
+            {
+                if(!error)
+                    for(const auto& k : keys)
+                        r.recopied.add(db::copy_timeline_tail(db::key_dir(_roots, k), db::key_dir(copies, k)));
+            }
+            catch(...)
+            {
+                error = std::current_exception();
+            }
+            release.set_value();
+
+            r.max_pause = std::max(r.max_pause, util::nanos(start, util::now()));
+            r.dirty += keys.size();
+        }
+
+        if(error) std::rethrow_exception(error);
+        return r;
+    }
+
+    /**
+     * Reads go to the worker that owns the key unless it is backed up,
+     * then they are offered to the other workers. Writes never go 
+     * through here. A stolen read still sees every write sent before it.
+     */
+    void server::send_read(std::size_t n, req r) const
+    {
+        REQUIRE_RANGE(n, 0, _workers.size());
+
+        auto& q = _workers[n]->queue();
+        if(_workers.size() > 1 && _steal_threshold > 0 && 
+                q.sizeGuess() >= static_cast<ssize_t>(_steal_threshold))
+        {
+            stolen_req s{n, _workers[n]->writes_sent(), std::move(r)};
+            if(_steal.write(std::move(s))) 
+            {
+                wake_idle_worker(n);
+                return;
+            }
+            r = std::move(s.r);
+        }
+
+        //dropping the request would break its promise
+        q.blockingWrite(std::move(r));
+    }
+
+    /**
+     * Wakes one worker parked on its empty queue, starting after the owner,
+     * so it steals the read just offered. A full queue needs no wake up.
+     */
+    void server::wake_idle_worker(std::size_t owner) const
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for(std::size_t i = 1; i < _workers.size(); i++)
+        {
+            auto& w = _workers[(owner + i) % _workers.size()];
+            if(!w->take_idle()) continue;
+
+            w->queue().write(wake_req{util::now()});
+            return;
+        }
+    }
+
+    void server::sync()
+    {
+        std::vector<std::future<void>> synced;
+        synced.reserve(_workers.size());
+
+        for(auto& w : _workers)
+        {
+            sync_req r{{}, util::now()};
+            synced.emplace_back(r.synced.get_future());
+            w->queue().blockingWrite(std::move(r));
+        }
+
+        for(auto& s : synced) s.get();
+    }
+
+    void server::save_hot_keys()
+    {
+        std::vector<std::future<std::vector<std::string>>> hot;
+        hot.reserve(_workers.size());
+
+        for(auto& w : _workers)
+        {
+            hot_req r{{}, util::now()};
+            hot.emplace_back(r.keys.get_future());
+            w->queue().blockingWrite(std::move(r));
+        }
+
+        const auto path = _roots.front() / HOT_KEYS_FILE;
+        const auto tmp = boost::filesystem::path{path.string() + ".new"};
+        {
+            std::ofstream out{tmp.string(), std::ios::trunc};
+            for(auto& h : hot)
+                for(const auto& k : h.get()) out << k << '\n';
+
+            if(!out) throw std::runtime_error{"unable to write " + tmp.string()};
+        }
+        boost::filesystem::rename(tmp, path);
+    }
+
+    void server::warm_start()
+    {
+        const auto path = _roots.front() / HOT_KEYS_FILE;
+        std::ifstream in{path.string()};
+        if(!in) return;
+
+        //queues are first in first out, so queries wait for the warming
+        std::string key;
+        while(std::getline(in, key))
+        {
+            if(key.empty()) continue;
+
+            const auto n = prepare_key(key);
+            _workers[n]->queue().blockingWrite(warm_req{std::move(key), util::now()});
+        }
+    }
+
+    void server::merge_late()
+    {
+        std::vector<std::future<void>> merged;
+        merged.reserve(_workers.size());
+
+        for(auto& w : _workers)
+        {
+            merge_req r{{}, util::now()};
+            merged.emplace_back(r.merged.get_future());
+            w->queue().blockingWrite(std::move(r));
+        }
+
+        for(auto& m : merged) m.get();
+    }
+
+    void server::apply_retention()
+    {
+        namespace bf = boost::filesystem;
+
+        const db::storage_schema none;
+        std::vector<std::vector<std::string>> keys(_workers.size());
+        for(const auto& root : _roots)
+        {
+            if(!bf::exists(root)) continue;
+
+            for(bf::recursive_directory_iterator it{root}, end; it != end; it++)
+            {
+                if(!bf::is_directory(it->status())) continue;
+
+                //.late, .hot and the like
+                const auto name = it->path().filename().string();
+                if(!name.empty() && name[0] == '.')
+                {
+                    it.no_push();
+                    continue;
+                }
+
+                if(!db::has_timeline_files(it->path())) continue;
+
+                auto key = db::dir_key(root, it->path());
+                if(_schemas.find(key, none).retention == 0) continue;
+
+                const auto n = worker_num(key);
+                keys[n].emplace_back(std::move(key));
+            }
+        }
+
+        const auto now = static_cast<db::time_type>(std::time(nullptr));
+        std::vector<std::future<std::size_t>> dropped;
+        for(std::size_t n = 0; n < _workers.size(); n++)
+        {
+            if(keys[n].empty()) continue;
+
+            retention_req r{std::move(keys[n]), now, {}, util::now()};
+            dropped.emplace_back(r.dropped.get_future());
+            _workers[n]->queue().blockingWrite(std::move(r));
+        }
+
+        std::size_t total = 0;
+        for(auto& d : dropped) total += d.get();
+        if(total > 0) std::cerr << "dropped " << total << " buckets past their retention" << std::endl;
+    }
+
+    void server::background_thread()
+    {
+        using clock = std::chrono::steady_clock;
+
+        struct task
+        {
+            const char* name;
+            clock::duration interval;
+            std::function<void()> run;
+            clock::time_point next;
+        };
+
+        std::vector<task> tasks;
+        if(_sync.mode != durability::none) 
+            tasks.push_back(task{"syncing timelines", _sync.interval, [this] { sync();}});
+        if(_warm.interval.count() > 0) 
+            tasks.push_back(task{"saving hot keys", _warm.interval, [this] { save_hot_keys();}});
+        if(_late.interval.count() > 0) 
+            tasks.push_back(task{"merging late points", _late.interval, [this] { merge_late();}});
+        if(_retention.interval.count() > 0) 
+            tasks.push_back(task{"applying retention", _retention.interval, [this] { apply_retention();}});
+
+        if(tasks.empty()) return;
+        for(auto& t : tasks) t.next = clock::now() + t.interval;
+
+        std::unique_lock<std::mutex> l{_background_lock};
+        while(true)
+        {
+            const auto next = std::min_element(tasks.begin(), tasks.end(), 
+                    [](const auto& a, const auto& b) { return a.next < b.next;})->next;
+            if(_background_wake.wait_until(l, next, [this] { return _background_done;})) return;
+
+            l.unlock();
+            const auto now = clock::now();
+            for(auto& t : tasks)
+            {
+                if(now < t.next) continue;
+                t.next = now + t.interval;
+
+                try
+                {
+                    t.run();
+                }
+                catch(std::exception& e)
+                {
+                    std::cerr << "error " << t.name << ": " << e.what() << std::endl;
+                }
+            }
+            l.lock();
+        }
+    }
+
+    std::vector<worker_stats> server::stats() const
+    {
+        std::vector<worker_stats> r;
+        r.reserve(_workers.size());
+
+        for(const auto& w : _workers)
+        {
+            const auto depth = w->queue().sizeGuess();
+            r.emplace_back(worker_stats{
+                    depth > 0 ? static_cast<std::size_t>(depth) : 0, 
+                    w->db().stats(),
+                    w->rejected(),
+                    w->synced(),
+                    w->late_pending(),
+                    w->late_merged()});
+        }
+
+        return r;
+    }
+
+    std::size_t server::steal_queue_depth() const
+    {
+        const auto depth = _steal.sizeGuess();
+        return depth > 0 ? depth : 0;
+    }
+
+    /**
+     * Workers are split evenly across the data roots, worker n serving
+     * root n % roots, so each worker mostly touches one disk. With fewer 
+     * workers than roots they are spread across all keys instead.
+     */
     std::size_t server::worker_num(const stde::string_view& key) const
     {
-        auto h = std::hash<stde::string_view>{}(key);
-        auto n = h % _workers.size(); //exclude rank 0
+        const auto h = std::hash<stde::string_view>{}(key);
+        const auto roots = _roots.size();
+        const auto workers = _workers.size();
+        if(workers < roots) return h % workers;
+
+        const auto root = db::root_num(key, roots);
+        const auto root_workers = (workers - root + roots - 1) / roots;
+        auto n = root + roots * ((h / roots) % root_workers);
 
         ENSURE_RANGE(n, 0, _workers.size());
         return n; 
@@ -5,12 +5,24 @@
 #include <iostream>
 #include <thread>
 #include <future>
+#include <chrono>
+#include <condition_variable>
+#include <stdexcept>
 #include <memory>
+#include <mutex>
+#include <unordered_set>
 #include <boost/variant.hpp>
+#include <boost/mpl/size.hpp>
 
 #include "db/db.hpp"
+#include "db/snapshot.hpp"
+#include "db/late.hpp"
+#include "util/cpu.hpp"
+#include "util/histogram.hpp"
+#include "service/raw.hpp"
 
 #include <folly/MPMCQueue.h>
+#include <folly/SharedMutex.h>
 
 namespace stde = std::experimental;
 
@@ -23,12 +35,20 @@ namespace henhouse::threaded
     using diff_future = std::future<db::diff_result>;
     using summary_promise = std::promise<db::summary_result>;
     using summary_future = std::future<db::summary_result>;
+    using raw_body_ptr = std::unique_ptr<folly::IOBuf>;
+    using raw_promise = std::promise<raw_body_ptr>;
+    using raw_future = std::future<raw_body_ptr>;
+    using values_promise = std::promise<db::series>;
+    using values_future = std::future<db::series>;
+    using anomaly_promise = std::promise<db::anomalies>;
+    using anomaly_future = std::future<db::anomalies>;
 
     struct put_req
     {
         std::string key;
         db::time_type time;
-        db::count_type count;
+        db::put_value value;
+        util::timestamp queued;
     };
 
     struct get_req
@@ -36,6 +56,7 @@ namespace henhouse::threaded
         std::string key;
         db::time_type time;
         get_promise result;
+        util::timestamp queued;
     };
 
     struct diff_req
@@ -45,25 +66,297 @@ namespace henhouse::threaded
         db::time_type b;
         db::offset_type index_offset;
         diff_promise result;
+        util::timestamp queued;
     };
 
     struct summary_req
     {
         std::string key;
         summary_promise result;
+        util::timestamp queued;
     };
 
-    using req = boost::variant<put_req, get_req, diff_req, summary_req>; 
+    struct put_item
+    {
+        std::string key;
+        db::time_type time;
+        db::put_value value;
+    };
+
+    using put_items = std::vector<put_item>;
+
+    //puts for keys owned by the same worker
+    struct put_batch_req
+    {
+        put_items items;
+        util::timestamp queued;
+    };
+
+    struct raw_req
+    {
+        std::string key;
+        db::time_type a;
+        db::time_type b;
+        raw_promise result;
+        util::timestamp queued;
+    };
+
+    using dirty_keys = std::vector<std::string>;
+
+    //starts recording the keys a worker writes
+    struct track_req
+    {
+        std::promise<void> started;
+        util::timestamp queued;
+    };
+
+    //stops a worker until released, handing over the keys
+    //written since tracking started and ending tracking.
+    struct pause_req
+    {
+        std::promise<dirty_keys> paused;
+        std::shared_future<void> release;
+        util::timestamp queued;
+    };
+
+    //writes the timelines a worker changed since its last sync to disk
+    struct sync_req
+    {
+        std::promise<void> synced;
+        util::timestamp queued;
+    };
+
+    //opens a timeline and reads its recent buckets ahead
+    struct warm_req
+    {
+        std::string key;
+        util::timestamp queued;
+    };
+
+    //asks for the keys of the timelines a worker has open
+    struct hot_req
+    {
+        std::promise<std::vector<std::string>> keys;
+        util::timestamp queued;
+    };
+
+    //merges a worker's late points into their timelines
+    struct merge_req
+    {
+        std::promise<void> merged;
+        util::timestamp queued;
+    };
+
+    //a whole /values series of one key, transformed
+    struct values_req
+    {
+        std::string key;
+        db::series_query query;
+        values_promise result;
+        util::timestamp queued;
+    };
+
+    //z-scores of a key's steps against their trailing windows
+    struct anomaly_req
+    {
+        std::string key;
+        db::anomaly_query query;
+        anomaly_promise result;
+        util::timestamp queued;
+    };
+
+    //drops buckets past their schema's retention from the keys' timelines
+    struct retention_req
+    {
+        std::vector<std::string> keys;
+        db::time_type now;
+        std::promise<std::size_t> dropped;
+        util::timestamp queued;
+    };
+
+    //wakes up an idle worker to look for reads to steal
+    struct wake_req
+    {
+        util::timestamp queued;
+    };
+
+    //wakes up a worker so it can see the server is done.
+    struct stop_req 
+    {
+        util::timestamp queued;
+    };
+
+    using req = boost::variant<
+        put_req, 
+        get_req, 
+        diff_req, 
+        summary_req, 
+        put_batch_req, 
+        raw_req, 
+        track_req,
+        pause_req,
+        sync_req,
+        warm_req,
+        hot_req,
+        merge_req,
+        values_req,
+        anomaly_req,
+        retention_req,
+        wake_req,
+        stop_req>; 
 
     using req_queue= folly::MPMCQueue<req>;
 
+    const std::size_t REQ_TYPES = boost::mpl::size<req::types>::value;
+
+    /**
+     * Latency of each stage a request goes through, in nanoseconds.
+     * exec is indexed by the request's position in the req variant.
+     */
+    struct stage_metrics
+    {
+        util::histogram queue_wait;
+        std::array<util::histogram, REQ_TYPES> exec;
+        util::histogram render;
+    };
+
+    /**
+     * Thrown when a snapshot is already running or its destination exists.
+     */
+    struct snapshot_conflict : public std::runtime_error
+    {
+        snapshot_conflict(const std::string& error) : std::runtime_error{error}{}
+    };
+
+    struct snapshot_result
+    {
+        std::string path;
+        db::copy_stats copied;      //copy of every timeline taken while writing
+        db::copy_stats recopied;    //timelines written during the copy, fixed while paused
+        std::size_t dirty = 0;      //timelines written during the copy
+        std::uint64_t max_pause = 0;//longest any worker was paused in nanoseconds
+    };
+
+    /**
+     * When written timelines reach the disk. none leaves it to the kernel.
+     * periodic syncs every timeline written within an interval together. 
+     * on_batch also syncs after every batch of puts and whenever a worker
+     * runs out of requests.
+     */
+    enum class durability { none, periodic, on_batch };
+
+    durability parse_durability(const std::string& d);
+
+    struct sync_options
+    {
+        durability mode = durability::none;
+        std::chrono::milliseconds interval{1000};
+    };
+
+    //hot keys are saved in this file in the data directory
+    const char* const HOT_KEYS_FILE = ".hot";
+
+    /**
+     * Keys of the timelines open in the workers' caches are saved every
+     * interval and at stop. On start the saved timelines are opened in 
+     * their workers and their recent buckets read ahead, so the first
+     * queries after a restart don't pay for it. 0 disables both.
+     */
+    struct warm_options
+    {
+        std::chrono::seconds interval{0};
+    };
+
+    //late points are spilled to files in this directory in the first data root
+    const char* const LATE_DIR = ".late";
+
+    /**
+     * Points too far behind their timeline for put are staged by their worker
+     * and merged into their timelines every interval, or as soon as a worker 
+     * stages max_points. Staged points are spilled to disk and merged on 
+     * start after a crash. An interval of 0 rejects them instead.
+     */
+    struct late_options
+    {
+        std::chrono::seconds interval{0};
+        std::size_t max_points = 1000000;
+    };
+
+    /**
+     * Puts to the last bucket of a timeline add up in a table of slots 
+     * pending puts per worker and are written to the timeline as one put 
+     * when the bucket closes, the key is read, or at most every interval. 
+     * An interval of 0 writes every put through.
+     */
+    struct coalesce_options
+    {
+        std::chrono::milliseconds interval{0};
+        std::size_t slots = 4096;
+    };
+
+    /**
+     * How often henhouse walks the data roots and drops buckets past the
+     * retention of their key's storage schema. 0 leaves it to 
+     * henhouse_compact.
+     */
+    struct retention_options
+    {
+        std::chrono::seconds interval{0};
+    };
+
+    struct worker_stats
+    {
+        std::size_t queue_depth;
+        db::cache_stats cache;
+        std::uint64_t rejected;
+        std::uint64_t synced;
+        std::uint64_t late_pending;
+        std::uint64_t late_merged;
+    };
+
+    /**
+     * Points that never reached a worker, counted across all inputs.
+     */
+    struct ingest_counters
+    {
+        std::atomic<std::uint64_t> dropped{0};   //shed because a worker queue was full
+        std::atomic<std::uint64_t> future{0};    //too far in the future
+        std::atomic<std::uint64_t> malformed{0}; //lines or records that did not parse
+    };
+
+    /**
+     * A read request taken off an overloaded worker. Any idle worker
+     * can evaluate it against the owner's timeline once the owner applied
+     * the writes sent to it before the read.
+     */
+    struct stolen_req
+    {
+        std::size_t owner = 0;
+        std::uint64_t writes = 0;
+        req r;
+    };
+
+    using steal_queue = folly::MPMCQueue<stolen_req>;
+
+    //reads are offered to other workers once the owner has this many
+    //requests waiting
+    const std::size_t STEAL_THRESHOLD = 16;
+
     class worker  
     {
         public: 
-            worker(const std::string & root, 
+            worker(const db::data_roots& roots, 
                     const std::size_t queue_size, 
                     const std::size_t cache_size, 
                     const db::time_type new_timeline_resolution,
+                    const durability mode,
+                    const late_options& late,
+                    const boost::filesystem::path& late_spill,
+                    const coalesce_options& coalesce,
+                    const db::gap_policy& gaps,
+                    const db::item_width width,
+                    const std::string& gauge_keys,
+                    const db::storage_schemas& schemas,
                     bool* done);
 
             req_queue& queue() { return _queue;}
@@ -72,10 +365,87 @@ namespace henhouse::threaded
             db::timeline_db& db() { return _db;}
             const db::timeline_db& db() const { return _db;}
 
+            //held exclusively by the owner while processing its requests
+            //and shared by other workers evaluating stolen reads.
+            folly::SharedMutex& lock() const { return _lock;}
+
             bool done() const { INVARIANT(_done); return *_done;}
 
+            //points refused by their timeline, usually for being too old
+            void count_rejected() { _rejected.fetch_add(1, std::memory_order_relaxed);}
+            std::uint64_t rejected() const { return _rejected.load(std::memory_order_relaxed);}
+
+            //keys written are recorded while tracking and until synced. 
+            //Only used by the worker's thread.
+            void track() { _tracking = true; _dirty.clear();}
+            void mark_dirty(const std::string& key) 
+            { 
+                if(_tracking) _dirty.insert(key);
+                if(_mode != durability::none) _unsynced.insert(key);
+            }
+            dirty_keys take_dirty();
+
+            durability mode() const { return _mode;}
+
+            //writes every timeline written since the last sync to disk
+            void sync();
+            bool has_unsynced() const { return !_unsynced.empty();}
+
+            //timelines synced to disk
+            std::uint64_t synced() const { return _synced.load(std::memory_order_relaxed);}
+
+            //stages a point put rejected for being too old, or counts it
+            //as rejected when staging is off
+            void stage_late(const std::string& key, db::time_type t, db::count_type c);
+
+            //merges staged points into their timelines
+            void merge_late();
+
+            //drops buckets past their schema's retention, returns how many
+            std::size_t apply_retention(const std::vector<std::string>& keys, db::time_type now);
+
+            //true once coalesced puts have waited the coalesce interval
+            bool coalesce_due() const;
+            void flush_coalesced();
+            std::chrono::steady_clock::time_point next_coalesce() const { return _next_coalesce;}
+
+            //set while the worker waits on its empty queue. take_idle clears 
+            //it and returns true for the one caller that should wake it.
+            void set_idle(bool idle) { _idle.store(idle);}
+            bool take_idle() 
+            { 
+                bool idle = true;
+                return _idle.compare_exchange_strong(idle, false);
+            }
+
+            std::uint64_t late_pending() const { return _late_pending.load(std::memory_order_relaxed);}
+            std::uint64_t late_merged() const { return _late_merged.load(std::memory_order_relaxed);}
+
+            //write requests counted before they are queued and once applied. 
+            //A write that failed to queue counts as applied.
+            void count_write_sent() { _writes_sent.fetch_add(1);}
+            void count_write_applied() { _writes_applied.fetch_add(1);}
+            std::uint64_t writes_sent() const { return _writes_sent.load();}
+            std::uint64_t writes_applied() const { return _writes_applied.load();}
+
         private:
             req_queue _queue;
+            mutable folly::SharedMutex _lock;
+            std::atomic<std::uint64_t> _rejected{0};
+            bool _tracking = false;
+            std::unordered_set<std::string> _dirty;
+            durability _mode;
+            std::unordered_set<std::string> _unsynced;
+            std::atomic<std::uint64_t> _synced{0};
+            std::unique_ptr<db::late_points> _late;
+            std::size_t _late_max;
+            std::atomic<std::uint64_t> _late_pending{0};
+            std::atomic<std::uint64_t> _late_merged{0};
+            std::atomic<std::uint64_t> _writes_sent{0};
+            std::atomic<std::uint64_t> _writes_applied{0};
+            std::atomic<bool> _idle{false};
+            std::chrono::milliseconds _coalesce_interval;
+            std::chrono::steady_clock::time_point _next_coalesce;
 
             bool* _done;
             db::timeline_db _db;
@@ -91,26 +461,146 @@ namespace henhouse::threaded
         public:
             server(
                     const std::size_t workers, 
-                    const std::string& root, 
+                    const db::data_roots& roots, 
                     const std::size_t queue_size, 
                     const std::size_t cache_size,
-                    const db::time_type new_timeline_resolution);
+                    const db::time_type new_timeline_resolution,
+                    const util::cpu_list& cpus = {},
+                    const sync_options& sync = {},
+                    const warm_options& warm = {},
+                    const late_options& late = {},
+                    const coalesce_options& coalesce = {},
+                    const db::gap_policy& gaps = {},
+                    const db::item_width width = db::item_width::wide,
+                    const std::string& gauge_keys = "",
+                    const db::storage_schemas& schemas = {},
+                    const std::size_t steal_threshold = STEAL_THRESHOLD,
+                    const retention_options& retention = {});
             ~server();
 
             summary_future summary(const stde::string_view& key) const; 
             get_future get(const stde::string_view& key, db::time_type t) const; 
-            void put(const stde::string_view& key, db::time_type t, db::count_type c);
+            void put(const stde::string_view& key, db::time_type t, db::count_type c) { put(key, t, db::count_value(c));}
+            void put(const stde::string_view& key, db::time_type t, const db::put_value& v);
+
+            /**
+             * Puts many points sending one request to each worker 
+             * owning any of the keys. Keys do not need to be sanitized.
+             */
+            void put(put_items items);
+
+            /**
+             * Sanitizes the key in place and returns the worker owning it.
+             * Used by inputs that see the same key many times.
+             */
+            std::size_t prepare_key(std::string& key) const;
+
+            /**
+             * Sends batches of prepared keys, one per worker indexed by
+             * worker number, blocking while a worker's queue is full. 
+             * Batches are left empty.
+             */
+            void put(std::vector<put_items>& batches);
+
+            /**
+             * Like put but never blocks. Batches whose worker queue is full
+             * are left in place and the rest are left empty. Returns true
+             * if every batch was sent.
+             */
+            bool try_put(std::vector<put_items>& batches);
+
+            std::size_t total_workers() const { return _workers.size();}
             diff_future diff(const stde::string_view& key, db::time_type a, db::time_type b, const db::offset_type index_offset) const;
 
+            /**
+             * Diffs every window of the query and transforms the series
+             * in one request instead of one diff per window.
+             */
+            values_future values(const stde::string_view& key, const db::series_query& q) const;
+
+            /**
+             * Scores every step of the query in one request to the key's worker.
+             */
+            anomaly_future anomaly(const stde::string_view& key, const db::anomaly_query& q) const;
+
+            /**
+             * Returns the /raw body of the items covering [a, b]. The owner 
+             * maps the files while it holds the timeline, so a rewrite or 
+             * widening that renames new files into place afterwards can't 
+             * change what the body points at. Always runs on the owner.
+             */
+            raw_future raw(const stde::string_view& key, db::time_type a, db::time_type b) const;
+
+            /**
+             * Copies every timeline into dest, which must not exist, while 
+             * writes continue. Afterwards each worker is paused in turn, just 
+             * long enough to recopy the tails of the timelines it wrote during 
+             * the copy. Every timeline in the snapshot is consistent as of its
+             * worker's pause. Only one snapshot runs at a time. With several
+             * data roots, root n is copied into dest/n.
+             */
+            snapshot_result snapshot(const std::string& dest);
+
+            /**
+             * Writes every timeline written since its last sync to disk and
+             * waits until they are written.
+             */
+            void sync();
+
+            /**
+             * Saves the keys of every worker's open timelines to HOT_KEYS_FILE 
+             * in the first data root.
+             */
+            void save_hot_keys();
+
             void stop();
 
+            stage_metrics& metrics() const { return _metrics;}
+            ingest_counters& ingest() const { return _ingest;}
+            std::vector<worker_stats> stats() const;
+            std::size_t steal_queue_depth() const;
+
         private:
 
             std::size_t worker_num(const stde::string_view& key) const;
+            void send_read(std::size_t n, req r) const;
+            void wake_idle_worker(std::size_t owner) const;
+            void warm_start();
+            /**
+             * Merges every worker's late points into their timelines and
+             * waits until they are merged.
+             */
+            void merge_late();
+
+            /**
+             * Sends every timeline whose schema has a retention to its 
+             * worker to drop the buckets past it, and waits until they are
+             * dropped.
+             */
+            void apply_retention();
+            void background_thread();
 
         private:
-            std::string _root;
+            db::data_roots _roots;
             workers _workers;
+            mutable steal_queue _steal;
+            mutable stage_metrics _metrics;
+            mutable ingest_counters _ingest;
+            std::mutex _snapshot_lock;
+            sync_options _sync;
+            warm_options _warm;
+            late_options _late;
+            coalesce_options _coalesce;
+            db::gap_policy _gaps;
+            db::item_width _width;
+            std::string _gauge_keys;
+            db::storage_schemas _schemas;
+            std::size_t _steal_threshold;
+            retention_options _retention;
+            std::mutex _background_lock;
+            std::condition_variable _background_wake;
+            std::thread _background;
+            bool _background_done = false;
             threads _threads;
             bool _done;
     };
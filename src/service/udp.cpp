@@ -0,0 +1,167 @@
+#include "service/udp.hpp"
+
+#include <cstring>
+#include <ctime>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace henhouse::net
+{
+    namespace
+    {
+        //datagrams read per recvmmsg call
+        const std::size_t BATCH = 64;
+
+        //max graphite datagram, larger ones are truncated by the kernel
+        const std::size_t DATAGRAM_SIZE = 64 * 1024;
+
+        //how often a blocked thread wakes up to check if it should stop
+        const int STOP_CHECK_MS = 200;
+
+        int bind_socket(const std::string& ip, const std::uint16_t port)
+        {
+            sockaddr_storage addr;
+            std::memset(&addr, 0, sizeof(addr));
+            socklen_t addr_len = 0;
+
+            auto* v4 = reinterpret_cast<sockaddr_in*>(&addr);
+            auto* v6 = reinterpret_cast<sockaddr_in6*>(&addr);
+            if(inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1)
+            {
+                v4->sin_family = AF_INET;
+                v4->sin_port = htons(port);
+                addr_len = sizeof(sockaddr_in);
+            }
+            else if(inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1)
+            {
+                v6->sin6_family = AF_INET6;
+                v6->sin6_port = htons(port);
+                addr_len = sizeof(sockaddr_in6);
+            }
+            else throw std::runtime_error{"invalid udp ip " + ip};
+
+            const int fd = socket(addr.ss_family, SOCK_DGRAM, 0);
+            if(fd < 0) throw std::runtime_error{"unable to create udp socket"};
+
+            int one = 1;
+            timeval timeout{0, STOP_CHECK_MS * 1000};
+            if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+               setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+               bind(fd, reinterpret_cast<sockaddr*>(&addr), addr_len) != 0)
+            {
+                const std::string error = std::strerror(errno);
+                close(fd);
+                throw std::runtime_error{"unable to bind udp port " + std::to_string(port) + ": " + error};
+            }
+
+            return fd;
+        }
+    }
+
+    udp_server::udp_server(
+            threaded::server& db, 
+            const std::string& ip,
+            const std::uint16_t port, 
+            const std::size_t threads,
+            const ingest_policy policy,
+            const util::cpu_list& cpus) :
+        _db{db}, 
+        _policy{policy == ingest_policy::pause ? ingest_policy::block : policy}, 
+        _cpus{cpus}
+    {
+        REQUIRE_GREATER(threads, 0);
+
+        try
+        {
+            //bind every socket before starting threads so a bad port fails fast
+            for(std::size_t i = 0; i < threads; i++)
+                _sockets.push_back(bind_socket(ip, port));
+        }
+        catch(...)
+        {
+            for(auto fd : _sockets) close(fd);
+            throw;
+        }
+
+        for(auto fd : _sockets)
+            _threads.emplace_back([this, fd] { run(fd);});
+    }
+
+    udp_server::~udp_server()
+    {
+        stop();
+    }
+
+    void udp_server::stop()
+    {
+        if(_done.exchange(true)) return;
+
+        for(auto& t : _threads) t.join();
+        for(auto fd : _sockets) close(fd);
+    }
+
+#ifdef __linux__
+    void udp_server::run(int fd)
+    try
+    {
+        _cpus.place_current_thread();
+
+        std::vector<char> buffers(BATCH * DATAGRAM_SIZE);
+        std::vector<iovec> iovecs(BATCH);
+        std::vector<mmsghdr> msgs(BATCH);
+
+        for(std::size_t i = 0; i < BATCH; i++)
+        {
+            iovecs[i].iov_base = buffers.data() + i * DATAGRAM_SIZE;
+            iovecs[i].iov_len = DATAGRAM_SIZE;
+
+            std::memset(&msgs[i], 0, sizeof(mmsghdr));
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        ingest_buffer buffer{_db, _policy};
+        while(!_done)
+        {
+            //block for the first datagram then take whatever else is waiting
+            const auto n = recvmmsg(fd, msgs.data(), BATCH, MSG_WAITFORONE, nullptr);
+            if(n <= 0) continue;
+
+            const auto now = std::time(nullptr);
+            for(int i = 0; i < n; i++)
+                buffer.add_lines({static_cast<char*>(iovecs[i].iov_base), msgs[i].msg_len}, now);
+
+            buffer.send();
+        }
+    }
+    catch(std::exception& e)
+    {
+        std::cerr << "udp input thread stopped: " << e.what() << std::endl;
+    }
+#else
+    void udp_server::run(int fd)
+    try
+    {
+        _cpus.place_current_thread();
+
+        std::vector<char> buffer(DATAGRAM_SIZE);
+        ingest_buffer points{_db, _policy};
+        while(!_done)
+        {
+            const auto n = recv(fd, buffer.data(), buffer.size(), 0);
+            if(n <= 0) continue;
+
+            points.add_lines({buffer.data(), static_cast<std::size_t>(n)}, std::time(nullptr));
+            points.send();
+        }
+    }
+    catch(std::exception& e)
+    {
+        std::cerr << "udp input thread stopped: " << e.what() << std::endl;
+    }
+#endif
+}
@@ -0,0 +1,48 @@
+#ifndef HENHOUSE_UDP_H
+#define HENHOUSE_UDP_H
+
+#include "service/threaded.hpp"
+#include "service/ingest.hpp"
+#include "util/cpu.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace henhouse::net
+{
+    /**
+     * Graphite compatible UDP input. Each thread owns its own SO_REUSEPORT
+     * socket so the kernel spreads datagrams across threads. Threads drain
+     * datagrams in batches with recvmmsg, parse every newline separated point 
+     * in them and hand each batch to the DB as one put per worker.
+     * UDP cannot push back on senders so the pause policy blocks the
+     * thread instead, letting the socket buffer absorb the burst.
+     */
+    class udp_server
+    {
+        public:
+            udp_server(
+                    threaded::server& db, 
+                    const std::string& ip,
+                    const std::uint16_t port, 
+                    const std::size_t threads,
+                    const ingest_policy policy,
+                    const util::cpu_list& cpus = {});
+            ~udp_server();
+
+            void stop();
+
+        private:
+            void run(int fd);
+
+        private:
+            threaded::server& _db;
+            ingest_policy _policy;
+            util::cpu_rotation _cpus;
+            std::vector<int> _sockets;
+            std::vector<std::thread> _threads;
+            std::atomic<bool> _done{false};
+    };
+}
+#endif
@@ -0,0 +1,126 @@
+#include "util/cpu.hpp"
+#include "util/dbc.hpp"
+
+#include <stdexcept>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#endif
+
+namespace ba = boost::algorithm;
+namespace fs = boost::filesystem;
+
+namespace henhouse::util
+{
+    namespace
+    {
+        const std::size_t MAX_NUMA_NODES = sizeof(unsigned long) * 8;
+
+        int parse_cpu(const std::string& cpu)
+        try
+        {
+            const auto c = boost::lexical_cast<int>(ba::trim_copy(cpu));
+            if(c < 0) throw std::runtime_error{"negative cpu"};
+            return c;
+        }
+        catch(...)
+        {
+            throw std::runtime_error{"invalid cpu in cpu list: " + cpu};
+        }
+    }
+
+    cpu_list parse_cpu_list(const std::string& cpus)
+    {
+        cpu_list r;
+        if(ba::trim_copy(cpus).empty()) return r;
+
+        std::vector<std::string> ranges;
+        ba::split(ranges, cpus, ba::is_any_of(","));
+
+        for(const auto& range : ranges)
+        {
+            const auto dash = range.find('-');
+            if(dash == std::string::npos)
+            {
+                r.push_back(parse_cpu(range));
+                continue;
+            }
+
+            const auto from = parse_cpu(range.substr(0, dash));
+            const auto to = parse_cpu(range.substr(dash + 1));
+            if(from > to) throw std::runtime_error{"invalid cpu range: " + range};
+
+            for(auto c = from; c <= to; c++) r.push_back(c);
+        }
+
+        ENSURE_FALSE(r.empty());
+        return r;
+    }
+
+    int numa_node(int cpu)
+    {
+        REQUIRE_GREATER_EQUAL(cpu, 0);
+
+        const fs::path cpu_dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        boost::system::error_code ec;
+        if(!fs::is_directory(cpu_dir, ec)) return NO_NUMA_NODE;
+
+        for(fs::directory_iterator it{cpu_dir, ec}, end; !ec && it != end; it.increment(ec))
+        {
+            const auto name = it->path().filename().string();
+            if(name.size() > 4 && ba::starts_with(name, "node"))
+            try
+            {
+                return boost::lexical_cast<int>(name.substr(4));
+            }
+            catch(...) {}
+        }
+
+        return NO_NUMA_NODE;
+    }
+
+#ifdef __linux__
+    void place_current_thread(int cpu)
+    {
+        REQUIRE_GREATER_EQUAL(cpu, 0);
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            throw std::runtime_error{"unable to pin thread to cpu " + std::to_string(cpu)};
+
+        //prefer the local node but fall back to others when it is full.
+        //failing here just means the kernel has no NUMA support.
+        const auto node = numa_node(cpu);
+        if(node == NO_NUMA_NODE || static_cast<std::size_t>(node) >= MAX_NUMA_NODES) return;
+
+        unsigned long mask = 1UL << node;
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, MAX_NUMA_NODES);
+    }
+#else
+    void place_current_thread(int) {}
+#endif
+
+    int cpu_rotation::next()
+    {
+        REQUIRE_FALSE(_cpus.empty());
+        const auto n = _next.fetch_add(1, std::memory_order_relaxed);
+        return _cpus[n % _cpus.size()];
+    }
+
+    void cpu_rotation::place_current_thread()
+    {
+        if(_cpus.empty()) return;
+        util::place_current_thread(next());
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef HENHOUSE_CPU_H
+#define HENHOUSE_CPU_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace henhouse::util
+{
+    using cpu_list = std::vector<int>;
+
+    const int NO_NUMA_NODE = -1;
+
+    /**
+     * Parses a cpu list in the same format as taskset and /sys,
+     * for example "0-3,8,10-11". An empty string is an empty list.
+     */
+    cpu_list parse_cpu_list(const std::string& cpus);
+
+    /**
+     * Returns the NUMA node the cpu belongs to or NO_NUMA_NODE if
+     * the machine does not expose NUMA topology.
+     */
+    int numa_node(int cpu);
+
+    /**
+     * Pins the calling thread to the cpu and makes its memory allocations
+     * prefer the cpu's NUMA node. Memory is placed on first touch,
+     * so anything the thread allocates and initializes after this call is local.
+     */
+    void place_current_thread(int cpu);
+
+    /**
+     * Hands out cpus from a list round robin so each thread in a pool
+     * gets its own cpu. An empty list means threads are not placed.
+     *
+     * This class is thread safe.
+     */
+    class cpu_rotation
+    {
+        public:
+            cpu_rotation(const cpu_list& cpus) : _cpus{cpus} {}
+
+            bool empty() const { return _cpus.empty();}
+
+            int next();
+            void place_current_thread();
+
+        private:
+            cpu_list _cpus;
+            std::atomic<std::size_t> _next{0};
+    };
+}
+#endif
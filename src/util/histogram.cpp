@@ -0,0 +1,99 @@
+#include "util/histogram.hpp"
+#include "util/dbc.hpp"
+
+#include <cmath>
+
+namespace henhouse::util
+{
+    namespace
+    {
+        std::atomic<std::size_t> NEXT_SHARD{0};
+
+        std::size_t thread_shard()
+        {
+            thread_local const std::size_t shard =
+                NEXT_SHARD.fetch_add(1, std::memory_order_relaxed) % HISTOGRAM_SHARDS;
+            return shard;
+        }
+    }
+
+    std::size_t histogram_bucket(std::uint64_t v)
+    {
+        if(v < HISTOGRAM_SUB_BUCKETS) return v;
+
+        const std::size_t exponent = 63 - __builtin_clzll(v);
+        const std::size_t shift = exponent - HISTOGRAM_SUB_BITS;
+        const std::size_t b = (shift + 1) * HISTOGRAM_SUB_BUCKETS + ((v >> shift) - HISTOGRAM_SUB_BUCKETS);
+
+        ENSURE_RANGE(b, 0, HISTOGRAM_BUCKETS);
+        return b;
+    }
+
+    std::uint64_t histogram_bucket_max(std::size_t bucket)
+    {
+        REQUIRE_RANGE(bucket, 0, HISTOGRAM_BUCKETS);
+        if(bucket < HISTOGRAM_SUB_BUCKETS) return bucket;
+
+        const std::size_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+        const std::uint64_t mantissa = HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS;
+
+        //the last bucket ends at the max value
+        const auto lower = mantissa << shift;
+        const auto width = std::uint64_t{1} << shift;
+        return lower + (width - 1);
+    }
+
+    void histogram_snapshot::merge(const histogram_snapshot& o)
+    {
+        for(std::size_t b = 0; b < counts.size(); b++) counts[b] += o.counts[b];
+        count += o.count;
+        sum += o.sum;
+    }
+
+    std::uint64_t histogram_snapshot::percentile(double q) const
+    {
+        REQUIRE_BETWEEN(q, 0.0, 1.0);
+        if(count == 0) return 0;
+
+        const auto rank = std::max<std::uint64_t>(1, std::ceil(q * count));
+
+        std::uint64_t seen = 0;
+        for(std::size_t b = 0; b < counts.size(); b++)
+        {
+            seen += counts[b];
+            if(seen >= rank) return histogram_bucket_max(b);
+        }
+
+        return histogram_bucket_max(counts.size() - 1);
+    }
+
+    std::uint64_t histogram_snapshot::count_at_most(std::uint64_t v) const
+    {
+        std::uint64_t c = 0;
+        for(std::size_t b = 0; b < counts.size() && histogram_bucket_max(b) <= v; b++)
+            c += counts[b];
+        return c;
+    }
+
+    void histogram::record(std::uint64_t v)
+    {
+        auto& s = _shards[thread_shard()];
+        s.counts[histogram_bucket(v)].fetch_add(1, std::memory_order_relaxed);
+        s.count.fetch_add(1, std::memory_order_relaxed);
+        s.sum.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    histogram_snapshot histogram::snapshot() const
+    {
+        histogram_snapshot r;
+        for(const auto& s : _shards)
+        {
+            for(std::size_t b = 0; b < s.counts.size(); b++)
+                r.counts[b] += s.counts[b].load(std::memory_order_relaxed);
+
+            r.count += s.count.load(std::memory_order_relaxed);
+            r.sum += s.sum.load(std::memory_order_relaxed);
+        }
+        return r;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef HENHOUSE_HISTOGRAM_H
+#define HENHOUSE_HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace henhouse::util
+{
+    using clock = std::chrono::steady_clock;
+    using timestamp = clock::time_point;
+
+    inline timestamp now() { return clock::now();}
+
+    inline std::uint64_t nanos(timestamp from, timestamp to)
+    {
+        return to > from ?
+            std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count() :
+            0;
+    }
+
+    //Each power of two is split into 2^SUB_BITS linear sub buckets
+    //giving about 12% relative error for any value.
+    const std::size_t HISTOGRAM_SUB_BITS = 3;
+    const std::size_t HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BITS;
+    const std::size_t HISTOGRAM_BUCKETS = (64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS;
+    const std::size_t HISTOGRAM_SHARDS = 16;
+
+    std::size_t histogram_bucket(std::uint64_t v);
+    std::uint64_t histogram_bucket_max(std::size_t bucket);
+
+    struct histogram_snapshot
+    {
+        std::array<std::uint64_t, HISTOGRAM_BUCKETS> counts = {};
+        std::uint64_t count = 0;
+        std::uint64_t sum = 0;
+
+        void merge(const histogram_snapshot& o);
+
+        //returns the bucket max of the value at quantile q in [0, 1]
+        std::uint64_t percentile(double q) const;
+
+        //count of values less than or equal to v, rounded to bucket boundaries
+        std::uint64_t count_at_most(std::uint64_t v) const;
+    };
+
+    /**
+     * HDR style log linear histogram of unsigned values. Writers record into
+     * a shard picked by their thread so threads rarely touch the same cache lines.
+     * Recording is a couple of relaxed atomic adds.
+     *
+     * This class is thread safe.
+     */
+    class histogram
+    {
+        public:
+            void record(std::uint64_t v);
+            void record(timestamp from, timestamp to) { record(nanos(from, to));}
+
+            histogram_snapshot snapshot() const;
+
+        private:
+            struct alignas(64) shard
+            {
+                std::array<std::atomic<std::uint64_t>, HISTOGRAM_BUCKETS> counts = {};
+                std::atomic<std::uint64_t> count{0};
+                std::atomic<std::uint64_t> sum{0};
+            };
+
+            std::array<shard, HISTOGRAM_SHARDS> _shards;
+    };
+}
+#endif
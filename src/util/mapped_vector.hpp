@@ -25,7 +25,7 @@ namespace henhouse::util
                     _new_size_factor = new_size_factor;
 
                     //open index data. New file size is new_size
-                    _data_file = std::make_unique<bio::mapped_file>();
+                    _data_file = mapped_file_ptr{new bio::mapped_file};
                     const bool created = open(*_data_file, data_file, new_size);
 
                     _metadata = reinterpret_cast<meta_t*>(_data_file->data());
@@ -170,6 +170,46 @@ namespace henhouse::util
                     return *(_items + (_metadata->size - 1));
                 }
 
+                /**
+                 * Writes items from pos to the end to disk and then the 
+                 * metadata. The metadata shares a mapped page the kernel
+                 * may write back at any time, so after a crash the size can
+                 * still cover items that never reached disk. Those read as
+                 * zeros and verify_timeline cuts them off as a torn tail.
+                 */
+                void sync(size_t pos)
+                {
+                    INVARIANT(_data_file);
+                    INVARIANT(_metadata);
+
+                    pos = std::min<size_t>(pos, _metadata->size);
+
+                    const auto begin = sizeof(meta_t) + pos * sizeof(data_type);
+                    const auto end = sizeof(meta_t) + _metadata->size * sizeof(data_type);
+                    CHECK_LESS_EQUAL(end, _data_file->size());
+
+                    util::sync(*_data_file, begin, end - begin);
+                    util::sync(*_data_file, 0, sizeof(meta_t));
+                }
+
+                /**
+                 * Asks the kernel to read the metadata and the last items 
+                 * into memory in the background.
+                 */
+                void prefetch_tail(size_t items) const
+                {
+                    INVARIANT(_data_file);
+                    INVARIANT(_metadata);
+
+                    const auto size = static_cast<size_t>(_metadata->size);
+                    const auto first = size - std::min(items, size);
+
+                    util::prefetch(*_data_file, 0, sizeof(meta_t));
+                    util::prefetch(*_data_file, 
+                            sizeof(meta_t) + first * sizeof(data_type), 
+                            (size - first) * sizeof(data_type));
+                }
+
             private:
 
                 void resize(size_t new_size) 
@@ -179,7 +219,7 @@ namespace henhouse::util
 
                     const auto old_max = _max_items;
 
-                    _data_file->resize(new_size);
+                    util::resize(*_data_file, new_size);
                     _metadata = reinterpret_cast<meta_t*>(_data_file->data());
                     _items = reinterpret_cast<data_type*>(_data_file->data() + sizeof(meta_t));
                     CHECK_GREATER(_data_file->size(), sizeof(meta_t));
@@ -1,9 +1,22 @@
 #include "util/mmap.hpp" 
 
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 namespace fs = boost::filesystem;
 
 namespace henhouse::util
 {
+    namespace
+    {
+        std::atomic<std::size_t> MAPPED_BYTES{0};
+    }
+
     bool open(bio::mapped_file& file, fs::path path, std::size_t new_size)
     {
         REQUIRE_GREATER(new_size, 0);
@@ -28,6 +41,72 @@ namespace henhouse::util
         if(!file.is_open())
             throw std::runtime_error{"unable to mmap " + path.string()};
 
+        MAPPED_BYTES.fetch_add(file.size(), std::memory_order_relaxed);
         return created;
     }
+
+    void resize(bio::mapped_file& file, std::size_t new_size)
+    {
+        REQUIRE(file.is_open());
+
+        const auto old_size = file.size();
+        file.resize(new_size);
+
+        MAPPED_BYTES.fetch_add(file.size(), std::memory_order_relaxed);
+        MAPPED_BYTES.fetch_sub(old_size, std::memory_order_relaxed);
+    }
+
+    void sync(bio::mapped_file& file, std::size_t offset, std::size_t size)
+    {
+        REQUIRE(file.is_open());
+        REQUIRE_LESS_EQUAL(offset + size, file.size());
+
+        if(size == 0) return;
+
+        //msync needs a page aligned start
+        const auto start = offset - (offset % PAGE_SIZE);
+        if(::msync(file.data() + start, size + (offset - start), MS_SYNC) != 0)
+            throw std::runtime_error{std::string{"unable to msync: "} + std::strerror(errno)};
+    }
+
+    void prefetch(const bio::mapped_file& file, std::size_t offset, std::size_t size)
+    {
+        REQUIRE(file.is_open());
+        REQUIRE_LESS_EQUAL(offset + size, file.size());
+
+        if(size == 0) return;
+
+        //only a hint, so failing is harmless
+        const auto start = offset - (offset % PAGE_SIZE);
+        ::madvise(const_cast<char*>(file.const_data()) + start, size + (offset - start), MADV_WILLNEED);
+    }
+
+    void sync(const fs::path& path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            if(errno == ENOENT) return;
+            throw std::runtime_error{"unable to open " + path.string() + ": " + std::strerror(errno)};
+        }
+
+        const int r = ::fdatasync(fd);
+        const int error = errno;
+        ::close(fd);
+
+        if(r != 0) 
+            throw std::runtime_error{"unable to sync " + path.string() + ": " + std::strerror(error)};
+    }
+
+    std::size_t mapped_bytes()
+    {
+        return MAPPED_BYTES.load(std::memory_order_relaxed);
+    }
+
+    void mapped_file_deleter::operator()(bio::mapped_file* f) const
+    {
+        if(f == nullptr) return;
+        if(f->is_open()) MAPPED_BYTES.fetch_sub(f->size(), std::memory_order_relaxed);
+        delete f;
+    }
 }
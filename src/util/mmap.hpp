@@ -9,11 +9,45 @@
 namespace bio = boost::iostreams;
 namespace henhouse::util
 {
-    using mapped_file_ptr = std::unique_ptr<bio::mapped_file>;
+    //closes the file and takes it out of the mapped bytes count
+    struct mapped_file_deleter
+    {
+        void operator()(bio::mapped_file* f) const;
+    };
+
+    using mapped_file_ptr = std::unique_ptr<bio::mapped_file, mapped_file_deleter>;
 
     const std::size_t PAGE_SIZE = bio::mapped_file::alignment();
     const float GROW_FACTOR = 1.5;
 
     bool open(bio::mapped_file& file, boost::filesystem::path path, std::size_t new_size);
+
+    /**
+     * Resizes the mapped file keeping the mapped bytes count correct. 
+     */
+    void resize(bio::mapped_file& file, std::size_t new_size);
+
+    /**
+     * Writes the dirty pages of the mapped file covering [offset, offset + size)
+     * to disk and waits until they are written.
+     */
+    void sync(bio::mapped_file& file, std::size_t offset, std::size_t size);
+
+    /**
+     * Asks the kernel to read the pages covering [offset, offset + size) 
+     * in the background. Never blocks on the read.
+     */
+    void prefetch(const bio::mapped_file& file, std::size_t offset, std::size_t size);
+
+    /**
+     * Writes every dirty page of the file at path to disk and waits. Used for
+     * files that are no longer mapped.
+     */
+    void sync(const boost::filesystem::path& path);
+
+    /**
+     * Total bytes currently mapped through open across all threads.
+     */
+    std::size_t mapped_bytes();
 }
 #endif
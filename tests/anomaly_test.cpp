@@ -0,0 +1,83 @@
+#include "test.hpp"
+
+#include "db/anomaly.hpp"
+
+#include <cmath>
+
+namespace hdb = henhouse::db;
+namespace ht = henhouse::test;
+
+namespace
+{
+    const hdb::time_type RES = 60;
+    const hdb::time_type START = 600000;
+    const hdb::time_type WINDOW = 10 * RES;
+
+    //alternates 1 and 3, a mean of 2 and a deviation of 1, then one spike
+    struct spiked : public ht::scratch_timeline
+    {
+        explicit spiked(hdb::count_type spike) : ht::scratch_timeline{RES}
+        {
+            for(hdb::time_type i = 0; i < 20; i++) TEST_TRUE(tl.put(START + i * RES, i % 2 == 0 ? 1 : 3));
+            TEST_TRUE(tl.put(START + 20 * RES, spike));
+        }
+    };
+
+    //a step holds the bucket ending it, so the last one is the spike
+    hdb::anomaly_query query(hdb::mean_type threshold)
+    {
+        return hdb::anomaly_query{START + 10 * RES, START + 20 * RES, RES, WINDOW, threshold};
+    }
+
+    void steps_score_against_their_window()
+    {
+        const spiked k{11};
+        const auto r = hdb::query_anomalies(k.tl, query(0));
+
+        TEST_EQUAL(r.times.size(), 10u);
+        TEST_EQUAL(r.means.size(), r.times.size());
+        TEST_EQUAL(r.scores.size(), r.times.size());
+        for(std::size_t i = 0; i + 1 < r.scores.size(); i++) TEST_EQUAL(std::abs(r.scores[i]), 1.0);
+
+        TEST_EQUAL(r.times.back(), START + 19 * RES);
+        TEST_EQUAL(r.means.back(), 11.0);
+        TEST_EQUAL(r.scores.back(), 9.0);
+    }
+
+    void threshold_keeps_only_outliers()
+    {
+        const spiked k{11};
+        const auto r = hdb::query_anomalies(k.tl, query(5));
+
+        TEST_EQUAL(r.times.size(), 1u);
+        TEST_EQUAL(r.scores[0], 9.0);
+
+        //a drop scores as far the other way
+        const spiked d{0};
+        TEST_EQUAL(hdb::query_anomalies(d.tl, query(1.5)).scores.size(), 1u);
+        TEST_EQUAL(hdb::query_anomalies(d.tl, query(1.5)).scores[0], -2.0);
+    }
+
+    void flat_windows_are_unscored()
+    {
+        ht::scratch_timeline k{RES};
+        for(hdb::time_type i = 0; i < 20; i++) TEST_TRUE(k.tl.put(START + i * RES, 4));
+
+        const auto r = hdb::query_anomalies(k.tl, query(0));
+        TEST_TRUE(!r.scores.empty());
+        for(const auto z : r.scores) TEST_TRUE(std::isnan(z));
+
+        //nothing to score never passes a threshold
+        TEST_TRUE(hdb::query_anomalies(k.tl, query(1)).times.empty());
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"steps score against their window", steps_score_against_their_window},
+        {"threshold keeps only outliers", threshold_keeps_only_outliers},
+        {"flat windows are unscored", flat_windows_are_unscored},
+    });
+}
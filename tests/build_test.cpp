@@ -0,0 +1,373 @@
+#include "test.hpp"
+
+#include "db/db.hpp"
+#include "db/build.hpp"
+#include "db/late.hpp"
+#include "db/verify.hpp"
+
+#include <fstream>
+
+#include <sys/stat.h>
+
+namespace hdb = henhouse::db;
+namespace ht = henhouse::test;
+namespace fs = boost::filesystem;
+
+namespace
+{
+    const hdb::time_type RES = 60;
+    const hdb::time_type START = 600000;
+
+    //puts a value of 1 into every bucket from START on
+    void fill(hdb::timeline_db& db, const std::string& key, std::size_t buckets)
+    {
+        for(std::size_t i = 0; i < buckets; i++) TEST_TRUE(db.put(key, START + i * RES, 1));
+    }
+
+    void check_clean(const fs::path& dir)
+    {
+        const auto s = hdb::verify_timeline(dir, hdb::verify_mode::check);
+        TEST_TRUE(s.clean());
+    }
+
+    //a rewrite replaces the file, a patch changes it in place
+    ino_t inode(const fs::path& p)
+    {
+        struct stat s;
+        TEST_EQUAL(::stat(p.c_str(), &s), 0);
+        return s.st_ino;
+    }
+
+    void write_file(const fs::path& p, const std::string& bytes)
+    {
+        std::ofstream out{p.string(), std::ios::binary | std::ios::trunc};
+        out.write(bytes.data(), bytes.size());
+    }
+
+    void written_timeline_matches_put()
+    {
+        ht::scratch_dir dir;
+        const hdb::buckets bs{{START, 1}, {START + RES, 2}, {START + 5 * RES, 3}, {START + 6 * RES, 4}};
+
+        auto put = hdb::open_timeline(dir.key("put").string(), RES);
+        for(const auto& b : bs) TEST_TRUE(put.put(b.time, b.value));
+
+        hdb::write_timeline(dir.key("written").string(), RES, bs);
+        const auto written = hdb::open_timeline(dir.key("written").string(), RES);
+
+        TEST_EQUAL(written.index().size(), put.index().size());
+        TEST_EQUAL(written.summary().sum, put.summary().sum);
+        for(auto a = START - RES; a < START + 8 * RES; a += RES)
+        {
+            const auto w = written.diff(a, a + 2 * RES, 0);
+            const auto p = put.diff(a, a + 2 * RES, 0);
+            TEST_EQUAL(w.sum, p.sum);
+            TEST_EQUAL(w.right.second_integral, p.right.second_integral);
+        }
+
+        const auto read = hdb::read_buckets(written);
+        TEST_EQUAL(read.size(), bs.size());
+        for(std::size_t i = 0; i < bs.size(); i++)
+        {
+            TEST_EQUAL(read[i].time, bs[i].time);
+            TEST_EQUAL(read[i].value, bs[i].value);
+        }
+        check_clean(dir.key("written"));
+    }
+
+    void merged_points_take_the_first_points_grid()
+    {
+        ht::scratch_dir dir;
+        const auto path = dir.key().string();
+
+        const auto r = hdb::merge_points(path, RES, hdb::data_points{{START + 7, 1}, {START + RES + 7, 2}, {START + RES + 50, 3}});
+        TEST_EQUAL(r.merged, 3u);
+        TEST_EQUAL(r.buckets, 2u);
+
+        const auto t = hdb::open_timeline(path, RES);
+        TEST_EQUAL(t.index().front().time, START + 7);
+        TEST_EQUAL(t.diff(START + 7, START + RES + 7, 0).sum, 5);
+        TEST_EQUAL(t.summary().sum, 6);
+        check_clean(path);
+    }
+
+    void late_point_past_back_limit()
+    {
+        ht::scratch_db s{4, RES};
+        auto& db = s.db;
+        fill(db, "k", 100);
+
+        //too far behind the last bucket for put, so it is staged and merged
+        const auto t = START + 10 * RES;
+        TEST_TRUE(!db.put("k", t, 5));
+
+        hdb::late_points late{s.dir.path() / ".late" / "0"};
+        late.add("k", t, 5);
+        late.add("k", t + 1, 2);
+        auto taken = late.take();
+
+        const auto data = hdb::key_dir(fs::path{s.dir.path()}, "k") / hdb::DATA_FILE;
+        db.sync("k");
+        const auto before = inode(data);
+        const auto r = db.merge("k", taken["k"]);
+        TEST_EQUAL(inode(data), before);
+
+        TEST_EQUAL(r.merged, 2u);
+        TEST_EQUAL(r.rejected, 0u);
+        TEST_EQUAL(ht::bucket_sum(db, "k", t, RES), 8);
+        TEST_EQUAL(ht::bucket_sum(db, "k", t + RES, RES), 1);
+        TEST_EQUAL(db.summary("k").sum, 107);
+        TEST_EQUAL(db.key_index_size("k"), 1u);
+        check_clean(hdb::key_dir(fs::path{s.dir.path()}, "k"));
+    }
+
+    void late_points_before_start_and_in_gaps()
+    {
+        ht::scratch_dir dir;
+        const auto path = dir.key().string();
+
+        hdb::data_points first{{START, 1}, {START + RES, 1}, {START + 10 * RES, 1}};
+        hdb::merge_points(path, RES, first);
+
+        //before the first bucket and into the gap both change the layout
+        hdb::data_points late{{START - 2 * RES, 3}, {START + 5 * RES + 7, 4}};
+        const auto r = hdb::merge_points(path, RES, late);
+        TEST_EQUAL(r.merged, 2u);
+
+        const auto t = hdb::open_timeline(path, RES);
+        TEST_EQUAL(t.summary().sum, 10);
+        TEST_EQUAL(t.index().front().time, START - 2 * RES);
+        TEST_EQUAL(t.diff(START + 4 * RES, START + 5 * RES, 0).sum, 4);
+        check_clean(path);
+    }
+
+    void patch_overflowing_compact_widens()
+    {
+        ht::scratch_dir dir;
+        const auto path = dir.key().string();
+
+        hdb::write_timeline(path, RES, hdb::buckets{{START, 1}, {START + RES, 1}, {START + 2 * RES, 1}}, hdb::item_width::compact);
+        TEST_TRUE(hdb::stored_width(path) == hdb::item_width::compact);
+
+        const hdb::count_type big = 3000000000;
+        hdb::merge_points(path, RES, hdb::data_points{{START + RES, big}});
+
+        TEST_TRUE(hdb::stored_width(path) == hdb::item_width::wide);
+        const auto t = hdb::open_timeline(path, RES);
+        TEST_EQUAL(t.summary().sum, big + 3);
+        check_clean(path);
+    }
+
+    void interrupted_rewrite_finishes()
+    {
+        ht::scratch_dir dir;
+        const auto path = dir.key();
+        const auto other = dir.key("other");
+
+        hdb::write_timeline(path.string(), RES, hdb::buckets{{START, 1}, {START + RES, 2}});
+        hdb::write_timeline(other.string(), RES, hdb::buckets{{START, 5}, {START + 5 * RES, 6}, {START + 6 * RES, 7}});
+
+        //crashed after the data was renamed in place but before the index
+        fs::copy_file(other / hdb::INDEX_FILE, path / (std::string{hdb::INDEX_FILE} + hdb::NEW_SUFFIX));
+        fs::copy_file(other / hdb::DATA_FILE, path / hdb::DATA_FILE, fs::copy_option::overwrite_if_exists);
+        write_file(path / hdb::REWRITE_FILE, hdb::DATA_FILE);
+
+        TEST_TRUE(hdb::has_unfinished_change(path));
+        const auto s = hdb::verify_timeline(path, hdb::verify_mode::check);
+        TEST_EQUAL(s.unfinished, 1u);
+
+        const auto t = hdb::open_timeline(path.string(), RES);
+        TEST_TRUE(!hdb::has_unfinished_change(path));
+        TEST_EQUAL(t.summary().sum, 18);
+        TEST_EQUAL(t.index().size(), 2u);
+        check_clean(path);
+    }
+
+    void unjournaled_rewrite_is_dropped()
+    {
+        ht::scratch_dir dir;
+        const auto path = dir.key();
+        const auto other = dir.key("other");
+
+        hdb::write_timeline(path.string(), RES, hdb::buckets{{START, 1}, {START + RES, 2}});
+        hdb::write_timeline(other.string(), RES, hdb::buckets{{START, 5}});
+
+        //crashed before the journal was written, so the old files stand
+        fs::copy_file(other / hdb::INDEX_FILE, path / (std::string{hdb::INDEX_FILE} + hdb::NEW_SUFFIX));
+        fs::copy_file(other / hdb::DATA_FILE, path / (std::string{hdb::DATA_FILE} + hdb::NEW_SUFFIX));
+
+        TEST_TRUE(!hdb::has_unfinished_change(path));
+        TEST_EQUAL(hdb::open_timeline(path.string(), RES).summary().sum, 3);
+
+        TEST_TRUE(hdb::recover_timeline(path));
+        TEST_TRUE(!fs::exists(path / (std::string{hdb::DATA_FILE} + hdb::NEW_SUFFIX)));
+        TEST_EQUAL(hdb::open_timeline(path.string(), RES).summary().sum, 3);
+    }
+
+    void interrupted_patch_finishes()
+    {
+        ht::scratch_dir dir;
+        const auto path = dir.key();
+
+        hdb::write_timeline(path.string(), RES, hdb::buckets{{START, 1}, {START + RES, 2}, {START + 2 * RES, 3}, {START + 3 * RES, 4}});
+
+        //crashed after journaling the patch, before any bucket changed
+        const hdb::bucket_patches patches{{1, 20}, {2, 30}};
+        write_file(path / hdb::PATCH_FILE, 
+                std::string{reinterpret_cast<const char*>(patches.data()), patches.size() * sizeof(hdb::bucket_patch)});
+
+        const auto t = hdb::open_timeline(path.string(), RES);
+        TEST_TRUE(!hdb::has_unfinished_change(path));
+        TEST_EQUAL(t.summary().sum, 55);
+        TEST_EQUAL(t.diff(START + RES, START + 2 * RES, 0).sum, 30);
+        check_clean(path);
+    }
+
+    void patch_recomputes_following_integrals()
+    {
+        ht::scratch_dir dir;
+        const auto path = dir.key();
+
+        hdb::write_timeline(path.string(), RES, hdb::buckets{{START, 1}, {START + RES, 2}, {START + 2 * RES, 3}});
+        TEST_TRUE(hdb::patch_timeline(path, hdb::bucket_patches{{0, 10}}));
+
+        const auto t = hdb::open_timeline(path.string(), RES);
+        TEST_EQUAL(t.summary().sum, 15);
+        TEST_EQUAL(t.diff(START, START + 2 * RES, 0).sum, 5);
+        TEST_TRUE(!fs::exists(path / hdb::PATCH_FILE));
+        check_clean(path);
+    }
+
+    void late_points_to_a_gauge_are_refused()
+    {
+        ht::scratch_db s{4, RES, 0, hdb::gap_policy{}, hdb::item_width::wide, "^g$"};
+        auto& db = s.db;
+        TEST_TRUE(db.put("g", START, hdb::put_value{0, 1.5, true}));
+        TEST_TRUE(db.put("g", START + RES, hdb::put_value{0, 2.5, true}));
+
+        const auto r = db.merge("g", hdb::data_points{{START, 3}});
+        TEST_EQUAL(r.merged, 0u);
+        TEST_EQUAL(r.rejected, 0u);
+        TEST_EQUAL(r.gauge, 1u);
+    }
+
+    void gaps_fill_only_up_to_the_policy()
+    {
+        const hdb::buckets bs{{START, 1}, {START + 3 * RES, 2}, {START + 10 * RES, 3}};
+
+        const auto none = hdb::fill_gaps(bs, RES, hdb::gap_policy{});
+        TEST_EQUAL(none.size(), bs.size());
+
+        //the gap of two is filled, the gap of six is past max_fill
+        const auto filled = hdb::fill_gaps(bs, RES, hdb::gap_policy{2, 4});
+        TEST_EQUAL(filled.size(), 5u);
+        TEST_EQUAL(filled[1].time, START + RES);
+        TEST_EQUAL(filled[1].value, 0);
+        TEST_EQUAL(filled[3].time, START + 3 * RES);
+        TEST_EQUAL(filled[4].time, START + 10 * RES);
+    }
+
+    void dry_run_compaction_leaves_the_files()
+    {
+        ht::scratch_dir dir;
+        const auto path = dir.key();
+
+        hdb::write_timeline(path.string(), RES, hdb::buckets{{START, 1}, {START + 3 * RES, 2}, {START + 5 * RES, 3}});
+        const auto before = inode(path / hdb::INDEX_FILE);
+
+        const auto r = hdb::compact_timeline(path.string(), RES, hdb::gap_policy{2, 2}, true);
+        TEST_EQUAL(r.index_before, 3u);
+        TEST_EQUAL(r.index_after, 1u);
+        TEST_EQUAL(r.filled, 3u);
+        TEST_EQUAL(r.dropped, 0u);
+
+        TEST_EQUAL(inode(path / hdb::INDEX_FILE), before);
+        TEST_EQUAL(hdb::open_timeline(path.string(), RES).index().size(), 3u);
+    }
+
+    void compaction_merges_index_items_and_keeps_sums()
+    {
+        ht::scratch_dir dir;
+        const auto path = dir.key().string();
+
+        hdb::write_timeline(path, RES, hdb::buckets{{START, 1}, {START + 3 * RES, 2}, {START + 5 * RES, 3}, {START + 20 * RES, 4}});
+
+        const auto r = hdb::compact_timeline(path, RES, hdb::gap_policy{2, 2}, false);
+        TEST_EQUAL(r.index_before, 4u);
+        TEST_EQUAL(r.index_after, 2u);
+
+        const auto t = hdb::open_timeline(path, RES);
+        TEST_EQUAL(t.index().size(), 2u);
+        TEST_EQUAL(t.summary().sum, 10);
+        TEST_EQUAL(t.diff(START - RES, START + 3 * RES, 0).sum, 3);
+        TEST_EQUAL(t.diff(START + 5 * RES, START + 20 * RES, 0).sum, 4);
+        check_clean(path);
+
+        //nothing left to fill, so a second pass doesn't rewrite
+        const auto again = hdb::compact_timeline(path, RES, hdb::gap_policy{2, 2}, false);
+        TEST_EQUAL(again.index_after, again.index_before);
+        TEST_EQUAL(again.filled, 0u);
+    }
+
+    void compaction_drops_buckets_before_keep_from()
+    {
+        ht::scratch_dir dir;
+        const auto path = dir.key().string();
+
+        hdb::write_timeline(path, RES, hdb::buckets{{START, 1}, {START + RES, 2}, {START + 2 * RES, 3}});
+
+        const auto r = hdb::compact_timeline(path, RES, hdb::gap_policy{}, false, START + RES);
+        TEST_EQUAL(r.dropped, 1u);
+
+        const auto t = hdb::open_timeline(path, RES);
+        TEST_EQUAL(t.index().front().time, START + RES);
+        TEST_EQUAL(t.summary().sum, 5);
+        check_clean(path);
+    }
+
+    void data_lock_excludes_a_second_holder()
+    {
+        ht::scratch_dir a;
+        ht::scratch_dir b;
+        const hdb::data_roots roots{a.path(), b.path()};
+        {
+            const hdb::data_lock held{roots};
+
+            bool refused = false;
+            try
+            {
+                const hdb::data_lock again{hdb::data_roots{b.path()}};
+            }
+            catch(std::runtime_error&)
+            {
+                refused = true;
+            }
+            TEST_TRUE(refused);
+        }
+
+        //released with its holder
+        const hdb::data_lock again{roots};
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"written timeline matches put", written_timeline_matches_put},
+        {"merged points take the first point's grid", merged_points_take_the_first_points_grid},
+        {"late point past the back limit", late_point_past_back_limit},
+        {"late points before start and in gaps", late_points_before_start_and_in_gaps},
+        {"patch overflowing compact widens", patch_overflowing_compact_widens},
+        {"interrupted rewrite finishes", interrupted_rewrite_finishes},
+        {"unjournaled rewrite is dropped", unjournaled_rewrite_is_dropped},
+        {"interrupted patch finishes", interrupted_patch_finishes},
+        {"patch recomputes following integrals", patch_recomputes_following_integrals},
+        {"late points to a gauge are refused", late_points_to_a_gauge_are_refused},
+        {"gaps fill only up to the policy", gaps_fill_only_up_to_the_policy},
+        {"dry run compaction leaves the files", dry_run_compaction_leaves_the_files},
+        {"compaction merges index items and keeps sums", compaction_merges_index_items_and_keeps_sums},
+        {"compaction drops buckets before keep_from", compaction_drops_buckets_before_keep_from},
+        {"data lock excludes a second holder", data_lock_excludes_a_second_holder},
+    });
+}
@@ -0,0 +1,125 @@
+#include "test.hpp"
+
+#include "service/bulk_reader.hpp"
+
+#include <cstring>
+
+namespace hdb = henhouse::db;
+namespace hn = henhouse::net;
+namespace ht = henhouse::test;
+namespace th = henhouse::threaded;
+
+namespace
+{
+    const hdb::time_type RES = 60;
+    const hdb::time_type START = 600000;
+
+    template <class value>
+        void append(std::string& frame, value v)
+        {
+            frame.append(reinterpret_cast<const char*>(&v), sizeof(v));
+        }
+
+    std::string key_frame(std::uint32_t id, const std::string& key)
+    {
+        std::string f{static_cast<char>(hn::bulk_key_frame)};
+        append(f, id);
+        return f + key;
+    }
+
+    struct record
+    {
+        std::uint32_t id;
+        hdb::time_type t;
+        hdb::count_type count;
+    };
+
+    std::string points_frame(const std::vector<record>& records)
+    {
+        std::string f{static_cast<char>(hn::bulk_points_frame)};
+        for(const auto& r : records)
+        {
+            append(f, r.id);
+            append(f, r.t);
+            append(f, r.count);
+        }
+        return f;
+    }
+
+    bool read(hn::bulk_reader& r, const std::string& frame)
+    {
+        return r.read(*folly::IOBuf::copyBuffer(frame.data(), frame.size()));
+    }
+
+    bool refused(hn::bulk_reader& r, const std::string& frame)
+    try
+    {
+        read(r, frame);
+        return false;
+    }
+    catch(hn::bulk_protocol_error&)
+    {
+        return true;
+    }
+
+    struct bulk_server
+    {
+        bulk_server() : db{2, hdb::data_roots{dir.path()}, 64, 16, RES} {}
+
+        ht::scratch_dir dir;
+        th::server db;
+    };
+
+    void points_go_to_their_registered_keys()
+    {
+        bulk_server s;
+        hn::bulk_reader r{s.db, hn::ingest_policy::block, hn::MAX_BULK_KEYS};
+
+        TEST_TRUE(!read(r, ""));
+        TEST_TRUE(!read(r, key_frame(0, "a")));
+        TEST_TRUE(!read(r, key_frame(7, "b")));
+        TEST_TRUE(read(r, points_frame({{0, START, 1}, {7, START, 2}, {0, START + RES, 3}})));
+        TEST_EQUAL(r.buffer().accepted(), 3u);
+        TEST_TRUE(r.buffer().send());
+
+        TEST_EQUAL(s.db.summary("a").get().sum, 4);
+        TEST_EQUAL(s.db.summary("b").get().sum, 2);
+    }
+
+    void a_frame_with_an_unknown_id_is_refused_whole()
+    {
+        bulk_server s;
+        hn::bulk_reader r{s.db, hn::ingest_policy::block, hn::MAX_BULK_KEYS};
+
+        TEST_TRUE(!read(r, key_frame(0, "a")));
+        TEST_TRUE(refused(r, points_frame({{0, START, 1}, {1, START, 1}})));
+        TEST_TRUE(refused(r, points_frame({{0, START, 1}, {hn::MAX_BULK_KEYS, START, 1}})));
+        TEST_EQUAL(r.buffer().accepted(), 0u);
+    }
+
+    void malformed_frames_are_refused()
+    {
+        bulk_server s;
+        hn::bulk_reader r{s.db, hn::ingest_policy::block, 4};
+
+        TEST_TRUE(!read(r, key_frame(0, "a")));
+
+        auto partial = points_frame({{0, START, 1}});
+        partial.pop_back();
+        TEST_TRUE(refused(r, partial));
+        TEST_TRUE(refused(r, key_frame(4, "too many")));
+        TEST_TRUE(refused(r, key_frame(1, "")));
+        TEST_TRUE(refused(r, std::string{"\x03"}));
+        TEST_EQUAL(r.buffer().accepted(), 0u);
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"points go to their registered keys", points_go_to_their_registered_keys},
+        {"a frame with an unknown id is refused whole", a_frame_with_an_unknown_id_is_refused_whole},
+        {"malformed frames are refused", malformed_frames_are_refused},
+    });
+}
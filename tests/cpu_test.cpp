@@ -0,0 +1,62 @@
+#include "test.hpp"
+
+#include "util/cpu.hpp"
+
+namespace hu = henhouse::util;
+namespace ht = henhouse::test;
+
+namespace
+{
+    bool refused(const std::string& cpus)
+    try
+    {
+        hu::parse_cpu_list(cpus);
+        return false;
+    }
+    catch(std::runtime_error&)
+    {
+        return true;
+    }
+
+    void cpu_lists_parse_like_taskset()
+    {
+        TEST_TRUE(hu::parse_cpu_list("").empty());
+        TEST_TRUE(hu::parse_cpu_list(" ").empty());
+        TEST_TRUE(hu::parse_cpu_list("3") == (hu::cpu_list{3}));
+        TEST_TRUE(hu::parse_cpu_list("0-3,8,10-11") == (hu::cpu_list{0, 1, 2, 3, 8, 10, 11}));
+        TEST_TRUE(hu::parse_cpu_list(" 1 , 4-5 ") == (hu::cpu_list{1, 4, 5}));
+    }
+
+    void bad_cpu_lists_are_refused()
+    {
+        TEST_TRUE(refused("a"));
+        TEST_TRUE(refused("1,"));
+        TEST_TRUE(refused("-1"));
+        TEST_TRUE(refused("3-1"));
+        TEST_TRUE(refused("1-"));
+    }
+
+    void rotation_hands_out_cpus_in_turn()
+    {
+        hu::cpu_rotation r{hu::cpu_list{4, 6}};
+        TEST_TRUE(!r.empty());
+        TEST_EQUAL(r.next(), 4);
+        TEST_EQUAL(r.next(), 6);
+        TEST_EQUAL(r.next(), 4);
+
+        //nothing to place on
+        hu::cpu_rotation none{hu::cpu_list{}};
+        TEST_TRUE(none.empty());
+        none.place_current_thread();
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"cpu lists parse like taskset", cpu_lists_parse_like_taskset},
+        {"bad cpu lists are refused", bad_cpu_lists_are_refused},
+        {"rotation hands out cpus in turn", rotation_hands_out_cpus_in_turn},
+    });
+}
@@ -0,0 +1,196 @@
+#include "test.hpp"
+
+#include "db/db.hpp"
+
+namespace hdb = henhouse::db;
+namespace ht = henhouse::test;
+
+namespace
+{
+    const hdb::time_type RES = 60;
+    const hdb::time_type START = 600000;
+    const std::size_t SLOTS = 16;
+
+    void puts_to_the_last_bucket_add_up()
+    {
+        ht::scratch_db s{4, RES, SLOTS};
+
+        for(int i = 0; i < 10; i++) TEST_TRUE(s.db.put("k", START + i, 1));
+        TEST_TRUE(s.db.has_coalesced());
+        TEST_EQUAL(s.db.stats().coalesced, 9u);
+
+        //a read writes the coalesced put first
+        TEST_EQUAL(ht::bucket_sum(s.db, "k", START, RES), 10);
+        TEST_TRUE(!s.db.has_coalesced());
+    }
+
+    void a_put_past_the_bucket_closes_it()
+    {
+        ht::scratch_db s{4, RES, SLOTS};
+
+        TEST_TRUE(s.db.put("k", START, 1));
+        TEST_TRUE(s.db.put("k", START + 1, 2));
+        TEST_TRUE(s.db.put("k", START + RES, 4));
+        TEST_TRUE(s.db.put("k", START + RES + 1, 8));
+
+        TEST_EQUAL(ht::bucket_sum(s.db, "k", START, RES), 3);
+        TEST_EQUAL(ht::bucket_sum(s.db, "k", START + RES, RES), 12);
+        TEST_EQUAL(s.db.summary("k").sum, 15);
+    }
+
+    void coalesced_puts_are_written_on_close()
+    {
+        ht::scratch_dir dir;
+        {
+            hdb::timeline_db db{hdb::data_roots{dir.path()}, 4, RES, SLOTS};
+            TEST_TRUE(db.put("k", START, 1));
+            TEST_TRUE(db.put("k", START + 1, 2));
+        }
+
+        hdb::timeline_db db{dir.str(), 4, RES};
+        TEST_EQUAL(db.summary("k").sum, 3);
+    }
+
+    void sync_writes_pending_and_closed_timelines()
+    {
+        ht::scratch_db s{1, RES, SLOTS};
+        TEST_TRUE(s.db.put("a", START, 1));
+        TEST_TRUE(s.db.put("a", START + 1, 2));
+        TEST_TRUE(s.db.has_coalesced());
+
+        s.db.sync("a");
+        TEST_TRUE(!s.db.has_coalesced());
+
+        //a cache of one closes a when b opens, so a is synced by its files
+        TEST_TRUE(s.db.put("b", START, 4));
+        s.db.sync("b");
+        TEST_EQUAL(s.db.stats().evictions, 1u);
+        s.db.sync("a");
+        TEST_EQUAL(s.db.summary("a").sum, 3);
+    }
+
+    void hot_keys_are_the_open_timelines_most_recent_first()
+    {
+        ht::scratch_db s{2, RES};
+        TEST_TRUE(s.db.put("a", START, 1));
+        TEST_TRUE(s.db.put("b", START, 1));
+        TEST_TRUE(s.db.put("c", START, 1));
+        TEST_TRUE(s.db.hot_keys() == (std::vector<std::string>{"c", "b"}));
+
+        TEST_EQUAL(s.db.summary("b").sum, 1);
+        TEST_TRUE(s.db.hot_keys() == (std::vector<std::string>{"b", "c"}));
+    }
+
+    void warmed_timelines_are_read_from_the_cache()
+    {
+        ht::scratch_dir dir;
+        {
+            hdb::timeline_db db{dir.str(), 4, RES};
+            TEST_TRUE(db.put("a", START, 1));
+        }
+
+        hdb::timeline_db db{dir.str(), 4, RES};
+        db.warm("a");
+        const auto misses = db.stats().misses;
+
+        TEST_EQUAL(db.summary("a").sum, 1);
+        TEST_EQUAL(db.stats().misses, misses);
+        TEST_TRUE(db.hot_keys() == (std::vector<std::string>{"a"}));
+    }
+
+    void keys_map_to_one_root_and_back()
+    {
+        ht::scratch_dir a;
+        ht::scratch_dir b;
+        const hdb::data_roots roots{a.path(), b.path()};
+
+        for(const std::string k : {"k", "a.long.key.split.into.dirs", "x"})
+        {
+            const auto n = hdb::root_num(k, roots.size());
+            TEST_TRUE(n < roots.size());
+            TEST_EQUAL(hdb::root_num(k, roots.size()), n);
+            TEST_TRUE(hdb::key_dir(roots, k) == hdb::key_dir(roots[n], k));
+            TEST_EQUAL(hdb::dir_key(roots[n], hdb::key_dir(roots, k)), k);
+        }
+    }
+
+    void data_roots_parse_from_a_list()
+    {
+        TEST_EQUAL(hdb::parse_data_roots("a").size(), 1u);
+        TEST_TRUE(hdb::parse_data_roots("a,,b,") == (hdb::data_roots{"a", "b"}));
+
+        bool refused = false;
+        try
+        {
+            hdb::parse_data_roots(",");
+        }
+        catch(std::runtime_error&)
+        {
+            refused = true;
+        }
+        TEST_TRUE(refused);
+    }
+
+    void timelines_spread_across_roots()
+    {
+        ht::scratch_dir a;
+        ht::scratch_dir b;
+        const hdb::data_roots roots{a.path(), b.path()};
+        {
+            hdb::timeline_db db{roots, 4, RES};
+            for(int i = 0; i < 32; i++) TEST_TRUE(db.put("k" + std::to_string(i), START, i));
+        }
+
+        for(const auto& root : roots) TEST_TRUE(!boost::filesystem::is_empty(root));
+
+        hdb::timeline_db db{roots, 4, RES};
+        for(int i = 0; i < 32; i++) 
+        {
+            const auto k = "k" + std::to_string(i);
+            TEST_TRUE(boost::filesystem::exists(hdb::key_dir(roots, k) / hdb::INDEX_FILE));
+            TEST_EQUAL(db.summary(k).sum, i);
+        }
+    }
+
+    void gauges_are_not_coalesced()
+    {
+        ht::scratch_db s{4, RES, SLOTS, hdb::gap_policy{}, hdb::item_width::wide, "^g$"};
+
+        TEST_TRUE(s.db.put("g", START, hdb::put_value{0, 1.5, true}));
+        TEST_TRUE(s.db.put("g", START + 1, hdb::put_value{0, 2.5, true}));
+        TEST_TRUE(!s.db.has_coalesced());
+        TEST_EQUAL(s.db.stats().coalesced, 0u);
+    }
+
+    void counters_refuse_fractions()
+    {
+        ht::scratch_db s{4, RES, SLOTS};
+
+        //a fractional first value doesn't make a gauge
+        TEST_TRUE(!s.db.put("k", START, hdb::put_value{1, 1.5, true}));
+        TEST_TRUE(s.db.put("k", START, 2));
+        TEST_TRUE(!s.db.put("k", START + 1, hdb::put_value{1, 1.5, true}));
+        TEST_TRUE(s.db.put("k", START + 2, 3));
+
+        TEST_EQUAL(s.db.summary("k").sum, 5);
+        TEST_TRUE(!s.db.find("k")->is_gauge());
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"puts to the last bucket add up", puts_to_the_last_bucket_add_up},
+        {"a put past the bucket closes it", a_put_past_the_bucket_closes_it},
+        {"coalesced puts are written on close", coalesced_puts_are_written_on_close},
+        {"sync writes pending and closed timelines", sync_writes_pending_and_closed_timelines},
+        {"hot keys are the open timelines most recent first", hot_keys_are_the_open_timelines_most_recent_first},
+        {"warmed timelines are read from the cache", warmed_timelines_are_read_from_the_cache},
+        {"keys map to one root and back", keys_map_to_one_root_and_back},
+        {"data roots parse from a list", data_roots_parse_from_a_list},
+        {"timelines spread across roots", timelines_spread_across_roots},
+        {"gauges are not coalesced", gauges_are_not_coalesced},
+        {"counters refuse fractions", counters_refuse_fractions},
+    });
+}
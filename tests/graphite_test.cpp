@@ -0,0 +1,107 @@
+#include "test.hpp"
+
+#include "service/graphite.hpp"
+
+namespace hn = henhouse::net;
+namespace ht = henhouse::test;
+
+namespace
+{
+    hn::point parse(const char* line)
+    {
+        hn::point p;
+        TEST_TRUE(hn::parse_point(line, p));
+        return p;
+    }
+
+    bool malformed(const char* line)
+    {
+        hn::point p;
+        return !hn::parse_point(line, p);
+    }
+
+    void integers_are_exact()
+    {
+        const auto p = parse("a.b 9007199254740993 1000");
+        TEST_TRUE(p.key == "a.b");
+        TEST_EQUAL(p.value.count, 9007199254740993);
+        TEST_TRUE(!p.value.fractional);
+        TEST_EQUAL(p.time, 1000u);
+
+        TEST_EQUAL(parse("a -5 1000").value.count, -5);
+        TEST_EQUAL(parse("a +5 1000").value.count, 5);
+    }
+
+    void decimals_are_fractional()
+    {
+        auto p = parse("a 2.75 1000");
+        TEST_TRUE(p.value.fractional);
+        TEST_EQUAL(p.value.count, 2);
+        TEST_EQUAL(p.value.gauge, 2.75);
+
+        p = parse("a -2.75 1000");
+        TEST_EQUAL(p.value.count, -2);
+    }
+
+    void exponents_are_fractional()
+    {
+        auto p = parse("a 1.5e-05 1000");
+        TEST_TRUE(p.value.fractional);
+        TEST_EQUAL(p.value.count, 0);
+        TEST_EQUAL(p.value.gauge, 1.5e-05);
+    }
+
+    void whole_decimals_are_counts()
+    {
+        auto p = parse("a 1.0 1000");
+        TEST_TRUE(!p.value.fractional);
+        TEST_EQUAL(p.value.count, 1);
+
+        p = parse("a 1e3 1000");
+        TEST_TRUE(!p.value.fractional);
+        TEST_EQUAL(p.value.count, 1000);
+        TEST_EQUAL(p.value.gauge, 1000.0);
+
+        TEST_EQUAL(parse("a 2E+2 1000").value.count, 200);
+    }
+
+    void out_of_range_is_malformed()
+    {
+        TEST_TRUE(malformed("a 9223372036854775808 1000"));
+        TEST_TRUE(malformed("a -9223372036854775809 1000"));
+        TEST_TRUE(malformed("a 1e19 1000"));
+        TEST_TRUE(malformed("a 1e400 1000"));
+        TEST_TRUE(malformed("a 1 18446744073709551616"));
+
+        TEST_EQUAL(parse("a 9223372036854775807 1000").value.count, 9223372036854775807);
+    }
+
+    void junk_is_malformed()
+    {
+        TEST_TRUE(malformed("a"));
+        TEST_TRUE(malformed("a 1"));
+        TEST_TRUE(malformed("a x 1000"));
+        TEST_TRUE(malformed("a - 1000"));
+        TEST_TRUE(malformed("a 1.2.3 1000"));
+        TEST_TRUE(malformed("a e5 1000"));
+        TEST_TRUE(malformed("a 0x10 1000"));
+        TEST_TRUE(malformed("a inf 1000"));
+        TEST_TRUE(malformed("a nan 1000"));
+        TEST_TRUE(malformed("a 1 -1000"));
+        TEST_TRUE(malformed("a 1 1000.5"));
+        TEST_TRUE(malformed("a 1 1000 extra"));
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"integers are exact", integers_are_exact},
+        {"decimals are fractional", decimals_are_fractional},
+        {"exponents are fractional", exponents_are_fractional},
+        {"whole decimals are counts", whole_decimals_are_counts},
+        {"out of range is malformed", out_of_range_is_malformed},
+        {"junk is malformed", junk_is_malformed},
+    });
+}
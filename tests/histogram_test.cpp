@@ -0,0 +1,87 @@
+#include "test.hpp"
+
+#include "util/histogram.hpp"
+
+#include <limits>
+#include <thread>
+
+namespace hu = henhouse::util;
+namespace ht = henhouse::test;
+
+namespace
+{
+    void small_values_are_exact()
+    {
+        for(std::uint64_t v = 0; v < hu::HISTOGRAM_SUB_BUCKETS; v++)
+        {
+            TEST_EQUAL(hu::histogram_bucket(v), v);
+            TEST_EQUAL(hu::histogram_bucket_max(v), v);
+        }
+    }
+
+    void buckets_bound_their_values_closely()
+    {
+        std::size_t last = 0;
+        for(std::uint64_t v = 1; v < (std::uint64_t{1} << 40); v = v * 3 / 2 + 1)
+        {
+            const auto b = hu::histogram_bucket(v);
+            const auto max = hu::histogram_bucket_max(b);
+            TEST_TRUE(b >= last);
+            TEST_TRUE(max >= v);
+            TEST_TRUE(max - v <= v / hu::HISTOGRAM_SUB_BUCKETS);
+            TEST_TRUE(b == 0 || hu::histogram_bucket_max(b - 1) < v);
+            last = b;
+        }
+
+        const auto top = hu::histogram_bucket(std::numeric_limits<std::uint64_t>::max());
+        TEST_EQUAL(top, hu::HISTOGRAM_BUCKETS - 1);
+        TEST_EQUAL(hu::histogram_bucket_max(top), std::numeric_limits<std::uint64_t>::max());
+    }
+
+    void percentiles_report_bucket_bounds()
+    {
+        hu::histogram h;
+        for(std::uint64_t v = 1; v <= 100; v++) h.record(v);
+
+        const auto s = h.snapshot();
+        TEST_EQUAL(s.count, 100u);
+        TEST_EQUAL(s.sum, 5050u);
+        TEST_EQUAL(s.percentile(0), 1u);
+        TEST_EQUAL(s.percentile(0.5), hu::histogram_bucket_max(hu::histogram_bucket(50)));
+        TEST_EQUAL(s.percentile(1), hu::histogram_bucket_max(hu::histogram_bucket(100)));
+        TEST_EQUAL(s.count_at_most(7), 7u);
+        TEST_EQUAL(s.count_at_most(hu::histogram_bucket_max(hu::histogram_bucket(100))), 100u);
+
+        TEST_EQUAL(hu::histogram_snapshot{}.percentile(0.99), 0u);
+    }
+
+    void records_from_every_thread_are_counted()
+    {
+        hu::histogram h;
+        std::vector<std::thread> writers;
+        for(int t = 0; t < 8; t++) writers.emplace_back([&]
+        {
+            for(int i = 0; i < 1000; i++) h.record(10);
+        });
+        for(auto& w : writers) w.join();
+
+        auto s = h.snapshot();
+        TEST_EQUAL(s.count, 8000u);
+        TEST_EQUAL(s.sum, 80000u);
+
+        s.merge(h.snapshot());
+        TEST_EQUAL(s.count, 16000u);
+        TEST_EQUAL(s.counts[hu::histogram_bucket(10)], 16000u);
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"small values are exact", small_values_are_exact},
+        {"buckets bound their values closely", buckets_bound_their_values_closely},
+        {"percentiles report bucket bounds", percentiles_report_bucket_bounds},
+        {"records from every thread are counted", records_from_every_thread_are_counted},
+    });
+}
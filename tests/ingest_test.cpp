@@ -0,0 +1,148 @@
+#include "test.hpp"
+
+#include "service/ingest.hpp"
+
+namespace hdb = henhouse::db;
+namespace hn = henhouse::net;
+namespace ht = henhouse::test;
+namespace th = henhouse::threaded;
+
+namespace
+{
+    const hdb::time_type RES = 60;
+
+    struct ingest_server
+    {
+        explicit ingest_server(std::size_t workers = 2, std::size_t queue_size = 64) : 
+            db{workers, hdb::data_roots{dir.path()}, queue_size, 16, RES} {}
+
+        ht::scratch_dir dir;
+        th::server db;
+    };
+
+    std::string now()
+    {
+        return std::to_string(std::time(nullptr));
+    }
+
+    void lines_cut_by_chunks_are_joined()
+    {
+        ingest_server s;
+        hn::ingest_buffer buffer{s.db, hn::ingest_policy::block};
+        hn::chunked_lines lines{buffer};
+
+        const auto body = "a 1 " + now() + "\nb 2 " + now() + "\r\na 3 " + now() + "\nb 4 " + now();
+        for(std::size_t i = 0; i < body.size(); i += 5) lines.add(stde::string_view{body}.substr(i, 5));
+        lines.finish();
+
+        TEST_EQUAL(buffer.accepted(), 4u);
+        TEST_EQUAL(buffer.rejected(), 0u);
+        TEST_TRUE(buffer.send());
+        TEST_EQUAL(s.db.summary("a").get().sum, 4);
+        TEST_EQUAL(s.db.summary("b").get().sum, 6);
+    }
+
+    void long_lines_are_dropped_whole()
+    {
+        ingest_server s;
+        hn::ingest_buffer buffer{s.db, hn::ingest_policy::block};
+        hn::chunked_lines lines{buffer};
+
+        const std::string long_key(hn::MAX_PUT_LINE, 'x');
+        lines.add("a 1 " + now() + "\n" + long_key);
+        lines.add(long_key);
+        lines.add(" 1 " + now() + "\na 2 ");
+        lines.add(now());
+        lines.finish();
+
+        TEST_EQUAL(lines.rejected(), 1u);
+        TEST_EQUAL(buffer.accepted(), 2u);
+        TEST_TRUE(buffer.send());
+        TEST_EQUAL(s.db.summary("a").get().sum, 3);
+    }
+
+    void policies_parse_by_name()
+    {
+        TEST_TRUE(hn::parse_ingest_policy("block") == hn::ingest_policy::block);
+        TEST_TRUE(hn::parse_ingest_policy("shed") == hn::ingest_policy::shed);
+        TEST_TRUE(hn::parse_ingest_policy("pause") == hn::ingest_policy::pause);
+
+        bool refused = false;
+        try
+        {
+            hn::parse_ingest_policy("drop");
+        }
+        catch(std::runtime_error&)
+        {
+            refused = true;
+        }
+        TEST_TRUE(refused);
+    }
+
+    void resume_delay_doubles_up_to_its_max()
+    {
+        auto d = hn::RESUME_DELAY;
+        for(int i = 0; i < 10; i++)
+        {
+            const auto next = hn::next_resume_delay(d);
+            TEST_TRUE(next == std::min(d * 2, hn::MAX_RESUME_DELAY));
+            d = next;
+        }
+        TEST_TRUE(d == hn::MAX_RESUME_DELAY);
+    }
+
+    //a stopped server's queue never drains, so sends fill it.
+    //returns how many sends went through before one was refused.
+    std::size_t send_until_refused(hn::ingest_buffer& buffer, th::server& db)
+    {
+        db.stop();
+
+        std::size_t sent = 0;
+        for(; sent < 16; sent++)
+        {
+            buffer.add_lines("a 1 " + now(), std::time(nullptr));
+            if(!buffer.send() || db.ingest().dropped.load() > 0) break;
+        }
+        return sent;
+    }
+
+    void shed_drops_what_a_full_queue_refuses()
+    {
+        ingest_server s{1, 2};
+        hn::ingest_buffer buffer{s.db, hn::ingest_policy::shed};
+        TEST_TRUE(send_until_refused(buffer, s.db) <= 2);
+        TEST_EQUAL(s.db.ingest().dropped.load(), 1u);
+        TEST_TRUE(!buffer.paused());
+
+        buffer.add_lines("a 1 " + now() + "\na 2 " + now(), std::time(nullptr));
+        TEST_TRUE(buffer.send());
+        TEST_EQUAL(s.db.ingest().dropped.load(), 3u);
+    }
+
+    void pause_keeps_what_a_full_queue_refuses()
+    {
+        ingest_server s{1, 2};
+        hn::ingest_buffer buffer{s.db, hn::ingest_policy::pause};
+        const auto sent = send_until_refused(buffer, s.db);
+        TEST_TRUE(sent <= 2);
+        TEST_TRUE(buffer.paused());
+
+        TEST_TRUE(!buffer.send());
+        TEST_TRUE(buffer.paused());
+        TEST_EQUAL(s.db.ingest().dropped.load(), 0u);
+        TEST_EQUAL(buffer.accepted(), sent + 1);
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"lines cut by chunks are joined", lines_cut_by_chunks_are_joined},
+        {"long lines are dropped whole", long_lines_are_dropped_whole},
+        {"policies parse by name", policies_parse_by_name},
+        {"resume delay doubles up to its max", resume_delay_doubles_up_to_its_max},
+        {"shed drops what a full queue refuses", shed_drops_what_a_full_queue_refuses},
+        {"pause keeps what a full queue refuses", pause_keeps_what_a_full_queue_refuses},
+    });
+}
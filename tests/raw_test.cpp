@@ -0,0 +1,104 @@
+#include "test.hpp"
+
+#include "service/raw.hpp"
+#include "service/threaded.hpp"
+
+#include <cstring>
+
+#include <folly/io/Cursor.h>
+
+namespace hdb = henhouse::db;
+namespace hn = henhouse::net;
+namespace ht = henhouse::test;
+namespace th = henhouse::threaded;
+
+namespace
+{
+    const hdb::time_type RES = 60;
+    const hdb::time_type START = 600000;
+
+    struct raw_server
+    {
+        explicit raw_server(hdb::item_width width) : 
+            db{1, hdb::data_roots{dir.path()}, 64, 16, RES, {}, {}, {}, {}, {}, {}, width} 
+        {
+            //bucket i holds i + 1
+            for(hdb::time_type i = 0; i < 10; i++) db.put("k", START + i * RES, i + 1);
+        }
+
+        ht::scratch_dir dir;
+        th::server db;
+    };
+
+    hn::raw_header read_header(folly::io::Cursor& c)
+    {
+        hn::raw_header h;
+        c.pull(&h, sizeof(h));
+        TEST_TRUE(std::memcmp(h.magic, hn::RAW_MAGIC, sizeof(h.magic)) == 0);
+        TEST_EQUAL(h.version, hn::RAW_VERSION);
+        TEST_EQUAL(h.index_item_size, sizeof(hdb::index_item));
+        TEST_EQUAL(h.resolution, RES);
+        return h;
+    }
+
+    template <class item>
+        void check_items(hdb::item_width width)
+        {
+            raw_server s{width};
+            const auto body = s.db.raw("k", START + 2 * RES, START + 5 * RES).get();
+
+            folly::io::Cursor c{body.get()};
+            const auto h = read_header(c);
+            TEST_EQUAL(h.data_item_size, sizeof(item));
+            TEST_EQUAL(h.a, START + 2 * RES);
+            TEST_EQUAL(h.b, START + 5 * RES);
+            TEST_EQUAL(h.index_count, 1u);
+            TEST_EQUAL(h.data_pos, 2u);
+            TEST_EQUAL(h.data_count, 4u);
+            TEST_EQUAL(c.totalLength(), h.index_count * sizeof(hdb::index_item) + h.data_count * sizeof(item));
+
+            hdb::index_item i;
+            c.pull(&i, sizeof(i));
+            TEST_EQUAL(i.time, START);
+            TEST_EQUAL(i.pos, 0u);
+
+            for(std::size_t d = 0; d < h.data_count; d++)
+            {
+                item v;
+                c.pull(&v, sizeof(v));
+                TEST_EQUAL(v.value, h.data_pos + d + 1);
+            }
+        }
+
+    void wide_items_are_sent_as_stored()
+    {
+        check_items<hdb::data_item>(hdb::item_width::wide);
+    }
+
+    void compact_items_are_sent_as_stored()
+    {
+        check_items<hdb::data_item32>(hdb::item_width::compact);
+    }
+
+    void a_range_before_the_timeline_is_empty()
+    {
+        raw_server s{hdb::item_width::wide};
+        const auto body = s.db.raw("k", START - 10 * RES, START - 5 * RES).get();
+
+        folly::io::Cursor c{body.get()};
+        const auto h = read_header(c);
+        TEST_EQUAL(h.index_count, 0u);
+        TEST_EQUAL(h.data_count, 0u);
+        TEST_EQUAL(c.totalLength(), 0u);
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"wide items are sent as stored", wide_items_are_sent_as_stored},
+        {"compact items are sent as stored", compact_items_are_sent_as_stored},
+        {"a range before the timeline is empty", a_range_before_the_timeline_is_empty},
+    });
+}
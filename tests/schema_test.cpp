@@ -0,0 +1,147 @@
+#include "test.hpp"
+
+#include "db/late.hpp"
+#include "db/schema.hpp"
+
+#include <sstream>
+
+namespace hdb = henhouse::db;
+namespace ht = henhouse::test;
+
+namespace
+{
+    hdb::storage_schema defaults()
+    {
+        hdb::storage_schema d;
+        d.resolution = 60;
+        return d;
+    }
+
+    hdb::storage_schemas parse(const std::string& text)
+    {
+        std::istringstream in{text};
+        return hdb::parse_schemas(in, defaults());
+    }
+
+    //true if parsing fails with an error naming the line
+    bool refused(const std::string& text, const std::string& line)
+    {
+        try
+        {
+            parse(text);
+        }
+        catch(std::runtime_error& e)
+        {
+            return std::string{e.what()}.find("schema line " + line + ":") == 0;
+        }
+        return false;
+    }
+
+    void fields_default_in_order()
+    {
+        const auto s = parse(
+                "# comment\n"
+                "\n"
+                "^a\\. 10\n"
+                "^b\\. 20 8192\n"
+                "^c\\. 30 8192 2.5 86400\n");
+        TEST_EQUAL(s.size(), 3u);
+
+        const auto d = defaults();
+        TEST_EQUAL(s.find("a.x", d).resolution, 10u);
+        TEST_EQUAL(s.find("a.x", d).files.size, hdb::DATA_SIZE);
+        TEST_EQUAL(s.find("b.x", d).files.size, 8192u);
+        TEST_EQUAL(s.find("c.x", d).files.growth, 2.5f);
+        TEST_EQUAL(s.find("c.x", d).retention, 86400u);
+        TEST_EQUAL(s.find("d.x", d).resolution, 60u);
+    }
+
+    void bad_fields_are_refused_with_their_line()
+    {
+        TEST_TRUE(refused("a 10\nb\n", "2"));
+        TEST_TRUE(refused("a 0\n", "1"));
+        TEST_TRUE(refused("a -60\n", "1"));
+        TEST_TRUE(refused("a 60 0\n", "1"));
+        TEST_TRUE(refused("a 60 -4096\n", "1"));
+        TEST_TRUE(refused("a 60 4096 0\n", "1"));
+        TEST_TRUE(refused("a 60 4096 -2\n", "1"));
+        TEST_TRUE(refused("a 60 4096 1\n", "1"));
+        TEST_TRUE(refused("a 60 4096 nan\n", "1"));
+        TEST_TRUE(refused("a 60 4096 2 -1\n", "1"));
+        TEST_TRUE(refused("a 60 4096 2 1 extra\n", "1"));
+        TEST_TRUE(refused("a 99999999999999999999\n", "1"));
+        TEST_TRUE(refused("\n\na( 60\n", "3"));
+    }
+
+    void new_timelines_take_the_first_matching_schema()
+    {
+        ht::scratch_db s{4, 60, 0, hdb::gap_policy{}, hdb::item_width::wide, "", parse("^fast\\. 10\n^f 30\n")};
+        auto& db = s.db;
+
+        TEST_TRUE(db.put("fast.x", 600000, 1));
+        TEST_TRUE(db.put("free.x", 600000, 1));
+        TEST_TRUE(db.put("slow.x", 600000, 1));
+
+        TEST_EQUAL(db.summary("fast.x").resolution, 10u);
+        TEST_EQUAL(db.summary("free.x").resolution, 30u);
+        TEST_EQUAL(db.summary("slow.x").resolution, 60u);
+    }
+
+    void spilled_points_take_their_schema_resolution()
+    {
+        ht::scratch_dir dir;
+        const hdb::data_roots roots{dir.path()};
+        const auto spill = dir.path() / ".late";
+        boost::filesystem::create_directories(spill);
+
+        {
+            hdb::late_points late{spill / "0"};
+            late.add("fast.x", 600000, 1);
+            late.add("slow.x", 600000, 2);
+            late.flush();
+        }
+
+        const auto r = hdb::merge_spill_files(spill, roots, parse("^fast\\. 10\n"), defaults());
+        TEST_EQUAL(r.merged, 2u);
+
+        auto fast = hdb::open_timeline(hdb::key_dir(roots, "fast.x").string(), 1);
+        auto slow = hdb::open_timeline(hdb::key_dir(roots, "slow.x").string(), 1);
+        TEST_EQUAL(fast.summary().resolution, 10u);
+        TEST_EQUAL(slow.summary().resolution, 60u);
+    }
+
+    void retention_drops_old_buckets()
+    {
+        ht::scratch_db s{4, 60, 0, hdb::gap_policy{}, hdb::item_width::wide, "", parse("^short\\. 60 4096 2 600\n")};
+        auto& db = s.db;
+
+        const hdb::time_type start = 600000;
+        for(hdb::time_type i = 0; i < 20; i++)
+        {
+            TEST_TRUE(db.put("short.x", start + i * 60, 1));
+            TEST_TRUE(db.put("long.x", start + i * 60, 1));
+        }
+
+        const auto now = start + 20 * 60;
+        const auto r = db.apply_retention("short.x", now);
+        TEST_EQUAL(r.dropped, 10u);
+        TEST_EQUAL(db.summary("short.x").sum, 10);
+
+        //nothing left to drop, so nothing is rewritten
+        TEST_EQUAL(db.apply_retention("short.x", now).index_before, 0u);
+        TEST_EQUAL(db.apply_retention("long.x", now).dropped, 0u);
+        TEST_EQUAL(db.summary("long.x").sum, 20);
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"fields default in order", fields_default_in_order},
+        {"bad fields are refused with their line", bad_fields_are_refused_with_their_line},
+        {"new timelines take the first matching schema", new_timelines_take_the_first_matching_schema},
+        {"spilled points take their schema resolution", spilled_points_take_their_schema_resolution},
+        {"retention drops old buckets", retention_drops_old_buckets},
+    });
+}
@@ -0,0 +1,96 @@
+#include "test.hpp"
+
+#include "db/build.hpp"
+#include "db/snapshot.hpp"
+#include "db/verify.hpp"
+
+namespace hdb = henhouse::db;
+namespace ht = henhouse::test;
+namespace fs = boost::filesystem;
+
+namespace
+{
+    const hdb::time_type RES = 60;
+    const hdb::time_type START = 600000;
+
+    void fill(hdb::any_timeline& t, hdb::time_type from, hdb::time_type to)
+    {
+        for(auto i = from; i < to; i++) TEST_TRUE(t.put(START + i * RES, 1));
+        t.sync();
+    }
+
+    void fuzzy_copy_takes_every_timeline()
+    {
+        ht::scratch_db s{4, RES};
+        TEST_TRUE(s.db.put("a", START, 1));
+        TEST_TRUE(s.db.put("b.c", START, 2));
+        s.db.sync("a");
+        s.db.sync("b.c");
+
+        //scratch data in hidden directories stays behind
+        fs::create_directories(s.dir.key(".late"));
+        hdb::write_timeline(s.dir.key(".late").string(), RES, hdb::buckets{{START, 5}});
+
+        ht::scratch_dir dest;
+        const auto stats = hdb::fuzzy_copy(s.dir.path(), dest.key("snap"));
+        TEST_EQUAL(stats.files, 4u);
+        TEST_TRUE(!fs::exists(dest.key("snap") / ".late"));
+
+        hdb::timeline_db copy{dest.key("snap").string(), 4, RES};
+        TEST_EQUAL(copy.summary("a").sum, 1);
+        TEST_EQUAL(copy.summary("b.c").sum, 2);
+    }
+
+    void tail_copy_brings_a_copy_up_to_date()
+    {
+        ht::scratch_timeline s{RES};
+        fill(s.tl, 0, 100);
+
+        ht::scratch_dir dest;
+        hdb::fuzzy_copy(s.dir.path(), dest.path());
+
+        //written during the copy
+        TEST_TRUE(s.tl.put(START + 95 * RES, 10));
+        fill(s.tl, 100, 150);
+
+        const auto stats = hdb::copy_timeline_tail(s.dir.key(), dest.key());
+        TEST_EQUAL(stats.files, 2u);
+
+        const auto copy = hdb::open_timeline(dest.key().string(), RES);
+        TEST_EQUAL(copy.summary().sum, 160);
+        TEST_EQUAL(copy.diff(START + 94 * RES, START + 95 * RES, 0).sum, 11);
+        TEST_TRUE(hdb::verify_timeline(dest.key(), hdb::verify_mode::check).clean());
+    }
+
+    void tail_copy_follows_a_widened_timeline()
+    {
+        ht::scratch_timeline s{RES, {}, hdb::item_width::compact};
+        fill(s.tl, 0, 10);
+
+        ht::scratch_dir dest;
+        hdb::fuzzy_copy(s.dir.path(), dest.path());
+        TEST_TRUE(fs::exists(dest.key() / hdb::DATA32_FILE));
+
+        const hdb::count_type big = hdb::count_type{1} << 40;
+        TEST_TRUE(s.tl.put(START + 10 * RES, big));
+        s.tl.sync();
+        TEST_TRUE(s.tl.width() == hdb::item_width::wide);
+
+        hdb::copy_timeline_tail(s.dir.key(), dest.key());
+        TEST_TRUE(!fs::exists(dest.key() / hdb::DATA32_FILE));
+
+        const auto copy = hdb::open_timeline(dest.key().string(), RES);
+        TEST_TRUE(copy.width() == hdb::item_width::wide);
+        TEST_EQUAL(copy.summary().sum, big + 10);
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"fuzzy copy takes every timeline", fuzzy_copy_takes_every_timeline},
+        {"tail copy brings a copy up to date", tail_copy_brings_a_copy_up_to_date},
+        {"tail copy follows a widened timeline", tail_copy_follows_a_widened_timeline},
+    });
+}
@@ -0,0 +1,134 @@
+#ifndef HENHOUSE_TEST_H
+#define HENHOUSE_TEST_H
+
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "db/db.hpp"
+
+#define TEST_STR(x) #x
+#define TEST_LINE(x) TEST_STR(x)
+
+#define TEST_TRUE(e) if(!(e)) throw std::runtime_error{__FILE__ ":" TEST_LINE(__LINE__) ": " #e}
+
+#define TEST_EQUAL(a, b) \
+    { \
+        const auto test_a = (a); \
+        const auto test_b = (b); \
+        if(!(test_a == test_b)) \
+        { \
+            std::stringstream test_s; \
+            test_s << __FILE__ ":" TEST_LINE(__LINE__) ": " #a " == " #b " (" << test_a << " != " << test_b << ")"; \
+            throw std::runtime_error{test_s.str()}; \
+        } \
+    }
+
+namespace henhouse::test
+{
+    /**
+     * A new empty directory, removed with everything in it when done.
+     */
+    class scratch_dir
+    {
+        public:
+            scratch_dir() : _path{boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("henhouse-test-%%%%-%%%%")}
+            {
+                boost::filesystem::create_directories(_path);
+            }
+
+            ~scratch_dir()
+            {
+                boost::system::error_code e;
+                boost::filesystem::remove_all(_path, e);
+            }
+
+            scratch_dir(const scratch_dir&) = delete;
+            scratch_dir& operator=(const scratch_dir&) = delete;
+
+            const boost::filesystem::path& path() const { return _path;}
+            std::string str() const { return _path.string();}
+            boost::filesystem::path key(const std::string& k = "k") const { return _path / k;}
+
+        private:
+            boost::filesystem::path _path;
+    };
+
+    /**
+     * A timeline for key k in its own scratch directory.
+     */
+    struct scratch_timeline
+    {
+        explicit scratch_timeline(
+                const db::time_type resolution, 
+                const db::gap_policy& gaps = {}, 
+                const db::item_width width = db::item_width::wide) :
+            tl{db::open_timeline(dir.key().string(), resolution, gaps, width)} {}
+
+        scratch_dir dir;
+        db::any_timeline tl;
+    };
+
+    /**
+     * A timeline_db over one scratch root, taking the rest of the 
+     * timeline_db arguments.
+     */
+    struct scratch_db
+    {
+        template <class... options>
+            explicit scratch_db(options&&... o) :
+                db(henhouse::db::data_roots{dir.path()}, std::forward<options>(o)...) {}
+
+        scratch_dir dir;
+        henhouse::db::timeline_db db;
+    };
+
+    /**
+     * The sum of the bucket ending at t.
+     */
+    inline db::count_type bucket_sum(
+            const db::timeline_db& d, 
+            const std::string& key, 
+            const db::time_type t, 
+            const db::time_type resolution)
+    {
+        return d.diff(key, t - resolution, t, 0).sum;
+    }
+
+    struct test_case
+    {
+        const char* name;
+        std::function<void()> run;
+    };
+
+    /**
+     * Runs every test, reporting the failed ones. Returns the exit status.
+     */
+    inline int run(const std::vector<test_case>& tests)
+    {
+        std::size_t failed = 0;
+        for(const auto& t : tests)
+        {
+            try
+            {
+                t.run();
+                std::cout << "ok   " << t.name << std::endl;
+            }
+            catch(std::exception& e)
+            {
+                failed++;
+                std::cout << "FAIL " << t.name << ": " << e.what() << std::endl;
+            }
+        }
+
+        std::cout << tests.size() - failed << " of " << tests.size() << " passed" << std::endl;
+        return failed == 0 ? 0 : 1;
+    }
+}
+#endif
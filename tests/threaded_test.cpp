@@ -0,0 +1,267 @@
+#include "test.hpp"
+
+#include "service/threaded.hpp"
+#include "service/metrics.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+namespace hdb = henhouse::db;
+namespace ht = henhouse::test;
+namespace th = henhouse::threaded;
+
+namespace
+{
+    const hdb::time_type RES = 60;
+    const hdb::time_type START = 600000;
+    const std::size_t QUEUE = 64;
+    const std::size_t CACHE = 16;
+
+    void every_worker_requested_starts()
+    {
+        for(std::size_t n = 1; n <= 3; n++)
+        {
+            ht::scratch_dir dir;
+            th::server s{n, hdb::data_roots{dir.path()}, QUEUE, CACHE, RES};
+            TEST_EQUAL(s.total_workers(), n);
+            TEST_EQUAL(s.stats().size(), n);
+
+            //every worker answers
+            for(std::size_t i = 0; i < 16; i++) s.put("k" + std::to_string(i), START, hdb::count_type(i));
+            for(std::size_t i = 0; i < 16; i++) TEST_EQUAL(s.summary("k" + std::to_string(i)).get().sum, hdb::count_type(i));
+        }
+    }
+
+    void placed_workers_answer_and_stop()
+    {
+        ht::scratch_dir dir;
+        th::server s{2, hdb::data_roots{dir.path()}, QUEUE, CACHE, RES, henhouse::util::cpu_list{0}};
+        s.put("k", START, 5);
+        TEST_EQUAL(s.get("k", START).get().value.value, 5);
+        s.stop();
+    }
+
+    void metrics_count_every_request()
+    {
+        ht::scratch_dir dir;
+        th::server s{1, hdb::data_roots{dir.path()}, QUEUE, CACHE, RES};
+        s.put("k", START, 1);
+        s.put("k", START + RES, 1);
+        TEST_EQUAL(s.summary("k").get().sum, 2);
+
+        //the worker records a request after answering it
+        s.sync();
+
+        const auto m = henhouse::net::render_metrics(s);
+        TEST_TRUE(m.find("henhouse_db_exec_seconds_count{type=\"put\"} 2\n") != std::string::npos);
+        TEST_TRUE(m.find("henhouse_db_exec_seconds_count{type=\"summary\"} 1\n") != std::string::npos);
+        TEST_TRUE(m.find("henhouse_db_exec_seconds_bucket{type=\"put\",le=\"+Inf\"} 2\n") != std::string::npos);
+        TEST_TRUE(m.find("henhouse_worker_queue_depth{worker=\"0\"} 0\n") != std::string::npos);
+    }
+
+    //each thread reads its own keys back right after putting them
+    std::size_t stale_reads(const std::size_t steal_threshold)
+    {
+        ht::scratch_dir dir;
+        th::server s{4, hdb::data_roots{dir.path()}, 8, CACHE, RES, {}, {}, {}, {}, {}, {}, 
+            hdb::item_width::wide, "", {}, steal_threshold};
+
+        std::atomic<std::size_t> stale{0};
+        std::vector<std::thread> readers;
+        for(int t = 0; t < 8; t++) readers.emplace_back([&, t]
+        {
+            for(int i = 0; i < 2000; i++)
+            {
+                const auto k = "k" + std::to_string(t) + "_" + std::to_string(i % 16);
+                s.put(k, START, 1);
+                if(s.summary(k).get().sum != i / 16 + 1) stale++;
+            }
+        });
+
+        for(auto& r : readers) r.join();
+        return stale;
+    }
+
+    void stolen_reads_see_earlier_puts()
+    {
+        TEST_EQUAL(stale_reads(1), 0u);
+        TEST_EQUAL(stale_reads(0), 0u);
+    }
+
+    void snapshots_hold_every_write_before_them()
+    {
+        ht::scratch_dir dir;
+        ht::scratch_dir dest;
+        th::server s{2, hdb::data_roots{dir.path()}, QUEUE, CACHE, RES};
+
+        for(int i = 0; i < 8; i++) 
+            for(hdb::time_type t = 0; t < 100; t++) s.put("k" + std::to_string(i), START + t * RES, 1);
+
+        const auto r = s.snapshot(dest.key("snap").string());
+        TEST_EQUAL(r.path, dest.key("snap").string());
+        TEST_EQUAL(r.copied.files, 16u);
+
+        hdb::timeline_db copy{r.path, 4, RES};
+        for(int i = 0; i < 8; i++) TEST_EQUAL(copy.summary("k" + std::to_string(i)).sum, 100);
+
+        bool refused = false;
+        try
+        {
+            s.snapshot(r.path);
+        }
+        catch(th::snapshot_conflict&)
+        {
+            refused = true;
+        }
+        TEST_TRUE(refused);
+    }
+
+    std::uint64_t synced(const th::server& s)
+    {
+        std::uint64_t n = 0;
+        for(const auto& w : s.stats()) n += w.synced;
+        return n;
+    }
+
+    void durability_parses_by_name()
+    {
+        TEST_TRUE(th::parse_durability("none") == th::durability::none);
+        TEST_TRUE(th::parse_durability("periodic") == th::durability::periodic);
+        TEST_TRUE(th::parse_durability("on_batch") == th::durability::on_batch);
+
+        bool refused = false;
+        try
+        {
+            th::parse_durability("always");
+        }
+        catch(std::runtime_error&)
+        {
+            refused = true;
+        }
+        TEST_TRUE(refused);
+    }
+
+    void on_batch_syncs_what_each_batch_wrote()
+    {
+        ht::scratch_dir dir;
+        th::server s{1, hdb::data_roots{dir.path()}, QUEUE, CACHE, RES, {}, 
+            th::sync_options{th::durability::on_batch, std::chrono::milliseconds{0}}};
+
+        s.put(th::put_items{{"a", START, hdb::count_value(1)}, {"b", START, hdb::count_value(1)}});
+
+        //the batch is synced before the worker reads the next request
+        TEST_EQUAL(s.summary("a").get().sum, 1);
+        TEST_EQUAL(synced(s), 2u);
+    }
+
+    void periodic_syncs_in_the_background()
+    {
+        ht::scratch_dir dir;
+        th::server s{2, hdb::data_roots{dir.path()}, QUEUE, CACHE, RES, {}, 
+            th::sync_options{th::durability::periodic, std::chrono::milliseconds{10}}};
+
+        for(int i = 0; i < 8; i++) s.put("k" + std::to_string(i), START, 1);
+        for(int i = 0; i < 200 && synced(s) < 8; i++) std::this_thread::sleep_for(std::chrono::milliseconds{10});
+        TEST_EQUAL(synced(s), 8u);
+    }
+
+    void without_durability_nothing_is_synced()
+    {
+        ht::scratch_dir dir;
+        th::server s{1, hdb::data_roots{dir.path()}, QUEUE, CACHE, RES};
+
+        s.put("k", START, 1);
+        s.sync();
+        TEST_EQUAL(synced(s), 0u);
+    }
+
+    std::uint64_t cache_hits(const th::server& s)
+    {
+        std::uint64_t n = 0;
+        for(const auto& w : s.stats()) n += w.cache.hits;
+        return n;
+    }
+
+    void hot_keys_are_warmed_after_a_restart()
+    {
+        ht::scratch_dir dir;
+        const th::warm_options warm{std::chrono::seconds{60}};
+        {
+            th::server s{2, hdb::data_roots{dir.path()}, QUEUE, CACHE, RES, {}, {}, warm};
+            for(int i = 0; i < 4; i++) s.put("k" + std::to_string(i), START, 1);
+        }
+
+        std::ifstream in{dir.key(th::HOT_KEYS_FILE).string()};
+        std::vector<std::string> saved;
+        for(std::string k; std::getline(in, k);) saved.push_back(k);
+        std::sort(saved.begin(), saved.end());
+        TEST_TRUE(saved == (std::vector<std::string>{"k0", "k1", "k2", "k3"}));
+
+        //warming runs ahead of the first queries in each worker's queue
+        th::server s{2, hdb::data_roots{dir.path()}, QUEUE, CACHE, RES, {}, {}, warm};
+        const auto hits = cache_hits(s);
+        for(int i = 0; i < 4; i++) TEST_EQUAL(s.summary("k" + std::to_string(i)).get().sum, 1);
+        TEST_EQUAL(cache_hits(s), hits + 4);
+    }
+
+    std::uint64_t coalesced(const th::coalesce_options& c)
+    {
+        ht::scratch_dir dir;
+        th::server s{1, hdb::data_roots{dir.path()}, QUEUE, CACHE, RES, {}, {}, {}, {}, c};
+        for(int i = 0; i < 10; i++) s.put("k", START + i, 1);
+        TEST_EQUAL(s.summary("k").get().sum, 10);
+        return s.stats().front().cache.coalesced;
+    }
+
+    void workers_coalesce_only_with_an_interval()
+    {
+        //an idle worker may write its first pending put early
+        TEST_TRUE(coalesced(th::coalesce_options{std::chrono::milliseconds{1000}, 16}) >= 8u);
+        TEST_EQUAL(coalesced(th::coalesce_options{std::chrono::milliseconds{0}, 16}), 0u);
+    }
+
+    void late_points_are_merged_by_stop()
+    {
+        ht::scratch_dir dir;
+        {
+            th::server s{2, hdb::data_roots{dir.path()}, QUEUE, CACHE, RES, {}, {}, {}, 
+                th::late_options{std::chrono::seconds{3600}}};
+            for(hdb::time_type t = 0; t < 100; t++) s.put("k", START + t * RES, 1);
+
+            //too far behind the last bucket for put, so they are staged
+            s.put("k", START + 10 * RES, 5);
+            s.put("k", START + 20 * RES, 100);
+            TEST_EQUAL(s.summary("k").get().sum, 100);
+
+            std::uint64_t pending = 0;
+            for(const auto& w : s.stats()) pending += w.late_pending;
+            TEST_EQUAL(pending, 2u);
+        }
+
+        hdb::timeline_db db{dir.str(), 4, RES};
+        TEST_EQUAL(db.summary("k").sum, 205);
+        TEST_EQUAL(ht::bucket_sum(db, "k", START + 10 * RES, RES), 6);
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"every worker requested starts", every_worker_requested_starts},
+        {"placed workers answer and stop", placed_workers_answer_and_stop},
+        {"metrics count every request", metrics_count_every_request},
+        {"stolen reads see earlier puts", stolen_reads_see_earlier_puts},
+        {"snapshots hold every write before them", snapshots_hold_every_write_before_them},
+        {"durability parses by name", durability_parses_by_name},
+        {"on batch syncs what each batch wrote", on_batch_syncs_what_each_batch_wrote},
+        {"periodic syncs in the background", periodic_syncs_in_the_background},
+        {"without durability nothing is synced", without_durability_nothing_is_synced},
+        {"hot keys are warmed after a restart", hot_keys_are_warmed_after_a_restart},
+        {"workers coalesce only with an interval", workers_coalesce_only_with_an_interval},
+        {"late points are merged by stop", late_points_are_merged_by_stop},
+    });
+}
@@ -0,0 +1,208 @@
+#include "test.hpp"
+
+#include "db/timeline.hpp"
+#include "db/verify.hpp"
+
+#include <limits>
+
+namespace hdb = henhouse::db;
+namespace ht = henhouse::test;
+namespace fs = boost::filesystem;
+
+namespace
+{
+    const hdb::time_type RES = 60;
+    const hdb::time_type START = 600000;
+    const hdb::count_type MAX32 = std::numeric_limits<std::int32_t>::max();
+
+    hdb::any_timeline open_compact(const ht::scratch_dir& dir)
+    {
+        return hdb::open_timeline(dir.key().string(), RES, {}, hdb::item_width::compact);
+    }
+
+    struct compact_timeline : public ht::scratch_timeline
+    {
+        compact_timeline() : ht::scratch_timeline{RES, {}, hdb::item_width::compact} {}
+    };
+
+    void check_clean(const ht::scratch_dir& dir)
+    {
+        TEST_TRUE(hdb::verify_timeline(dir.key(), hdb::verify_mode::check).clean());
+    }
+
+    void small_values_stay_compact()
+    {
+        compact_timeline s;
+        auto& t = s.tl;
+        for(hdb::time_type i = 0; i < 100; i++) TEST_TRUE(t.put(START + i * RES, 100));
+
+        TEST_TRUE(t.width() == hdb::item_width::compact);
+        TEST_EQUAL(t.summary().sum, 10000);
+        t.sync();
+        check_clean(s.dir);
+    }
+
+    void compact_buckets_read_like_wide_ones()
+    {
+        compact_timeline c;
+        ht::scratch_timeline w{RES};
+        for(hdb::time_type i = 0; i < 20; i++)
+        {
+            TEST_TRUE(c.tl.put(START + i * RES, i * 7));
+            TEST_TRUE(w.tl.put(START + i * RES, i * 7));
+        }
+
+        for(auto a = START - RES; a < START + 20 * RES; a += 3 * RES)
+        {
+            const auto cd = c.tl.diff(a, a + 4 * RES, 0);
+            const auto wd = w.tl.diff(a, a + 4 * RES, 0);
+            TEST_EQUAL(cd.sum, wd.sum);
+            TEST_EQUAL(cd.left.integral, wd.left.integral);
+            TEST_EQUAL(cd.right.second_integral, wd.right.second_integral);
+        }
+        TEST_TRUE(fs::exists(c.dir.key() / hdb::DATA32_FILE));
+    }
+
+    void value_overflow_widens()
+    {
+        compact_timeline s;
+        auto& t = s.tl;
+        TEST_TRUE(t.put(START, 1));
+        TEST_TRUE(t.put(START + RES, MAX32 + 1));
+
+        TEST_TRUE(t.width() == hdb::item_width::wide);
+        TEST_EQUAL(t.summary().sum, MAX32 + 2);
+        TEST_TRUE(!fs::exists(s.dir.key() / hdb::DATA32_FILE));
+        check_clean(s.dir);
+    }
+
+    void integral_overflow_widens()
+    {
+        compact_timeline s;
+        auto& t = s.tl;
+
+        //every value fits, the running sum of squares does not for long
+        const hdb::count_type v = 40000;
+        for(hdb::time_type i = 0; i < 3; i++) TEST_TRUE(t.put(START + i * RES, v));
+
+        TEST_TRUE(t.width() == hdb::item_width::wide);
+        const auto d = t.diff(START - RES, START + 2 * RES, 0);
+        TEST_EQUAL(d.sum, 3 * v);
+        TEST_EQUAL(d.right.second_integral, 3 * v * v);
+        check_clean(s.dir);
+    }
+
+    void huge_put_into_recent_bucket_widens()
+    {
+        compact_timeline s;
+        auto& t = s.tl;
+        for(hdb::time_type i = 0; i < 10; i++) TEST_TRUE(t.put(START + i * RES, 1));
+
+        //fits checks the value before squaring the change it makes
+        const hdb::count_type huge = hdb::count_type{1} << 31;
+        TEST_TRUE(t.put(START + 5 * RES, huge));
+
+        TEST_TRUE(t.width() == hdb::item_width::wide);
+        TEST_EQUAL(t.summary().sum, huge + 10);
+        check_clean(s.dir);
+    }
+
+    void widened_timeline_reopens_wide()
+    {
+        ht::scratch_dir dir;
+        {
+            auto t = open_compact(dir);
+            TEST_TRUE(t.put(START, MAX32));
+            TEST_TRUE(t.put(START + RES, MAX32));
+            t.sync();
+        }
+
+        const auto t = open_compact(dir);
+        TEST_TRUE(t.width() == hdb::item_width::wide);
+        TEST_EQUAL(t.summary().sum, 2 * MAX32);
+    }
+
+    struct gauge_timeline : public ht::scratch_timeline
+    {
+        gauge_timeline() : ht::scratch_timeline{RES, {}, hdb::item_width::gauge} {}
+    };
+
+    hdb::put_value gauge(double v) { return hdb::put_value{0, v, true};}
+
+    void gauge_put_replaces_the_bucket()
+    {
+        gauge_timeline s;
+        auto& t = s.tl;
+        TEST_TRUE(t.is_gauge());
+        TEST_TRUE(t.put(START, gauge(1.5)));
+        TEST_TRUE(t.put(START + 1, gauge(2.25)));
+        TEST_TRUE(t.put(START + RES, gauge(0.5)));
+
+        const auto r = t.summary();
+        TEST_TRUE(r.is_gauge);
+        TEST_EQUAL(r.sum, 0);
+        TEST_EQUAL(hdb::sum_of(r), 2.75);
+
+        const auto d = t.diff(START - RES, START, 0);
+        TEST_TRUE(d.is_gauge);
+        TEST_EQUAL(d.gauge_right.value, 2.25);
+    }
+
+    void gauge_sums_keep_small_values()
+    {
+        gauge_timeline s;
+        auto& t = s.tl;
+        TEST_TRUE(t.put(START, gauge(1e16)));
+        for(hdb::time_type i = 1; i <= 100; i++) TEST_TRUE(t.put(START + i * RES, gauge(1.0)));
+
+        //without the compensation each 1.0 is lost against 1e16
+        TEST_EQUAL(hdb::sum_of(t.diff(START, START + 100 * RES, 0)), 100.0);
+    }
+
+    void gauge_timeline_reopens_as_gauge()
+    {
+        ht::scratch_dir dir;
+        {
+            auto t = hdb::open_timeline(dir.key().string(), RES, {}, hdb::item_width::gauge);
+            TEST_TRUE(t.put(START, gauge(0.125)));
+        }
+
+        //the stored width wins over the one asked for
+        const auto t = hdb::open_timeline(dir.key().string(), RES);
+        TEST_TRUE(t.is_gauge());
+        TEST_EQUAL(hdb::sum_of(t.summary()), 0.125);
+        check_clean(dir);
+    }
+
+    void gaps_fill_with_empty_buckets()
+    {
+        ht::scratch_timeline s{RES, hdb::gap_policy{5, 100}};
+        auto& t = s.tl;
+        TEST_TRUE(t.put(START, 1));
+        TEST_TRUE(t.put(START + 4 * RES, 1));
+        TEST_EQUAL(t.index().size(), 1u);
+        TEST_EQUAL(t.data_size(), 5u);
+
+        //longer than the fill and too long next to the timeline's size
+        TEST_TRUE(t.put(START + 20 * RES, 1));
+        TEST_EQUAL(t.index().size(), 2u);
+        TEST_EQUAL(t.summary().sum, 3);
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"small values stay compact", small_values_stay_compact},
+        {"compact buckets read like wide ones", compact_buckets_read_like_wide_ones},
+        {"value overflow widens", value_overflow_widens},
+        {"integral overflow widens", integral_overflow_widens},
+        {"huge put into recent bucket widens", huge_put_into_recent_bucket_widens},
+        {"widened timeline reopens wide", widened_timeline_reopens_wide},
+        {"gaps fill with empty buckets", gaps_fill_with_empty_buckets},
+        {"gauge put replaces the bucket", gauge_put_replaces_the_bucket},
+        {"gauge sums keep small values", gauge_sums_keep_small_values},
+        {"gauge timeline reopens as gauge", gauge_timeline_reopens_as_gauge},
+    });
+}
@@ -0,0 +1,245 @@
+#include "test.hpp"
+
+#include "db/transform.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace hdb = henhouse::db;
+namespace ht = henhouse::test;
+
+namespace
+{
+    const hdb::time_type RES = 60;
+    const hdb::time_type START = 600000;
+
+    //a counter timeline adding 60 every bucket, one per second
+    struct per_second : public ht::scratch_timeline
+    {
+        explicit per_second(std::size_t buckets) : ht::scratch_timeline{RES}
+        {
+            for(hdb::time_type i = 0; i < buckets; i++) TEST_TRUE(tl.put(START + i * RES, 60));
+        }
+    };
+
+    //a counter timeline putting each value to its own bucket
+    struct steps : public ht::scratch_timeline
+    {
+        explicit steps(const std::vector<hdb::count_type>& values) : ht::scratch_timeline{RES}
+        {
+            for(std::size_t i = 0; i < values.size(); i++) TEST_TRUE(tl.put(START + i * RES, values[i]));
+        }
+    };
+
+    std::vector<hdb::mean_type> transformed(const hdb::any_timeline& t, const std::string& chain)
+    {
+        const hdb::series_query q{START, START + 4 * RES, RES, RES, hdb::value_field::sum, hdb::parse_transforms(chain)};
+        return hdb::query_series(t, q).values;
+    }
+
+    bool refused(const std::string& chain)
+    {
+        try
+        {
+            hdb::parse_transforms(chain);
+        }
+        catch(std::runtime_error&)
+        {
+            return true;
+        }
+        return false;
+    }
+
+    hdb::series_query rate_query(hdb::time_type a, hdb::time_type b)
+    {
+        hdb::series_query q{a, b, RES, RES, hdb::value_field::sum, hdb::parse_transforms("rate")};
+        return q;
+    }
+
+    void counter_sums_stay_exact()
+    {
+        ht::scratch_timeline k{RES};
+        auto& t = k.tl;
+
+        //not a double
+        const hdb::count_type big = (hdb::count_type{1} << 53) + 1;
+        TEST_TRUE(t.put(START, 1));
+        TEST_TRUE(t.put(START + RES, big));
+
+        hdb::series_query q{START + RES, START + 2 * RES, RES, RES, hdb::value_field::sum, {}};
+        q.offsets.push_back(RES);
+        auto s = hdb::query_series(t, q);
+        TEST_EQUAL(s.counts.size(), s.values.size());
+        TEST_EQUAL(s.counts[0], big);
+        TEST_EQUAL(s.shifted_counts.size(), 1u);
+
+        q.field = hdb::value_field::agg;
+        s = hdb::query_series(t, q);
+        TEST_EQUAL(s.counts[0], big + 1);
+
+        q.field = hdb::value_field::mean;
+        TEST_TRUE(hdb::query_series(t, q).counts.empty());
+
+        q.field = hdb::value_field::sum;
+        q.fns = hdb::parse_transforms("cumsum");
+        s = hdb::query_series(t, q);
+        TEST_TRUE(s.counts.empty());
+        TEST_TRUE(s.shifted_counts.empty());
+    }
+
+    void gauge_sums_are_not_counts()
+    {
+        ht::scratch_timeline k{RES, {}, hdb::item_width::gauge};
+        auto& t = k.tl;
+        TEST_TRUE(t.put(START, hdb::put_value{0, 0.5, true}));
+
+        hdb::series_query q{START + RES, START + 2 * RES, RES, RES, hdb::value_field::sum, {}};
+        TEST_TRUE(hdb::query_series(t, q).counts.empty());
+    }
+
+    void transforms_apply_left_to_right()
+    {
+        const steps k{{5, 3, 8, 8, 2}};
+        const auto& t = k.tl;
+
+        const std::vector<hdb::mean_type> raw{5, 3, 8, 8, 2};
+        TEST_TRUE(transformed(t, "") == raw);
+        TEST_TRUE(transformed(t, "cumsum") == (std::vector<hdb::mean_type>{5, 8, 16, 24, 26}));
+        TEST_TRUE(transformed(t, "ma:2") == (std::vector<hdb::mean_type>{5, 4, 5.5, 8, 5}));
+        TEST_TRUE(transformed(t, "ewma:0.5") == (std::vector<hdb::mean_type>{5, 4, 6, 7, 4.5}));
+
+        const auto d = transformed(t, "derivative");
+        TEST_TRUE(std::isnan(d[0]));
+        TEST_TRUE(std::equal(d.begin() + 1, d.end(), std::vector<hdb::mean_type>{-2, 5, 0, -6}.begin()));
+
+        //counter resets are missing rather than negative
+        const auto n = transformed(t, "nonnegative_derivative");
+        TEST_TRUE(std::isnan(n[1]));
+        TEST_EQUAL(n[2], 5.0);
+        TEST_EQUAL(n[3], 0.0);
+        TEST_TRUE(std::isnan(n[4]));
+
+        //the derivative's running sum is the change since the first value
+        const auto c = transformed(t, "derivative,cumsum");
+        TEST_TRUE(std::isnan(c[0]));
+        for(std::size_t i = 1; i < raw.size(); i++) TEST_EQUAL(c[i], raw[i] - raw[0]);
+    }
+
+    void bad_transforms_are_refused()
+    {
+        TEST_TRUE(!refused("rate,derivative,nonnegative_derivative,ewma:0.3,ma:3,cumsum"));
+        TEST_TRUE(refused("nope"));
+        TEST_TRUE(refused("rate,nope"));
+        TEST_TRUE(refused("ewma:0"));
+        TEST_TRUE(refused("ewma:1.5"));
+        TEST_TRUE(refused("ewma:x"));
+        TEST_TRUE(refused("ma:0"));
+        TEST_TRUE(refused("ma:-2"));
+    }
+
+    void rate_divides_by_the_window()
+    {
+        const per_second k{10};
+        const auto& t = k.tl;
+
+        const auto s = hdb::query_series(t, rate_query(START + RES, START + 5 * RES));
+        TEST_EQUAL(s.values.size(), 5u);
+        for(const auto v : s.values) TEST_EQUAL(v, 1.0);
+    }
+
+    void rate_divides_the_current_window_by_its_past()
+    {
+        const per_second k{5};
+        const auto& t = k.tl;
+
+        //now is 30 seconds into the fourth window, the fifth hasn't started
+        auto q = rate_query(START + RES, START + 5 * RES);
+        q.now = START + 3 * RES + 30;
+        const auto s = hdb::query_series(t, q);
+
+        TEST_EQUAL(s.values.size(), 5u);
+        TEST_EQUAL(s.values[2], 1.0);
+        TEST_EQUAL(s.covered[3], 30u);
+        TEST_EQUAL(s.values[3], 2.0);
+        TEST_TRUE(std::isnan(s.values[4]));
+    }
+
+    void offsets_parse_with_units()
+    {
+        const auto o = hdb::parse_offsets("90,2m,,1h,1d,1w");
+        TEST_EQUAL(o.size(), 5u);
+        TEST_EQUAL(o[0].seconds, 90u);
+        TEST_EQUAL(o[1].seconds, 120u);
+        TEST_EQUAL(o[2].seconds, 3600u);
+        TEST_EQUAL(o[3].seconds, 86400u);
+        TEST_EQUAL(o[4].seconds, 604800u);
+        TEST_EQUAL(o[3].name, "1d");
+
+        for(const std::string bad : {"0", "0d", "-1d", "d", "x", "1y", "1.5h"})
+        {
+            bool refused = false;
+            try
+            {
+                hdb::parse_offsets(bad);
+            }
+            catch(std::runtime_error&)
+            {
+                refused = true;
+            }
+            TEST_TRUE(refused);
+        }
+    }
+
+    void shifted_windows_are_the_earlier_ones()
+    {
+        const steps k{{1, 2, 3, 4, 5, 6}};
+        const auto& t = k.tl;
+
+        hdb::series_query q{START + 2 * RES, START + 5 * RES, RES, RES, hdb::value_field::sum, {}};
+        q.offsets = {2 * RES, 10 * RES};
+        auto s = hdb::query_series(t, q);
+
+        TEST_TRUE(s.values == (std::vector<hdb::mean_type>{3, 4, 5, 6}));
+        TEST_EQUAL(s.shifted.size(), 2u);
+        TEST_TRUE(s.shifted[0] == (std::vector<hdb::mean_type>{1, 2, 3, 4}));
+        TEST_TRUE(s.shifted_counts[0] == (std::vector<hdb::count_type>{1, 2, 3, 4}));
+        TEST_TRUE(s.shifted[1] == (std::vector<hdb::mean_type>{0, 0, 0, 0}));
+
+        //ratios against nothing are missing
+        q.ratio = true;
+        s = hdb::query_series(t, q);
+        TEST_TRUE(s.shifted[0] == (std::vector<hdb::mean_type>{3, 2, 5.0 / 3, 1.5}));
+        TEST_TRUE(s.shifted_counts.empty());
+        for(const auto v : s.shifted[1]) TEST_TRUE(std::isnan(v));
+    }
+
+    void rate_of_shifted_windows_is_per_second_too()
+    {
+        const per_second k{10};
+        const auto& t = k.tl;
+
+        auto q = rate_query(START + 5 * RES, START + 8 * RES);
+        q.offsets.push_back(3 * RES);
+        q.now = START + 8 * RES;
+        const auto s = hdb::query_series(t, q);
+
+        TEST_EQUAL(s.shifted.size(), 1u);
+        for(const auto v : s.shifted[0]) TEST_EQUAL(v, 1.0);
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"counter sums stay exact", counter_sums_stay_exact},
+        {"gauge sums are not counts", gauge_sums_are_not_counts},
+        {"transforms apply left to right", transforms_apply_left_to_right},
+        {"bad transforms are refused", bad_transforms_are_refused},
+        {"rate divides by the window", rate_divides_by_the_window},
+        {"rate divides the current window by its past", rate_divides_the_current_window_by_its_past},
+        {"offsets parse with units", offsets_parse_with_units},
+        {"shifted windows are the earlier ones", shifted_windows_are_the_earlier_ones},
+        {"rate of shifted windows is per second too", rate_of_shifted_windows_is_per_second_too},
+    });
+}
@@ -0,0 +1,107 @@
+#include "test.hpp"
+
+#include "service/udp.hpp"
+#include "service/graphite.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace hdb = henhouse::db;
+namespace hn = henhouse::net;
+namespace ht = henhouse::test;
+namespace th = henhouse::threaded;
+
+namespace
+{
+    const hdb::time_type RES = 60;
+    const std::uint16_t PORT = 23417;
+
+    void send_datagram(const std::string& text)
+    {
+        const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        TEST_TRUE(fd >= 0);
+
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(PORT);
+        inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+        const auto sent = sendto(fd, text.data(), text.size(), 0, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        close(fd);
+        TEST_EQUAL(sent, static_cast<ssize_t>(text.size()));
+    }
+
+    //UDP gives no answer, so wait until the points show up
+    bool wait_for_sum(th::server& db, const std::string& key, hdb::count_type sum)
+    {
+        for(int i = 0; i < 500; i++)
+        {
+            if(db.summary(key).get().sum == sum) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+
+    void every_line_of_a_datagram_is_put()
+    {
+        ht::scratch_dir dir;
+        th::server db{2, hdb::data_roots{dir.path()}, 64, 16, RES};
+        hn::udp_server udp{db, "127.0.0.1", PORT, 2, hn::ingest_policy::block};
+
+        const auto now = std::to_string(std::time(nullptr));
+        send_datagram("a 1 " + now + "\nb 2 " + now + "\r\nbad line\n\na 3 " + now);
+        send_datagram("b 4 " + now + "\n");
+
+        TEST_TRUE(wait_for_sum(db, "a", 4));
+        TEST_TRUE(wait_for_sum(db, "b", 6));
+        TEST_EQUAL(db.ingest().malformed.load(), 1u);
+        udp.stop();
+    }
+
+    void points_far_in_the_future_are_refused()
+    {
+        ht::scratch_dir dir;
+        th::server db{1, hdb::data_roots{dir.path()}, 64, 16, RES};
+        hn::udp_server udp{db, "127.0.0.1", PORT, 1, hn::ingest_policy::shed};
+
+        const auto now = std::time(nullptr);
+        send_datagram("a 1 " + std::to_string(now + 2 * hn::TOLERANCE) + "\na 1 " + std::to_string(now));
+
+        TEST_TRUE(wait_for_sum(db, "a", 1));
+        TEST_EQUAL(db.ingest().future.load(), 1u);
+    }
+
+    void bad_addresses_are_refused()
+    {
+        ht::scratch_dir dir;
+        th::server db{1, hdb::data_roots{dir.path()}, 64, 16, RES};
+
+        bool refused = false;
+        try
+        {
+            hn::udp_server udp{db, "not an ip", PORT, 1, hn::ingest_policy::block};
+        }
+        catch(std::runtime_error&)
+        {
+            refused = true;
+        }
+        TEST_TRUE(refused);
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"every line of a datagram is put", every_line_of_a_datagram_is_put},
+        {"points far in the future are refused", points_far_in_the_future_are_refused},
+        {"bad addresses are refused", bad_addresses_are_refused},
+    });
+}
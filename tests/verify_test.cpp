@@ -0,0 +1,101 @@
+#include "test.hpp"
+
+#include "db/build.hpp"
+#include "db/verify.hpp"
+
+#include <fstream>
+
+namespace hdb = henhouse::db;
+namespace ht = henhouse::test;
+namespace fs = boost::filesystem;
+
+namespace
+{
+    const hdb::time_type RES = 60;
+    const hdb::time_type START = 600000;
+
+    const hdb::buckets BUCKETS{{START, 1}, {START + RES, 2}, {START + 2 * RES, 3}, {START + 10 * RES, 4}, {START + 11 * RES, 5}};
+
+    template <class value>
+        void write_at(const fs::path& p, std::size_t offset, const value& v)
+        {
+            std::fstream f{p.string(), std::ios::binary | std::ios::in | std::ios::out};
+            f.seekp(offset);
+            f.write(reinterpret_cast<const char*>(&v), sizeof(v));
+        }
+
+    hdb::verify_stats check(const fs::path& dir)
+    {
+        return hdb::verify_timeline(dir, hdb::verify_mode::check);
+    }
+
+    void written_timelines_are_clean()
+    {
+        ht::scratch_dir dir;
+        hdb::write_timeline(dir.key().string(), RES, BUCKETS);
+
+        const auto s = check(dir.key());
+        TEST_EQUAL(s.timelines, 1u);
+        TEST_TRUE(s.bytes > 0);
+        TEST_TRUE(s.clean());
+    }
+
+    void torn_tails_are_cut()
+    {
+        ht::scratch_dir dir;
+        hdb::write_timeline(dir.key().string(), RES, BUCKETS);
+
+        //a size made durable before its buckets
+        write_at(dir.key() / hdb::DATA_FILE, 0, hdb::data_metadata{BUCKETS.size() + 3});
+        TEST_EQUAL(check(dir.key()).torn, 1u);
+
+        TEST_EQUAL(hdb::verify_timeline(dir.key(), hdb::verify_mode::repair).torn, 1u);
+        TEST_TRUE(check(dir.key()).clean());
+        TEST_EQUAL(hdb::open_timeline(dir.key().string(), RES).summary().sum, 15);
+    }
+
+    void bad_integrals_are_recomputed()
+    {
+        ht::scratch_dir dir;
+        hdb::write_timeline(dir.key().string(), RES, BUCKETS);
+
+        const auto third = sizeof(hdb::data_metadata) + 2 * sizeof(hdb::data_item);
+        write_at(dir.key() / hdb::DATA_FILE, third, hdb::data_item{3, 100, 100});
+        TEST_EQUAL(check(dir.key()).integrals, 1u);
+
+        TEST_EQUAL(hdb::verify_timeline(dir.key(), hdb::verify_mode::repair).integrals, 1u);
+        TEST_TRUE(check(dir.key()).clean());
+
+        const auto t = hdb::open_timeline(dir.key().string(), RES);
+        TEST_EQUAL(t.summary().sum, 15);
+        TEST_EQUAL(t.diff(START, START + 11 * RES, 0).sum, 14);
+    }
+
+    void trees_skip_hidden_directories()
+    {
+        ht::scratch_dir a;
+        ht::scratch_dir b;
+        hdb::write_timeline(a.key("x").string(), RES, BUCKETS);
+        hdb::write_timeline(a.key("y").string(), RES, BUCKETS);
+        hdb::write_timeline(b.key("z").string(), RES, BUCKETS);
+
+        //a broken timeline in scratch space isn't looked at
+        hdb::write_timeline(a.key(".late").string(), RES, BUCKETS);
+        write_at(a.key(".late") / hdb::DATA_FILE, 0, hdb::data_metadata{100});
+
+        const auto s = hdb::verify_tree(std::vector<fs::path>{a.path(), b.path()}, hdb::verify_mode::check, 2);
+        TEST_EQUAL(s.timelines, 3u);
+        TEST_TRUE(s.clean());
+    }
+}
+
+int main()
+{
+    return ht::run(
+    {
+        {"written timelines are clean", written_timelines_are_clean},
+        {"torn tails are cut", torn_tails_are_cut},
+        {"bad integrals are recomputed", bad_integrals_are_recomputed},
+        {"trees skip hidden directories", trees_skip_hidden_directories},
+    });
+}